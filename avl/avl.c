@@ -691,6 +691,13 @@ avl_tree_search(avl_tree_h_td avl_tree, avl_tree_search_options_td options,
             rc = -1;
         }
 
+        /*
+         * The node is freed by a delete once the mutex is released
+         */
+        if (searched_node_ptr != NULL) {
+            *found_object = searched_node_ptr->object->data;
+        }
+
         rc = avl_tree_unlock(&(avl_tree->mutex), avl_tree->options);
 
         if (searched_node_ptr == NULL) {
@@ -701,10 +708,6 @@ avl_tree_search(avl_tree_h_td avl_tree, avl_tree_search_options_td options,
         }
     }
 
-    if (rc == 0) {
-        *found_object = searched_node_ptr->object->data;
-    }
-
     if (rc == 0) {
         DEBUG("%s: SEARCH request - SUCCESS tree handle:%p options:%d"
               " compare object:%p",
@@ -0,0 +1,386 @@
+/*
+ * avl_node.c - intrusive avl tree
+ *
+ * Date   : 2021/04/29
+ */
+
+#include "avl_node.h"
+#include <assert.h>
+#include <stddef.h>
+
+// child links are what the lock-free lookups follow
+#define AVL_SET(slot, value) __atomic_store_n(&(slot), (value), __ATOMIC_RELAXED)
+#define AVL_GET(slot) __atomic_load_n(&(slot), __ATOMIC_RELAXED)
+
+#define AVL_SEQ_TRIES 3
+
+static inline int
+avl_height(const avl_node_t *node)
+{
+    return node ? node->height : 0;
+}
+
+static inline void
+avl_update_height(avl_node_t *node)
+{
+    int lh = avl_height(node->left), rh = avl_height(node->right);
+    node->height = (lh > rh ? lh : rh) + 1;
+}
+
+static inline void
+avl_change_child(avl_root_t *root, avl_node_t *parent, avl_node_t *old,
+                 avl_node_t *new)
+{
+    if (!parent) {
+        AVL_SET(root->node, new);
+    } else if (parent->left == old) {
+        AVL_SET(parent->left, new);
+    } else {
+        AVL_SET(parent->right, new);
+    }
+}
+
+//     x            y
+//    / \          / \    y takes the place of x,
+//   a   y   =>   x   c
+//      / \      / \      b moves from y to x
+//     b   c    a   b
+static avl_node_t *
+avl_rotate_left(avl_root_t *root, avl_node_t *x)
+{
+    avl_node_t *y = x->right, *b = y->left;
+
+    AVL_SET(x->right, b);
+    if (b)
+        b->parent = x;
+    y->parent = x->parent;
+    AVL_SET(y->left, x);
+    avl_change_child(root, x->parent, x, y);
+    x->parent = y;
+
+    avl_update_height(x);
+    avl_update_height(y);
+    return y;
+}
+
+static avl_node_t *
+avl_rotate_right(avl_root_t *root, avl_node_t *x)
+{
+    avl_node_t *y = x->left, *b = y->right;
+
+    AVL_SET(x->left, b);
+    if (b)
+        b->parent = x;
+    y->parent = x->parent;
+    AVL_SET(y->right, x);
+    avl_change_child(root, x->parent, x, y);
+    x->parent = y;
+
+    avl_update_height(x);
+    avl_update_height(y);
+    return y;
+}
+
+// from node up to the first subtree whose height didn't change
+static void
+avl_rebalance(avl_root_t *root, avl_node_t *node)
+{
+    int lh, rh, old;
+
+    while (node) {
+        old = node->height;
+        lh  = avl_height(node->left);
+        rh  = avl_height(node->right);
+
+        if (lh > rh + 1) {
+            if (avl_height(node->left->left) < avl_height(node->left->right))
+                avl_rotate_left(root, node->left);
+            node = avl_rotate_right(root, node);
+        } else if (rh > lh + 1) {
+            if (avl_height(node->right->right) < avl_height(node->right->left))
+                avl_rotate_right(root, node->right);
+            node = avl_rotate_left(root, node);
+        } else {
+            node->height = (lh > rh ? lh : rh) + 1;
+        }
+
+        if (node->height == old) {
+            break;
+        }
+        node = node->parent;
+    }
+}
+
+void
+avl_insert(avl_root_t *root, avl_node_t *parent, avl_node_t **link,
+           avl_node_t *node)
+{
+    node->left   = NULL;
+    node->right  = NULL;
+    node->parent = parent;
+    node->height = 1;
+    AVL_SET(*link, node);
+
+    avl_rebalance(root, parent);
+}
+
+void
+avl_delete(avl_root_t *root, avl_node_t *node)
+{
+    avl_node_t *child, *parent, *succ;
+
+    if (!node->left || !node->right) {
+        child  = node->left ? node->left : node->right;
+        parent = node->parent;
+        if (child)
+            child->parent = parent;
+        avl_change_child(root, parent, node, child);
+        avl_rebalance(root, parent);
+        return;
+    }
+
+    // the successor has no left child, it takes the place of node
+    for (succ = node->right; succ->left; succ = succ->left) {
+    }
+
+    if (succ->parent != node) {
+        parent = succ->parent;
+        AVL_SET(parent->left, succ->right);
+        if (succ->right)
+            succ->right->parent = parent;
+        AVL_SET(succ->right, node->right);
+        node->right->parent = succ;
+    } else {
+        parent = succ;
+    }
+
+    AVL_SET(succ->left, node->left);
+    node->left->parent = succ;
+    succ->parent       = node->parent;
+    succ->height       = node->height;
+    avl_change_child(root, node->parent, node, succ);
+
+    avl_rebalance(root, parent);
+}
+
+void
+avl_replace(avl_root_t *root, avl_node_t *old, avl_node_t *new)
+{
+    *new = *old;
+    if (old->left)
+        old->left->parent = new;
+    if (old->right)
+        old->right->parent = new;
+    avl_change_child(root, old->parent, old, new);
+}
+
+avl_node_t *
+avl_first(const avl_root_t *root)
+{
+    avl_node_t *node = root->node;
+
+    if (!node)
+        return NULL;
+    while (node->left)
+        node = node->left;
+    return node;
+}
+
+avl_node_t *
+avl_last(const avl_root_t *root)
+{
+    avl_node_t *node = root->node;
+
+    if (!node)
+        return NULL;
+    while (node->right)
+        node = node->right;
+    return node;
+}
+
+avl_node_t *
+avl_next(const avl_node_t *node)
+{
+    const avl_node_t *parent;
+
+    if (node->right) {
+        node = node->right;
+        while (node->left)
+            node = node->left;
+        return (avl_node_t *)node;
+    }
+
+    while ((parent = node->parent) && node == parent->right)
+        node = parent;
+    return (avl_node_t *)parent;
+}
+
+avl_node_t *
+avl_prev(const avl_node_t *node)
+{
+    const avl_node_t *parent;
+
+    if (node->left) {
+        node = node->left;
+        while (node->right)
+            node = node->right;
+        return (avl_node_t *)node;
+    }
+
+    while ((parent = node->parent) && node == parent->left)
+        node = parent;
+    return (avl_node_t *)parent;
+}
+
+avl_node_t *
+avl_find(const avl_root_t *root, const void *key, avl_compare_fn cmp)
+{
+    avl_node_t *node = root->node;
+    int r;
+
+    while (node) {
+        r = cmp(key, node);
+        if (0 == r)
+            return node;
+        node = r < 0 ? node->left : node->right;
+    }
+    return NULL;
+}
+
+avl_node_t *
+avl_insert_unique(avl_root_t *root, avl_node_t *node, avl_node_compare_fn cmp)
+{
+    avl_node_t **link = &root->node, *parent = NULL;
+    int r;
+
+    while (*link) {
+        parent = *link;
+        r      = cmp(node, parent);
+        if (0 == r)
+            return parent;
+        link = r < 0 ? &parent->left : &parent->right;
+    }
+
+    avl_insert(root, parent, link, node);
+    return NULL;
+}
+
+//------------------------------------------------------------------------
+
+int
+avl_seqtree_init(avl_seqtree_t *tree)
+{
+    tree->root.node = NULL;
+    tree->seq       = 0;
+    tree->count     = 0;
+    return spinlock_create(&tree->lock);
+}
+
+void
+avl_seqtree_destroy(avl_seqtree_t *tree)
+{
+    spinlock_destroy(&tree->lock);
+}
+
+void
+avl_seqtree_write_lock(avl_seqtree_t *tree)
+{
+    spinlock_lock(&tree->lock);
+    __atomic_store_n(&tree->seq, tree->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void
+avl_seqtree_write_unlock(avl_seqtree_t *tree)
+{
+    __atomic_store_n(&tree->seq, tree->seq + 1, __ATOMIC_RELEASE);
+    spinlock_unlock(&tree->lock);
+}
+
+uint32_t
+avl_seqtree_read_begin(avl_seqtree_t *tree)
+{
+    return __atomic_load_n(&tree->seq, __ATOMIC_ACQUIRE);
+}
+
+int
+avl_seqtree_read_retry(avl_seqtree_t *tree, uint32_t seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return (seq & 1) || __atomic_load_n(&tree->seq, __ATOMIC_RELAXED) != seq;
+}
+
+// a racing rotation may send the walk around, give up past the height
+static avl_node_t *
+avl_seqtree_find_bounded(avl_seqtree_t *tree, const void *key,
+                         avl_compare_fn cmp, int *ok)
+{
+    avl_node_t *node = AVL_GET(tree->root.node);
+    int r, depth;
+
+    for (depth = 0; node && depth < AVL_MAX_HEIGHT; depth++) {
+        r = cmp(key, node);
+        if (0 == r)
+            return node;
+        node = r < 0 ? AVL_GET(node->left) : AVL_GET(node->right);
+    }
+    *ok = !node;
+    return NULL;
+}
+
+avl_node_t *
+avl_seqtree_find(avl_seqtree_t *tree, const void *key, avl_compare_fn cmp)
+{
+    avl_node_t *node;
+    uint32_t seq;
+    int i, ok;
+
+    for (i = 0; i < AVL_SEQ_TRIES; i++) {
+        seq = avl_seqtree_read_begin(tree);
+        if (seq & 1) {
+            continue; // a writer is in
+        }
+
+        ok   = 1;
+        node = avl_seqtree_find_bounded(tree, key, cmp, &ok);
+        if (ok && !avl_seqtree_read_retry(tree, seq)) {
+            return node;
+        }
+    }
+
+    // writers keep coming, queue with them
+    spinlock_lock(&tree->lock);
+    node = avl_find(&tree->root, key, cmp);
+    spinlock_unlock(&tree->lock);
+    return node;
+}
+
+avl_node_t *
+avl_seqtree_insert(avl_seqtree_t *tree, avl_node_t *node,
+                   avl_node_compare_fn cmp)
+{
+    avl_node_t *exist;
+
+    avl_seqtree_write_lock(tree);
+    exist = avl_insert_unique(&tree->root, node, cmp);
+    if (!exist) {
+        tree->count++;
+    }
+    avl_seqtree_write_unlock(tree);
+    return exist;
+}
+
+void
+avl_seqtree_delete(avl_seqtree_t *tree, avl_node_t *node)
+{
+    avl_seqtree_write_lock(tree);
+    avl_delete(&tree->root, node);
+    tree->count--;
+    avl_seqtree_write_unlock(tree);
+}
+
+uint32_t
+avl_seqtree_count(avl_seqtree_t *tree)
+{
+    return __atomic_load_n(&tree->count, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,111 @@
+/*
+ * avl_node.h - intrusive avl tree
+ *
+ * Date   : 2021/04/29
+ */
+#ifndef __AVL_NODE_H__
+#define __AVL_NODE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "macro.h"
+#include "spinlock.h"
+#include <stdint.h>
+
+/*
+ * The node lives in the user struct, as rbtree_node_t does, nothing is
+ * allocated. The caller searches for the link, e.g.
+ *
+ *   avl_node_t **link = &root->node, *parent = NULL;
+ *   while (*link) {
+ *       parent = *link;
+ *       link = key < avl_entry(parent, T, node)->key ? &parent->left
+ *                                                    : &parent->right;
+ *   }
+ *   avl_insert(root, parent, link, &obj->node);
+ *
+ * or uses the avl_find/avl_insert_unique helpers with a compare function.
+ */
+typedef struct avl_node {
+    struct avl_node *left;
+    struct avl_node *right;
+    struct avl_node *parent;
+    int height; // leaf is 1
+} avl_node_t;
+
+typedef struct avl_root {
+    struct avl_node *node;
+} avl_root_t;
+
+#define avl_entry(ptr, type, member) container_of(ptr, type, member)
+
+/// 1.44 * log2(2^64), no avl tree in memory is taller
+#define AVL_MAX_HEIGHT 92
+
+/// link node at *link (a child slot of parent) and re-balance
+void avl_insert(avl_root_t *root, avl_node_t *parent, avl_node_t **link,
+                avl_node_t *node);
+void avl_delete(avl_root_t *root, avl_node_t *node);
+/// put new in the place of old, same key
+void avl_replace(avl_root_t *root, avl_node_t *old, avl_node_t *new);
+
+avl_node_t *avl_first(const avl_root_t *root);
+avl_node_t *avl_last(const avl_root_t *root);
+avl_node_t *avl_next(const avl_node_t *node);
+avl_node_t *avl_prev(const avl_node_t *node);
+
+/// @return <0 if key is less than the node's key, 0 equal, >0 greater
+typedef int (*avl_compare_fn)(const void *key, const avl_node_t *node);
+/// @return <0 if a is less than b, 0 equal, >0 greater
+typedef int (*avl_node_compare_fn)(const avl_node_t *a, const avl_node_t *b);
+
+avl_node_t *avl_find(const avl_root_t *root, const void *key,
+                     avl_compare_fn cmp);
+/// @return NULL if inserted, else the node with the same key (node isn't
+/// linked)
+avl_node_t *avl_insert_unique(avl_root_t *root, avl_node_t *node,
+                              avl_node_compare_fn cmp);
+
+/*
+ * Read-mostly concurrent tree: writers serialize on a spinlock and bump
+ * a sequence count around each change, lookups walk the tree without
+ * any lock or shared write and retry when a writer interfered, falling
+ * back to the lock after a few failed tries.
+ * Lookups may touch nodes deleted meanwhile: a deleted node must stay
+ * readable until the lookups started before the delete have ended
+ * (objects from a pool, or freed after a grace period).
+ */
+typedef struct avl_seqtree {
+    avl_root_t root;
+    volatile uint32_t seq; // odd while a writer changes the tree
+    uint32_t count;
+    spinlock_t lock;
+} avl_seqtree_t;
+
+int avl_seqtree_init(avl_seqtree_t *tree);
+void avl_seqtree_destroy(avl_seqtree_t *tree);
+
+avl_node_t *avl_seqtree_find(avl_seqtree_t *tree, const void *key,
+                             avl_compare_fn cmp);
+/// @return NULL if inserted, else the node with the same key
+avl_node_t *avl_seqtree_insert(avl_seqtree_t *tree, avl_node_t *node,
+                               avl_node_compare_fn cmp);
+void avl_seqtree_delete(avl_seqtree_t *tree, avl_node_t *node);
+uint32_t avl_seqtree_count(avl_seqtree_t *tree);
+
+/// for compound changes through the avl_* calls on tree->root
+void avl_seqtree_write_lock(avl_seqtree_t *tree);
+void avl_seqtree_write_unlock(avl_seqtree_t *tree);
+
+/// custom optimistic readers: read_begin, walk (bounded, a racing
+/// writer may make the walk loop), read_retry, and redo if it returns 1
+uint32_t avl_seqtree_read_begin(avl_seqtree_t *tree);
+int avl_seqtree_read_retry(avl_seqtree_t *tree, uint32_t seq);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
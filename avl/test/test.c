@@ -4,6 +4,9 @@
  * Date   : 2021/03/18
  */
 
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,6 +14,7 @@
 #include <unistd.h>
 
 #include "avl.h"
+#include "avl_node.h"
 
 avl_tree_h_td my_avl_tree;
 
@@ -67,6 +71,251 @@ my_walk_fn(void *obj, void *ctx)
     return (AVL_CONT_WALK);
 }
 
+typedef struct avl_value {
+    avl_node_t node;
+    int key;
+} avl_value_t;
+
+static int
+avl_value_compare(const void *key, const avl_node_t *node)
+{
+    int k = *(const int *)key, v = avl_entry(node, avl_value_t, node)->key;
+    return k < v ? -1 : (k > v ? 1 : 0);
+}
+
+static int
+avl_value_node_compare(const avl_node_t *a, const avl_node_t *b)
+{
+    return avl_value_compare(&avl_entry(a, avl_value_t, node)->key, b);
+}
+
+static int
+avl_check(const avl_node_t *node, const avl_node_t *parent)
+{
+    int lh, rh;
+
+    if (!node)
+        return 0;
+    assert(node->parent == parent);
+    lh = avl_check(node->left, node);
+    rh = avl_check(node->right, node);
+    assert(lh - rh <= 1 && rh - lh <= 1);
+    assert(node->height == (lh > rh ? lh : rh) + 1);
+    return node->height;
+}
+
+#define AVL_N 100000
+
+// random inserts/deletes against a presence table
+static void
+avl_node_test(void)
+{
+    static avl_value_t values[AVL_N];
+    static char present[AVL_N];
+    avl_root_t root = {NULL};
+    avl_node_t *node;
+    int i, k, n = 0, prev;
+
+    srand(7);
+    for (i = 0; i < AVL_N; i++)
+        values[i].key = i;
+
+    for (i = 0; i < 4 * AVL_N; i++) {
+        k = rand() % AVL_N;
+        if (present[k]) {
+            assert(&values[k].node == avl_find(&root, &k, avl_value_compare));
+            avl_delete(&root, &values[k].node);
+            present[k] = 0;
+            n--;
+        } else {
+            assert(!avl_insert_unique(&root, &values[k].node,
+                                      avl_value_node_compare));
+            present[k] = 1;
+            n++;
+        }
+        if (0 == i % 9973)
+            avl_check(root.node, NULL);
+    }
+    assert(avl_check(root.node, NULL) <= 24); // 1.44 * log2(100000)
+
+    k = 0;
+    prev = -1;
+    for (node = avl_first(&root); node; node = avl_next(node), k++) {
+        assert(avl_entry(node, avl_value_t, node)->key > prev);
+        prev = avl_entry(node, avl_value_t, node)->key;
+    }
+    assert(k == n);
+    for (node = avl_last(&root); node; node = avl_prev(node))
+        k--;
+    assert(0 == k);
+
+    for (i = 0; i < AVL_N; i++) {
+        node = avl_find(&root, &i, avl_value_compare);
+        assert(present[i] ? node == &values[i].node : !node);
+        if (node)
+            avl_delete(&root, node);
+    }
+    assert(!root.node);
+    printf("avl_node: ok\n");
+}
+
+#define AVL_READERS 4
+#define AVL_MODE_SEQ 0
+#define AVL_MODE_RWLOCK 1
+#define AVL_MODE_MUTEX 2
+
+static struct {
+    int mode;
+    avl_seqtree_t seq;
+    avl_root_t root;
+    pthread_rwlock_t rwlock;
+    pthread_mutex_t mutex;
+    avl_value_t *values; // even keys stay, odd keys come and go
+    volatile int stop;
+    volatile long lookups;
+    volatile long writes;
+} s_avl;
+
+static avl_node_t *
+avl_bench_find(int key)
+{
+    avl_node_t *node;
+
+    switch (s_avl.mode) {
+    case AVL_MODE_SEQ:
+        return avl_seqtree_find(&s_avl.seq, &key, avl_value_compare);
+    case AVL_MODE_RWLOCK:
+        pthread_rwlock_rdlock(&s_avl.rwlock);
+        node = avl_find(&s_avl.root, &key, avl_value_compare);
+        pthread_rwlock_unlock(&s_avl.rwlock);
+        return node;
+    default:
+        pthread_mutex_lock(&s_avl.mutex);
+        node = avl_find(&s_avl.root, &key, avl_value_compare);
+        pthread_mutex_unlock(&s_avl.mutex);
+        return node;
+    }
+}
+
+static void
+avl_bench_toggle(avl_value_t *v, int insert)
+{
+    switch (s_avl.mode) {
+    case AVL_MODE_SEQ:
+        if (insert)
+            avl_seqtree_insert(&s_avl.seq, &v->node, avl_value_node_compare);
+        else
+            avl_seqtree_delete(&s_avl.seq, &v->node);
+        break;
+    case AVL_MODE_RWLOCK:
+        pthread_rwlock_wrlock(&s_avl.rwlock);
+        if (insert)
+            avl_insert_unique(&s_avl.root, &v->node, avl_value_node_compare);
+        else
+            avl_delete(&s_avl.root, &v->node);
+        pthread_rwlock_unlock(&s_avl.rwlock);
+        break;
+    default:
+        pthread_mutex_lock(&s_avl.mutex);
+        if (insert)
+            avl_insert_unique(&s_avl.root, &v->node, avl_value_node_compare);
+        else
+            avl_delete(&s_avl.root, &v->node);
+        pthread_mutex_unlock(&s_avl.mutex);
+        break;
+    }
+}
+
+static void *
+avl_reader(void *param)
+{
+    unsigned int r = (unsigned int)(uintptr_t)param;
+    long n = 0;
+    int key;
+
+    while (!s_avl.stop) {
+        r   = r * 1103515245 + 12345;
+        key = (int)((r >> 8) % AVL_N) & ~1;
+        // a lookup racing rotations must still find the stable keys
+        if (avl_bench_find(key) != &s_avl.values[key].node)
+            abort();
+        n++;
+    }
+    __sync_fetch_and_add(&s_avl.lookups, n);
+    return NULL;
+}
+
+// one writer, a change every ~10us
+static void *
+avl_writer(void *param)
+{
+    unsigned int r = 1;
+    char *present = (char *)calloc(AVL_N, 1);
+    long n = 0;
+    int key;
+
+    (void)param;
+    while (!s_avl.stop) {
+        r   = r * 1103515245 + 12345;
+        key = (int)((r >> 8) % AVL_N) | 1;
+        if (key >= AVL_N)
+            continue;
+        avl_bench_toggle(&s_avl.values[key], !present[key]);
+        present[key] ^= 1;
+        n++;
+        usleep(10);
+    }
+    s_avl.writes = n;
+    free(present);
+    return NULL;
+}
+
+static void
+avl_concurrent_test(void)
+{
+    static const char *names[] = {"seqlock", "rwlock", "mutex"};
+    pthread_t readers[AVL_READERS], writer;
+    int mode, i;
+
+    s_avl.values = (avl_value_t *)calloc(AVL_N, sizeof(avl_value_t));
+    for (mode = AVL_MODE_SEQ; mode <= AVL_MODE_MUTEX; mode++) {
+        memset(s_avl.values, 0, sizeof(avl_value_t) * AVL_N);
+        s_avl.mode    = mode;
+        s_avl.stop    = 0;
+        s_avl.lookups = 0;
+        s_avl.root.node = NULL;
+        avl_seqtree_init(&s_avl.seq);
+        pthread_rwlock_init(&s_avl.rwlock, NULL);
+        pthread_mutex_init(&s_avl.mutex, NULL);
+
+        for (i = 0; i < AVL_N; i += 2) {
+            s_avl.values[i].key = i;
+            s_avl.values[i + 1].key = i + 1;
+            avl_bench_toggle(&s_avl.values[i], 1);
+        }
+
+        pthread_create(&writer, NULL, avl_writer, NULL);
+        for (i = 0; i < AVL_READERS; i++)
+            pthread_create(&readers[i], NULL, avl_reader,
+                           (void *)(uintptr_t)(i + 1));
+        sleep(1);
+        s_avl.stop = 1;
+        for (i = 0; i < AVL_READERS; i++)
+            pthread_join(readers[i], NULL);
+        pthread_join(writer, NULL);
+
+        printf("avl %s: %d readers %ld lookups/s, %ld writes/s\n", names[mode],
+               AVL_READERS, s_avl.lookups, s_avl.writes);
+        avl_check(mode == AVL_MODE_SEQ ? s_avl.seq.root.node : s_avl.root.node,
+                  NULL);
+
+        avl_seqtree_destroy(&s_avl.seq);
+        pthread_rwlock_destroy(&s_avl.rwlock);
+        pthread_mutex_destroy(&s_avl.mutex);
+    }
+    free(s_avl.values);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -296,5 +545,8 @@ main(int argc, char *argv[])
         printf("SHUTDOWN AVL SUCCESS\n");
     }
     printf("Return Code = %d\n", rc);
+
+    avl_node_test();
+    avl_concurrent_test();
     return 0;
 }
@@ -0,0 +1,370 @@
+/*
+ * bitops.c - word bitmap
+ *
+ * Date   : 2021/04/30
+ */
+#include "bitops.h"
+#include "hweight.h"
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define BITOPS_X86 1
+#include <immintrin.h>
+#endif
+
+#define BITMAP_FIRST_WORD_MASK(start) (~0UL << ((start) % BITS_PER_LONG))
+#define BITMAP_LAST_WORD_MASK(nbits)  (~0UL >> (-(nbits) % BITS_PER_LONG))
+
+typedef struct bitops_kernel {
+    int level;
+    void (*or_)(unsigned long *d, const unsigned long *a, const unsigned long *b, size_t n);
+    void (*xor_)(unsigned long *d, const unsigned long *a, const unsigned long *b, size_t n);
+    int (*and_)(unsigned long *d, const unsigned long *a, const unsigned long *b, size_t n);
+    int (*andnot_)(unsigned long *d, const unsigned long *a, const unsigned long *b, size_t n);
+    size_t (*weight)(const unsigned long *p, size_t n);
+} bitops_kernel_t;
+
+// n words each
+
+static void or_generic(unsigned long *d, const unsigned long *a, const unsigned long *b, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++)
+        d[i] = a[i] | b[i];
+}
+
+static void xor_generic(unsigned long *d, const unsigned long *a, const unsigned long *b, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++)
+        d[i] = a[i] ^ b[i];
+}
+
+static int and_generic(unsigned long *d, const unsigned long *a, const unsigned long *b, size_t n)
+{
+    unsigned long r = 0;
+    size_t i;
+    for (i = 0; i < n; i++)
+        r |= (d[i] = a[i] & b[i]);
+    return r != 0;
+}
+
+static int andnot_generic(unsigned long *d, const unsigned long *a, const unsigned long *b, size_t n)
+{
+    unsigned long r = 0;
+    size_t i;
+    for (i = 0; i < n; i++)
+        r |= (d[i] = a[i] & ~b[i]);
+    return r != 0;
+}
+
+static size_t weight_generic(const unsigned long *p, size_t n)
+{
+    size_t i, w = 0;
+    for (i = 0; i < n; i++)
+        w += hweight_long(p[i]);
+    return w;
+}
+
+static const bitops_kernel_t s_generic = {
+    BITMAP_SIMD_NONE, or_generic, xor_generic, and_generic, andnot_generic, weight_generic,
+};
+
+#if defined(BITOPS_X86)
+
+// the vector loops leave n % (vector / long) words to the generic ones
+
+#define SSE2_WORDS (16 / sizeof(unsigned long))
+#define AVX2_WORDS (32 / sizeof(unsigned long))
+
+#define SSE2_BINOP(name, expr)                                                 \
+__attribute__((target("sse2")))                                                \
+static void name##_sse2(unsigned long *d, const unsigned long *a, const unsigned long *b, size_t n) \
+{                                                                              \
+    __m128i x, y;                                                              \
+    size_t i;                                                                  \
+    for (i = 0; i + SSE2_WORDS <= n; i += SSE2_WORDS) {                        \
+        x = _mm_loadu_si128((const __m128i *)(a + i));                         \
+        y = _mm_loadu_si128((const __m128i *)(b + i));                         \
+        _mm_storeu_si128((__m128i *)(d + i), expr);                            \
+    }                                                                          \
+    name##_generic(d + i, a + i, b + i, n - i);                                \
+}
+
+#define SSE2_TESTOP(name, expr)                                                \
+__attribute__((target("sse2")))                                                \
+static int name##_sse2(unsigned long *d, const unsigned long *a, const unsigned long *b, size_t n) \
+{                                                                              \
+    __m128i x, y, r, acc = _mm_setzero_si128();                                \
+    size_t i;                                                                  \
+    for (i = 0; i + SSE2_WORDS <= n; i += SSE2_WORDS) {                        \
+        x = _mm_loadu_si128((const __m128i *)(a + i));                         \
+        y = _mm_loadu_si128((const __m128i *)(b + i));                         \
+        r = expr;                                                              \
+        acc = _mm_or_si128(acc, r);                                            \
+        _mm_storeu_si128((__m128i *)(d + i), r);                               \
+    }                                                                          \
+    acc = _mm_cmpeq_epi8(acc, _mm_setzero_si128());                            \
+    return (_mm_movemask_epi8(acc) != 0xFFFF)                                  \
+           | name##_generic(d + i, a + i, b + i, n - i);                       \
+}
+
+SSE2_BINOP(or, _mm_or_si128(x, y))
+SSE2_BINOP(xor, _mm_xor_si128(x, y))
+SSE2_TESTOP(and, _mm_and_si128(x, y))
+SSE2_TESTOP(andnot, _mm_andnot_si128(y, x))
+
+// SWAR in each byte, psadbw sums the bytes
+__attribute__((target("sse2")))
+static size_t weight_sse2(const unsigned long *p, size_t n)
+{
+    const __m128i m1 = _mm_set1_epi8(0x55);
+    const __m128i m2 = _mm_set1_epi8(0x33);
+    const __m128i m4 = _mm_set1_epi8(0x0F);
+    __m128i v, acc = _mm_setzero_si128();
+    uint64_t sum[2];
+    size_t i;
+
+    for (i = 0; i + SSE2_WORDS <= n; i += SSE2_WORDS) {
+        v = _mm_loadu_si128((const __m128i *)(p + i));
+        v = _mm_sub_epi8(v, _mm_and_si128(_mm_srli_epi64(v, 1), m1));
+        v = _mm_add_epi8(_mm_and_si128(v, m2), _mm_and_si128(_mm_srli_epi64(v, 2), m2));
+        v = _mm_and_si128(_mm_add_epi8(v, _mm_srli_epi64(v, 4)), m4);
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(v, _mm_setzero_si128()));
+    }
+    _mm_storeu_si128((__m128i *)sum, acc);
+    return (size_t)(sum[0] + sum[1]) + weight_generic(p + i, n - i);
+}
+
+static const bitops_kernel_t s_sse2 = {
+    BITMAP_SIMD_SSE2, or_sse2, xor_sse2, and_sse2, andnot_sse2, weight_sse2,
+};
+
+#define AVX2_BINOP(name, expr)                                                 \
+__attribute__((target("avx2")))                                                \
+static void name##_avx2(unsigned long *d, const unsigned long *a, const unsigned long *b, size_t n) \
+{                                                                              \
+    __m256i x, y;                                                              \
+    size_t i;                                                                  \
+    for (i = 0; i + AVX2_WORDS <= n; i += AVX2_WORDS) {                        \
+        x = _mm256_loadu_si256((const __m256i *)(a + i));                      \
+        y = _mm256_loadu_si256((const __m256i *)(b + i));                      \
+        _mm256_storeu_si256((__m256i *)(d + i), expr);                         \
+    }                                                                          \
+    name##_generic(d + i, a + i, b + i, n - i);                                \
+}
+
+#define AVX2_TESTOP(name, expr)                                                \
+__attribute__((target("avx2")))                                                \
+static int name##_avx2(unsigned long *d, const unsigned long *a, const unsigned long *b, size_t n) \
+{                                                                              \
+    __m256i x, y, r, acc = _mm256_setzero_si256();                             \
+    size_t i;                                                                  \
+    for (i = 0; i + AVX2_WORDS <= n; i += AVX2_WORDS) {                        \
+        x = _mm256_loadu_si256((const __m256i *)(a + i));                      \
+        y = _mm256_loadu_si256((const __m256i *)(b + i));                      \
+        r = expr;                                                              \
+        acc = _mm256_or_si256(acc, r);                                         \
+        _mm256_storeu_si256((__m256i *)(d + i), r);                            \
+    }                                                                          \
+    return (!_mm256_testz_si256(acc, acc))                                     \
+           | name##_generic(d + i, a + i, b + i, n - i);                       \
+}
+
+AVX2_BINOP(or, _mm256_or_si256(x, y))
+AVX2_BINOP(xor, _mm256_xor_si256(x, y))
+AVX2_TESTOP(and, _mm256_and_si256(x, y))
+AVX2_TESTOP(andnot, _mm256_andnot_si256(y, x))
+
+// nibble lookup with pshufb (Mula), psadbw sums the bytes
+__attribute__((target("avx2")))
+static size_t weight_avx2(const unsigned long *p, size_t n)
+{
+    const __m256i lookup = _mm256_setr_epi8(
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i m4 = _mm256_set1_epi8(0x0F);
+    __m256i v, c, acc = _mm256_setzero_si256();
+    uint64_t sum[4];
+    size_t i;
+
+    for (i = 0; i + AVX2_WORDS <= n; i += AVX2_WORDS) {
+        v = _mm256_loadu_si256((const __m256i *)(p + i));
+        c = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, _mm256_and_si256(v, m4)),
+                            _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), m4)));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(c, _mm256_setzero_si256()));
+    }
+    _mm256_storeu_si256((__m256i *)sum, acc);
+    return (size_t)(sum[0] + sum[1] + sum[2] + sum[3]) + weight_sse2(p + i, n - i);
+}
+
+static const bitops_kernel_t s_avx2 = {
+    BITMAP_SIMD_AVX2, or_avx2, xor_avx2, and_avx2, andnot_avx2, weight_avx2,
+};
+
+#endif
+
+static const bitops_kernel_t *s_kernel = &s_generic;
+
+int bitmap_long_simd(void)
+{
+    return s_kernel->level;
+}
+
+int bitmap_long_simd_limit(int level)
+{
+    const bitops_kernel_t *k = &s_generic;
+#if defined(BITOPS_X86)
+    __builtin_cpu_init();
+    if (level >= BITMAP_SIMD_AVX2 && __builtin_cpu_supports("avx2"))
+        k = &s_avx2;
+    else if (level >= BITMAP_SIMD_SSE2 && __builtin_cpu_supports("sse2"))
+        k = &s_sse2;
+#else
+    (void)level;
+#endif
+    s_kernel = k;
+    return k->level;
+}
+
+__attribute__((constructor))
+static void bitops_init(void)
+{
+    bitmap_long_simd_limit(BITMAP_SIMD_AVX2);
+}
+
+void bitmap_long_zero(unsigned long *map, size_t nbits)
+{
+    memset(map, 0x00, BITS_TO_LONGS(nbits) * sizeof(unsigned long));
+}
+
+void bitmap_long_fill(unsigned long *map, size_t nbits)
+{
+    memset(map, 0xFF, BITS_TO_LONGS(nbits) * sizeof(unsigned long));
+}
+
+void bitmap_long_copy(unsigned long *dst, const unsigned long *src, size_t nbits)
+{
+    memmove(dst, src, BITS_TO_LONGS(nbits) * sizeof(unsigned long));
+}
+
+void bitmap_long_set(unsigned long *map, size_t start, size_t len)
+{
+    unsigned long *p = map + BIT_WORD(start);
+    size_t end = start + len;
+    size_t n;
+
+    if (0 == len)
+        return;
+    if (BIT_WORD(start) == BIT_WORD(end - 1)) {
+        *p |= BITMAP_FIRST_WORD_MASK(start) & BITMAP_LAST_WORD_MASK(end);
+        return;
+    }
+
+    *p++ |= BITMAP_FIRST_WORD_MASK(start);
+    n = BIT_WORD(end - 1) - BIT_WORD(start) - 1;
+    memset(p, 0xFF, n * sizeof(unsigned long));
+    p[n] |= BITMAP_LAST_WORD_MASK(end);
+}
+
+void bitmap_long_clear(unsigned long *map, size_t start, size_t len)
+{
+    unsigned long *p = map + BIT_WORD(start);
+    size_t end = start + len;
+    size_t n;
+
+    if (0 == len)
+        return;
+    if (BIT_WORD(start) == BIT_WORD(end - 1)) {
+        *p &= ~(BITMAP_FIRST_WORD_MASK(start) & BITMAP_LAST_WORD_MASK(end));
+        return;
+    }
+
+    *p++ &= ~BITMAP_FIRST_WORD_MASK(start);
+    n = BIT_WORD(end - 1) - BIT_WORD(start) - 1;
+    memset(p, 0x00, n * sizeof(unsigned long));
+    p[n] &= ~BITMAP_LAST_WORD_MASK(end);
+}
+
+void bitmap_long_or(unsigned long *dst, const unsigned long *src1,
+                    const unsigned long *src2, size_t nbits)
+{
+    s_kernel->or_(dst, src1, src2, BITS_TO_LONGS(nbits));
+}
+
+void bitmap_long_xor(unsigned long *dst, const unsigned long *src1,
+                     const unsigned long *src2, size_t nbits)
+{
+    s_kernel->xor_(dst, src1, src2, BITS_TO_LONGS(nbits));
+}
+
+int bitmap_long_and(unsigned long *dst, const unsigned long *src1,
+                    const unsigned long *src2, size_t nbits)
+{
+    size_t n = nbits / BITS_PER_LONG;
+    unsigned long r;
+    int any = s_kernel->and_(dst, src1, src2, n);
+
+    // the bits past nbits don't count
+    if (nbits % BITS_PER_LONG) {
+        r = dst[n] = src1[n] & src2[n];
+        any |= 0 != (r & BITMAP_LAST_WORD_MASK(nbits));
+    }
+    return any;
+}
+
+int bitmap_long_andnot(unsigned long *dst, const unsigned long *src1,
+                       const unsigned long *src2, size_t nbits)
+{
+    size_t n = nbits / BITS_PER_LONG;
+    unsigned long r;
+    int any = s_kernel->andnot_(dst, src1, src2, n);
+
+    if (nbits % BITS_PER_LONG) {
+        r = dst[n] = src1[n] & ~src2[n];
+        any |= 0 != (r & BITMAP_LAST_WORD_MASK(nbits));
+    }
+    return any;
+}
+
+size_t bitmap_long_weight(const unsigned long *map, size_t nbits)
+{
+    size_t n = nbits / BITS_PER_LONG;
+    size_t w = s_kernel->weight(map, n);
+
+    if (nbits % BITS_PER_LONG)
+        w += hweight_long(map[n] & BITMAP_LAST_WORD_MASK(nbits));
+    return w;
+}
+
+// invert: ~0UL to look for zeros
+static inline size_t find_next(const unsigned long *addr, size_t size,
+                               size_t offset, unsigned long invert)
+{
+    size_t i, r;
+    unsigned long w;
+
+    if (offset >= size)
+        return size;
+
+    i = BIT_WORD(offset);
+    w = (addr[i] ^ invert) & BITMAP_FIRST_WORD_MASK(offset);
+    while (0 == w) {
+        if (++i >= BITS_TO_LONGS(size))
+            return size;
+        w = addr[i] ^ invert;
+    }
+
+    r = i * BITS_PER_LONG + (size_t)__builtin_ctzl(w);
+    return r < size ? r : size;
+}
+
+size_t find_next_bit(const unsigned long *addr, size_t size, size_t offset)
+{
+    return find_next(addr, size, offset, 0UL);
+}
+
+size_t find_next_zero_bit(const unsigned long *addr, size_t size, size_t offset)
+{
+    return find_next(addr, size, offset, ~0UL);
+}
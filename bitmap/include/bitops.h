@@ -0,0 +1,90 @@
+/*
+ * bitops.h - word bitmap
+ *
+ * Date   : 2021/04/30
+ */
+#ifndef __BITOPS_H__
+#define __BITOPS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bitmaps of unsigned long words, bit nr is bit (nr % BITS_PER_LONG) of
+ * word nr / BITS_PER_LONG (the byte bitmap in bitmap.h is MSB first).
+ * and/or/xor/andnot/copy/fill write whole words, the bits past nbits in
+ * the last word are left undefined; weight and find ignore them.
+ */
+#define BITS_PER_LONG           (8 * sizeof(unsigned long))
+#define BITS_TO_LONGS(nbits)    (((nbits) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define BIT_WORD(nr)            ((nr) / BITS_PER_LONG)
+#define BIT_MASK(nr)            (1UL << ((nr) % BITS_PER_LONG))
+
+static inline void set_bit(size_t nr, unsigned long *addr)
+{
+    addr[BIT_WORD(nr)] |= BIT_MASK(nr);
+}
+
+static inline void clear_bit(size_t nr, unsigned long *addr)
+{
+    addr[BIT_WORD(nr)] &= ~BIT_MASK(nr);
+}
+
+static inline void change_bit(size_t nr, unsigned long *addr)
+{
+    addr[BIT_WORD(nr)] ^= BIT_MASK(nr);
+}
+
+static inline int test_bit(size_t nr, const unsigned long *addr)
+{
+    return (int)((addr[BIT_WORD(nr)] >> (nr % BITS_PER_LONG)) & 1);
+}
+
+void bitmap_long_zero(unsigned long *map, size_t nbits);
+void bitmap_long_fill(unsigned long *map, size_t nbits);
+void bitmap_long_copy(unsigned long *dst, const unsigned long *src, size_t nbits);
+
+void bitmap_long_set(unsigned long *map, size_t start, size_t len);
+void bitmap_long_clear(unsigned long *map, size_t start, size_t len);
+
+void bitmap_long_or(unsigned long *dst, const unsigned long *src1,
+                    const unsigned long *src2, size_t nbits);
+void bitmap_long_xor(unsigned long *dst, const unsigned long *src1,
+                     const unsigned long *src2, size_t nbits);
+/// @return 1-the result has a bit set, 0-empty
+int bitmap_long_and(unsigned long *dst, const unsigned long *src1,
+                    const unsigned long *src2, size_t nbits);
+/// dst = src1 & ~src2
+/// @return 1-the result has a bit set, 0-empty
+int bitmap_long_andnot(unsigned long *dst, const unsigned long *src1,
+                       const unsigned long *src2, size_t nbits);
+size_t bitmap_long_weight(const unsigned long *map, size_t nbits);
+
+/// @return the first set/zero bit from offset, size if none
+size_t find_next_bit(const unsigned long *addr, size_t size, size_t offset);
+size_t find_next_zero_bit(const unsigned long *addr, size_t size, size_t offset);
+#define find_first_bit(addr, size)      find_next_bit(addr, size, 0)
+#define find_first_zero_bit(addr, size) find_next_zero_bit(addr, size, 0)
+
+/// kernels for and/or/xor/andnot/weight, picked from the cpu at load time
+enum {
+    BITMAP_SIMD_NONE = 0,
+    BITMAP_SIMD_SSE2,
+    BITMAP_SIMD_AVX2,
+};
+
+/// @return the kernels in use
+int bitmap_long_simd(void);
+/// use no better than level (benchmarks, tests), not while others run
+/// @return the kernels in use
+int bitmap_long_simd_limit(int level);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
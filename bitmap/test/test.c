@@ -4,9 +4,11 @@
  * Date   : 2021/03/16
  */
 #include "bitmap.h"
+#include "bitops.h"
 #include "hweight.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 
 #ifdef NDEBUG
@@ -120,9 +122,207 @@ void bitmap_test(void)
 }
 
 
+static uint64_t s_seed = 0x9e3779b97f4a7c15ULL;
+
+static unsigned long rand_long(void)
+{
+	s_seed ^= s_seed << 13;
+	s_seed ^= s_seed >> 7;
+	s_seed ^= s_seed << 17;
+	return (unsigned long)s_seed;
+}
+
+static const char* simd_name(int level)
+{
+	return BITMAP_SIMD_AVX2 == level ? "avx2" : (BITMAP_SIMD_SSE2 == level ? "sse2" : "generic");
+}
+
+#define W 300
+
+// every kernel against bit by bit, odd lengths and word offsets
+void bitops_test(void)
+{
+	static const size_t sizes[] = { 0, 1, 63, 64, 65, 127, 128, 129, 255, 256, 257, 1000, 4099, W * BITS_PER_LONG - 1 };
+	unsigned long a[W + 3], b[W + 3], d[W + 3], *pa, *pb, *pd;
+	size_t i, j, k, n, w, any, level, off, start, len;
+	char ref[W * 64];
+
+	for (level = BITMAP_SIMD_NONE; level <= BITMAP_SIMD_AVX2; level++)
+	{
+		if (bitmap_long_simd_limit((int)level) != (int)level)
+			continue;
+
+		for (off = 0; off < 3; off++)
+		{
+			pa = a + off;
+			pb = b + (off + 1) % 3;
+			pd = d + (off + 2) % 3;
+			for (k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++)
+			{
+				n = sizes[k];
+				for (i = 0; i < W; i++)
+				{
+					pa[i] = rand_long() & rand_long();
+					pb[i] = k % 2 ? pa[i] : rand_long();
+				}
+
+				bitmap_long_or(pd, pa, pb, n);
+				for (i = 0; i < n; i++)
+					assert(test_bit(i, pd) == (test_bit(i, pa) | test_bit(i, pb)));
+				bitmap_long_xor(pd, pa, pb, n);
+				for (i = 0; i < n; i++)
+					assert(test_bit(i, pd) == (test_bit(i, pa) ^ test_bit(i, pb)));
+
+				any = bitmap_long_and(pd, pa, pb, n);
+				for (i = w = 0; i < n; i++)
+				{
+					assert(test_bit(i, pd) == (test_bit(i, pa) & test_bit(i, pb)));
+					w += test_bit(i, pd);
+				}
+				assert(any == (w > 0));
+				assert(w == bitmap_long_weight(pd, n));
+
+				// equal maps leave nothing
+				any = bitmap_long_andnot(pd, pa, pb, n);
+				for (i = w = 0; i < n; i++)
+				{
+					assert(test_bit(i, pd) == (test_bit(i, pa) & !test_bit(i, pb)));
+					w += test_bit(i, pd);
+				}
+				assert(any == (w > 0));
+				assert(w == bitmap_long_weight(pd, n));
+			}
+		}
+		printf("bitops %s ok\n", simd_name((int)level));
+	}
+	bitmap_long_simd_limit(BITMAP_SIMD_AVX2);
+
+	// ranges and find against a char per bit
+	n = W * BITS_PER_LONG - 5;
+	bitmap_long_zero(a, n);
+	memset(ref, 0, sizeof(ref));
+	assert(n == find_first_bit(a, n));
+	assert(0 == find_first_zero_bit(a, n));
+	for (k = 0; k < 2000; k++)
+	{
+		start = rand_long() % n;
+		len = k % 3 ? rand_long() % 100 : rand_long() % (n - start + 1);
+		if (start + len > n)
+			len = n - start;
+		if (k % 2)
+			bitmap_long_set(a, start, len);
+		else
+			bitmap_long_clear(a, start, len);
+		memset(ref + start, k % 2, len);
+
+		if (k % 50)
+			continue;
+		for (i = 0; i < n; i++)
+			assert(test_bit(i, a) == ref[i]);
+		for (i = 0; i < n; i = j + 1)
+		{
+			j = find_next_bit(a, n, i);
+			assert(j == n || ref[j]);
+			while (i < j)
+				assert(!ref[i++]);
+		}
+		for (i = 0; i < n; i = j + 1)
+		{
+			j = find_next_zero_bit(a, n, i);
+			assert(j == n || !ref[j]);
+			while (i < j)
+				assert(ref[i++]);
+		}
+	}
+
+	// the tail past size is not looked at
+	bitmap_long_fill(a, 70);
+	clear_bit(69, a);
+	assert(69 == find_first_zero_bit(a, 69 + 1));
+	assert(68 == find_first_zero_bit(a, 68));
+	set_bit(69, a);
+	change_bit(3, a);
+	assert(3 == find_first_zero_bit(a, 70) && 70 == find_next_zero_bit(a, 70, 4));
+	printf("bitops test ok\n");
+}
+
+#define BENCH_BITS 100000000
+
+static double ms(clock_t start)
+{
+	return (clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+// allocation map sized: the byte api against the word one at every level
+void bitops_bench(void)
+{
+	size_t bytes = (BENCH_BITS + 7) / 8, words = BITS_TO_LONGS(BENCH_BITS);
+	uint8_t *x = malloc(bytes), *y = malloc(bytes), *z = malloc(bytes);
+	unsigned long *a = malloc(words * sizeof(long)), *b = malloc(words * sizeof(long)), *d = malloc(words * sizeof(long));
+	size_t i, sum = 0;
+	clock_t start;
+	int level;
+
+	for (i = 0; i < words; i++)
+	{
+		a[i] = rand_long();
+		b[i] = rand_long();
+	}
+	memcpy(x, a, bytes);
+	memcpy(y, b, bytes);
+	memset(z, 0, bytes);
+	memset(d, 0, words * sizeof(long));
+
+	start = clock();
+	bitmap_or(z, x, y, BENCH_BITS);
+	printf("bytes   : or %6.1fms", ms(start));
+	start = clock();
+	bitmap_and(z, x, y, BENCH_BITS);
+	printf(" and %6.1fms", ms(start));
+	start = clock();
+	sum += bitmap_weight(x, BENCH_BITS);
+	printf(" weight %6.1fms", ms(start));
+	bitmap_fill(z, BENCH_BITS);
+	start = clock();
+	sum += bitmap_find_next_zero(z, BENCH_BITS, 0);
+	printf(" find %6.1fms", ms(start));
+	start = clock();
+	bitmap_set(z, 3, BENCH_BITS - 6);
+	printf(" set %6.1fms\n", ms(start));
+
+	for (level = BITMAP_SIMD_NONE; level <= BITMAP_SIMD_AVX2; level++)
+	{
+		if (bitmap_long_simd_limit(level) != level)
+			continue;
+		start = clock();
+		bitmap_long_or(d, a, b, BENCH_BITS);
+		printf("%-8s: or %6.1fms", simd_name(level), ms(start));
+		start = clock();
+		sum += bitmap_long_and(d, a, b, BENCH_BITS);
+		printf(" and %6.1fms", ms(start));
+		start = clock();
+		sum += bitmap_long_weight(a, BENCH_BITS);
+		printf(" weight %6.1fms", ms(start));
+		bitmap_long_fill(d, BENCH_BITS);
+		start = clock();
+		sum += find_first_zero_bit(d, BENCH_BITS);
+		printf(" find %6.1fms", ms(start));
+		start = clock();
+		bitmap_long_set(d, 3, BENCH_BITS - 6);
+		printf(" set %6.1fms\n", ms(start));
+	}
+	bitmap_long_simd_limit(BITMAP_SIMD_AVX2);
+	printf("(%u)\n", (unsigned int)sum);
+
+	free(x); free(y); free(z);
+	free(a); free(b); free(d);
+}
+
 int main(void)
 {
     hweight_test();
     bitmap_test();
+    bitops_test();
+    bitops_bench();
     return 0;
 }
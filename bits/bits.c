@@ -30,8 +30,7 @@ int bits_next(struct bits* bits)
 
 uint64_t bits_next_n(struct bits* bits, int n)
 {
-	size_t i;
-	uint64_t v;
+	bits_reader_t r;
 
 	assert(n > 0 && n <= 64);
 	assert(bits && bits->data && bits->size > 0);
@@ -41,25 +40,13 @@ uint64_t bits_next_n(struct bits* bits, int n)
 		return 0; // throw exception
 	}
 
-	v = bits->data[bits->bits / 8] & (0xFFU >> (bits->bits % 8)); // remain valid value
-	if (n <= 8 - (int)(bits->bits % 8))
-		return v >> (8 - (bits->bits % 8) - n); // shift right value
-
-	n -= 8 - (int)(bits->bits % 8);
-	for (i = 1; n >= 8 && bits->bits / 8 + i < bits->size; i++)
-	{
-		v <<= 8;
-		v += bits->data[bits->bits / 8 + i];
-		n -= 8;
-	}
+	// one load if the bits lie in the 8 bytes from the current one
+	if (bits->bits / 8 + 8 <= bits->size && (int)(bits->bits % 8) + n <= 64)
+		return (bits_load_be64(bits->data + bits->bits / 8) << (bits->bits % 8)) >> (64 - n);
 
-	if (n > 0)
-	{
-		v <<= n;
-		v += bits->data[bits->bits / 8 + i] >> (8 - n);
-	}
-
-	return v;
+	bits_reader_init(&r, bits->data, bits->size);
+	bits_reader_skip(&r, bits->bits);
+	return bits_reader_read_n(&r, n);
 }
 
 int bits_read(struct bits* bits)
@@ -82,21 +69,21 @@ uint64_t bits_read_n(struct bits* bits, int n)
 
 int bits_read_ue(struct bits* bits)
 {
-	int bit;
-	int leadingZeroBits = -1;
-	for (bit = 0; !bit && -1 != bit; ++leadingZeroBits)
-	{
-		bit = bits_read(bits);
-		assert(0 == bit || 1 == bit);
-	}
+	uint32_t v;
+	bits_reader_t r;
 
-	bit = 0;
-	if (leadingZeroBits > 0)
+	assert(bits && bits->data && bits->size > 0);
+	bits_reader_init(&r, bits->data, bits->size);
+	bits_reader_skip(&r, bits->bits);
+	v = bits_reader_read_ue(&r);
+	if (r.error)
 	{
-		assert(leadingZeroBits < 32);
-		bit = (int)bits_read_n(bits, leadingZeroBits);
+		bits->error = -1;
+		return 0; // throw exception
 	}
-	return (1 << leadingZeroBits) - 1 + bit;
+
+	bits->bits = bits_reader_tell(&r);
+	return (int)v;
 }
 
 int bits_read_se(struct bits* bits)
@@ -160,3 +147,110 @@ int bits_write_n(struct bits* bits, uint64_t v, int n)
 	bits->bits += m;
 	return 0;
 }
+
+void bits_reader_init(bits_reader_t* r, const void* data, size_t size)
+{
+	r->data = (const uint8_t*)data;
+	r->ptr = r->data;
+	r->end = r->data + size;
+	r->cache = 0;
+	r->count = 0;
+	r->error = 0;
+}
+
+void bits_reader_refill_tail(bits_reader_t* r)
+{
+	// the cache bit at count is the first bit of *ptr
+	while (r->count <= 56 && r->ptr < r->end)
+	{
+		r->cache |= (uint64_t)*r->ptr++ << (56 - r->count);
+		r->count += 8;
+	}
+}
+
+void bits_reader_skip(bits_reader_t* r, size_t n)
+{
+	size_t bytes;
+	if (n <= (size_t)r->count)
+	{
+		r->cache = n < 64 ? r->cache << n : 0;
+		r->count -= (int)n;
+		return;
+	}
+
+	n -= r->count;
+	bytes = n / 8;
+	r->cache = 0;
+	r->count = 0;
+	if (bytes > (size_t)(r->end - r->ptr))
+	{
+		r->ptr = r->end;
+		r->error = -1;
+		return;
+	}
+
+	r->ptr += bytes;
+	if (n % 8)
+		bits_reader_read_fast(r, (int)(n % 8));
+}
+
+uint32_t bits_reader_read_ue_slow(bits_reader_t* r)
+{
+	int zeros, n;
+	uint32_t v;
+
+	bits_reader_refill(r);
+	zeros = bits_clz64(r->cache);
+	n = 2 * zeros + 1;
+	if (n <= r->count)
+	{
+		v = (uint32_t)(r->cache >> (64 - n)) - 1;
+		r->cache <<= n;
+		r->count -= n;
+		return v;
+	}
+
+	// longer than a refill, or at the end
+	if (zeros >= 32 || zeros >= r->count)
+	{
+		r->error = -1;
+		return 0; // throw exception
+	}
+
+	bits_reader_read_fast(r, zeros);
+	v = (uint32_t)bits_reader_read_fast(r, zeros + 1);
+	return r->error ? 0 : v - 1;
+}
+
+void bits_writer_init(bits_writer_t* w, void* data, size_t size)
+{
+	w->data = (uint8_t*)data;
+	w->ptr = w->data;
+	w->end = w->data + size;
+	w->cache = 0;
+	w->count = 0;
+	w->error = 0;
+}
+
+void bits_writer_store_tail(bits_writer_t* w)
+{
+	for (; w->count >= 8 && w->ptr < w->end; w->count -= 8)
+	{
+		*w->ptr++ = (uint8_t)(w->cache >> 56);
+		w->cache <<= 8;
+	}
+
+	if (w->count >= 8)
+	{
+		w->error = -1; // throw exception
+		w->cache = 0;
+		w->count = 0;
+	}
+}
+
+int bits_writer_flush(bits_writer_t* w)
+{
+	bits_writer_align(w);
+	bits_writer_store_tail(w);
+	return w->error ? -1 : (int)(w->ptr - w->data);
+}
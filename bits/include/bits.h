@@ -70,6 +70,246 @@ int bits_write(bits_t* bits, int v);
 /// @return 0-ok, other-error
 int bits_write_n(bits_t* bits, uint64_t v, int n);
 
+/// MSB first reader keeping the next bits in a 64-bit cache, refilled with
+/// one unaligned load; reads past the end set error and return 0
+typedef struct bits_reader
+{
+	const uint8_t* data;
+	const uint8_t* ptr; // next byte to load
+	const uint8_t* end;
+	uint64_t cache; // unread bits, left aligned
+	int count; // valid bits in cache
+	int error;
+} bits_reader_t;
+
+/// MSB first writer, bits are stored once a 64-bit cache is full
+typedef struct bits_writer
+{
+	uint8_t* data;
+	uint8_t* ptr; // next byte to store
+	uint8_t* end;
+	uint64_t cache; // unstored bits, left aligned
+	int count;
+	int error;
+} bits_writer_t;
+
+#define BITS_CACHE_FAST 56 // bits readable after one refill
+
+static inline uint64_t bits_load_be64(const uint8_t* p)
+{
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	uint64_t v;
+	__builtin_memcpy(&v, p, sizeof(v));
+	return __builtin_bswap64(v);
+#else
+	return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) | ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32)
+		| ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) | ((uint64_t)p[6] << 8) | (uint64_t)p[7];
+#endif
+}
+
+static inline void bits_store_be64(uint8_t* p, uint64_t v)
+{
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	v = __builtin_bswap64(v);
+	__builtin_memcpy(p, &v, sizeof(v));
+#else
+	int i;
+	for (i = 0; i < 8; i++)
+		p[i] = (uint8_t)(v >> (56 - 8 * i));
+#endif
+}
+
+/// @return leading zero bits, 64 for 0
+static inline int bits_clz64(uint64_t v)
+{
+#if defined(__GNUC__)
+	return v ? __builtin_clzll(v) : 64;
+#else
+	int n = 0;
+	for (; n < 64 && !(v & 0x8000000000000000ULL); n++)
+		v <<= 1;
+	return n;
+#endif
+}
+
+void bits_reader_init(bits_reader_t* r, const void* data, size_t size);
+/// refill byte by byte near the end, use bits_reader_refill
+void bits_reader_refill_tail(bits_reader_t* r);
+/// skip n bits, any n
+void bits_reader_skip(bits_reader_t* r, size_t n);
+/// Exp-Golomb codes longer than a refill, use bits_reader_read_ue
+uint32_t bits_reader_read_ue_slow(bits_reader_t* r);
+
+/// make at least BITS_CACHE_FAST bits valid, fewer at the end
+static inline void bits_reader_refill(bits_reader_t* r)
+{
+	if (r->end - r->ptr >= 8)
+	{
+		r->cache |= bits_load_be64(r->ptr) >> r->count;
+		r->ptr += (63 - r->count) >> 3;
+		r->count |= BITS_CACHE_FAST;
+	}
+	else
+	{
+		bits_reader_refill_tail(r);
+	}
+}
+
+/// read n-bit(n <= BITS_CACHE_FAST)
+static inline uint64_t bits_reader_read_fast(bits_reader_t* r, int n)
+{
+	uint64_t v;
+	if (r->count < n)
+	{
+		bits_reader_refill(r);
+		if (r->count < n)
+		{
+			r->error = -1;
+			return 0; // throw exception
+		}
+	}
+
+	v = r->cache >> (64 - n);
+	r->cache <<= n;
+	r->count -= n;
+	return v;
+}
+
+/// read n-bit(0 < n <= 64) from bit stream(offset position)
+/// @return value, 0 and error set if out of data
+static inline uint64_t bits_reader_read_n(bits_reader_t* r, int n)
+{
+	uint64_t v;
+	if (n <= BITS_CACHE_FAST)
+		return bits_reader_read_fast(r, n);
+	v = bits_reader_read_fast(r, n - 32) << 32;
+	return v | bits_reader_read_fast(r, 32);
+}
+
+static inline int bits_reader_read(bits_reader_t* r)
+{
+	return (int)bits_reader_read_fast(r, 1);
+}
+
+/// Exp-Golomb code, the zeros are counted with clz
+/// @return value(< 2^32 - 1), 0 and error set if out of data or too long
+static inline uint32_t bits_reader_read_ue(bits_reader_t* r)
+{
+	int n;
+	uint32_t v;
+	if (r->count < 32)
+		bits_reader_refill(r);
+
+	n = 2 * bits_clz64(r->cache) + 1;
+	if (n > r->count)
+		return bits_reader_read_ue_slow(r);
+
+	v = (uint32_t)(r->cache >> (64 - n)) - 1;
+	r->cache <<= n;
+	r->count -= n;
+	return v;
+}
+
+static inline int32_t bits_reader_read_se(bits_reader_t* r)
+{
+	uint32_t v = bits_reader_read_ue(r);
+	return (v & 1) ? (int32_t)((v >> 1) + 1) : -(int32_t)(v >> 1);
+}
+
+/// @return bits read
+static inline size_t bits_reader_tell(const bits_reader_t* r)
+{
+	return (size_t)(r->ptr - r->data) * 8 - r->count;
+}
+
+static inline size_t bits_reader_remain(const bits_reader_t* r)
+{
+	return r->error ? 0 : (size_t)(r->end - r->ptr) * 8 + r->count;
+}
+
+/// skip to the next byte boundary
+static inline void bits_reader_align(bits_reader_t* r)
+{
+	r->cache <<= r->count & 7;
+	r->count &= ~7;
+}
+
+void bits_writer_init(bits_writer_t* w, void* data, size_t size);
+/// store the whole bytes of the cache byte by byte, near the end
+void bits_writer_store_tail(bits_writer_t* w);
+/// pad to a byte boundary and store everything
+/// @return -1-error, other-bytes written
+int bits_writer_flush(bits_writer_t* w);
+
+static inline void bits_writer_store(bits_writer_t* w)
+{
+	int n;
+	if (w->end - w->ptr >= 8)
+	{
+		bits_store_be64(w->ptr, w->cache);
+		n = w->count >> 3;
+		w->ptr += n;
+		w->cache = (w->cache << (n * 4)) << (n * 4); // n may be 8
+		w->count -= n * 8;
+	}
+	else
+	{
+		bits_writer_store_tail(w);
+	}
+}
+
+/// write n-bit(0 < n <= 64), the bits above n are ignored
+static inline void bits_writer_write_n(bits_writer_t* w, uint64_t v, int n)
+{
+	if (n > 32)
+	{
+		bits_writer_write_n(w, v >> 32, n - 32);
+		n = 32;
+	}
+
+	if (w->count + n > 64)
+		bits_writer_store(w);
+	v &= (uint64_t)-1 >> (64 - n);
+	w->cache |= v << (64 - w->count - n);
+	w->count += n;
+}
+
+static inline void bits_writer_write(bits_writer_t* w, int v)
+{
+	bits_writer_write_n(w, v ? 1 : 0, 1);
+}
+
+/// v + 1 in x, len - 1 zeros and x in len bits
+static inline void bits_writer_write_golomb(bits_writer_t* w, uint64_t x)
+{
+	int len = 64 - bits_clz64(x);
+	if (len > 32)
+		bits_writer_write_n(w, 0, len - 1);
+	bits_writer_write_n(w, x, len > 32 ? len : 2 * len - 1);
+}
+
+static inline void bits_writer_write_ue(bits_writer_t* w, uint32_t v)
+{
+	bits_writer_write_golomb(w, (uint64_t)v + 1);
+}
+
+static inline void bits_writer_write_se(bits_writer_t* w, int32_t v)
+{
+	bits_writer_write_golomb(w, v > 0 ? 2 * (uint64_t)v : 2 * (uint64_t)(-(int64_t)v) + 1);
+}
+
+/// pad zero bits to the next byte boundary
+static inline void bits_writer_align(bits_writer_t* w)
+{
+	w->count = (w->count + 7) & ~7;
+}
+
+/// @return bits written
+static inline size_t bits_writer_tell(const bits_writer_t* w)
+{
+	return (size_t)(w->ptr - w->data) * 8 + w->count;
+}
+
 #ifdef __cplusplus
 }
 #endif
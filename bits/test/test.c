@@ -5,6 +5,9 @@
  */
 #include "bits.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #ifdef NDEBUG
 #undef NDEBUG
 #endif
@@ -68,9 +71,182 @@ void bits_test(void)
     printf("bits_test ok\n");
 }
 
+static uint64_t rand64(void)
+{
+	static uint64_t x = 88172645463325252ULL;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return x;
+}
+
+// values of 0..2^(1..32)-1, exponentially spread like real streams
+static uint32_t rand_value(void)
+{
+	int n = 1 + (int)(rand64() % 32);
+	return (uint32_t)(rand64() & (((uint64_t)1 << n) - 1));
+}
+
+static void bits_reader_test(void)
+{
+	enum { N = 4096 };
+	static uint8_t buf[N * 16];
+	static uint32_t v[N];
+	static int w[N];
+	bits_writer_t bw;
+	bits_reader_t br;
+	bits_t bits;
+	size_t pos;
+	int i, n, bytes;
+
+	// fields of 1..64 bits, also through bits_t
+	bits_writer_init(&bw, buf, sizeof(buf));
+	for (i = 0; i < N; i++)
+	{
+		w[i] = 1 + (int)(rand64() % 64);
+		v[i] = (uint32_t)rand64();
+		bits_writer_write_n(&bw, (uint64_t)v[i] << 32 | v[i], w[i]);
+	}
+	bytes = bits_writer_flush(&bw);
+	assert(bytes > 0 && (size_t)bytes == (bits_writer_tell(&bw) + 7) / 8);
+
+	bits_reader_init(&br, buf, bytes);
+	bits_init(&bits, buf, bytes);
+	for (i = 0, pos = 0; i < N; i++)
+	{
+		uint64_t mask = (uint64_t)-1 >> (64 - w[i]);
+		assert(bits_reader_tell(&br) == pos);
+		assert(bits_reader_read_n(&br, w[i]) == (((uint64_t)v[i] << 32 | v[i]) & mask));
+		assert(bits_read_n(&bits, w[i]) == (((uint64_t)v[i] << 32 | v[i]) & mask));
+		pos += w[i];
+	}
+	assert(0 == br.error && 0 == bits.error && bits_reader_remain(&br) < 8);
+
+	// Exp-Golomb, mixed with single bits
+	memset(buf, 0, sizeof(buf));
+	bits_writer_init(&bw, buf, sizeof(buf));
+	for (i = 0; i < N; i++)
+	{
+		v[i] = i < 4 ? 0xFFFFFFFE - i : rand_value();
+		bits_writer_write_ue(&bw, v[i]);
+		bits_writer_write_se(&bw, (int32_t)v[i]);
+		bits_writer_write(&bw, i & 1);
+	}
+	bytes = bits_writer_flush(&bw);
+	assert(bytes > 0);
+
+	bits_reader_init(&br, buf, bytes);
+	bits_init(&bits, buf, bytes);
+	for (i = 0; i < N; i++)
+	{
+		assert(v[i] == bits_reader_read_ue(&br));
+		assert((int32_t)v[i] == bits_reader_read_se(&br));
+		assert((i & 1) == bits_reader_read(&br));
+		if (v[i] < 0x3FFFFFFF) // bits_t decodes into int
+		{
+			assert((int)v[i] == bits_read_ue(&bits));
+			assert((int)v[i] == bits_read_se(&bits));
+			assert((i & 1) == bits_read(&bits));
+		}
+		else
+		{
+			bits.bits = bits_reader_tell(&br);
+		}
+	}
+	assert(0 == br.error && 0 == bits.error);
+
+	// skip and align, the tail, errors
+	bits_reader_init(&br, buf, bytes);
+	bits_reader_skip(&br, 13);
+	bits_reader_align(&br);
+	assert(16 == bits_reader_tell(&br));
+	bits_reader_skip(&br, (size_t)bytes * 8 - 16 - 3);
+	assert(3 == bits_reader_remain(&br));
+	bits_reader_read_n(&br, 3);
+	assert(0 == br.error && 0 == bits_reader_remain(&br));
+	assert(0 == bits_reader_read(&br) && br.error);
+
+	n = 0x0F; // 0000 1111: 4 zeros, then end
+	bits_reader_init(&br, &n, 1);
+	assert(0 == bits_reader_read_ue(&br) && br.error);
+	bits_reader_init(&br, buf, 4);
+	bits_reader_skip(&br, 33);
+	assert(br.error);
+
+	bits_writer_init(&bw, buf, 3);
+	bits_writer_write_n(&bw, 0xABCDEF, 24);
+	assert(3 == bits_writer_flush(&bw) && 0xAB == buf[0] && 0xEF == buf[2]);
+	bits_writer_write(&bw, 1);
+	assert(-1 == bits_writer_flush(&bw));
+
+	printf("bits_reader_test ok\n");
+}
+
+static double ms(clock_t start)
+{
+	return (double)(clock() - start) * 1000 / CLOCKS_PER_SEC;
+}
+
+// Exp-Golomb and fixed fields: bits_t against the cached reader
+static void bits_bench(void)
+{
+	enum { N = 1000000 };
+	size_t size = N * 9;
+	uint8_t* buf = calloc(1, size);
+	uint32_t* v = malloc(N * sizeof(uint32_t));
+	bits_writer_t bw;
+	bits_reader_t br;
+	bits_t bits;
+	uint64_t sum = 0;
+	clock_t start;
+	double t_ue, t_n, r_ue, r_n, w_ue;
+	int i;
+
+	for (i = 0; i < N; i++)
+		v[i] = rand_value() >> (8 + rand64() % 24); // mostly small
+	start = clock();
+	bits_writer_init(&bw, buf, size);
+	for (i = 0; i < N; i++)
+		bits_writer_write_ue(&bw, v[i]);
+	w_ue = ms(start);
+	size = (size_t)bits_writer_flush(&bw);
+
+	start = clock();
+	bits_init(&bits, buf, size);
+	for (i = 0; i < N; i++)
+		sum += bits_read_ue(&bits);
+	t_ue = ms(start);
+	start = clock();
+	bits_reader_init(&br, buf, size);
+	for (i = 0; i < N; i++)
+		sum -= bits_reader_read_ue(&br);
+	r_ue = ms(start);
+	assert(0 == sum && 0 == bits.error && 0 == br.error);
+
+	size = N * 9; // 12.5 bits a field
+	start = clock();
+	bits_init(&bits, buf, size);
+	for (i = 0; i < N; i++)
+		sum += bits_read_n(&bits, 1 + i % 24);
+	t_n = ms(start);
+	start = clock();
+	bits_reader_init(&br, buf, size);
+	for (i = 0; i < N; i++)
+		sum -= bits_reader_read_n(&br, 1 + i % 24);
+	r_n = ms(start);
+	assert(0 == sum && 0 == bits.error && 0 == br.error);
+
+	printf("%d ue: bits_t %.2fms, reader %.2fms, writer %.2fms\n", N, t_ue, r_ue, w_ue);
+	printf("%d 1..24 bit fields: bits_t %.2fms, reader %.2fms\n", N, t_n, r_n);
+	free(buf);
+	free(v);
+}
+
 int main(void)
 {
     bits_test();
     bits_test2();
+    bits_reader_test();
+    bits_bench();
     return 0;
 }
@@ -0,0 +1,977 @@
+/*
+ * bptree.c - cache-conscious B+tree
+ *
+ * Date   : 2021/04/30
+ */
+
+#include "bptree.h"
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BP_MIN (BPTREE_FANOUT / 2) // keys in a node other than the root
+#define BP_EMPTY UINT64_MAX        // unused key slots, never less than a key
+#define BP_MAX_DEPTH 24            // (BP_MIN+1)^24 keys is out of reach
+
+// byte-string key, shared by the leaf slot and the separators copied from it
+struct bp_blob {
+    unsigned int ref;
+    size_t len;
+    unsigned char data[1];
+};
+
+struct bptree_node {
+    uint64_t keys[BPTREE_FANOUT]; // key or key prefix, BP_EMPTY past n
+    int n;
+    int leaf;
+    struct bptree_node *prev, *next; // leaves only
+    void *ptrs[BPTREE_FANOUT + 1];   // children, values in a leaf
+    struct bp_blob *blobs[1];        // BPTREE_KEY_BYTES only, [BPTREE_FANOUT]
+};
+
+struct bptree {
+    int type;
+    int height;
+    size_t count;
+    size_t node_size;
+    bptree_node_t *root;
+    bptree_node_t *head, *tail; // leaf list
+};
+
+struct bp_key {
+    uint64_t prefix;
+    const unsigned char *data;
+    size_t len;
+};
+
+struct bp_path {
+    bptree_node_t *node;
+    int idx; // child taken
+};
+
+static inline uint64_t
+bp_prefix(const unsigned char *p, size_t len)
+{
+    uint64_t v = 0;
+    size_t i;
+
+    for (i = 0; i < 8; i++)
+        v = (v << 8) | (i < len ? p[i] : 0);
+    return v;
+}
+
+static inline void
+bp_key_u64(struct bp_key *k, uint64_t key)
+{
+    k->prefix = key;
+    k->data   = NULL;
+    k->len    = 0;
+}
+
+static inline void
+bp_key_bytes(struct bp_key *k, const void *key, size_t len)
+{
+    k->data   = (const unsigned char *)key;
+    k->len    = len;
+    k->prefix = bp_prefix(k->data, len);
+}
+
+static struct bp_blob *
+bp_blob_new(const struct bp_key *k)
+{
+    struct bp_blob *b;
+
+    b = (struct bp_blob *)malloc(offsetof(struct bp_blob, data) + k->len + 1);
+    if (!b)
+        return NULL;
+    b->ref = 1;
+    b->len = k->len;
+    memcpy(b->data, k->data, k->len);
+    return b;
+}
+
+static inline struct bp_blob *
+bp_blob_get(struct bp_blob *b)
+{
+    b->ref++;
+    return b;
+}
+
+static inline void
+bp_blob_put(struct bp_blob *b)
+{
+    if (b && 0 == --b->ref)
+        free(b);
+}
+
+static inline int
+bp_blob_cmp(const struct bp_blob *b, const struct bp_key *k)
+{
+    size_t n = b->len < k->len ? b->len : k->len;
+    int r    = memcmp(b->data, k->data, n);
+
+    if (r)
+        return r;
+    return b->len < k->len ? -1 : (b->len > k->len ? 1 : 0);
+}
+
+static inline int
+bp_key_cmp(const struct bp_key *a, const struct bp_key *b)
+{
+    size_t n;
+    int r;
+
+    if (a->prefix != b->prefix)
+        return a->prefix < b->prefix ? -1 : 1;
+    if (!a->data)
+        return 0;
+    n = a->len < b->len ? a->len : b->len;
+    r = memcmp(a->data, b->data, n);
+    if (r)
+        return r;
+    return a->len < b->len ? -1 : (a->len > b->len ? 1 : 0);
+}
+
+// fixed trip counts and no branch: the last key of each group of 8
+// picks the group, then the 8 keys of it, the compiler vectorizes both
+static inline int
+bp_count_less(const uint64_t *keys, uint64_t k)
+{
+    int i, g = 0, c = 0;
+
+    for (i = 7; i < BPTREE_FANOUT - 1; i += 8)
+        g += keys[i] < k;
+    keys += g * 8;
+    for (i = 0; i < 8; i++)
+        c += keys[i] < k;
+    return g * 8 + c;
+}
+
+static inline int
+bp_count_lesseq(const uint64_t *keys, uint64_t k)
+{
+    int i, c = 0;
+
+    for (i = 0; i < BPTREE_FANOUT; i++)
+        c += keys[i] <= k;
+    return c;
+}
+
+// first slot with a key >= k, or > k if upper
+static int
+bp_search(const bptree_t *tree, const bptree_node_t *node,
+          const struct bp_key *k, int upper)
+{
+    int lo, hi, mid, r;
+
+    lo = bp_count_less(node->keys, k->prefix);
+    if (BPTREE_KEY_U64 == tree->type)
+        return lo + (upper && lo < node->n && node->keys[lo] == k->prefix);
+
+    // the full keys decide between the slots with the same prefix
+    hi = bp_count_lesseq(node->keys, k->prefix);
+    if (hi > node->n)
+        hi = node->n;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        r   = bp_blob_cmp(node->blobs[mid], k);
+        if (r < 0 || (upper && 0 == r))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static inline int
+bp_equal(const bptree_t *tree, const bptree_node_t *node, int i,
+         const struct bp_key *k)
+{
+    if (i >= node->n || node->keys[i] != k->prefix)
+        return 0;
+    return BPTREE_KEY_U64 == tree->type || 0 == bp_blob_cmp(node->blobs[i], k);
+}
+
+static bptree_node_t *
+bp_node_new(bptree_t *tree, int leaf)
+{
+    bptree_node_t *node;
+    int i;
+
+    node = (bptree_node_t *)aligned_alloc(64, tree->node_size);
+    if (!node)
+        return NULL;
+    for (i = 0; i < BPTREE_FANOUT; i++)
+        node->keys[i] = BP_EMPTY;
+    node->n    = 0;
+    node->leaf = leaf;
+    node->prev = NULL;
+    node->next = NULL;
+    return node;
+}
+
+static void
+bp_node_free(bptree_t *tree, bptree_node_t *node)
+{
+    int i;
+
+    if (!node->leaf) {
+        for (i = 0; i <= node->n; i++)
+            bp_node_free(tree, (bptree_node_t *)node->ptrs[i]);
+    }
+    if (BPTREE_KEY_BYTES == tree->type) {
+        for (i = 0; i < node->n; i++)
+            bp_blob_put(node->blobs[i]);
+    }
+    free(node);
+}
+
+// make room for key i, and ptr i (leaf, off 0) or i+1 (inner, off 1)
+static void
+bp_open(bptree_t *tree, bptree_node_t *node, int i, int off)
+{
+    int n = node->n - i;
+
+    memmove(&node->keys[i + 1], &node->keys[i], n * sizeof(node->keys[0]));
+    memmove(&node->ptrs[i + 1 + off], &node->ptrs[i + off],
+            n * sizeof(node->ptrs[0]));
+    if (BPTREE_KEY_BYTES == tree->type)
+        memmove(&node->blobs[i + 1], &node->blobs[i],
+                n * sizeof(node->blobs[0]));
+    node->n++;
+}
+
+// drop key i and its ptr, the blob isn't released
+static void
+bp_close(bptree_t *tree, bptree_node_t *node, int i, int off)
+{
+    int n = node->n - i - 1;
+
+    memmove(&node->keys[i], &node->keys[i + 1], n * sizeof(node->keys[0]));
+    memmove(&node->ptrs[i + off], &node->ptrs[i + 1 + off],
+            n * sizeof(node->ptrs[0]));
+    if (BPTREE_KEY_BYTES == tree->type)
+        memmove(&node->blobs[i], &node->blobs[i + 1],
+                n * sizeof(node->blobs[0]));
+    node->n--;
+    node->keys[node->n] = BP_EMPTY;
+}
+
+static inline void
+bp_set_key(bptree_t *tree, bptree_node_t *node, int i, uint64_t prefix,
+           struct bp_blob *blob)
+{
+    node->keys[i] = prefix;
+    if (BPTREE_KEY_BYTES == tree->type)
+        node->blobs[i] = blob;
+}
+
+// move count slots of src from i to dst at j, ptrs aligned with the keys
+static void
+bp_move(bptree_t *tree, bptree_node_t *dst, int j, bptree_node_t *src, int i,
+        int count)
+{
+    memcpy(&dst->keys[j], &src->keys[i], count * sizeof(src->keys[0]));
+    memcpy(&dst->ptrs[j], &src->ptrs[i], count * sizeof(src->ptrs[0]));
+    if (BPTREE_KEY_BYTES == tree->type)
+        memcpy(&dst->blobs[j], &src->blobs[i], count * sizeof(src->blobs[0]));
+}
+
+static void
+bp_link_after(bptree_t *tree, bptree_node_t *node, bptree_node_t *right)
+{
+    right->prev = node;
+    right->next = node->next;
+    if (node->next)
+        node->next->prev = right;
+    else
+        tree->tail = right;
+    node->next = right;
+}
+
+// upper half of a full leaf to right
+static void
+bp_split_leaf(bptree_t *tree, bptree_node_t *node, bptree_node_t *right)
+{
+    int h = BPTREE_FANOUT / 2, i;
+
+    bp_move(tree, right, 0, node, h, node->n - h);
+    right->n = node->n - h;
+    for (i = h; i < node->n; i++)
+        node->keys[i] = BP_EMPTY;
+    node->n = h;
+    bp_link_after(tree, node, right);
+}
+
+// insert (*prefix, *blob) at i and child at i+1 into a full inner node,
+// the upper half goes to right, the middle key is returned in prefix/blob
+static void
+bp_split_inner(bptree_t *tree, bptree_node_t *node, bptree_node_t *right,
+               int i, uint64_t *prefix, struct bp_blob **blob, void *child)
+{
+    uint64_t keys[BPTREE_FANOUT + 1];
+    struct bp_blob *blobs[BPTREE_FANOUT + 1];
+    void *ptrs[BPTREE_FANOUT + 2];
+    int j, mid = (BPTREE_FANOUT + 1) / 2, bytes;
+
+    bytes = BPTREE_KEY_BYTES == tree->type;
+    for (j = 0; j <= BPTREE_FANOUT; j++) {
+        keys[j]  = j < i ? node->keys[j] : (j == i ? *prefix : node->keys[j - 1]);
+        blobs[j] = !bytes ? NULL
+                          : (j < i ? node->blobs[j]
+                                   : (j == i ? *blob : node->blobs[j - 1]));
+    }
+    for (j = 0; j <= BPTREE_FANOUT + 1; j++)
+        ptrs[j] = j <= i ? node->ptrs[j]
+                         : (j == i + 1 ? child : node->ptrs[j - 1]);
+
+    for (j = 0; j < BPTREE_FANOUT; j++) {
+        node->keys[j] = j < mid ? keys[j] : BP_EMPTY;
+        if (bytes && j < mid)
+            node->blobs[j] = blobs[j];
+    }
+    memcpy(node->ptrs, ptrs, (mid + 1) * sizeof(ptrs[0]));
+    node->n = mid;
+
+    right->n = BPTREE_FANOUT - mid;
+    memcpy(right->keys, keys + mid + 1, right->n * sizeof(keys[0]));
+    memcpy(right->ptrs, ptrs + mid + 1, (right->n + 1) * sizeof(ptrs[0]));
+    if (bytes)
+        memcpy(right->blobs, blobs + mid + 1, right->n * sizeof(blobs[0]));
+
+    *prefix = keys[mid];
+    *blob   = blobs[mid];
+}
+
+static bptree_node_t *
+bp_descend(const bptree_t *tree, const struct bp_key *k, struct bp_path *path,
+           int *depth)
+{
+    bptree_node_t *node = tree->root;
+    int i, d = 0;
+
+    while (!node->leaf) {
+        i = bp_search(tree, node, k, 1);
+        if (path) {
+            path[d].node = node;
+            path[d].idx  = i;
+        }
+        d++;
+        node = (bptree_node_t *)node->ptrs[i];
+    }
+    if (depth)
+        *depth = d;
+    return node;
+}
+
+static int
+bp_insert(bptree_t *tree, const struct bp_key *k, void *value, void **exist)
+{
+    struct bp_path path[BP_MAX_DEPTH];
+    bptree_node_t *spare[BP_MAX_DEPTH + 1], *node, *right, *parent;
+    struct bp_blob *blob = NULL;
+    uint64_t prefix;
+    int i, depth, level, need, used, h;
+
+    if (!tree->root) {
+        if (!(tree->root = bp_node_new(tree, 1)))
+            return -ENOMEM;
+        tree->head = tree->tail = tree->root;
+        tree->height = 1;
+    }
+
+    node = bp_descend(tree, k, path, &depth);
+    i    = bp_search(tree, node, k, 0);
+    if (bp_equal(tree, node, i, k)) {
+        if (exist)
+            *exist = node->ptrs[i];
+        return -EEXIST;
+    }
+
+    if (BPTREE_KEY_BYTES == tree->type && !(blob = bp_blob_new(k)))
+        return -ENOMEM;
+
+    if (node->n < BPTREE_FANOUT) {
+        bp_open(tree, node, i, 0);
+        bp_set_key(tree, node, i, k->prefix, blob);
+        node->ptrs[i] = value;
+        tree->count++;
+        return 0;
+    }
+
+    // every full node on the path splits, allocate them first so that a
+    // failure leaves the tree as it was
+    need = 1;
+    for (level = depth - 1; level >= 0 && BPTREE_FANOUT == path[level].node->n;
+         level--)
+        need++;
+    if (level < 0)
+        need++; // new root
+    for (h = 0; h < need; h++) {
+        if (!(spare[h] = bp_node_new(tree, 0 == h))) {
+            while (h-- > 0)
+                free(spare[h]);
+            bp_blob_put(blob);
+            return -ENOMEM;
+        }
+    }
+
+    used  = 0;
+    right = spare[used++]; // the leaf
+    bp_split_leaf(tree, node, right);
+    if (i <= node->n) {
+        bp_open(tree, node, i, 0);
+        bp_set_key(tree, node, i, k->prefix, blob);
+        node->ptrs[i] = value;
+    } else {
+        i -= node->n;
+        bp_open(tree, right, i, 0);
+        bp_set_key(tree, right, i, k->prefix, blob);
+        right->ptrs[i] = value;
+    }
+    tree->count++;
+
+    // separator: the first key of the right leaf
+    prefix = right->keys[0];
+    blob   = BPTREE_KEY_BYTES == tree->type ? bp_blob_get(right->blobs[0]) : NULL;
+    for (level = depth - 1; level >= 0; level--) {
+        parent = path[level].node;
+        i      = path[level].idx;
+        if (parent->n < BPTREE_FANOUT) {
+            bp_open(tree, parent, i, 1);
+            bp_set_key(tree, parent, i, prefix, blob);
+            parent->ptrs[i + 1] = right;
+            return 0;
+        }
+        node = spare[used++];
+        bp_split_inner(tree, parent, node, i, &prefix, &blob, right);
+        right = node;
+    }
+
+    node = spare[used++];
+    bp_set_key(tree, node, 0, prefix, blob);
+    node->ptrs[0] = tree->root;
+    node->ptrs[1] = right;
+    node->n       = 1;
+    tree->root    = node;
+    tree->height++;
+    return 0;
+}
+
+// separator i of parent takes the key of node slot j
+static void
+bp_set_sep(bptree_t *tree, bptree_node_t *parent, int i, bptree_node_t *node,
+           int j)
+{
+    parent->keys[i] = node->keys[j];
+    if (BPTREE_KEY_BYTES == tree->type) {
+        bp_blob_put(parent->blobs[i]);
+        parent->blobs[i] = bp_blob_get(node->blobs[j]);
+    }
+}
+
+static void
+bp_borrow_left(bptree_t *tree, bptree_node_t *parent, int ci,
+               bptree_node_t *left, bptree_node_t *node)
+{
+    int n = node->n;
+
+    if (node->leaf) {
+        bp_open(tree, node, 0, 0);
+        bp_move(tree, node, 0, left, left->n - 1, 1);
+        bp_close(tree, left, left->n - 1, 0);
+        bp_set_sep(tree, parent, ci - 1, node, 0);
+        return;
+    }
+
+    // rotate through the separator
+    memmove(&node->keys[1], &node->keys[0], n * sizeof(node->keys[0]));
+    memmove(&node->ptrs[1], &node->ptrs[0], (n + 1) * sizeof(node->ptrs[0]));
+    if (BPTREE_KEY_BYTES == tree->type)
+        memmove(&node->blobs[1], &node->blobs[0], n * sizeof(node->blobs[0]));
+    bp_set_key(tree, node, 0, parent->keys[ci - 1],
+               BPTREE_KEY_BYTES == tree->type ? parent->blobs[ci - 1] : NULL);
+    node->ptrs[0] = left->ptrs[left->n];
+    node->n++;
+
+    bp_set_key(tree, parent, ci - 1, left->keys[left->n - 1],
+               BPTREE_KEY_BYTES == tree->type ? left->blobs[left->n - 1]
+                                              : NULL);
+    left->n--;
+    left->keys[left->n] = BP_EMPTY;
+}
+
+static void
+bp_borrow_right(bptree_t *tree, bptree_node_t *parent, int ci,
+                bptree_node_t *node, bptree_node_t *right)
+{
+    int n = node->n;
+
+    if (node->leaf) {
+        bp_move(tree, node, n, right, 0, 1);
+        node->n++;
+        bp_close(tree, right, 0, 0);
+        bp_set_sep(tree, parent, ci, right, 0);
+        return;
+    }
+
+    bp_set_key(tree, node, n, parent->keys[ci],
+               BPTREE_KEY_BYTES == tree->type ? parent->blobs[ci] : NULL);
+    node->ptrs[n + 1] = right->ptrs[0];
+    node->n++;
+
+    bp_set_key(tree, parent, ci, right->keys[0],
+               BPTREE_KEY_BYTES == tree->type ? right->blobs[0] : NULL);
+    n = right->n;
+    memmove(&right->keys[0], &right->keys[1], (n - 1) * sizeof(right->keys[0]));
+    memmove(&right->ptrs[0], &right->ptrs[1], n * sizeof(right->ptrs[0]));
+    if (BPTREE_KEY_BYTES == tree->type)
+        memmove(&right->blobs[0], &right->blobs[1],
+                (n - 1) * sizeof(right->blobs[0]));
+    right->n--;
+    right->keys[right->n] = BP_EMPTY;
+}
+
+// b (child s+1 of parent) into a (child s)
+static void
+bp_merge(bptree_t *tree, bptree_node_t *parent, int s, bptree_node_t *a,
+         bptree_node_t *b)
+{
+    if (a->leaf) {
+        bp_move(tree, a, a->n, b, 0, b->n);
+        a->n += b->n;
+        a->next = b->next;
+        if (b->next)
+            b->next->prev = a;
+        else
+            tree->tail = a;
+        if (BPTREE_KEY_BYTES == tree->type)
+            bp_blob_put(parent->blobs[s]);
+    } else {
+        bp_set_key(tree, a, a->n, parent->keys[s],
+                   BPTREE_KEY_BYTES == tree->type ? parent->blobs[s] : NULL);
+        bp_move(tree, a, a->n + 1, b, 0, b->n);
+        a->ptrs[a->n + 1 + b->n] = b->ptrs[b->n];
+        a->n += b->n + 1;
+    }
+    bp_close(tree, parent, s, 1);
+    free(b);
+}
+
+static void
+bp_rebalance(bptree_t *tree, struct bp_path *path, int depth,
+             bptree_node_t *node)
+{
+    bptree_node_t *parent, *left, *right;
+    int ci;
+
+    for (; depth > 0; depth--, node = parent) {
+        if (node->n >= BP_MIN)
+            return;
+
+        parent = path[depth - 1].node;
+        ci     = path[depth - 1].idx;
+        left   = ci > 0 ? (bptree_node_t *)parent->ptrs[ci - 1] : NULL;
+        right  = ci < parent->n ? (bptree_node_t *)parent->ptrs[ci + 1] : NULL;
+
+        if (left && left->n > BP_MIN) {
+            bp_borrow_left(tree, parent, ci, left, node);
+            return;
+        }
+        if (right && right->n > BP_MIN) {
+            bp_borrow_right(tree, parent, ci, node, right);
+            return;
+        }
+        if (left)
+            bp_merge(tree, parent, ci - 1, left, node);
+        else
+            bp_merge(tree, parent, ci, node, right);
+    }
+
+    // root
+    if (node->n > 0)
+        return;
+    if (node->leaf) {
+        tree->root = tree->head = tree->tail = NULL;
+        tree->height = 0;
+    } else {
+        tree->root = (bptree_node_t *)node->ptrs[0];
+        tree->height--;
+    }
+    free(node);
+}
+
+static void *
+bp_delete(bptree_t *tree, const struct bp_key *k)
+{
+    struct bp_path path[BP_MAX_DEPTH];
+    bptree_node_t *node;
+    void *value;
+    int i, depth;
+
+    if (!tree->root)
+        return NULL;
+
+    node = bp_descend(tree, k, path, &depth);
+    i    = bp_search(tree, node, k, 0);
+    if (!bp_equal(tree, node, i, k))
+        return NULL;
+
+    value = node->ptrs[i];
+    if (BPTREE_KEY_BYTES == tree->type)
+        bp_blob_put(node->blobs[i]); // separators may still hold it
+    bp_close(tree, node, i, 0);
+    tree->count--;
+
+    bp_rebalance(tree, path, depth, node);
+    return value;
+}
+
+static void *
+bp_find(bptree_t *tree, const struct bp_key *k)
+{
+    bptree_node_t *node;
+    int i;
+
+    if (!tree->root)
+        return NULL;
+    node = bp_descend(tree, k, NULL, NULL);
+    i    = bp_search(tree, node, k, 0);
+    return bp_equal(tree, node, i, k) ? node->ptrs[i] : NULL;
+}
+
+static int
+bp_seek(bptree_t *tree, const struct bp_key *k, bptree_iter_t *it)
+{
+    if (!tree->root) {
+        it->node = NULL;
+        return 0;
+    }
+    it->node = bp_descend(tree, k, NULL, NULL);
+    it->pos  = bp_search(tree, it->node, k, 0);
+    if (it->pos >= it->node->n) {
+        it->node = it->node->next; // greater than the keys of the leaf
+        it->pos  = 0;
+    }
+    return NULL != it->node;
+}
+
+//------------------------------------------------------------------------
+
+struct bp_source {
+    const uint64_t *u64;
+    const void *const *keys;
+    const size_t *lens;
+    void *const *values;
+};
+
+static inline void
+bp_source_key(const struct bp_source *src, size_t i, struct bp_key *k)
+{
+    if (src->u64)
+        bp_key_u64(k, src->u64[i]);
+    else
+        bp_key_bytes(k, src->keys[i], src->lens[i]);
+}
+
+// n items into count nodes, as even as possible
+static inline size_t
+bp_share(size_t n, size_t count, size_t i)
+{
+    return n / count + (i < n % count);
+}
+
+static int
+bp_bulk_load(bptree_t *tree, const struct bp_source *src, size_t n)
+{
+    bptree_node_t **level = NULL, **upper, *node, *prev = NULL;
+    struct bp_blob *blob;
+    struct bp_key k, last;
+    size_t count, nodes, i, j, m, c;
+
+    if (tree->root)
+        return -EINVAL;
+    for (i = 1; i < n; i++) {
+        bp_source_key(src, i - 1, &last);
+        bp_source_key(src, i, &k);
+        if (bp_key_cmp(&last, &k) >= 0)
+            return -EINVAL;
+    }
+    if (0 == n)
+        return 0;
+
+    // leaves, nearly full
+    nodes = (n + BPTREE_FANOUT - 1) / BPTREE_FANOUT;
+    level = (bptree_node_t **)calloc(nodes, sizeof(level[0]));
+    if (!level)
+        return -ENOMEM;
+    count = nodes;
+    for (i = j = 0; i < nodes; i++) {
+        if (!(node = bp_node_new(tree, 1)))
+            goto fail;
+        level[i] = node;
+        for (m = bp_share(n, nodes, i); node->n < (int)m; node->n++, j++) {
+            bp_source_key(src, j, &k);
+            blob = NULL;
+            if (!src->u64 && !(blob = bp_blob_new(&k)))
+                goto fail;
+            bp_set_key(tree, node, node->n, k.prefix, blob);
+            node->ptrs[node->n] = src->values ? src->values[j] : NULL;
+        }
+        node->prev = prev;
+        if (prev)
+            prev->next = node;
+        prev = node;
+    }
+    tree->head   = level[0];
+    tree->tail   = level[nodes - 1];
+    tree->height = 1;
+
+    // each inner node takes the first keys of its children but the first,
+    // the first key of a subtree is that of its leftmost leaf
+    while (count > 1) {
+        nodes = (count + BPTREE_FANOUT) / (BPTREE_FANOUT + 1);
+        upper = (bptree_node_t **)calloc(nodes, sizeof(upper[0]));
+        if (!upper)
+            goto fail;
+        for (i = j = 0; i < nodes; i++) {
+            if (!(node = bp_node_new(tree, 0))) {
+                while (i-- > 0)
+                    free(upper[i]);
+                free(upper);
+                goto fail;
+            }
+            upper[i] = node;
+            for (m = bp_share(count, nodes, i), c = 0; c < m; c++, j++) {
+                node->ptrs[c] = level[j];
+                if (c > 0) {
+                    bptree_node_t *leaf = level[j];
+                    while (!leaf->leaf)
+                        leaf = (bptree_node_t *)leaf->ptrs[0];
+                    bp_set_key(tree, node, (int)c - 1, leaf->keys[0],
+                               src->u64 ? NULL : bp_blob_get(leaf->blobs[0]));
+                }
+            }
+            node->n = (int)m - 1;
+        }
+        free(level);
+        level = upper;
+        count = nodes;
+        tree->height++;
+    }
+
+    tree->root  = level[0];
+    tree->count = n;
+    free(level);
+    return 0;
+
+fail:
+    // level holds whole subtrees
+    for (i = 0; i < count && level[i]; i++)
+        bp_node_free(tree, level[i]);
+    free(level);
+    tree->head = tree->tail = NULL;
+    tree->height = 0;
+    return -ENOMEM;
+}
+
+//------------------------------------------------------------------------
+
+bptree_t *
+bptree_create(int type)
+{
+    bptree_t *tree;
+    size_t size;
+
+    if (BPTREE_KEY_U64 != type && BPTREE_KEY_BYTES != type)
+        return NULL;
+
+    tree = (bptree_t *)calloc(1, sizeof(*tree));
+    if (!tree)
+        return NULL;
+    tree->type = type;
+
+    size = offsetof(struct bptree_node, blobs);
+    if (BPTREE_KEY_BYTES == type)
+        size += BPTREE_FANOUT * sizeof(struct bp_blob *);
+    tree->node_size = (size + 63) & ~(size_t)63;
+    return tree;
+}
+
+void
+bptree_destroy(bptree_t *tree)
+{
+    if (tree->root)
+        bp_node_free(tree, tree->root);
+    free(tree);
+}
+
+size_t
+bptree_count(bptree_t *tree)
+{
+    return tree->count;
+}
+
+int
+bptree_height(bptree_t *tree)
+{
+    return tree->height;
+}
+
+int
+bptree_insert_u64(bptree_t *tree, uint64_t key, void *value, void **exist)
+{
+    struct bp_key k;
+
+    bp_key_u64(&k, key);
+    return bp_insert(tree, &k, value, exist);
+}
+
+void *
+bptree_find_u64(bptree_t *tree, uint64_t key)
+{
+    struct bp_key k;
+
+    bp_key_u64(&k, key);
+    return bp_find(tree, &k);
+}
+
+void *
+bptree_delete_u64(bptree_t *tree, uint64_t key)
+{
+    struct bp_key k;
+
+    bp_key_u64(&k, key);
+    return bp_delete(tree, &k);
+}
+
+int
+bptree_seek_u64(bptree_t *tree, uint64_t key, bptree_iter_t *it)
+{
+    struct bp_key k;
+
+    bp_key_u64(&k, key);
+    return bp_seek(tree, &k, it);
+}
+
+int
+bptree_insert(bptree_t *tree, const void *key, size_t len, void *value,
+              void **exist)
+{
+    struct bp_key k;
+
+    bp_key_bytes(&k, key, len);
+    return bp_insert(tree, &k, value, exist);
+}
+
+void *
+bptree_find(bptree_t *tree, const void *key, size_t len)
+{
+    struct bp_key k;
+
+    bp_key_bytes(&k, key, len);
+    return bp_find(tree, &k);
+}
+
+void *
+bptree_delete(bptree_t *tree, const void *key, size_t len)
+{
+    struct bp_key k;
+
+    bp_key_bytes(&k, key, len);
+    return bp_delete(tree, &k);
+}
+
+int
+bptree_seek(bptree_t *tree, const void *key, size_t len, bptree_iter_t *it)
+{
+    struct bp_key k;
+
+    bp_key_bytes(&k, key, len);
+    return bp_seek(tree, &k, it);
+}
+
+int
+bptree_bulk_load_u64(bptree_t *tree, const uint64_t *keys, void *const *values,
+                     size_t n)
+{
+    struct bp_source src = {keys, NULL, NULL, values};
+
+    if (BPTREE_KEY_U64 != tree->type)
+        return -EINVAL;
+    return bp_bulk_load(tree, &src, n);
+}
+
+int
+bptree_bulk_load(bptree_t *tree, const void *const *keys, const size_t *lens,
+                 void *const *values, size_t n)
+{
+    struct bp_source src = {NULL, keys, lens, values};
+
+    if (BPTREE_KEY_BYTES != tree->type)
+        return -EINVAL;
+    return bp_bulk_load(tree, &src, n);
+}
+
+int
+bptree_first(bptree_t *tree, bptree_iter_t *it)
+{
+    it->node = tree->head;
+    it->pos  = 0;
+    return NULL != it->node;
+}
+
+int
+bptree_last(bptree_t *tree, bptree_iter_t *it)
+{
+    it->node = tree->tail;
+    it->pos  = it->node ? it->node->n - 1 : 0;
+    return NULL != it->node;
+}
+
+int
+bptree_next(bptree_iter_t *it)
+{
+    if (!it->node)
+        return 0;
+    if (++it->pos >= it->node->n) {
+        it->node = it->node->next;
+        it->pos  = 0;
+    }
+    return NULL != it->node;
+}
+
+int
+bptree_prev(bptree_iter_t *it)
+{
+    if (!it->node)
+        return 0;
+    if (--it->pos < 0) {
+        it->node = it->node->prev;
+        it->pos  = it->node ? it->node->n - 1 : 0;
+    }
+    return NULL != it->node;
+}
+
+uint64_t
+bptree_iter_u64(const bptree_iter_t *it)
+{
+    return it->node->keys[it->pos];
+}
+
+const void *
+bptree_iter_key(const bptree_iter_t *it, size_t *len)
+{
+    const struct bp_blob *b = it->node->blobs[it->pos];
+
+    if (len)
+        *len = b->len;
+    return b->data;
+}
+
+void *
+bptree_iter_value(const bptree_iter_t *it)
+{
+    return it->node->ptrs[it->pos];
+}
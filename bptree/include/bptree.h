@@ -0,0 +1,88 @@
+/*
+ * bptree.h - cache-conscious B+tree
+ *
+ * Date   : 2021/04/30
+ */
+#ifndef __BPTREE_H__
+#define __BPTREE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// keys per node, a multiple of 8. A node is searched without branches,
+/// one key per 8 then the 8 keys of a group (4 cache lines of keys at 32)
+#ifndef BPTREE_FANOUT
+#define BPTREE_FANOUT 32
+#endif
+
+enum {
+    BPTREE_KEY_U64,   // uint64_t keys, stored in the nodes
+    BPTREE_KEY_BYTES, // byte strings, copied, ordered as memcmp then length
+};
+
+typedef struct bptree bptree_t;
+typedef struct bptree_node bptree_node_t;
+
+/*
+ * Byte-string keys keep their first 8 bytes (big-endian) in the same
+ * 64-bit slots as integer keys, the full key is only compared when the
+ * prefixes are equal.
+ * Leaves are linked both ways for range scans. An iterator is valid
+ * until the next insert/delete.
+ */
+typedef struct bptree_iter {
+    bptree_node_t *node; // leaf, NULL at the end
+    int pos;
+} bptree_iter_t;
+
+/// @param type BPTREE_KEY_U64 or BPTREE_KEY_BYTES
+bptree_t *bptree_create(int type);
+/// values aren't freed
+void bptree_destroy(bptree_t *tree);
+size_t bptree_count(bptree_t *tree);
+int bptree_height(bptree_t *tree);
+
+/// @param exist optional, the value already stored for the key
+/// @return 0-ok, -EEXIST, -ENOMEM
+int bptree_insert_u64(bptree_t *tree, uint64_t key, void *value, void **exist);
+/// @return the value, NULL if not found
+void *bptree_find_u64(bptree_t *tree, uint64_t key);
+/// @return the value removed, NULL if not found
+void *bptree_delete_u64(bptree_t *tree, uint64_t key);
+/// first key >= key
+/// @return 1 if the iterator points at a key, 0 at end
+int bptree_seek_u64(bptree_t *tree, uint64_t key, bptree_iter_t *it);
+
+int bptree_insert(bptree_t *tree, const void *key, size_t len, void *value,
+                  void **exist);
+void *bptree_find(bptree_t *tree, const void *key, size_t len);
+void *bptree_delete(bptree_t *tree, const void *key, size_t len);
+int bptree_seek(bptree_t *tree, const void *key, size_t len,
+                bptree_iter_t *it);
+
+/// build from strictly ascending keys into an empty tree, leaves full.
+/// O(n), no search, no split
+/// @return 0-ok, -EINVAL if not empty or not sorted, -ENOMEM
+int bptree_bulk_load_u64(bptree_t *tree, const uint64_t *keys,
+                         void *const *values, size_t n);
+int bptree_bulk_load(bptree_t *tree, const void *const *keys,
+                     const size_t *lens, void *const *values, size_t n);
+
+/// @return 1 if the iterator points at a key, 0 at end/empty
+int bptree_first(bptree_t *tree, bptree_iter_t *it);
+int bptree_last(bptree_t *tree, bptree_iter_t *it);
+int bptree_next(bptree_iter_t *it);
+int bptree_prev(bptree_iter_t *it);
+
+uint64_t bptree_iter_u64(const bptree_iter_t *it);
+const void *bptree_iter_key(const bptree_iter_t *it, size_t *len);
+void *bptree_iter_value(const bptree_iter_t *it);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
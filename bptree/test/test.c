@@ -0,0 +1,448 @@
+/*
+ * test.c - test
+ *
+ * Date   : 2021/04/30
+ */
+
+#include "bptree.h"
+#include "avl_node.h"
+#include "rbtree.h"
+#include "system.h"
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KEYS 20000
+#define BENCH_N 1000000
+#define SCAN_N 1000 // scans of 100 keys
+
+static uint64_t s_seed = 88172645463325252ULL;
+
+static uint64_t rand64(void)
+{
+    s_seed ^= s_seed << 13;
+    s_seed ^= s_seed >> 7;
+    s_seed ^= s_seed << 17;
+    return s_seed;
+}
+
+#define VALUE(k) ((void *)(uintptr_t)((k) + 1))
+
+// the tree holds exactly the keys set in ref, in order, both ways
+static void bptree_check_u64(bptree_t *tree, const char *ref, int n)
+{
+    bptree_iter_t it;
+    int i, count = 0, ok;
+
+    ok = bptree_first(tree, &it);
+    for (i = 0; i < n; i++) {
+        if (!ref[i])
+            continue;
+        assert(ok && (uint64_t)i == bptree_iter_u64(&it));
+        assert(VALUE(i) == bptree_iter_value(&it));
+        ok = bptree_next(&it);
+        count++;
+    }
+    assert(!ok && (size_t)count == bptree_count(tree));
+
+    ok = bptree_last(tree, &it);
+    for (i = n - 1; i >= 0; i--) {
+        if (!ref[i])
+            continue;
+        assert(ok && (uint64_t)i == bptree_iter_u64(&it));
+        ok = bptree_prev(&it);
+    }
+    assert(!ok);
+}
+
+static void bptree_u64_test(void)
+{
+    bptree_t *tree;
+    bptree_iter_t it;
+    char *ref;
+    void *exist;
+    int i, k, r;
+
+    tree = bptree_create(BPTREE_KEY_U64);
+    ref  = (char *)calloc(KEYS, 1);
+    assert(tree && 0 == bptree_first(tree, &it));
+    assert(NULL == bptree_find_u64(tree, 1) && 0 == bptree_height(tree));
+
+    // random inserts and deletes, the tree grows, shrinks and grows again
+    for (i = 0; i < 40 * KEYS; i++) {
+        k = (int)(rand64() % KEYS);
+        if ((i / (4 * KEYS)) % 2 == 0 ? rand64() % 4 != 0 : rand64() % 4 == 0) {
+            r = bptree_insert_u64(tree, k, VALUE(k), &exist);
+            assert(ref[k] ? -EEXIST == r && VALUE(k) == exist : 0 == r);
+            ref[k] = 1;
+        } else {
+            assert((ref[k] ? VALUE(k) : NULL) == bptree_delete_u64(tree, k));
+            ref[k] = 0;
+        }
+        if (0 == i % (2 * KEYS))
+            bptree_check_u64(tree, ref, KEYS);
+    }
+    bptree_check_u64(tree, ref, KEYS);
+
+    for (k = 0; k < KEYS; k++) {
+        assert((ref[k] ? VALUE(k) : NULL) == bptree_find_u64(tree, k));
+        // lower bound
+        for (i = k; i < KEYS && !ref[i]; i++) {
+        }
+        r = bptree_seek_u64(tree, k, &it);
+        assert(i < KEYS ? r && (uint64_t)i == bptree_iter_u64(&it) : !r);
+    }
+
+    // down to empty, the root collapses on the way
+    for (k = 0; k < KEYS; k++) {
+        if (ref[k])
+            assert(VALUE(k) == bptree_delete_u64(tree, k));
+    }
+    assert(0 == bptree_count(tree) && 0 == bptree_height(tree));
+    assert(0 == bptree_first(tree, &it) && 0 == bptree_seek_u64(tree, 0, &it));
+
+    // extremes, UINT64_MAX is also the empty slot marker
+    assert(0 == bptree_insert_u64(tree, UINT64_MAX, VALUE(1), NULL));
+    assert(0 == bptree_insert_u64(tree, 0, VALUE(0), NULL));
+    assert(VALUE(1) == bptree_find_u64(tree, UINT64_MAX));
+    assert(1 == bptree_seek_u64(tree, 1, &it));
+    assert(UINT64_MAX == bptree_iter_u64(&it));
+
+    bptree_destroy(tree);
+    free(ref);
+}
+
+static int keycmp(const void *a, const void *b)
+{
+    const char *x = *(const char *const *)a, *y = *(const char *const *)b;
+    return strcmp(x, y);
+}
+
+// strings sharing an 8 byte prefix, and some shorter ones
+static char **make_strings(int n)
+{
+    char **keys;
+    int i;
+
+    keys = (char **)malloc(n * sizeof(keys[0]));
+    for (i = 0; i < n; i++) {
+        keys[i] = (char *)malloc(32);
+        if (i % 4)
+            snprintf(keys[i], 32, "https://%d", (int)(rand64() % 1000000000));
+        else
+            snprintf(keys[i], 32, "%x", (unsigned int)(rand64() % 100000000));
+    }
+    qsort(keys, n, sizeof(keys[0]), keycmp);
+    for (i = 1; i < n; i++) { // unique
+        if (0 == strcmp(keys[i - 1], keys[i]))
+            snprintf(keys[i], 32, "%s!", keys[i - 1]);
+    }
+    qsort(keys, n, sizeof(keys[0]), keycmp);
+    return keys;
+}
+
+static void bptree_bytes_test(void)
+{
+    bptree_t *tree;
+    bptree_iter_t it;
+    char **keys, *ref;
+    const void *key;
+    size_t len;
+    int i, j, ok;
+
+    keys = make_strings(KEYS);
+    ref  = (char *)calloc(KEYS, 1);
+    tree = bptree_create(BPTREE_KEY_BYTES);
+
+    // insert in random order, remove every third
+    for (i = 0; i < 4 * KEYS; i++) {
+        j = (int)(rand64() % KEYS);
+        bptree_insert(tree, keys[j], strlen(keys[j]), VALUE(j), NULL);
+        ref[j] = 1;
+    }
+    for (j = 0; j < KEYS; j += 3) {
+        assert((ref[j] ? VALUE(j) : NULL)
+               == bptree_delete(tree, keys[j], strlen(keys[j])));
+        ref[j] = 0;
+    }
+
+    ok = bptree_first(tree, &it);
+    for (j = 0; j < KEYS; j++) {
+        if (!ref[j]) {
+            assert(NULL == bptree_find(tree, keys[j], strlen(keys[j])));
+            continue;
+        }
+        assert(ok && VALUE(j) == bptree_iter_value(&it));
+        key = bptree_iter_key(&it, &len);
+        assert(len == strlen(keys[j]) && 0 == memcmp(key, keys[j], len));
+        assert(VALUE(j) == bptree_find(tree, keys[j], strlen(keys[j])));
+        ok = bptree_next(&it);
+    }
+    assert(!ok);
+
+    // memcmp order, then the shorter first: "ab" < "ab\0" < "ab\1"
+    assert(0 == bptree_insert(tree, "ab\1", 3, VALUE(3), NULL));
+    assert(0 == bptree_insert(tree, "ab\0", 3, VALUE(2), NULL));
+    assert(0 == bptree_insert(tree, "ab", 2, VALUE(1), NULL));
+    assert(-EEXIST == bptree_insert(tree, "ab", 2, NULL, NULL));
+    assert(1 == bptree_seek(tree, "ab", 2, &it) && VALUE(1) == bptree_iter_value(&it));
+    assert(bptree_next(&it) && VALUE(2) == bptree_iter_value(&it));
+    assert(bptree_next(&it) && VALUE(3) == bptree_iter_value(&it));
+    assert(VALUE(2) == bptree_delete(tree, "ab\0", 3));
+    assert(NULL == bptree_find(tree, "ab\0", 3));
+
+    bptree_destroy(tree);
+    for (j = 0; j < KEYS; j++)
+        free(keys[j]);
+    free(keys);
+    free(ref);
+}
+
+static void bptree_bulk_test(void)
+{
+    bptree_t *tree;
+    bptree_iter_t it;
+    uint64_t *keys;
+    void **values;
+    char **strs, *ref;
+    size_t *lens;
+    int i, n;
+
+    keys   = (uint64_t *)malloc(KEYS * sizeof(keys[0]));
+    values = (void **)malloc(KEYS * sizeof(values[0]));
+    ref    = (char *)calloc(2 * KEYS, 1);
+    for (i = 0; i < KEYS; i++) {
+        keys[i]   = 2 * i;
+        values[i] = VALUE(2 * i);
+    }
+
+    // every size around the node and level boundaries
+    for (n = 0; n < 2000; n += (n < 100 ? 1 : 37)) {
+        tree = bptree_create(BPTREE_KEY_U64);
+        assert(0 == bptree_bulk_load_u64(tree, keys, values, n));
+        memset(ref, 0, 2 * KEYS);
+        for (i = 0; i < n; i++)
+            ref[2 * i] = 1;
+        bptree_check_u64(tree, ref, 2 * n + 1);
+        assert(-EINVAL == bptree_bulk_load_u64(tree, keys, values, n) || 0 == n);
+        bptree_destroy(tree);
+    }
+
+    // still a regular tree
+    tree = bptree_create(BPTREE_KEY_U64);
+    assert(0 == bptree_bulk_load_u64(tree, keys, values, KEYS));
+    memset(ref, 0, 2 * KEYS);
+    for (i = 0; i < KEYS; i++)
+        ref[2 * i] = 1;
+    for (i = 0; i < 2 * KEYS; i++) {
+        if (i % 3 == 0) {
+            assert(0 == bptree_insert_u64(tree, i | 1, VALUE(i | 1), NULL));
+            ref[i | 1] = 1;
+        } else if (i % 3 == 1 && ref[i]) {
+            assert(VALUE(i) == bptree_delete_u64(tree, i));
+            ref[i] = 0;
+        }
+    }
+    bptree_check_u64(tree, ref, 2 * KEYS);
+    bptree_destroy(tree);
+
+    keys[7] = keys[6];
+    tree    = bptree_create(BPTREE_KEY_U64);
+    assert(-EINVAL == bptree_bulk_load_u64(tree, keys, values, 8));
+    assert(0 == bptree_count(tree));
+    bptree_destroy(tree);
+
+    strs = make_strings(KEYS);
+    lens = (size_t *)malloc(KEYS * sizeof(lens[0]));
+    for (i = 0; i < KEYS; i++) {
+        lens[i]   = strlen(strs[i]);
+        values[i] = VALUE(i);
+    }
+    tree = bptree_create(BPTREE_KEY_BYTES);
+    assert(-EINVAL == bptree_bulk_load_u64(tree, keys, values, 1));
+    assert(0 == bptree_bulk_load(tree, (const void *const *)strs, lens, values,
+                                 KEYS));
+    for (i = 0; i < KEYS; i += 2)
+        assert(VALUE(i) == bptree_delete(tree, strs[i], lens[i]));
+    for (i = 1; i < KEYS; i += 2) {
+        assert(bptree_seek(tree, strs[i - 1], lens[i - 1], &it));
+        assert(VALUE(i) == bptree_iter_value(&it));
+    }
+    assert(KEYS / 2 == bptree_count(tree));
+    bptree_destroy(tree);
+
+    for (i = 0; i < KEYS; i++)
+        free(strs[i]);
+    free(strs);
+    free(lens);
+    free(keys);
+    free(values);
+    free(ref);
+}
+
+//------------------------------------------------------------------------
+
+struct rb_item {
+    rbtree_node_t node;
+    uint64_t key;
+};
+
+struct avl_item {
+    avl_node_t node;
+    uint64_t key;
+};
+
+static int avl_key_cmp(const void *key, const avl_node_t *node)
+{
+    uint64_t k = *(const uint64_t *)key;
+    uint64_t v = avl_entry(node, struct avl_item, node)->key;
+    return k < v ? -1 : (k > v ? 1 : 0);
+}
+
+static void report(const char *name, uint64_t insert, uint64_t lookup,
+                   uint64_t scan)
+{
+    printf("%-12s insert %5ums lookup %5ums scan %5ums\n", name,
+           (unsigned int)insert, (unsigned int)lookup, (unsigned int)scan);
+}
+
+static int u64cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// insert BENCH_N random keys, look them all up, SCAN_N range scans
+static void bptree_bench(void)
+{
+    struct rb_item *rbs;
+    struct avl_item *avls;
+    rbtree_root_t rbroot = {NULL};
+    avl_root_t avlroot   = {NULL};
+    rbtree_node_t **link, *parent;
+    const rbtree_node_t *rn;
+    avl_node_t **alink, *aparent, *an;
+    bptree_t *tree;
+    bptree_iter_t it;
+    uint64_t *keys, *sorted, clock, t1, t2, sum = 0;
+    int i, j;
+
+    keys   = (uint64_t *)malloc(BENCH_N * sizeof(keys[0]));
+    sorted = (uint64_t *)malloc(BENCH_N * sizeof(keys[0]));
+    for (i = 0; i < BENCH_N; i++)
+        keys[i] = sorted[i] = rand64() >> 1;
+    qsort(sorted, BENCH_N, sizeof(sorted[0]), u64cmp);
+
+    tree  = bptree_create(BPTREE_KEY_U64);
+    clock = system_clock();
+    for (i = 0; i < BENCH_N; i++)
+        bptree_insert_u64(tree, keys[i], VALUE(i), NULL);
+    t1 = system_clock();
+    for (i = 0; i < BENCH_N; i++)
+        sum += (uintptr_t)bptree_find_u64(tree, keys[i]);
+    t2 = system_clock();
+    for (i = 0; i < SCAN_N; i++) {
+        bptree_seek_u64(tree, keys[i], &it);
+        for (j = 0; j < 100 && it.node; j++, bptree_next(&it))
+            sum += bptree_iter_u64(&it);
+    }
+    report("bptree", t1 - clock, t2 - t1, system_clock() - t2);
+    printf("bptree height %d\n", bptree_height(tree));
+    bptree_destroy(tree);
+
+    // bulk load from sorted
+    tree  = bptree_create(BPTREE_KEY_U64);
+    clock = system_clock();
+    bptree_bulk_load_u64(tree, sorted, NULL, BENCH_N);
+    t1 = system_clock();
+    for (i = 0; i < BENCH_N; i++)
+        sum += (uintptr_t)bptree_find_u64(tree, keys[i]);
+    t2 = system_clock();
+    for (i = 0; i < SCAN_N; i++) {
+        bptree_seek_u64(tree, keys[i], &it);
+        for (j = 0; j < 100 && it.node; j++, bptree_next(&it))
+            sum += bptree_iter_u64(&it);
+    }
+    report("bptree bulk", t1 - clock, t2 - t1, system_clock() - t2);
+    bptree_destroy(tree);
+
+    rbs   = (struct rb_item *)malloc(BENCH_N * sizeof(rbs[0]));
+    clock = system_clock();
+    for (i = 0; i < BENCH_N; i++) {
+        rbs[i].key = keys[i];
+        link       = &rbroot.node;
+        parent     = NULL;
+        while (*link) {
+            parent = *link;
+            link   = keys[i] < rbtree_entry(parent, struct rb_item, node)->key
+                         ? &parent->left
+                         : &parent->right;
+        }
+        rbtree_insert(&rbroot, parent, link, &rbs[i].node);
+    }
+    t1 = system_clock();
+    for (i = 0; i < BENCH_N; i++) {
+        for (rn = rbroot.node; rn;) {
+            uint64_t k = rbtree_entry(rn, struct rb_item, node)->key;
+            if (k == keys[i])
+                break;
+            rn = keys[i] < k ? rn->left : rn->right;
+        }
+        sum += (uintptr_t)rn;
+    }
+    t2 = system_clock();
+    for (i = 0; i < SCAN_N; i++) {
+        rn = &rbs[i].node;
+        for (j = 0; j < 100 && rn; j++, rn = rbtree_next(rn))
+            sum += rbtree_entry(rn, struct rb_item, node)->key;
+    }
+    report("rbtree_new", t1 - clock, t2 - t1, system_clock() - t2);
+    free(rbs);
+
+    avls  = (struct avl_item *)malloc(BENCH_N * sizeof(avls[0]));
+    clock = system_clock();
+    for (i = 0; i < BENCH_N; i++) {
+        avls[i].key = keys[i];
+        alink       = &avlroot.node;
+        aparent     = NULL;
+        while (*alink) {
+            aparent = *alink;
+            alink   = keys[i] < avl_entry(aparent, struct avl_item, node)->key
+                          ? &aparent->left
+                          : &aparent->right;
+        }
+        avl_insert(&avlroot, aparent, alink, &avls[i].node);
+    }
+    t1 = system_clock();
+    for (i = 0; i < BENCH_N; i++)
+        sum += (uintptr_t)avl_find(&avlroot, &keys[i], avl_key_cmp);
+    t2 = system_clock();
+    for (i = 0; i < SCAN_N; i++) {
+        an = &avls[i].node;
+        for (j = 0; j < 100 && an; j++, an = avl_next(an))
+            sum += avl_entry(an, struct avl_item, node)->key;
+    }
+    report("avl", t1 - clock, t2 - t1, system_clock() - t2);
+    free(avls);
+
+    printf("(%u)\n", (unsigned int)sum);
+    free(keys);
+    free(sorted);
+}
+
+int main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    bptree_u64_test();
+    bptree_bytes_test();
+    bptree_bulk_test();
+    bptree_bench();
+    return 0;
+}
@@ -29,3 +29,121 @@ bsearch(const void *key, const void *base, size_t num, size_t size,
 
     return NULL;
 }
+
+#define BSEARCH_BATCH 8                   // searches in flight
+#define BSEARCH_LINE  64                  // cache line bytes
+
+#ifdef __GNUC__
+#define bsearch_prefetch(p) __builtin_prefetch(p)
+#else
+#define bsearch_prefetch(p) ((void)(p))
+#endif
+
+/*
+ * The answer stays in [base, base + n]; one comparison halves n, a
+ * conditional move follows it. CMP is < for lower, <= for upper.
+ */
+#define BSEARCH_BOUND(T, CMP)                                              \
+    {                                                                      \
+        const T *base = a;                                                 \
+        size_t half;                                                       \
+                                                                           \
+        if (0 == n)                                                        \
+            return 0;                                                      \
+        while (n > 1) {                                                    \
+            half = n >> 1;                                                 \
+            bsearch_prefetch(base + (half >> 1));                          \
+            bsearch_prefetch(base + half + (half >> 1));                   \
+            base = base[half] CMP key ? base + half : base;                \
+            n -= half;                                                     \
+        }                                                                  \
+        return (size_t)(base - a) + (*base CMP key);                       \
+    }
+
+#define BSEARCH_DEFINE(sfx, T)                                             \
+    size_t                                                                 \
+    bsearch_lower_##sfx(const T *a, size_t n, T key)                       \
+    BSEARCH_BOUND(T, <)                                                    \
+                                                                           \
+    size_t                                                                 \
+    bsearch_upper_##sfx(const T *a, size_t n, T key)                       \
+    BSEARCH_BOUND(T, <=)                                                   \
+                                                                           \
+    /* in order walk of the tree, a is read in sequence */                 \
+    static size_t                                                          \
+    eytzinger_fill_##sfx(T *e, const T *a, size_t i, size_t k, size_t n)  \
+    {                                                                      \
+        if (k <= n) {                                                      \
+            i      = eytzinger_fill_##sfx(e, a, i, 2 * k, n);              \
+            e[k]   = a[i++];                                               \
+            i      = eytzinger_fill_##sfx(e, a, i, 2 * k + 1, n);          \
+        }                                                                  \
+        return i;                                                          \
+    }                                                                      \
+                                                                           \
+    void                                                                   \
+    bsearch_eytzinger_##sfx(T *e, const T *a, size_t n)                    \
+    {                                                                      \
+        eytzinger_fill_##sfx(e, a, 0, 1, n);                               \
+    }                                                                      \
+                                                                           \
+    size_t                                                                 \
+    bsearch_eytzinger_lower_##sfx(const T *e, size_t n, T key)             \
+    {                                                                      \
+        size_t k = 1, p;                                                   \
+                                                                           \
+        while (k <= n) {                                                   \
+            /* the descendants of k a line's worth of levels down, */      \
+            /* clamped so the address stays inside the array */           \
+            p = k * (BSEARCH_LINE / sizeof(T));                            \
+            bsearch_prefetch(e + (p <= n ? p : n));                        \
+            k = 2 * k + (e[k] < key);                                      \
+        }                                                                  \
+        /* drop the right turns after the last left one */                 \
+        return k >> bsearch_ffs(~k);                                       \
+    }                                                                      \
+                                                                           \
+    void                                                                   \
+    bsearch_lower_batch_##sfx(const T *a, size_t n, const T *keys,         \
+                              size_t m, size_t *out)                       \
+    {                                                                      \
+        const T *base[BSEARCH_BATCH];                                      \
+        size_t i, j, len, half;                                            \
+                                                                           \
+        for (i = 0; i + BSEARCH_BATCH <= m && n > 0; i += BSEARCH_BATCH) { \
+            for (j = 0; j < BSEARCH_BATCH; j++)                            \
+                base[j] = a;                                               \
+            /* the same n for all, so the same steps */                    \
+            for (len = n; len > 1; len -= half) {                          \
+                half = len >> 1;                                           \
+                for (j = 0; j < BSEARCH_BATCH; j++)                        \
+                    base[j] = base[j][half] < keys[i + j] ? base[j] + half \
+                                                          : base[j];       \
+            }                                                              \
+            for (j = 0; j < BSEARCH_BATCH; j++)                            \
+                out[i + j] = (size_t)(base[j] - a) + (*base[j] < keys[i + j]); \
+        }                                                                  \
+        for (; i < m; i++)                                                 \
+            out[i] = bsearch_lower_##sfx(a, n, keys[i]);                   \
+    }
+
+// one past the lowest set bit, k != 0
+static inline unsigned
+bsearch_ffs(size_t k)
+{
+#ifdef __GNUC__
+    return (unsigned)__builtin_ctzll((unsigned long long)k) + 1;
+#else
+    unsigned n = 1;
+
+    while (!(k & 1)) {
+        k >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+BSEARCH_DEFINE(u32, uint32_t)
+BSEARCH_DEFINE(u64, uint64_t)
+BSEARCH_DEFINE(i64, int64_t)
@@ -8,6 +8,7 @@
 #define __BSEARCH_H__
 
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -16,6 +17,42 @@ extern "C" {
 void *bsearch(const void*key, const void *base, size_t num, size_t size,
               int (*cmp)(const void *key, const void *elt));
 
+/*
+ * Typed searches in sorted arrays, for u32/u64/i64:
+ *  - lower/upper: the first index with a[i] >= key / a[i] > key, n if
+ *    none; the loop has no data dependent branch and prefetches both
+ *    next probes
+ *  - eytzinger: the array in the BFS order of its implicit search tree
+ *    (e[1] root, children of k at 2k and 2k + 1, e[0] unused), the next
+ *    levels of a probe share a cache line, which is prefetched
+ *  - batch: lower bounds of several keys, walked in lockstep so their
+ *    cache misses overlap
+ */
+size_t bsearch_lower_u32(const uint32_t *a, size_t n, uint32_t key);
+size_t bsearch_upper_u32(const uint32_t *a, size_t n, uint32_t key);
+size_t bsearch_lower_u64(const uint64_t *a, size_t n, uint64_t key);
+size_t bsearch_upper_u64(const uint64_t *a, size_t n, uint64_t key);
+size_t bsearch_lower_i64(const int64_t *a, size_t n, int64_t key);
+size_t bsearch_upper_i64(const int64_t *a, size_t n, int64_t key);
+
+/// @param e room for n + 1 values, filled from the sorted a
+void bsearch_eytzinger_u32(uint32_t *e, const uint32_t *a, size_t n);
+void bsearch_eytzinger_u64(uint64_t *e, const uint64_t *a, size_t n);
+void bsearch_eytzinger_i64(int64_t *e, const int64_t *a, size_t n);
+
+/// @return the index in e of the first value >= key, 0 if none
+size_t bsearch_eytzinger_lower_u32(const uint32_t *e, size_t n, uint32_t key);
+size_t bsearch_eytzinger_lower_u64(const uint64_t *e, size_t n, uint64_t key);
+size_t bsearch_eytzinger_lower_i64(const int64_t *e, size_t n, int64_t key);
+
+/// out[i] = lower bound of keys[i]
+void bsearch_lower_batch_u32(const uint32_t *a, size_t n, const uint32_t *keys,
+                             size_t m, size_t *out);
+void bsearch_lower_batch_u64(const uint64_t *a, size_t n, const uint64_t *keys,
+                             size_t m, size_t *out);
+void bsearch_lower_batch_i64(const int64_t *a, size_t n, const int64_t *keys,
+                             size_t m, size_t *out);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
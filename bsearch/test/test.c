@@ -7,6 +7,12 @@
 #include "bsearch.h"
 #include "macro.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <assert.h>
 
 
 static int
@@ -18,9 +24,9 @@ cmp(const void *key, const void *elt)
 int bsearch_test(void)
 {
     int array[128];
-    int i;
+    size_t i;
     for (i = 0; i < ARRAY_SIZE(array); i++) {
-        array[i] = i;
+        array[i] = (int)i;
     }
     int keys[] = {1, 64, 27, 126, 128};
     int *ret   = NULL;
@@ -37,9 +43,153 @@ int bsearch_test(void)
     return 0;
 }
 
+static uint64_t
+rand64(void)
+{
+    static uint64_t x = 88172645463325252ULL;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return x;
+}
+
+static int
+cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int
+cmp_i64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// against linear scans, with duplicates and keys outside the range
+static void
+bsearch_typed_test(void)
+{
+    uint32_t a[300], e[301], keys[37];
+    int64_t b[300], f[301], keys64[37];
+    size_t out[37], out64[37], n, i, j, lo, up, k;
+
+    for (n = 0; n <= 300; n += n < 40 ? 1 : 37) {
+        for (i = 0; i < n; i++) {
+            a[i] = (uint32_t)(rand64() % (2 * n + 1));
+            b[i] = (int64_t)(rand64() % (2 * n + 1)) - (int64_t)n;
+        }
+        qsort(a, n, sizeof(a[0]), cmp_u32);
+        qsort(b, n, sizeof(b[0]), cmp_i64);
+        bsearch_eytzinger_u32(e, a, n);
+        bsearch_eytzinger_i64(f, b, n);
+
+        for (i = 0; i < ARRAY_SIZE(keys); i++) {
+            keys[i]   = (uint32_t)(rand64() % (2 * n + 3));
+            keys64[i] = (int64_t)(rand64() % (2 * n + 3)) - (int64_t)n - 1;
+        }
+        bsearch_lower_batch_u32(a, n, keys, ARRAY_SIZE(keys), out);
+        bsearch_lower_batch_i64(b, n, keys64, ARRAY_SIZE(keys64), out64);
+
+        for (i = 0; i < ARRAY_SIZE(keys); i++) {
+            for (lo = 0; lo < n && a[lo] < keys[i]; lo++)
+                ;
+            for (up = lo; up < n && a[up] <= keys[i]; up++)
+                ;
+            assert(lo == bsearch_lower_u32(a, n, keys[i]));
+            assert(up == bsearch_upper_u32(a, n, keys[i]));
+            assert(lo == out[i]);
+            k = bsearch_eytzinger_lower_u32(e, n, keys[i]);
+            assert(lo < n ? k && e[k] == a[lo] : 0 == k);
+
+            for (lo = 0; lo < n && b[lo] < keys64[i]; lo++)
+                ;
+            for (up = lo; up < n && b[up] <= keys64[i]; up++)
+                ;
+            assert(lo == bsearch_lower_i64(b, n, keys64[i]));
+            assert(up == bsearch_upper_i64(b, n, keys64[i]));
+            assert(lo == out64[i]);
+            k = bsearch_eytzinger_lower_i64(f, n, keys64[i]);
+            assert(lo < n ? k && f[k] == b[lo] : 0 == k);
+        }
+    }
+
+    // the whole u64 range
+    {
+        uint64_t c[] = {0, 1, UINT64_MAX / 2, UINT64_MAX - 1, UINT64_MAX}, g[6];
+        bsearch_eytzinger_u64(g, c, ARRAY_SIZE(c));
+        for (j = 0; j < ARRAY_SIZE(c); j++) {
+            assert(j == bsearch_lower_u64(c, ARRAY_SIZE(c), c[j]));
+            assert(j + 1 == bsearch_upper_u64(c, ARRAY_SIZE(c), c[j]));
+            k = bsearch_eytzinger_lower_u64(g, ARRAY_SIZE(c), c[j]);
+            assert(k && g[k] == c[j]);
+        }
+        assert(1 == bsearch_upper_u64(c, ARRAY_SIZE(c), 0));
+    }
+    printf("bsearch_typed_test ok\n");
+}
+
+static double
+ms(clock_t start)
+{
+    return (double)(clock() - start) * 1000 / CLOCKS_PER_SEC;
+}
+
+// lookups of present and absent keys, bsearch needs its callback
+static void
+bsearch_bench(size_t n)
+{
+    size_t m = 1000000, i, *out = malloc(m * sizeof(size_t));
+    uint32_t *a = malloc(n * sizeof(uint32_t)), *e = malloc((n + 1) * sizeof(uint32_t));
+    uint32_t *keys = malloc(m * sizeof(uint32_t));
+    uint64_t sum1 = 0, sum2 = 0, sum3 = 0, sum4 = 0;
+    double t_cb, t_lo, t_ey, t_ba;
+    clock_t start;
+
+    for (i = 0; i < n; i++)
+        a[i] = (uint32_t)(2 * i);
+    for (i = 0; i < m; i++)
+        keys[i] = (uint32_t)(rand64() % (2 * n - 1)); // <= the last
+    bsearch_eytzinger_u32(e, a, n);
+
+    start = clock();
+    for (i = 0; i < m; i++)
+        sum1 += bsearch(&keys[i], a, n, sizeof(uint32_t), cmp_u32) != NULL;
+    t_cb = ms(start);
+
+    start = clock();
+    for (i = 0; i < m; i++)
+        sum2 += a[bsearch_lower_u32(a, n, keys[i])] == keys[i];
+    t_lo = ms(start);
+
+    start = clock();
+    for (i = 0; i < m; i++)
+        sum3 += e[bsearch_eytzinger_lower_u32(e, n, keys[i])] == keys[i];
+    t_ey = ms(start);
+
+    start = clock();
+    bsearch_lower_batch_u32(a, n, keys, m, out);
+    for (i = 0; i < m; i++)
+        sum4 += a[out[i]] == keys[i];
+    t_ba = ms(start);
+    assert(sum1 == sum2 && sum1 == sum3 && sum1 == sum4);
+
+    printf("%8lu u32, 1M lookups: bsearch %7.2fms lower %7.2fms eytzinger %7.2fms batch %7.2fms\n",
+           (unsigned long)n, t_cb, t_lo, t_ey, t_ba);
+    free(a);
+    free(e);
+    free(keys);
+    free(out);
+}
+
 int
 main(void)
 {
     bsearch_test();
+    bsearch_typed_test();
+    bsearch_bench(1000);
+    bsearch_bench(64000);
+    bsearch_bench(4000000);
     return 0;
 }
@@ -0,0 +1,518 @@
+/*
+ * chmap.c - concurrent hash map
+ *
+ * Date   : 2021/04/30
+ */
+
+#include "chmap.h"
+#include "atomic.h"
+#include "jhash.h"
+#include "locker.h"
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CM_SEGMENTS 64
+#define CM_MIN_BUCKETS 16
+#define CM_READERS 64     // striped reader counters
+#define CM_READ_TRIES 4   // optimistic lookups before taking the lock
+#define CM_GC_BATCH 256   // removed entries a segment holds before a grace period
+
+#define CM_LOAD(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define CM_STORE(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+struct cm_entry {
+    struct cm_entry *next;
+    struct cm_entry *gc_next;
+    uint32_t hash;
+    uint32_t len;
+    void *value;
+    unsigned char key[1];
+};
+
+struct cm_table {
+    struct cm_table *gc_next;
+    size_t mask;
+    struct cm_entry *buckets[1];
+};
+
+struct cm_segment {
+    locker_t lock;
+    volatile uint32_t seq; // odd while the buckets are rehashed
+    struct cm_table *table;
+    size_t count;
+    // waiting for a grace period
+    struct cm_entry *gc;
+    struct cm_table *gc_tables;
+    size_t gc_count;
+    char pad[64];
+};
+
+struct cm_readers {
+    volatile int32_t n[2];
+    char pad[64 - 2 * sizeof(int32_t)];
+};
+
+/*
+ * Grace periods the way SRCU does them: a read section counts itself in
+ * n[index] of its stripe, a grace period flips the index and waits for
+ * the old counters to drain. Readers that took the index just before a
+ * flip are drained by the next grace period first.
+ */
+struct chmap {
+    struct cm_readers readers[CM_READERS];
+    volatile int32_t index;
+    locker_t gp_lock;
+    chmap_hash_fn hash;
+    chmap_free_fn free_fn;
+    unsigned int shift; // 32 - log2(segments)
+    unsigned int nsegments;
+    struct cm_segment *segments;
+};
+
+static uint32_t s_cm_stripes;
+static __thread uint32_t t_cm_stripe; // 0 unassigned
+static __thread int t_cm_nest;        // read sections open, any map
+
+static uint32_t
+cm_jhash(const void *key, size_t len)
+{
+    return jhash(key, (uint32_t)len, 0);
+}
+
+static inline struct cm_readers *
+cm_readers(chmap_t *map)
+{
+    if (0 == t_cm_stripe)
+        t_cm_stripe = (uint32_t)atomic_increment32((volatile int32_t *)&s_cm_stripes);
+    return &map->readers[t_cm_stripe % CM_READERS];
+}
+
+int
+chmap_read_lock(chmap_t *map)
+{
+    struct cm_readers *r = cm_readers(map);
+    int idx;
+
+    idx = __atomic_load_n(&map->index, __ATOMIC_SEQ_CST);
+    atomic_increment32(&r->n[idx]); // full barrier before any entry is read
+    t_cm_nest++;
+    return idx;
+}
+
+void
+chmap_read_unlock(chmap_t *map, int token)
+{
+    t_cm_nest--;
+    atomic_decrement32(&cm_readers(map)->n[token]);
+}
+
+static void
+cm_wait_readers(chmap_t *map, int idx)
+{
+    int i;
+
+    for (i = 0; i < CM_READERS; i++) {
+        while (0 != atomic_load32(&map->readers[i].n[idx]))
+            sched_yield();
+    }
+}
+
+static void
+cm_grace_period(chmap_t *map)
+{
+    int idx;
+
+    locker_lock(&map->gp_lock);
+    idx = map->index;
+    cm_wait_readers(map, idx ^ 1); // late readers of the last flip
+    __atomic_store_n(&map->index, idx ^ 1, __ATOMIC_SEQ_CST);
+    cm_wait_readers(map, idx);
+    locker_unlock(&map->gp_lock);
+}
+
+static void
+cm_free(chmap_t *map, struct cm_entry *gc, struct cm_table *gc_tables)
+{
+    struct cm_entry *e;
+    struct cm_table *t;
+
+    while (gc) {
+        e  = gc;
+        gc = gc->gc_next;
+        if (map->free_fn)
+            map->free_fn(e->value);
+        free(e);
+    }
+    while (gc_tables) {
+        t         = gc_tables;
+        gc_tables = gc_tables->gc_next;
+        free(t);
+    }
+}
+
+// segment locked
+static void
+cm_retire(struct cm_segment *seg, struct cm_entry *e)
+{
+    e->gc_next = seg->gc;
+    seg->gc    = e;
+    seg->gc_count++;
+}
+
+// unlocks the segment, then frees its removed entries if enough are
+// waiting and no read section of this thread could hold them
+static void
+cm_unlock(chmap_t *map, struct cm_segment *seg)
+{
+    struct cm_entry *gc       = NULL;
+    struct cm_table *gc_table = NULL;
+
+    if (seg->gc_count >= CM_GC_BATCH && 0 == t_cm_nest) {
+        gc             = seg->gc;
+        gc_table       = seg->gc_tables;
+        seg->gc        = NULL;
+        seg->gc_tables = NULL;
+        seg->gc_count  = 0;
+    }
+    locker_unlock(&seg->lock);
+
+    if (gc || gc_table) {
+        cm_grace_period(map);
+        cm_free(map, gc, gc_table);
+    }
+}
+
+static struct cm_table *
+cm_table_new(size_t buckets)
+{
+    struct cm_table *t;
+
+    t = (struct cm_table *)calloc(
+        1, offsetof(struct cm_table, buckets) + buckets * sizeof(t->buckets[0]));
+    if (t)
+        t->mask = buckets - 1;
+    return t;
+}
+
+// segment locked, lookups walking meanwhile retry on seq
+static void
+cm_grow(struct cm_segment *seg)
+{
+    struct cm_table *old = seg->table, *t;
+    struct cm_entry *e, *next;
+    size_t i;
+
+    t = cm_table_new((old->mask + 1) * 2);
+    if (!t)
+        return; // longer chains, still correct
+
+    __atomic_store_n(&seg->seq, seg->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (i = 0; i <= old->mask; i++) {
+        for (e = old->buckets[i]; e; e = next) {
+            next = e->next;
+            CM_STORE(e->next, t->buckets[e->hash & t->mask]);
+            t->buckets[e->hash & t->mask] = e;
+        }
+    }
+    CM_STORE(seg->table, t);
+    __atomic_store_n(&seg->seq, seg->seq + 1, __ATOMIC_RELEASE);
+
+    // lookups may still be in the old buckets
+    old->gc_next   = seg->gc_tables;
+    seg->gc_tables = old;
+    seg->gc_count += CM_GC_BATCH / 4;
+}
+
+static inline struct cm_segment *
+cm_segment(chmap_t *map, uint32_t hash)
+{
+    return &map->segments[map->shift < 32 ? hash >> map->shift : 0];
+}
+
+static inline int
+cm_match(const struct cm_entry *e, const void *key, size_t len, uint32_t hash)
+{
+    return e->hash == hash && e->len == len && 0 == memcmp(e->key, key, len);
+}
+
+// in a read section
+static struct cm_entry *
+cm_lookup(struct cm_segment *seg, const void *key, size_t len, uint32_t hash)
+{
+    struct cm_table *t;
+    struct cm_entry *e;
+    size_t n, limit;
+    uint32_t seq;
+    int tries;
+
+    for (tries = 0; tries < CM_READ_TRIES; tries++) {
+        seq = __atomic_load_n(&seg->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+
+        // a rehash racing with the walk may link it into a loop
+        t     = CM_LOAD(seg->table);
+        limit = t->mask + 2;
+        for (n = 0, e = CM_LOAD(t->buckets[hash & t->mask]); e && n < limit;
+             e = CM_LOAD(e->next), n++) {
+            if (cm_match(e, key, len, hash))
+                return e; // was in the map during the walk
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (n < limit && __atomic_load_n(&seg->seq, __ATOMIC_RELAXED) == seq)
+            return NULL;
+    }
+
+    locker_lock(&seg->lock);
+    t = seg->table;
+    for (e = t->buckets[hash & t->mask]; e; e = e->next) {
+        if (cm_match(e, key, len, hash))
+            break;
+    }
+    locker_unlock(&seg->lock);
+    return e;
+}
+
+chmap_t *
+chmap_create(unsigned int segments, chmap_hash_fn hash, chmap_free_fn free_fn)
+{
+    chmap_t *map;
+    unsigned int i, bits = 0;
+
+    if (0 == segments)
+        segments = CM_SEGMENTS;
+    if (segments & (segments - 1))
+        return NULL;
+    while ((1u << bits) < segments)
+        bits++;
+
+    map = (chmap_t *)calloc(1, sizeof(*map));
+    if (!map)
+        return NULL;
+    map->segments = (struct cm_segment *)calloc(segments, sizeof(map->segments[0]));
+    if (!map->segments) {
+        free(map);
+        return NULL;
+    }
+    map->hash      = hash ? hash : cm_jhash;
+    map->free_fn   = free_fn;
+    map->shift     = 32 - bits;
+    map->nsegments = segments;
+    locker_create(&map->gp_lock);
+
+    for (i = 0; i < segments; i++) {
+        map->segments[i].table = cm_table_new(CM_MIN_BUCKETS);
+        if (!map->segments[i].table) {
+            map->nsegments = i;
+            chmap_destroy(map);
+            return NULL;
+        }
+        locker_create(&map->segments[i].lock);
+    }
+    return map;
+}
+
+void
+chmap_destroy(chmap_t *map)
+{
+    struct cm_segment *seg;
+    struct cm_entry *e, *next;
+    unsigned int i;
+    size_t j;
+
+    for (i = 0; i < map->nsegments; i++) {
+        seg = &map->segments[i];
+        for (j = 0; j <= seg->table->mask; j++) {
+            for (e = seg->table->buckets[j]; e; e = next) {
+                next = e->next;
+                cm_retire(seg, e);
+            }
+        }
+        seg->table->gc_next = seg->gc_tables;
+        cm_free(map, seg->gc, seg->table);
+        locker_destroy(&seg->lock);
+    }
+    locker_destroy(&map->gp_lock);
+    free(map->segments);
+    free(map);
+}
+
+size_t
+chmap_count(chmap_t *map)
+{
+    size_t n = 0;
+    unsigned int i;
+
+    for (i = 0; i < map->nsegments; i++)
+        n += __atomic_load_n(&map->segments[i].count, __ATOMIC_RELAXED);
+    return n;
+}
+
+static struct cm_entry *
+cm_entry_new(const void *key, size_t len, uint32_t hash, void *value)
+{
+    struct cm_entry *e;
+
+    e = (struct cm_entry *)malloc(offsetof(struct cm_entry, key) + len);
+    if (!e)
+        return NULL;
+    e->hash  = hash;
+    e->len   = (uint32_t)len;
+    e->value = value;
+    memcpy(e->key, key, len);
+    return e;
+}
+
+// segment locked, @return the link to the entry with key or to the end
+static struct cm_entry **
+cm_find_link(struct cm_segment *seg, const void *key, size_t len, uint32_t hash)
+{
+    struct cm_entry **link = &seg->table->buckets[hash & seg->table->mask];
+
+    for (; *link; link = &(*link)->next) {
+        if (cm_match(*link, key, len, hash))
+            break;
+    }
+    return link;
+}
+
+// segment locked, new entry at the head of its bucket
+static void
+cm_link(struct cm_segment *seg, struct cm_entry *e)
+{
+    struct cm_entry **head = &seg->table->buckets[e->hash & seg->table->mask];
+
+    e->next = *head;
+    CM_STORE(*head, e);
+    __atomic_store_n(&seg->count, seg->count + 1, __ATOMIC_RELAXED);
+    if (seg->count > seg->table->mask + 1)
+        cm_grow(seg);
+}
+
+int
+chmap_insert(chmap_t *map, const void *key, size_t len, void *value,
+             void **exist)
+{
+    uint32_t hash           = map->hash(key, len);
+    struct cm_segment *seg  = cm_segment(map, hash);
+    struct cm_entry **link, *e;
+
+    // allocated outside the lock, most inserts are new keys
+    e = cm_entry_new(key, len, hash, value);
+    if (!e)
+        return -ENOMEM;
+
+    locker_lock(&seg->lock);
+    link = cm_find_link(seg, key, len, hash);
+    if (*link) {
+        if (exist)
+            *exist = (*link)->value;
+        locker_unlock(&seg->lock);
+        free(e);
+        return -EEXIST;
+    }
+    cm_link(seg, e);
+    cm_unlock(map, seg);
+    return 0;
+}
+
+int
+chmap_put(chmap_t *map, const void *key, size_t len, void *value)
+{
+    uint32_t hash          = map->hash(key, len);
+    struct cm_segment *seg = cm_segment(map, hash);
+    struct cm_entry **link, *e, *old;
+
+    // a new entry even to replace: lookups may hold the old value
+    e = cm_entry_new(key, len, hash, value);
+    if (!e)
+        return -ENOMEM;
+
+    locker_lock(&seg->lock);
+    link = cm_find_link(seg, key, len, hash);
+    old  = *link;
+    if (!old) {
+        cm_link(seg, e);
+        cm_unlock(map, seg);
+        return 0;
+    }
+    e->next = old->next;
+    CM_STORE(*link, e);
+    cm_retire(seg, old);
+    cm_unlock(map, seg);
+    return 1;
+}
+
+int
+chmap_remove(chmap_t *map, const void *key, size_t len)
+{
+    uint32_t hash          = map->hash(key, len);
+    struct cm_segment *seg = cm_segment(map, hash);
+    struct cm_entry **link, *e;
+
+    locker_lock(&seg->lock);
+    link = cm_find_link(seg, key, len, hash);
+    e    = *link;
+    if (!e) {
+        locker_unlock(&seg->lock);
+        return -ENOENT;
+    }
+    // e->next stays, lookups standing on e go on
+    CM_STORE(*link, e->next);
+    __atomic_store_n(&seg->count, seg->count - 1, __ATOMIC_RELAXED);
+    cm_retire(seg, e);
+    cm_unlock(map, seg);
+    return 0;
+}
+
+int
+chmap_get(chmap_t *map, const void *key, size_t len, void **value)
+{
+    uint32_t hash = map->hash(key, len);
+    struct cm_entry *e;
+    int token;
+
+    token = chmap_read_lock(map);
+    e     = cm_lookup(cm_segment(map, hash), key, len, hash);
+    if (e)
+        *value = e->value;
+    chmap_read_unlock(map, token);
+    return e ? 0 : -ENOENT;
+}
+
+void
+chmap_synchronize(chmap_t *map)
+{
+    struct cm_entry *gc = NULL, *e;
+    struct cm_table *gc_tables = NULL, *t;
+    struct cm_segment *seg;
+    unsigned int i;
+
+    for (i = 0; i < map->nsegments; i++) {
+        seg = &map->segments[i];
+        locker_lock(&seg->lock);
+        while (seg->gc) {
+            e          = seg->gc;
+            seg->gc    = e->gc_next;
+            e->gc_next = gc;
+            gc         = e;
+        }
+        while (seg->gc_tables) {
+            t              = seg->gc_tables;
+            seg->gc_tables = t->gc_next;
+            t->gc_next     = gc_tables;
+            gc_tables      = t;
+        }
+        seg->gc_count = 0;
+        locker_unlock(&seg->lock);
+    }
+
+    cm_grace_period(map);
+    cm_free(map, gc, gc_tables);
+}
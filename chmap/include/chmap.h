@@ -0,0 +1,67 @@
+/*
+ * chmap.h - concurrent hash map
+ *
+ * Date   : 2021/04/30
+ */
+#ifndef __CHMAP_H__
+#define __CHMAP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Key/value map shared by threads. The keys pick a segment by the top
+ * bits of their hash, each segment has its own writer lock and chained
+ * buckets.
+ *
+ * Lookups take no lock: writers publish and unlink entries with single
+ * pointer stores, a segment resize bumps a sequence count the lookups
+ * retry on. Removed entries (and their values, through free_fn) are
+ * freed once every read section that may still see them has ended.
+ */
+typedef struct chmap chmap_t;
+
+/// NULL for chmap_create means jhash(key, len, 0)
+typedef uint32_t (*chmap_hash_fn)(const void *key, size_t len);
+typedef void (*chmap_free_fn)(void *value);
+
+/// @param segments power of 2, 0 for 64
+/// @param free_fn values removed or replaced, after the grace period
+chmap_t *chmap_create(unsigned int segments, chmap_hash_fn hash,
+                      chmap_free_fn free_fn);
+/// no other thread may use it, remaining values go to free_fn
+void chmap_destroy(chmap_t *map);
+/// exact when no writer runs
+size_t chmap_count(chmap_t *map);
+
+/// @param exist optional, the value of the same key
+/// @return 0-ok, -EEXIST, -ENOMEM
+int chmap_insert(chmap_t *map, const void *key, size_t len, void *value,
+                 void **exist);
+/// insert or replace
+/// @return 0-inserted, 1-replaced, -ENOMEM
+int chmap_put(chmap_t *map, const void *key, size_t len, void *value);
+/// @return 0-ok, -ENOENT
+int chmap_remove(chmap_t *map, const void *key, size_t len);
+/// the value may be freed once it returns, unless inside
+/// chmap_read_lock/unlock
+/// @return 0-ok, -ENOENT
+int chmap_get(chmap_t *map, const void *key, size_t len, void **value);
+
+/// nestable, keeps the values got alive, don't block inside
+/// @return the token for chmap_read_unlock
+int chmap_read_lock(chmap_t *map);
+void chmap_read_unlock(chmap_t *map, int token);
+
+/// wait for the read sections running and free what was removed before,
+/// not from inside a read section
+void chmap_synchronize(chmap_t *map);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
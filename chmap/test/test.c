@@ -0,0 +1,334 @@
+/*
+ * test.c - test
+ *
+ * Date   : 2021/04/30
+ */
+
+#include "chmap.h"
+#include "hashtab.h"
+#include "rwlocker.h"
+#include "system.h"
+#include "thread.h"
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define VALUE_MAGIC 0x5a5a5a5a
+#define VALUE_DEAD 0xdeaddead
+
+typedef struct value {
+    uint32_t key;
+    uint32_t magic;
+} value_t;
+
+static long s_allocs;
+static long s_frees;
+
+static value_t *value_new(uint32_t key)
+{
+    value_t *v = (value_t *)malloc(sizeof(*v));
+    v->key     = key;
+    v->magic   = VALUE_MAGIC;
+    __atomic_fetch_add(&s_allocs, 1, __ATOMIC_RELAXED);
+    return v;
+}
+
+static void value_free(void *value)
+{
+    value_t *v = (value_t *)value;
+    assert(VALUE_MAGIC == v->magic);
+    v->magic = VALUE_DEAD;
+    __atomic_fetch_add(&s_frees, 1, __ATOMIC_RELAXED);
+    free(v);
+}
+
+static uint64_t rand64(uint64_t *seed)
+{
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+    return *seed;
+}
+
+static void chmap_basic_test(void)
+{
+    chmap_t *map;
+    value_t *v, *exist;
+    uint32_t k;
+    void *p;
+    char key[32];
+    int token;
+
+    assert(NULL == chmap_create(3, NULL, NULL));
+    map = chmap_create(4, NULL, value_free);
+    assert(map && 0 == chmap_count(map));
+
+    // segments grow their buckets many times
+    for (k = 0; k < 20000; k++)
+        assert(0 == chmap_insert(map, &k, sizeof(k), value_new(k), NULL));
+    assert(20000 == chmap_count(map));
+
+    k = 7;
+    v = value_new(7);
+    assert(-EEXIST == chmap_insert(map, &k, sizeof(k), v, (void **)&exist));
+    assert(exist != v && 7 == exist->key);
+    value_free(v);
+
+    for (k = 0; k < 20001; k++) {
+        if (k < 20000) {
+            assert(0 == chmap_get(map, &k, sizeof(k), &p));
+            assert(((value_t *)p)->key == k);
+        } else {
+            assert(-ENOENT == chmap_get(map, &k, sizeof(k), &p));
+        }
+    }
+
+    // replace keeps the count, the old value waits for the grace period
+    k = 9;
+    assert(1 == chmap_put(map, &k, sizeof(k), value_new(9)));
+    k = 30000;
+    assert(0 == chmap_put(map, &k, sizeof(k), value_new(30000)));
+    assert(20001 == chmap_count(map));
+
+    for (k = 0; k < 20000; k += 2) {
+        assert(0 == chmap_remove(map, &k, sizeof(k)));
+        assert(-ENOENT == chmap_remove(map, &k, sizeof(k)));
+    }
+    assert(10001 == chmap_count(map));
+
+    // a read section keeps the value through a remove
+    k     = 1;
+    token = chmap_read_lock(map);
+    assert(0 == chmap_get(map, &k, sizeof(k), &p));
+    assert(0 == chmap_remove(map, &k, sizeof(k)));
+    assert(VALUE_MAGIC == ((value_t *)p)->magic);
+    chmap_read_unlock(map, token);
+
+    chmap_synchronize(map);
+    assert(s_allocs - s_frees == 10000);
+
+    // other key sizes
+    snprintf(key, sizeof(key), "session-%d", 42);
+    assert(0 == chmap_insert(map, key, strlen(key), value_new(42), NULL));
+    assert(-ENOENT == chmap_get(map, key, strlen(key) - 1, &p));
+    assert(0 == chmap_get(map, key, strlen(key), &p) && 42 == ((value_t *)p)->key);
+
+    chmap_destroy(map);
+    assert(s_allocs == s_frees);
+}
+
+//------------------------------------------------------------------------
+
+#define STRESS_KEYS 4096
+#define STRESS_OPS 200000
+
+struct stress {
+    chmap_t *map;
+    int id;
+    long inserted; // inserts - removes
+};
+
+static int STDCALL stress_worker(void *param)
+{
+    struct stress *s = (struct stress *)param;
+    uint64_t seed = 0x9e3779b97f4a7c15ULL * (s->id + 1), r;
+    value_t *v;
+    uint32_t k;
+    void *p;
+    int i, token;
+
+    for (i = 0; i < STRESS_OPS; i++) {
+        r = rand64(&seed);
+        k = (uint32_t)(r % STRESS_KEYS);
+        switch (r >> 61) {
+        case 0:
+            v = value_new(k);
+            if (0 == chmap_insert(s->map, &k, sizeof(k), v, NULL))
+                s->inserted++;
+            else
+                value_free(v);
+            break;
+        case 1:
+            if (0 == chmap_put(s->map, &k, sizeof(k), value_new(k)))
+                s->inserted++;
+            break;
+        case 2:
+        case 3:
+            if (0 == chmap_remove(s->map, &k, sizeof(k)))
+                s->inserted--;
+            break;
+        default:
+            // the value stays readable while others remove it
+            token = chmap_read_lock(s->map);
+            if (0 == chmap_get(s->map, &k, sizeof(k), &p)) {
+                v = (value_t *)p;
+                assert(VALUE_MAGIC == v->magic && k == v->key);
+            }
+            chmap_read_unlock(s->map, token);
+            break;
+        }
+    }
+    return 0;
+}
+
+static void chmap_stress_test(int nthreads)
+{
+    struct stress s[16];
+    pthread_t threads[16];
+    uint64_t clock;
+    long inserted = 0;
+    uint32_t k;
+    size_t n = 0;
+    void *p;
+    int i;
+
+    clock = system_clock();
+    for (i = 0; i < nthreads; i++) {
+        memset(&s[i], 0, sizeof(s[i]));
+        // few segments, so they resize under the readers
+        s[i].map = i ? s[0].map : chmap_create(4, NULL, value_free);
+        s[i].id  = i;
+        thread_create(&threads[i], stress_worker, &s[i]);
+    }
+    for (i = 0; i < nthreads; i++) {
+        thread_destroy(threads[i]);
+        inserted += s[i].inserted;
+    }
+
+    for (k = 0; k < STRESS_KEYS; k++) {
+        if (0 == chmap_get(s[0].map, &k, sizeof(k), &p)) {
+            assert(k == ((value_t *)p)->key);
+            n++;
+        }
+    }
+    assert((size_t)inserted == n && n == chmap_count(s[0].map));
+    chmap_synchronize(s[0].map);
+    assert((long)n == s_allocs - s_frees);
+
+    chmap_destroy(s[0].map);
+    assert(s_allocs == s_frees);
+    printf("chmap stress %d threads: %d ops in %ums, %d left\n", nthreads,
+           nthreads * STRESS_OPS, (unsigned int)(system_clock() - clock),
+           (int)n);
+}
+
+//------------------------------------------------------------------------
+
+#define BENCH_KEYS 100000
+#define BENCH_OPS 3200000 // split between the threads
+
+struct bench {
+    chmap_t *map;
+    hashtab_kv_t *kv;
+    rwlocker_t *lock;
+    int id;
+    int ops;
+};
+
+// 95% gets, 5% inserts/removes half and half
+static int STDCALL bench_worker(void *param)
+{
+    struct bench *b = (struct bench *)param;
+    uint64_t seed   = 0x2545f4914f6cdd1dULL * (b->id + 1), r;
+    uint32_t k;
+    void *p;
+    int i;
+
+    for (i = 0; i < b->ops; i++) {
+        r = rand64(&seed);
+        k = (uint32_t)(r % BENCH_KEYS);
+        r = (r >> 32) % 200;
+        if (b->map) {
+            if (r < 5)
+                chmap_insert(b->map, &k, sizeof(k), (void *)(uintptr_t)k, NULL);
+            else if (r < 10)
+                chmap_remove(b->map, &k, sizeof(k));
+            else
+                chmap_get(b->map, &k, sizeof(k), &p);
+        } else if (r < 10) {
+            rwlocker_wrlock(b->lock);
+            if (r < 5)
+                hashtab_kv_put(b->kv, &k, sizeof(k), (void *)(uintptr_t)k, NULL);
+            else
+                hashtab_kv_del(b->kv, &k, sizeof(k), NULL);
+            rwlocker_wrunlock(b->lock);
+        } else {
+            rwlocker_rdlock(b->lock);
+            hashtab_kv_get(b->kv, &k, sizeof(k), &p);
+            rwlocker_rdunlock(b->lock);
+        }
+    }
+    return 0;
+}
+
+static uint64_t bench_run(chmap_t *map, hashtab_kv_t *kv, rwlocker_t *lock,
+                          int nthreads)
+{
+    struct bench b[64];
+    pthread_t threads[64];
+    uint64_t clock;
+    int i;
+
+    clock = system_clock();
+    for (i = 0; i < nthreads; i++) {
+        b[i].map  = map;
+        b[i].kv   = kv;
+        b[i].lock = lock;
+        b[i].id   = i;
+        b[i].ops  = BENCH_OPS / nthreads;
+        thread_create(&threads[i], bench_worker, &b[i]);
+    }
+    for (i = 0; i < nthreads; i++)
+        thread_destroy(threads[i]);
+    return system_clock() - clock;
+}
+
+static void chmap_bench(void)
+{
+    chmap_t *map;
+    hashtab_kv_t *kv;
+    rwlocker_t lock;
+    uint64_t tmap, tkv;
+    uint32_t k;
+    int n;
+
+    for (n = 1; n <= 64; n *= 2) {
+        map = chmap_create(0, NULL, NULL);
+        kv  = hashtab_kv_create(BENCH_KEYS, NULL);
+        rwlocker_create(&lock);
+        for (k = 0; k < BENCH_KEYS; k += 2) {
+            chmap_insert(map, &k, sizeof(k), (void *)(uintptr_t)k, NULL);
+            hashtab_kv_put(kv, &k, sizeof(k), (void *)(uintptr_t)k, NULL);
+        }
+
+        tmap = bench_run(map, NULL, NULL, n);
+        tkv  = bench_run(NULL, kv, &lock, n);
+        printf("%2d threads: chmap %6.2f Mops/s, hashtab+rwlock %6.2f Mops/s\n",
+               n, BENCH_OPS / 1000.0 / (tmap ? tmap : 1),
+               BENCH_OPS / 1000.0 / (tkv ? tkv : 1));
+
+        chmap_destroy(map);
+        hashtab_kv_destroy(kv);
+        rwlocker_destroy(&lock);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    chmap_basic_test();
+    chmap_stress_test(1);
+    chmap_stress_test(4);
+    chmap_stress_test(16);
+    chmap_bench();
+    return 0;
+}
@@ -0,0 +1,554 @@
+/*
+ * evloop.c - epoll event loop with timers and task posting
+ *
+ * Date   : 2021/04/27
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "evloop.h"
+#include "atomic.h"
+#include "system.h"
+#include "thread.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+typedef struct evloop_io {
+    int fd;
+    uint32_t events;
+    evloop_io_cb cb;
+    void *param;
+    struct evloop_io *next; // in the garbage list
+} evloop_io_t;
+
+typedef struct evloop_task {
+    evloop_task_cb cb;
+    void *param;
+    struct evloop_task *next;
+} evloop_task_t;
+
+struct evloop {
+    int epfd;
+    int evfd;
+    volatile int32_t wake_pending; // evfd written, not read yet
+    volatile int32_t stop;
+
+    pthread_t tid;
+    volatile int32_t running;
+
+    // indexed by fd
+    evloop_io_t **ios;
+    int nios;
+    int dispatching;
+    evloop_io_t *garbage; // removed while dispatching
+
+    // pushed by cas, taken all at once by the loop
+    evloop_task_t *volatile tasks;
+
+    time_wheel_t *wheel;
+};
+
+evloop_t *
+evloop_create(void)
+{
+    struct epoll_event ev;
+    evloop_t *loop;
+
+    loop = (evloop_t *)calloc(1, sizeof(*loop));
+    if (!loop) {
+        return NULL;
+    }
+
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    loop->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    loop->wheel = time_wheel_create(system_clock());
+    if (loop->epfd < 0 || loop->evfd < 0 || !loop->wheel) {
+        goto failed;
+    }
+
+    // the only registration with data.ptr == NULL
+    memset(&ev, 0, sizeof(ev));
+    ev.events   = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->evfd, &ev) != 0) {
+        goto failed;
+    }
+    return loop;
+
+failed:
+    if (loop->wheel)
+        time_wheel_destroy(loop->wheel);
+    if (loop->evfd >= 0)
+        close(loop->evfd);
+    if (loop->epfd >= 0)
+        close(loop->epfd);
+    free(loop);
+    return NULL;
+}
+
+static void
+evloop_run_tasks(evloop_t *loop)
+{
+    evloop_task_t *list, *prev, *task, *next;
+
+    list = (evloop_task_t *)__atomic_exchange_n(&loop->tasks, NULL,
+                                                __ATOMIC_ACQUIRE);
+
+    // a stack, reverse to posting order
+    for (prev = NULL; list; list = next) {
+        next       = list->next;
+        list->next = prev;
+        prev       = list;
+    }
+
+    for (task = prev; task; task = next) {
+        next = task->next;
+        task->cb(task->param);
+        free(task);
+    }
+}
+
+void
+evloop_destroy(evloop_t *loop)
+{
+    evloop_io_t *io;
+    int i;
+
+    // tasks posted last still run, they may own memory
+    evloop_run_tasks(loop);
+
+    for (i = 0; i < loop->nios; i++) {
+        free(loop->ios[i]);
+    }
+    while ((io = loop->garbage)) {
+        loop->garbage = io->next;
+        free(io);
+    }
+    free(loop->ios);
+
+    time_wheel_destroy(loop->wheel);
+    close(loop->evfd);
+    close(loop->epfd);
+    free(loop);
+}
+
+int
+evloop_add(evloop_t *loop, int fd, uint32_t events, evloop_io_cb cb,
+           void *param)
+{
+    struct epoll_event ev;
+    evloop_io_t **ios, *io;
+    int n;
+
+    if (fd < 0 || !cb) {
+        return -EINVAL;
+    }
+
+    if (fd >= loop->nios) {
+        n   = fd < 64 ? 64 : fd * 2;
+        ios = (evloop_io_t **)realloc(loop->ios, sizeof(evloop_io_t *) * n);
+        if (!ios) {
+            return -ENOMEM;
+        }
+        memset(ios + loop->nios, 0, sizeof(evloop_io_t *) * (n - loop->nios));
+        loop->ios  = ios;
+        loop->nios = n;
+    }
+
+    if (loop->ios[fd]) {
+        return -EEXIST;
+    }
+
+    io = (evloop_io_t *)calloc(1, sizeof(*io));
+    if (!io) {
+        return -ENOMEM;
+    }
+    io->fd     = fd;
+    io->events = events;
+    io->cb     = cb;
+    io->param  = param;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events   = events;
+    ev.data.ptr = io;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        n = -errno;
+        free(io);
+        return n;
+    }
+
+    loop->ios[fd] = io;
+    return 0;
+}
+
+int
+evloop_mod(evloop_t *loop, int fd, uint32_t events)
+{
+    struct epoll_event ev;
+    evloop_io_t *io;
+
+    if (fd < 0 || fd >= loop->nios || !(io = loop->ios[fd])) {
+        return -ENOENT;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events   = events;
+    ev.data.ptr = io;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &ev) != 0) {
+        return -errno;
+    }
+    io->events = events;
+    return 0;
+}
+
+int
+evloop_del(evloop_t *loop, int fd)
+{
+    evloop_io_t *io;
+
+    if (fd < 0 || fd >= loop->nios || !(io = loop->ios[fd])) {
+        return -ENOENT;
+    }
+
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+    loop->ios[fd] = NULL;
+
+    // events of this round may still point at it
+    if (loop->dispatching) {
+        io->fd        = -1;
+        io->next      = loop->garbage;
+        loop->garbage = io;
+    } else {
+        free(io);
+    }
+    return 0;
+}
+
+static void
+evloop_wakeup(evloop_t *loop)
+{
+    uint64_t one = 1;
+    ssize_t r;
+
+    // one write per sleep is enough
+    if (atomic_cas32(&loop->wake_pending, 0, 1)) {
+        r = write(loop->evfd, &one, sizeof(one));
+        (void)r;
+    }
+}
+
+int
+evloop_post(evloop_t *loop, evloop_task_cb cb, void *param)
+{
+    evloop_task_t *task, *head;
+
+    task = (evloop_task_t *)malloc(sizeof(*task));
+    if (!task) {
+        return -ENOMEM;
+    }
+    task->cb    = cb;
+    task->param = param;
+
+    do {
+        head       = loop->tasks;
+        task->next = head;
+    } while (!atomic_cas_ptr((void *volatile *)&loop->tasks, head, task));
+
+    if (!evloop_in_loop(loop)) {
+        evloop_wakeup(loop);
+    }
+    return 0;
+}
+
+time_wheel_t *
+evloop_wheel(evloop_t *loop)
+{
+    return loop->wheel;
+}
+
+int
+evloop_timer_start(evloop_t *loop, twtimer_t *timer)
+{
+    int r = twtimer_start(loop->wheel, timer);
+    if (0 == r && !evloop_in_loop(loop)) {
+        evloop_wakeup(loop);
+    }
+    return r;
+}
+
+int
+evloop_timer_stop(evloop_t *loop, twtimer_t *timer)
+{
+    int r = twtimer_stop(loop->wheel, timer);
+    if (0 == r && !evloop_in_loop(loop)) {
+        evloop_wakeup(loop);
+    }
+    return r;
+}
+
+int
+evloop_in_loop(evloop_t *loop)
+{
+    return loop->running && pthread_equal(loop->tid, pthread_self());
+}
+
+static int
+evloop_round(evloop_t *loop, int timeout)
+{
+    struct epoll_event events[EVLOOP_MAX_EVENTS];
+    evloop_io_t *io;
+    uint64_t value;
+    int i, n, sleep, r = 0;
+    ssize_t len;
+
+    sleep = twtimer_process(loop->wheel, system_clock());
+    if (timeout < 0 || timeout > sleep) {
+        timeout = sleep == INT_MAX ? -1 : sleep;
+    }
+    if (loop->tasks || loop->stop) {
+        timeout = 0;
+    }
+
+    n = epoll_wait(loop->epfd, events, EVLOOP_MAX_EVENTS, timeout);
+    if (n < 0) {
+        return errno == EINTR ? 0 : -errno;
+    }
+
+    loop->dispatching = 1;
+    for (i = 0; i < n; i++) {
+        io = (evloop_io_t *)events[i].data.ptr;
+        if (!io) {
+            // clear the flag before taking the tasks, a post after it
+            // writes again
+            len = read(loop->evfd, &value, sizeof(value));
+            (void)len;
+            loop->wake_pending = 0;
+            __sync_synchronize();
+            continue;
+        }
+
+        if (io->fd < 0) {
+            continue; // removed by an earlier callback
+        }
+        io->cb(loop, io->fd, events[i].events, io->param);
+        r++;
+    }
+    loop->dispatching = 0;
+
+    while ((io = loop->garbage)) {
+        loop->garbage = io->next;
+        free(io);
+    }
+
+    evloop_run_tasks(loop);
+    twtimer_process(loop->wheel, system_clock());
+    return r;
+}
+
+int
+evloop_run_once(evloop_t *loop, int timeout)
+{
+    int r, owner = !loop->running;
+
+    // a round outside evloop_run() is in the loop until it returns
+    if (owner) {
+        loop->tid     = pthread_self();
+        loop->running = 1;
+    }
+
+    r = evloop_round(loop, timeout);
+
+    if (owner) {
+        loop->running = 0;
+        memset(&loop->tid, 0, sizeof(loop->tid));
+    }
+    return r;
+}
+
+int
+evloop_run(evloop_t *loop)
+{
+    int r = 0;
+
+    loop->tid     = pthread_self();
+    loop->running = 1;
+    while (!loop->stop) {
+        r = evloop_run_once(loop, -1);
+        if (r < 0) {
+            break;
+        }
+    }
+    evloop_run_tasks(loop);
+    loop->running = 0;
+    loop->stop    = 0;
+    memset(&loop->tid, 0, sizeof(loop->tid));
+    return r < 0 ? r : 0;
+}
+
+void
+evloop_stop(evloop_t *loop)
+{
+    loop->stop = 1;
+    if (!evloop_in_loop(loop)) {
+        evloop_wakeup(loop);
+    }
+}
+
+struct evloop_group {
+    int n;
+    int pin;
+    evloop_t **loops;
+    pthread_t *threads;
+    int nthreads;
+    volatile int32_t started;
+};
+
+static int STDCALL
+evloop_group_worker(void *param)
+{
+    struct evloop_group *group = (struct evloop_group *)param;
+    evloop_t *loop;
+    int i;
+#if defined(__linux__)
+    cpu_set_t set;
+#endif
+
+    // the n-th thread to start takes loop n
+    i    = atomic_increment32(&group->started) - 1;
+    loop = group->loops[i];
+
+#if defined(__linux__)
+    if (group->pin) {
+        CPU_ZERO(&set);
+        CPU_SET(i % system_getcpucount(), &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#endif
+
+    return evloop_run(loop);
+}
+
+evloop_group_t *
+evloop_group_create(int n, int pin)
+{
+    struct evloop_group *group;
+    int i;
+
+    if (n <= 0) {
+        return NULL;
+    }
+
+    group = (struct evloop_group *)calloc(1, sizeof(*group));
+    if (!group) {
+        return NULL;
+    }
+    group->pin     = pin;
+    group->loops   = (evloop_t **)calloc(n, sizeof(evloop_t *));
+    group->threads = (pthread_t *)calloc(n, sizeof(pthread_t));
+    if (!group->loops || !group->threads) {
+        goto failed;
+    }
+
+    for (i = 0; i < n; i++) {
+        group->loops[i] = evloop_create();
+        if (!group->loops[i]) {
+            goto failed;
+        }
+        group->n++;
+    }
+
+    // a loop posted to before its thread runs keeps the task
+    for (i = 0; i < n; i++) {
+        if (thread_create(&group->threads[i], evloop_group_worker, group) != 0) {
+            goto failed;
+        }
+        group->nthreads++;
+    }
+    return group;
+
+failed:
+    evloop_group_destroy(group);
+    return NULL;
+}
+
+void
+evloop_group_destroy(evloop_group_t *group)
+{
+    int i;
+
+    // the threads took the first nthreads loops
+    for (i = 0; i < group->nthreads; i++) {
+        evloop_stop(group->loops[i]);
+    }
+    for (i = 0; i < group->nthreads; i++) {
+        thread_destroy(group->threads[i]);
+    }
+
+    for (i = 0; i < group->n; i++) {
+        evloop_destroy(group->loops[i]);
+    }
+    free(group->threads);
+    free(group->loops);
+    free(group);
+}
+
+int
+evloop_group_size(evloop_group_t *group)
+{
+    return group->n;
+}
+
+evloop_t *
+evloop_group_get(evloop_group_t *group, int i)
+{
+    if (i < 0 || i >= group->n) {
+        return NULL;
+    }
+    return group->loops[i];
+}
+
+int
+evloop_reuseport_socket(int type, const char *ip, uint16_t port, int backlog)
+{
+    struct sockaddr_in addr;
+    int fd, on = 1, r;
+
+    fd = socket(AF_INET, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (ip && inet_pton(AF_INET, ip, &addr.sin_addr) != 1) {
+        close(fd);
+        return -EINVAL;
+    }
+
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0
+#ifdef SO_REUSEPORT
+        || setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0
+#endif
+        || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+        || (type == SOCK_STREAM && listen(fd, backlog) != 0)) {
+        r = -errno;
+        close(fd);
+        return r;
+    }
+    return fd;
+}
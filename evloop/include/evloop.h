@@ -0,0 +1,98 @@
+/*
+ * evloop.h - epoll event loop with timers and task posting
+ *
+ * Date   : 2021/04/27
+ */
+#ifndef __EVLOOP_H__
+#define __EVLOOP_H__
+
+#include "twtimer.h"
+#include <stdint.h>
+#include <sys/epoll.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EVLOOP_READ EPOLLIN
+#define EVLOOP_WRITE EPOLLOUT
+#define EVLOOP_EDGE EPOLLET // edge-triggered, drain the fd until EAGAIN
+#define EVLOOP_ERROR (EPOLLERR | EPOLLHUP)
+
+#ifndef EVLOOP_MAX_EVENTS
+#define EVLOOP_MAX_EVENTS 256 // per epoll_wait
+#endif
+
+typedef struct evloop evloop_t;
+
+/// @param events EVLOOP_READ/EVLOOP_WRITE/EVLOOP_ERROR that are ready
+typedef void (*evloop_io_cb)(evloop_t *loop, int fd, uint32_t events,
+                             void *param);
+typedef void (*evloop_task_cb)(void *param);
+
+/*
+ * A loop belongs to the thread running it: fds are added, modified and
+ * removed from that thread (e.g. from a callback or a posted task).
+ * evloop_post, evloop_timer_start/stop and evloop_stop may be called
+ * from any thread, they wake the loop through an eventfd.
+ * epoll_wait sleeps until the next timer of the loop's time wheel.
+ */
+evloop_t *evloop_create(void);
+void evloop_destroy(evloop_t *loop);
+
+/// @param events EVLOOP_READ|EVLOOP_WRITE, optionally EVLOOP_EDGE
+/// @return 0-ok, -errno
+int evloop_add(evloop_t *loop, int fd, uint32_t events, evloop_io_cb cb,
+               void *param);
+int evloop_mod(evloop_t *loop, int fd, uint32_t events);
+/// the fd isn't closed, no callback for it runs after
+int evloop_del(evloop_t *loop, int fd);
+
+/// run cb(param) on the loop thread, FIFO
+/// @return 0-ok, -ENOMEM
+int evloop_post(evloop_t *loop, evloop_task_cb cb, void *param);
+
+/// the time wheel of the loop, its callbacks run on the loop thread
+time_wheel_t *evloop_wheel(evloop_t *loop);
+/// twtimer_start/twtimer_stop on the loop's wheel, the loop re-computes
+/// its sleep if called from another thread
+int evloop_timer_start(evloop_t *loop, twtimer_t *timer);
+int evloop_timer_stop(evloop_t *loop, twtimer_t *timer);
+
+/// one round: timers, epoll_wait (at most timeout ms, -1 until the next
+/// timer) and the posted tasks; outside evloop_run the calling thread is
+/// the loop thread until it returns
+/// @return number of fd callbacks run, -errno
+int evloop_run_once(evloop_t *loop, int timeout);
+/// run until evloop_stop
+int evloop_run(evloop_t *loop);
+void evloop_stop(evloop_t *loop);
+/// @return 1 if called on the thread running the loop
+int evloop_in_loop(evloop_t *loop);
+
+/*
+ * One loop per thread, e.g. per core, each serving its own SO_REUSEPORT
+ * socket so the kernel spreads the connections/datagrams.
+ */
+typedef struct evloop_group evloop_group_t;
+
+/// start n threads running a loop each
+/// @param pin bind thread i to cpu i % ncpu
+evloop_group_t *evloop_group_create(int n, int pin);
+/// stop and join the threads, destroy the loops
+void evloop_group_destroy(evloop_group_t *group);
+int evloop_group_size(evloop_group_t *group);
+evloop_t *evloop_group_get(evloop_group_t *group, int i);
+
+/// a non-blocking socket bound with SO_REUSEADDR|SO_REUSEPORT, listening
+/// if SOCK_STREAM, call it once per loop with the same address
+/// @param type SOCK_STREAM or SOCK_DGRAM
+/// @param ip NULL for any
+/// @return fd, -errno
+int evloop_reuseport_socket(int type, const char *ip, uint16_t port,
+                            int backlog);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,299 @@
+/*
+ * test.c - test
+ *
+ * Date   : 2021/04/27
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "evloop.h"
+#include "atomic.h"
+#include "system.h"
+#include "thread.h"
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static int s_rounds;
+static int s_timeouts;
+
+static void ontimeout(void *param)
+{
+    evloop_t *loop = (evloop_t *)param;
+    if (++s_timeouts == 5)
+        evloop_stop(loop);
+}
+
+// the loop must sleep until the timer, not spin
+static void evloop_timer_test(void)
+{
+    twtimer_t timers[5];
+    evloop_t *loop;
+    uint64_t clock;
+    int i, r;
+
+    loop = evloop_create();
+    assert(loop);
+
+    clock = system_clock();
+    memset(timers, 0, sizeof(timers));
+    for (i = 0; i < 5; i++) {
+        timers[i].expire    = clock + 20 * (i + 1);
+        timers[i].ontimeout = ontimeout;
+        timers[i].param     = loop;
+        assert(0 == evloop_timer_start(loop, &timers[i]));
+    }
+
+    s_rounds = 0;
+    while (s_timeouts < 5) {
+        r = evloop_run_once(loop, -1);
+        assert(r >= 0);
+        s_rounds++;
+    }
+    assert(system_clock() - clock >= 100);
+    assert(s_rounds < 20);
+    assert(!evloop_in_loop(loop)); // only while a round runs
+
+    evloop_destroy(loop);
+    printf("evloop timer: 5 timeouts in %d rounds\n", s_rounds);
+}
+
+#define POSTERS 4
+#define POSTS 100000
+
+static volatile int32_t s_posted;
+static int s_last[POSTERS];
+
+static void ontask(void *param)
+{
+    intptr_t v = (intptr_t)param;
+    int id = (int)(v / POSTS), seq = (int)(v % POSTS);
+
+    // FIFO per poster
+    assert(seq == s_last[id] + 1);
+    s_last[id] = seq;
+    s_posted++;
+}
+
+static evloop_t *s_loop;
+
+static int STDCALL poster(void *param)
+{
+    intptr_t id = (intptr_t)param;
+    int i;
+    for (i = 0; i < POSTS; i++)
+        assert(0 == evloop_post(s_loop, ontask, (void *)(id * POSTS + i)));
+    return 0;
+}
+
+static int STDCALL loop_worker(void *param)
+{
+    return evloop_run((evloop_t *)param);
+}
+
+static void onstop(void *param)
+{
+    evloop_stop((evloop_t *)param);
+}
+
+static void evloop_post_test(void)
+{
+    pthread_t loop_thread, threads[POSTERS];
+    uint64_t clock;
+    intptr_t i;
+
+    s_loop = evloop_create();
+    for (i = 0; i < POSTERS; i++)
+        s_last[i] = -1;
+
+    thread_create(&loop_thread, loop_worker, s_loop);
+    clock = system_clock();
+    for (i = 0; i < POSTERS; i++)
+        thread_create(&threads[i], poster, (void *)i);
+    for (i = 0; i < POSTERS; i++)
+        thread_destroy(threads[i]);
+
+    evloop_post(s_loop, onstop, s_loop);
+    thread_destroy(loop_thread);
+    assert(s_posted == POSTERS * POSTS);
+    printf("evloop post: %d tasks from %d threads in %ums\n", (int)s_posted,
+           POSTERS, (unsigned int)(system_clock() - clock));
+
+    evloop_destroy(s_loop);
+}
+
+struct edge_ctx {
+    int reads;
+    int bytes;
+};
+
+static void onedge(evloop_t *loop, int fd, uint32_t events, void *param)
+{
+    struct edge_ctx *ctx = (struct edge_ctx *)param;
+    char buf[7];
+    ssize_t n;
+
+    (void)loop;
+    assert(events & EVLOOP_READ);
+    ctx->reads++;
+    // drain until EAGAIN, no more notification for what's left
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        ctx->bytes += (int)n;
+    assert(n < 0 && errno == EAGAIN);
+}
+
+static void ondel(evloop_t *loop, int fd, uint32_t events, void *param)
+{
+    (void)events;
+    (void)param;
+    assert(0 == evloop_del(loop, fd));
+}
+
+static void evloop_edge_test(void)
+{
+    struct edge_ctx ctx = {0, 0};
+    evloop_t *loop;
+    int fds[2], fds2[2];
+    char data[100];
+
+    loop = evloop_create();
+    assert(0 == pipe2(fds, O_NONBLOCK));
+    assert(0 == evloop_add(loop, fds[0], EVLOOP_READ | EVLOOP_EDGE, onedge, &ctx));
+    assert(-EEXIST == evloop_add(loop, fds[0], EVLOOP_READ, onedge, &ctx));
+
+    memset(data, 'x', sizeof(data));
+    assert(100 == write(fds[1], data, sizeof(data)));
+    assert(1 == evloop_run_once(loop, 100));
+    assert(1 == ctx.reads && 100 == ctx.bytes);
+
+    // nothing new, edge-triggered doesn't report again
+    assert(0 == evloop_run_once(loop, 10));
+    assert(1 == write(fds[1], "y", 1));
+    assert(1 == evloop_run_once(loop, 100));
+    assert(2 == ctx.reads && 101 == ctx.bytes);
+
+    // removed from its own callback, level-triggered
+    assert(0 == pipe2(fds2, O_NONBLOCK));
+    assert(0 == evloop_add(loop, fds2[0], EVLOOP_READ, ondel, NULL));
+    assert(1 == write(fds2[1], "z", 1));
+    assert(1 == evloop_run_once(loop, 100));
+    assert(0 == evloop_run_once(loop, 10));
+    assert(-ENOENT == evloop_del(loop, fds2[0]));
+
+    assert(0 == evloop_del(loop, fds[0]));
+    evloop_destroy(loop);
+    close(fds[0]);
+    close(fds[1]);
+    close(fds2[0]);
+    close(fds2[1]);
+    printf("evloop edge: ok\n");
+}
+
+#define LOOPS 4
+#define DATAGRAMS 4000
+
+static volatile int32_t s_recv[LOOPS];
+static volatile int32_t s_total;
+
+static void onudp(evloop_t *loop, int fd, uint32_t events, void *param)
+{
+    char buf[64];
+    intptr_t i = (intptr_t)param;
+
+    (void)loop;
+    (void)events;
+    while (recv(fd, buf, sizeof(buf), 0) > 0) {
+        atomic_increment32(&s_recv[i]);
+        atomic_increment32(&s_total);
+    }
+}
+
+struct udp_add {
+    evloop_t *loop;
+    int fd;
+    intptr_t i;
+    volatile int32_t done;
+};
+
+static void onadd(void *param)
+{
+    struct udp_add *add = (struct udp_add *)param;
+    assert(0 == evloop_add(add->loop, add->fd, EVLOOP_READ, onudp, (void *)add->i));
+    add->done = 1;
+}
+
+// SO_REUSEPORT hashes the 4-tuple, one sender socket per port
+static void evloop_reuseport_test(void)
+{
+    struct udp_add adds[LOOPS];
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    evloop_group_t *group;
+    int i, fd, used;
+    uint64_t clock;
+
+    group = evloop_group_create(LOOPS, 1);
+    assert(group && LOOPS == evloop_group_size(group));
+
+    for (i = 0; i < LOOPS; i++) {
+        adds[i].loop = evloop_group_get(group, i);
+        adds[i].i    = i;
+        adds[i].done = 0;
+        adds[i].fd   = evloop_reuseport_socket(SOCK_DGRAM, "127.0.0.1",
+                                               i ? ntohs(addr.sin_port) : 0, 0);
+        assert(adds[i].fd >= 0);
+        if (0 == i)
+            assert(0 == getsockname(adds[0].fd, (struct sockaddr *)&addr, &len));
+        // fds are added by the loop thread
+        assert(0 == evloop_post(adds[i].loop, onadd, &adds[i]));
+    }
+    for (i = 0; i < LOOPS; i++) {
+        while (!adds[i].done)
+            system_sleep(1);
+    }
+
+    for (i = 0; i < DATAGRAMS; i++) {
+        fd = socket(AF_INET, SOCK_DGRAM, 0);
+        assert(sizeof(i) == sendto(fd, &i, sizeof(i), 0,
+                                   (struct sockaddr *)&addr, sizeof(addr)));
+        close(fd);
+    }
+
+    clock = system_clock();
+    while (s_total < DATAGRAMS && system_clock() - clock < 2000)
+        system_sleep(1);
+
+    for (used = i = 0; i < LOOPS; i++)
+        used += s_recv[i] ? 1 : 0;
+    printf("evloop reuseport: %d datagrams, per loop %d/%d/%d/%d\n",
+           (int)s_total, (int)s_recv[0], (int)s_recv[1], (int)s_recv[2],
+           (int)s_recv[3]);
+    assert(used > 1);
+
+    evloop_group_destroy(group);
+    for (i = 0; i < LOOPS; i++)
+        close(adds[i].fd);
+}
+
+int main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    evloop_timer_test();
+    evloop_edge_test();
+    evloop_post_test();
+    evloop_reuseport_test();
+    return 0;
+}
@@ -0,0 +1,1083 @@
+/*
+ * fileio.c - asynchronous file I/O, io_uring or thread pool
+ *
+ * Date   : 2021/04/28
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "fileio.h"
+#include "atomic.h"
+#include "system.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define FILEIO_HAVE_URING 1
+#endif
+
+#define FILEIO_MAX_ENTRIES 4096
+
+enum {
+    FILEIO_OP_READ,
+    FILEIO_OP_WRITE,
+    FILEIO_OP_READ_FIXED,
+    FILEIO_OP_WRITE_FIXED,
+    FILEIO_OP_FSYNC,
+    FILEIO_OP_RENAME,
+};
+
+struct fileio_req {
+    int op;
+    int fd;
+    int index; // registered buffer
+    int datasync;
+    void *buf;
+    size_t len;
+    uint64_t offset;
+    char *from; // rename, to follows it in the same allocation
+    char *to;
+
+    int result;
+    fileio_cb cb;
+    void *param;
+    struct fileio *io;
+    struct fileio_req *next;
+};
+
+#if defined(FILEIO_HAVE_URING)
+struct fileio_ring {
+    int fd;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_entries;
+    unsigned int *sq_array;
+    struct io_uring_sqe *sqes;
+
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_size;
+    size_t cq_size;
+    size_t sqes_size;
+
+    int rename;  // IORING_OP_RENAMEAT supported
+    int fixed;   // buffers registered with the kernel
+    pthread_mutex_t sq_lock;
+};
+#endif
+
+struct fileio {
+    int backend;
+    unsigned int entries;
+    volatile int32_t inflight;
+    int evfd;
+
+    thread_pool_t *pool;
+    int own_pool;
+    pthread_mutex_t pool_lock;
+
+    // finished on the pool, pushed by cas
+    struct fileio_req *volatile done;
+    // reaping the ring is single consumer
+    pthread_mutex_t poll_lock;
+
+    struct iovec *iov;
+    unsigned int niov;
+
+#if defined(FILEIO_HAVE_URING)
+    struct fileio_ring ring;
+#endif
+};
+
+//------------------------------------------------------------------------
+// thread pool backend
+
+static void
+fileio_signal(struct fileio *io)
+{
+    uint64_t one = 1;
+    ssize_t r;
+
+    r = write(io->evfd, &one, sizeof(one));
+    (void)r;
+}
+
+static void
+fileio_worker(void *param)
+{
+    struct fileio_req *req = (struct fileio_req *)param;
+    struct fileio *io      = req->io;
+    struct fileio_req *head;
+    ssize_t r;
+
+    switch (req->op) {
+    case FILEIO_OP_READ:
+    case FILEIO_OP_READ_FIXED:
+        r = pread(req->fd, req->buf, req->len, (off_t)req->offset);
+        break;
+    case FILEIO_OP_WRITE:
+    case FILEIO_OP_WRITE_FIXED:
+        r = pwrite(req->fd, req->buf, req->len, (off_t)req->offset);
+        break;
+    case FILEIO_OP_FSYNC:
+        r = req->datasync ? fdatasync(req->fd) : fsync(req->fd);
+        break;
+    case FILEIO_OP_RENAME:
+        r = rename(req->from, req->to);
+        break;
+    default:
+        r     = -1;
+        errno = EINVAL;
+        break;
+    }
+    req->result = r < 0 ? -errno : (int)r;
+
+    do {
+        head      = io->done;
+        req->next = head;
+    } while (!atomic_cas_ptr((void *volatile *)&io->done, head, req));
+    fileio_signal(io);
+}
+
+static int
+fileio_pool_submit(struct fileio *io, struct fileio_req *req)
+{
+    int r;
+
+    if (!io->pool) {
+        pthread_mutex_lock(&io->pool_lock);
+        if (!io->pool) {
+            io->pool     = thread_pool_create(2, 8);
+            io->own_pool = 1;
+        }
+        pthread_mutex_unlock(&io->pool_lock);
+        if (!io->pool) {
+            return -ENOMEM;
+        }
+    }
+
+    r = thread_pool_push(io->pool, fileio_worker, req);
+    return r < 0 ? r : 0;
+}
+
+static int
+fileio_pool_reap(struct fileio *io, struct fileio_req **list)
+{
+    struct fileio_req *req, *next, *prev = *list;
+    int n = 0;
+
+    if (!io->done) {
+        return 0;
+    }
+
+    // a stack, reverse to completion order
+    req = (struct fileio_req *)__atomic_exchange_n(&io->done, NULL,
+                                                   __ATOMIC_ACQUIRE);
+    for (; req; req = next, n++) {
+        next      = req->next;
+        req->next = prev;
+        prev      = req;
+    }
+    *list = prev;
+    return n;
+}
+
+//------------------------------------------------------------------------
+// io_uring backend, raw syscalls, no liburing
+
+#if defined(FILEIO_HAVE_URING)
+static int
+fileio_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+fileio_uring_enter(int fd, unsigned int submit, unsigned int complete,
+                   unsigned int flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, submit, complete, flags,
+                        NULL, 0);
+}
+
+static int
+fileio_uring_register(int fd, unsigned int opcode, const void *arg,
+                      unsigned int n)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, n);
+}
+
+static int
+fileio_uring_probe(struct fileio_ring *ring)
+{
+    static const int ops[] = {IORING_OP_READ, IORING_OP_WRITE,
+                              IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED,
+                              IORING_OP_FSYNC};
+    struct io_uring_probe *probe;
+    size_t i;
+    int r = -1;
+
+    probe = (struct io_uring_probe *)calloc(
+        1, sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op));
+    if (!probe) {
+        return -1;
+    }
+
+    if (0 == fileio_uring_register(ring->fd, IORING_REGISTER_PROBE, probe,
+                                   256)) {
+        for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+            if (ops[i] > probe->last_op
+                || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED))
+                break;
+        }
+        if (i == sizeof(ops) / sizeof(ops[0])) {
+            ring->rename = IORING_OP_RENAMEAT <= probe->last_op
+                           && (probe->ops[IORING_OP_RENAMEAT].flags
+                               & IO_URING_OP_SUPPORTED);
+            r = 0;
+        }
+    }
+    free(probe);
+    return r;
+}
+
+static void
+fileio_uring_exit(struct fileio_ring *ring)
+{
+    if (ring->sqes)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ptr && ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_size);
+    if (ring->sq_ptr)
+        munmap(ring->sq_ptr, ring->sq_size);
+    if (ring->fd >= 0)
+        close(ring->fd);
+    pthread_mutex_destroy(&ring->sq_lock);
+}
+
+static int
+fileio_uring_init(struct fileio *io)
+{
+    struct fileio_ring *ring = &io->ring;
+    struct io_uring_params p;
+    char *sq, *cq;
+
+    memset(ring, 0, sizeof(*ring));
+    pthread_mutex_init(&ring->sq_lock, NULL);
+
+    // a completion per entry in flight, the cq ring never overflows
+    memset(&p, 0, sizeof(p));
+    ring->fd = fileio_uring_setup(io->entries, &p);
+    if (ring->fd < 0 || !(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        goto failed;
+    }
+
+    ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (ring->cq_size > ring->sq_size)
+        ring->sq_size = ring->cq_size;
+    ring->cq_size = ring->sq_size;
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_SQ_RING);
+    if (MAP_FAILED == ring->sq_ptr) {
+        ring->sq_ptr = NULL;
+        goto failed;
+    }
+    ring->cq_ptr = ring->sq_ptr;
+
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes      = (struct io_uring_sqe *)mmap(
+        NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (MAP_FAILED == ring->sqes) {
+        ring->sqes = NULL;
+        goto failed;
+    }
+
+    sq               = (char *)ring->sq_ptr;
+    ring->sq_head    = (unsigned int *)(sq + p.sq_off.head);
+    ring->sq_tail    = (unsigned int *)(sq + p.sq_off.tail);
+    ring->sq_mask    = (unsigned int *)(sq + p.sq_off.ring_mask);
+    ring->sq_entries = (unsigned int *)(sq + p.sq_off.ring_entries);
+    ring->sq_array   = (unsigned int *)(sq + p.sq_off.array);
+
+    cq            = (char *)ring->cq_ptr;
+    ring->cq_head = (unsigned int *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+    ring->cqes    = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    if (0 != fileio_uring_probe(ring)
+        || 0 != fileio_uring_register(ring->fd, IORING_REGISTER_EVENTFD,
+                                      &io->evfd, 1)) {
+        goto failed;
+    }
+    return 0;
+
+failed:
+    fileio_uring_exit(ring);
+    return -1;
+}
+
+static int
+fileio_uring_submit(struct fileio *io, struct fileio_req *req)
+{
+    struct fileio_ring *ring = &io->ring;
+    struct io_uring_sqe *sqe;
+    unsigned int head, tail, idx;
+    int r;
+
+    pthread_mutex_lock(&ring->sq_lock);
+    tail = *ring->sq_tail;
+    head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (tail - head >= *ring->sq_entries) {
+        pthread_mutex_unlock(&ring->sq_lock);
+        return -EAGAIN;
+    }
+
+    idx = tail & *ring->sq_mask;
+    sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd        = req->fd;
+    sqe->addr      = (uint64_t)(uintptr_t)req->buf;
+    sqe->len       = (uint32_t)req->len;
+    sqe->off       = req->offset;
+    sqe->user_data = (uint64_t)(uintptr_t)req;
+
+    switch (req->op) {
+    case FILEIO_OP_READ: sqe->opcode = IORING_OP_READ; break;
+    case FILEIO_OP_WRITE: sqe->opcode = IORING_OP_WRITE; break;
+    case FILEIO_OP_READ_FIXED:
+        sqe->opcode    = ring->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->buf_index = ring->fixed ? (uint16_t)req->index : 0;
+        break;
+    case FILEIO_OP_WRITE_FIXED:
+        sqe->opcode    = ring->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->buf_index = ring->fixed ? (uint16_t)req->index : 0;
+        break;
+    case FILEIO_OP_FSYNC:
+        sqe->opcode      = IORING_OP_FSYNC;
+        sqe->addr        = 0;
+        sqe->len         = 0;
+        sqe->off         = 0;
+        sqe->fsync_flags = req->datasync ? IORING_FSYNC_DATASYNC : 0;
+        break;
+    case FILEIO_OP_RENAME:
+        sqe->opcode = IORING_OP_RENAMEAT;
+        sqe->fd     = AT_FDCWD;
+        sqe->addr   = (uint64_t)(uintptr_t)req->from;
+        sqe->len    = (uint32_t)AT_FDCWD;
+        sqe->addr2  = (uint64_t)(uintptr_t)req->to;
+        break;
+    default: assert(0); break;
+    }
+
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    // also resubmits what an earlier enter left in the ring
+    do {
+        r = fileio_uring_enter(ring->fd, tail + 1 - head, 0, 0);
+    } while (r < 0 && EINTR == errno);
+    pthread_mutex_unlock(&ring->sq_lock);
+
+    // the tail is published, req belongs to the ring now: an sqe left
+    // queued by a failed enter goes in with fileio_uring_flush, and req
+    // is freed by its completion
+    return 0;
+}
+
+// enter what is still queued in the sq ring
+// @return sqes left queued
+static unsigned int
+fileio_uring_flush(struct fileio *io)
+{
+    struct fileio_ring *ring = &io->ring;
+    unsigned int head, tail;
+    int r;
+
+    if (__atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == *ring->sq_tail)
+        return 0;
+
+    pthread_mutex_lock(&ring->sq_lock);
+    tail = *ring->sq_tail;
+    head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (tail != head) {
+        do {
+            r = fileio_uring_enter(ring->fd, tail - head, 0, 0);
+        } while (r < 0 && EINTR == errno);
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    }
+    pthread_mutex_unlock(&ring->sq_lock);
+    return tail - head;
+}
+
+static int
+fileio_uring_reap(struct fileio *io, struct fileio_req **list)
+{
+    struct fileio_ring *ring = &io->ring;
+    struct fileio_req *req, *last = NULL;
+    struct io_uring_cqe *cqe;
+    unsigned int head, tail;
+    int n = 0;
+
+    head = *ring->cq_head;
+    tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++, n++) {
+        cqe         = &ring->cqes[head & *ring->cq_mask];
+        req         = (struct fileio_req *)(uintptr_t)cqe->user_data;
+        req->result = cqe->res;
+        req->next   = NULL;
+        if (last)
+            last->next = req;
+        else
+            *list = req;
+        last = req;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return n;
+}
+#endif
+
+//------------------------------------------------------------------------
+
+fileio_t *
+fileio_create(unsigned int entries, int flags, thread_pool_t *pool)
+{
+    struct fileio *io;
+    unsigned int n;
+
+    if (entries < 1 || entries > FILEIO_MAX_ENTRIES) {
+        return NULL;
+    }
+    for (n = 1; n < entries; n <<= 1) {
+    }
+
+    io = (struct fileio *)calloc(1, sizeof(*io));
+    if (!io) {
+        return NULL;
+    }
+    io->entries = n;
+    io->pool    = pool;
+    pthread_mutex_init(&io->pool_lock, NULL);
+    pthread_mutex_init(&io->poll_lock, NULL);
+
+    io->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (io->evfd < 0) {
+        goto failed;
+    }
+
+    io->backend = FILEIO_THREADS;
+#if defined(FILEIO_HAVE_URING)
+    io->ring.fd = -1;
+    if (!(flags & FILEIO_FORCE_THREADS) && 0 == fileio_uring_init(io)) {
+        io->backend = FILEIO_URING;
+    }
+#else
+    (void)flags;
+#endif
+
+    if (FILEIO_THREADS == io->backend && !io->pool) {
+        io->pool     = thread_pool_create(4, 16);
+        io->own_pool = 1;
+        if (!io->pool) {
+            goto failed;
+        }
+    }
+    return io;
+
+failed:
+    if (io->evfd >= 0)
+        close(io->evfd);
+    pthread_mutex_destroy(&io->pool_lock);
+    pthread_mutex_destroy(&io->poll_lock);
+    free(io);
+    return NULL;
+}
+
+void
+fileio_destroy(fileio_t *io)
+{
+    while (io->inflight > 0) {
+        fileio_poll(io, 1, -1);
+    }
+
+#if defined(FILEIO_HAVE_URING)
+    if (FILEIO_URING == io->backend) {
+        fileio_uring_exit(&io->ring);
+    }
+#endif
+    if (io->own_pool && io->pool) {
+        thread_pool_destroy(io->pool);
+    }
+
+    close(io->evfd);
+    pthread_mutex_destroy(&io->pool_lock);
+    pthread_mutex_destroy(&io->poll_lock);
+    free(io->iov);
+    free(io);
+}
+
+int
+fileio_backend(fileio_t *io)
+{
+    return io->backend;
+}
+
+int
+fileio_fd(fileio_t *io)
+{
+    return io->evfd;
+}
+
+int
+fileio_inflight(fileio_t *io)
+{
+    return (int)io->inflight;
+}
+
+static int
+fileio_submit(struct fileio *io, struct fileio_req *req)
+{
+    int r;
+
+    // bounds the cq ring and the pool queue
+    if (atomic_increment32(&io->inflight) > (int32_t)io->entries) {
+        atomic_decrement32(&io->inflight);
+        free(req);
+        return -EAGAIN;
+    }
+
+    req->io = io;
+#if defined(FILEIO_HAVE_URING)
+    if (FILEIO_URING == io->backend
+        && (FILEIO_OP_RENAME != req->op || io->ring.rename)) {
+        r = fileio_uring_submit(io, req);
+    } else
+#endif
+    {
+        r = fileio_pool_submit(io, req);
+    }
+
+    if (0 != r) {
+        atomic_decrement32(&io->inflight);
+        free(req);
+    }
+    return r;
+}
+
+static struct fileio_req *
+fileio_req_alloc(int op, int fd, void *buf, size_t len, uint64_t offset,
+                 fileio_cb cb, void *param)
+{
+    struct fileio_req *req;
+
+    req = (struct fileio_req *)calloc(1, sizeof(*req));
+    if (req) {
+        req->op     = op;
+        req->fd     = fd;
+        req->buf    = buf;
+        req->len    = len;
+        req->offset = offset;
+        req->cb     = cb;
+        req->param  = param;
+    }
+    return req;
+}
+
+int
+fileio_read(fileio_t *io, int fd, void *buf, size_t len, uint64_t offset,
+            fileio_cb cb, void *param)
+{
+    struct fileio_req *req;
+
+    if (len > INT32_MAX) {
+        return -EINVAL;
+    }
+    req = fileio_req_alloc(FILEIO_OP_READ, fd, buf, len, offset, cb, param);
+    return req ? fileio_submit(io, req) : -ENOMEM;
+}
+
+int
+fileio_write(fileio_t *io, int fd, const void *buf, size_t len,
+             uint64_t offset, fileio_cb cb, void *param)
+{
+    struct fileio_req *req;
+
+    if (len > INT32_MAX) {
+        return -EINVAL;
+    }
+    req = fileio_req_alloc(FILEIO_OP_WRITE, fd, (void *)buf, len, offset, cb,
+                           param);
+    return req ? fileio_submit(io, req) : -ENOMEM;
+}
+
+int
+fileio_fsync(fileio_t *io, int fd, int datasync, fileio_cb cb, void *param)
+{
+    struct fileio_req *req;
+
+    req = fileio_req_alloc(FILEIO_OP_FSYNC, fd, NULL, 0, 0, cb, param);
+    if (!req) {
+        return -ENOMEM;
+    }
+    req->datasync = datasync;
+    return fileio_submit(io, req);
+}
+
+int
+fileio_rename(fileio_t *io, const char *from, const char *to, fileio_cb cb,
+              void *param)
+{
+    struct fileio_req *req;
+    size_t n1, n2;
+
+    n1  = strlen(from) + 1;
+    n2  = strlen(to) + 1;
+    req = (struct fileio_req *)calloc(1, sizeof(*req) + n1 + n2);
+    if (!req) {
+        return -ENOMEM;
+    }
+    req->op    = FILEIO_OP_RENAME;
+    req->fd    = -1;
+    req->from  = (char *)(req + 1);
+    req->to    = req->from + n1;
+    req->cb    = cb;
+    req->param = param;
+    memcpy(req->from, from, n1);
+    memcpy(req->to, to, n2);
+    return fileio_submit(io, req);
+}
+
+int
+fileio_register_buffers(fileio_t *io, const struct iovec *iov, unsigned int n)
+{
+    struct iovec *v;
+
+    if (n > UINT16_MAX) {
+        return -EINVAL;
+    }
+
+    v = NULL;
+    if (n > 0) {
+        v = (struct iovec *)malloc(sizeof(struct iovec) * n);
+        if (!v) {
+            return -ENOMEM;
+        }
+        memcpy(v, iov, sizeof(struct iovec) * n);
+    }
+
+#if defined(FILEIO_HAVE_URING)
+    if (FILEIO_URING == io->backend) {
+        if (io->ring.fixed) {
+            fileio_uring_register(io->ring.fd, IORING_UNREGISTER_BUFFERS, NULL,
+                                  0);
+            io->ring.fixed = 0;
+        }
+        // over RLIMIT_MEMLOCK on older kernels, plain reads/writes then
+        if (n > 0
+            && 0 == fileio_uring_register(io->ring.fd,
+                                          IORING_REGISTER_BUFFERS, v, n)) {
+            io->ring.fixed = 1;
+        }
+    }
+#endif
+
+    free(io->iov);
+    io->iov  = v;
+    io->niov = n;
+    return 0;
+}
+
+static int
+fileio_fixed_check(struct fileio *io, int index, const void *buf, size_t len)
+{
+    const char *base;
+
+    if (index < 0 || (unsigned int)index >= io->niov) {
+        return -EINVAL;
+    }
+    base = (const char *)io->iov[index].iov_base;
+    if ((const char *)buf < base
+        || (const char *)buf + len > base + io->iov[index].iov_len) {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+int
+fileio_read_fixed(fileio_t *io, int fd, int index, void *buf, size_t len,
+                  uint64_t offset, fileio_cb cb, void *param)
+{
+    struct fileio_req *req;
+
+    if (0 != fileio_fixed_check(io, index, buf, len)) {
+        return -EINVAL;
+    }
+    req = fileio_req_alloc(FILEIO_OP_READ_FIXED, fd, buf, len, offset, cb,
+                           param);
+    if (!req) {
+        return -ENOMEM;
+    }
+    req->index = index;
+    return fileio_submit(io, req);
+}
+
+int
+fileio_write_fixed(fileio_t *io, int fd, int index, const void *buf,
+                   size_t len, uint64_t offset, fileio_cb cb, void *param)
+{
+    struct fileio_req *req;
+
+    if (0 != fileio_fixed_check(io, index, buf, len)) {
+        return -EINVAL;
+    }
+    req = fileio_req_alloc(FILEIO_OP_WRITE_FIXED, fd, (void *)buf, len,
+                           offset, cb, param);
+    if (!req) {
+        return -ENOMEM;
+    }
+    req->index = index;
+    return fileio_submit(io, req);
+}
+
+static int
+fileio_reap(struct fileio *io)
+{
+    struct fileio_req *list = NULL, *pool = NULL, *req, *next;
+    uint64_t value;
+    ssize_t len;
+    int n = 0;
+
+    // clear the eventfd first, a completion after it signals again
+    len = read(io->evfd, &value, sizeof(value));
+    (void)len;
+
+#if defined(FILEIO_HAVE_URING)
+    if (FILEIO_URING == io->backend) {
+        fileio_uring_flush(io);
+    }
+#endif
+
+    pthread_mutex_lock(&io->poll_lock);
+#if defined(FILEIO_HAVE_URING)
+    if (FILEIO_URING == io->backend) {
+        n += fileio_uring_reap(io, &list);
+    }
+#endif
+    n += fileio_pool_reap(io, &pool);
+    pthread_mutex_unlock(&io->poll_lock);
+
+    // callbacks may submit or poll again
+    for (req = list; req; req = next) {
+        next = req->next;
+        atomic_decrement32(&io->inflight);
+        if (req->cb)
+            req->cb(req->param, req->result);
+        free(req);
+    }
+    for (req = pool; req; req = next) {
+        next = req->next;
+        atomic_decrement32(&io->inflight);
+        if (req->cb)
+            req->cb(req->param, req->result);
+        free(req);
+    }
+    return n;
+}
+
+int
+fileio_poll(fileio_t *io, int min, int timeout)
+{
+    struct pollfd pfd;
+    uint64_t clock = 0;
+    int n = 0, wait;
+
+    if (timeout > 0) {
+        clock = system_clock();
+    }
+
+    for (;;) {
+        n += fileio_reap(io);
+        if (n >= min || io->inflight <= 0 || 0 == timeout) {
+            break;
+        }
+
+        wait = timeout;
+        if (timeout > 0) {
+            wait = timeout - (int)(system_clock() - clock);
+            if (wait <= 0) {
+                break;
+            }
+        }
+
+#if defined(FILEIO_HAVE_URING)
+        // sqes the kernel turned away make no completion to wake us,
+        // retry them soon
+        if (FILEIO_URING == io->backend && (wait < 0 || wait > 1)
+            && fileio_uring_flush(io) > 0) {
+            wait = 1;
+        }
+#endif
+
+        pfd.fd      = io->evfd;
+        pfd.events  = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, wait) < 0 && EINTR != errno) {
+            return -errno;
+        }
+    }
+
+    return (n < min && io->inflight > 0) ? -ETIMEDOUT : n;
+}
+
+//------------------------------------------------------------------------
+// read-ahead reader
+
+#define FILEIO_READER_MAX_DEPTH 16
+
+enum { FILEIO_BLOCK_IDLE, FILEIO_BLOCK_PENDING, FILEIO_BLOCK_READY };
+
+struct fileio_block {
+    char *data;
+    uint64_t offset;
+    int len; // bytes read, -errno
+    volatile int state;
+};
+
+struct fileio_reader {
+    fileio_t *io;
+    int fd;
+    size_t block;
+    int depth;
+    uint64_t size;
+
+    uint64_t pos;  // next byte for the caller
+    uint64_t next; // offset of the next block to submit
+    int head;      // block holding pos
+    int count;     // blocks submitted from head on
+    struct fileio_block blocks[FILEIO_READER_MAX_DEPTH];
+};
+
+static void
+fileio_reader_oncomplete(void *param, int result)
+{
+    struct fileio_block *b = (struct fileio_block *)param;
+    b->len                 = result;
+    b->state               = FILEIO_BLOCK_READY;
+}
+
+// @return 0-ok or engine full, other-the error of fileio_read
+static int
+fileio_reader_fill(struct fileio_reader *r)
+{
+    struct fileio_block *b;
+    size_t len;
+    int ret;
+
+    while (r->count < r->depth && r->next < r->size) {
+        b   = &r->blocks[(r->head + r->count) % r->depth];
+        len = r->size - r->next < r->block ? (size_t)(r->size - r->next)
+                                           : r->block;
+        b->offset = r->next;
+        b->state  = FILEIO_BLOCK_PENDING;
+        ret = fileio_read(r->io, r->fd, b->data, len, b->offset,
+                          fileio_reader_oncomplete, b);
+        if (0 != ret) {
+            // engine full, retried after the next completion
+            b->state = FILEIO_BLOCK_IDLE;
+            return -EAGAIN == ret ? 0 : ret;
+        }
+        r->next += len;
+        r->count++;
+    }
+    return 0;
+}
+
+static void
+fileio_reader_wait(struct fileio_reader *r, struct fileio_block *b)
+{
+    while (FILEIO_BLOCK_PENDING == b->state) {
+        fileio_poll(r->io, 1, -1);
+    }
+}
+
+static void
+fileio_reader_drop(struct fileio_reader *r)
+{
+    struct fileio_block *b = &r->blocks[r->head];
+
+    fileio_reader_wait(r, b);
+    b->state = FILEIO_BLOCK_IDLE;
+    r->head  = (r->head + 1) % r->depth;
+    r->count--;
+}
+
+fileio_reader_t *
+fileio_reader_open(fileio_t *io, const char *file, size_t block, int depth)
+{
+    struct fileio_reader *r;
+    struct stat st;
+    int i;
+
+    if (depth < 1 || depth > FILEIO_READER_MAX_DEPTH || block < 512
+        || block > INT32_MAX) {
+        return NULL;
+    }
+
+    r = (struct fileio_reader *)calloc(1, sizeof(*r));
+    if (!r) {
+        return NULL;
+    }
+    r->io    = io;
+    r->block = (block + 4095) & ~(size_t)4095;
+    r->depth = depth;
+    r->fd    = open(file, O_RDONLY | O_CLOEXEC);
+    if (r->fd < 0 || 0 != fstat(r->fd, &st)) {
+        goto failed;
+    }
+    r->size = (uint64_t)st.st_size;
+    posix_fadvise(r->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    for (i = 0; i < depth; i++) {
+        r->blocks[i].data = (char *)aligned_alloc(4096, r->block);
+        if (!r->blocks[i].data) {
+            goto failed;
+        }
+    }
+
+    fileio_reader_fill(r);
+    return r;
+
+failed:
+    fileio_reader_close(r);
+    return NULL;
+}
+
+void
+fileio_reader_close(fileio_reader_t *r)
+{
+    int i;
+
+    while (r->count > 0) {
+        fileio_reader_drop(r);
+    }
+    for (i = 0; i < r->depth; i++) {
+        free(r->blocks[i].data);
+    }
+    if (r->fd >= 0) {
+        close(r->fd);
+    }
+    free(r);
+}
+
+int
+fileio_reader_read(fileio_reader_t *r, void *buf, size_t len)
+{
+    struct fileio_block *b;
+    size_t n, total = 0;
+    uint64_t in;
+    int ret;
+
+    while (total < len && r->pos < r->size) {
+        ret = fileio_reader_fill(r);
+        if (0 == r->count) {
+            if (0 != ret) {
+                return ret; // nothing in flight to wait for
+            }
+            // nothing could be submitted, make room
+            fileio_poll(r->io, 1, -1);
+            continue;
+        }
+
+        b = &r->blocks[r->head];
+        fileio_reader_wait(r, b);
+        if (b->len < 0) {
+            return b->len;
+        }
+
+        in = r->pos - b->offset;
+        if (in >= (uint64_t)b->len) {
+            if ((uint64_t)b->len < r->block && b->offset + b->len < r->size) {
+                break; // truncated under us
+            }
+            fileio_reader_drop(r);
+            continue;
+        }
+
+        n = (size_t)((uint64_t)b->len - in);
+        if (n > len - total) {
+            n = len - total;
+        }
+        memcpy((char *)buf + total, b->data + in, n);
+        total += n;
+        r->pos += n;
+        if (r->pos >= b->offset + (uint64_t)b->len) {
+            fileio_reader_drop(r);
+        }
+    }
+
+    // refill while the caller works on this data
+    fileio_reader_fill(r);
+    return (int)total;
+}
+
+int
+fileio_reader_seek(fileio_reader_t *r, uint64_t offset)
+{
+    if (offset > r->size) {
+        return -EINVAL;
+    }
+
+    if (r->count > 0 && offset >= r->blocks[r->head].offset
+        && offset < r->next) {
+        // forward inside the read-ahead, keep what follows
+        while (offset >= r->blocks[r->head].offset + r->block) {
+            fileio_reader_drop(r);
+        }
+    } else {
+        while (r->count > 0) {
+            fileio_reader_drop(r);
+        }
+        r->head = 0;
+        r->next = offset;
+    }
+
+    r->pos = offset;
+    fileio_reader_fill(r);
+    return 0;
+}
+
+uint64_t
+fileio_reader_tell(fileio_reader_t *r)
+{
+    return r->pos;
+}
+
+uint64_t
+fileio_reader_size(fileio_reader_t *r)
+{
+    return r->size;
+}
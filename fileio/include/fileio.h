@@ -0,0 +1,108 @@
+/*
+ * fileio.h - asynchronous file I/O, io_uring or thread pool
+ *
+ * Date   : 2021/04/28
+ */
+#ifndef __FILEIO_H__
+#define __FILEIO_H__
+
+#include "thread-pool.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+    FILEIO_URING   = 1, // io_uring, linux 5.6+
+    FILEIO_THREADS = 2, // blocking syscalls on a thread pool
+};
+
+#define FILEIO_FORCE_THREADS 0x01 // fileio_create flag, don't try io_uring
+
+typedef struct fileio fileio_t;
+
+/// @param result bytes read/written, 0 for fsync/rename, -errno on error
+typedef void (*fileio_cb)(void *param, int result);
+
+/*
+ * Requests are submitted from any thread. Callbacks run on the thread
+ * calling fileio_poll(), never inside a submit, so the owner of the
+ * engine (e.g. an event loop) sees them in one place:
+ *   evloop_add(loop, fileio_fd(io), EVLOOP_READ, on_fileio, io)
+ * with on_fileio calling fileio_poll(io, 0, 0).
+ *
+ * io_uring needs the READ, WRITE, FSYNC ops and the FIXED variants (5.6),
+ * without them, or with FILEIO_FORCE_THREADS, the syscalls run on the
+ * thread pool.
+ * RENAMEAT (5.11) falls back to the pool alone.
+ */
+
+/// @param entries max requests in flight, rounded up to a power of 2
+/// @param pool used for the blocking syscalls, NULL to create one
+/// @return NULL on error
+fileio_t *fileio_create(unsigned int entries, int flags, thread_pool_t *pool);
+/// wait for the requests in flight, their callbacks run
+void fileio_destroy(fileio_t *io);
+/// @return FILEIO_URING or FILEIO_THREADS
+int fileio_backend(fileio_t *io);
+/// readable when completions are pending
+int fileio_fd(fileio_t *io);
+
+/// @return 0-ok, -EAGAIN if entries are in flight, -errno
+int fileio_read(fileio_t *io, int fd, void *buf, size_t len, uint64_t offset,
+                fileio_cb cb, void *param);
+int fileio_write(fileio_t *io, int fd, const void *buf, size_t len,
+                 uint64_t offset, fileio_cb cb, void *param);
+/// covers the writes completed before it, not the ones in flight
+/// @param datasync 1-fdatasync
+int fileio_fsync(fileio_t *io, int fd, int datasync, fileio_cb cb,
+                 void *param);
+/// the paths are copied
+int fileio_rename(fileio_t *io, const char *from, const char *to, fileio_cb cb,
+                  void *param);
+
+/// pin buffers once, io_uring skips mapping them per request. Replaces
+/// any previous set, no fixed request may be in flight
+/// @return 0-ok, -errno
+int fileio_register_buffers(fileio_t *io, const struct iovec *iov,
+                            unsigned int n);
+/// buf/len must lie in the registered buffer index
+int fileio_read_fixed(fileio_t *io, int fd, int index, void *buf, size_t len,
+                      uint64_t offset, fileio_cb cb, void *param);
+int fileio_write_fixed(fileio_t *io, int fd, int index, const void *buf,
+                       size_t len, uint64_t offset, fileio_cb cb, void *param);
+
+/// run the callbacks of completed requests
+/// @param min wait for at least min completions (at most the in flight)
+/// @param timeout ms, -1 no limit
+/// @return completions reaped, -ETIMEDOUT if fewer than min
+int fileio_poll(fileio_t *io, int min, int timeout);
+/// @return requests submitted and not reaped yet
+int fileio_inflight(fileio_t *io);
+
+/*
+ * Sequential reader with read-ahead: depth blocks are in flight while
+ * the caller consumes the current one. Polls the engine itself when it
+ * waits, other callbacks of the engine may run from it.
+ */
+typedef struct fileio_reader fileio_reader_t;
+
+/// @param block bytes per read, e.g. 256KB
+/// @param depth blocks read ahead, 1..16
+fileio_reader_t *fileio_reader_open(fileio_t *io, const char *file,
+                                    size_t block, int depth);
+void fileio_reader_close(fileio_reader_t *r);
+/// @return bytes copied, less than len only at EOF, -errno
+int fileio_reader_read(fileio_reader_t *r, void *buf, size_t len);
+/// drops the blocks read ahead unless offset falls in them
+int fileio_reader_seek(fileio_reader_t *r, uint64_t offset);
+uint64_t fileio_reader_tell(fileio_reader_t *r);
+uint64_t fileio_reader_size(fileio_reader_t *r);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,242 @@
+/*
+ * test.c - test
+ *
+ * Date   : 2021/04/28
+ */
+
+#include "fileio.h"
+#include "evloop.h"
+#include "system.h"
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BLOCK (64 * 1024)
+#define BLOCKS 256 // 16MB
+
+static const char *s_file  = "fileio_test.dat";
+static const char *s_file2 = "fileio_test.dat.1";
+
+struct result {
+    int calls;
+    int bytes;
+    int error;
+};
+
+static void oncomplete(void *param, int result)
+{
+    struct result *r = (struct result *)param;
+    r->calls++;
+    if (result < 0)
+        r->error = result;
+    else
+        r->bytes += result;
+}
+
+static void fill(char *buf, int block)
+{
+    int i;
+    for (i = 0; i < BLOCK; i++)
+        buf[i] = (char)(block * 31 + i);
+}
+
+static void fileio_basic_test(fileio_t *io)
+{
+    struct result res = {0, 0, 0};
+    struct iovec iov[2];
+    struct stat st;
+    char *buf, *fixed;
+    uint64_t clock;
+    int i, fd, r;
+
+    buf = (char *)malloc((size_t)BLOCK * BLOCKS);
+    for (i = 0; i < BLOCKS; i++)
+        fill(buf + (size_t)i * BLOCK, i);
+
+    fd = open(s_file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    assert(fd >= 0);
+
+    // in any order, at most entries in flight
+    clock = system_clock();
+    for (i = BLOCKS - 1; i >= 0; i--) {
+        while (-EAGAIN == (r = fileio_write(io, fd, buf + (size_t)i * BLOCK,
+                                            BLOCK, (uint64_t)i * BLOCK,
+                                            oncomplete, &res)))
+            fileio_poll(io, 1, -1);
+        assert(0 == r);
+    }
+    // io_uring doesn't order the fsync after writes in flight
+    while (fileio_inflight(io) > 0)
+        assert(fileio_poll(io, 1, 1000) > 0);
+    assert(0 == fileio_fsync(io, fd, 1, oncomplete, &res));
+    while (fileio_inflight(io) > 0)
+        assert(fileio_poll(io, 1, 1000) > 0);
+    assert(BLOCKS + 1 == res.calls && 0 == res.error);
+    assert(BLOCK * BLOCKS == res.bytes);
+    printf("fileio %s: write 16MB in %ums\n",
+           FILEIO_URING == fileio_backend(io) ? "uring" : "threads",
+           (unsigned int)(system_clock() - clock));
+
+    // registered buffers
+    fixed = (char *)aligned_alloc(4096, 2 * BLOCK);
+    iov[0].iov_base = fixed;
+    iov[0].iov_len  = BLOCK;
+    iov[1].iov_base = fixed + BLOCK;
+    iov[1].iov_len  = BLOCK;
+    assert(0 == fileio_register_buffers(io, iov, 2));
+    assert(-EINVAL == fileio_read_fixed(io, fd, 0, fixed + 1, BLOCK, 0,
+                                        oncomplete, &res));
+    assert(-EINVAL == fileio_read_fixed(io, fd, 2, fixed, 1, 0, oncomplete,
+                                        &res));
+
+    memset(&res, 0, sizeof(res));
+    assert(0 == fileio_read_fixed(io, fd, 0, fixed, BLOCK, 7 * BLOCK,
+                                  oncomplete, &res));
+    assert(0 == fileio_read_fixed(io, fd, 1, fixed + BLOCK, BLOCK, 9 * BLOCK,
+                                  oncomplete, &res));
+    assert(2 == fileio_poll(io, 2, 1000));
+    assert(2 == res.calls && 2 * BLOCK == res.bytes);
+    assert(0 == memcmp(fixed, buf + 7 * BLOCK, BLOCK));
+    assert(0 == memcmp(fixed + BLOCK, buf + 9 * BLOCK, BLOCK));
+
+    memset(fixed, 'f', BLOCK);
+    assert(0 == fileio_write_fixed(io, fd, 0, fixed, 100, 5, oncomplete, &res));
+    assert(1 == fileio_poll(io, 1, 1000));
+    assert(0 == fileio_register_buffers(io, NULL, 0));
+
+    // short read at EOF, error as -errno
+    memset(&res, 0, sizeof(res));
+    assert(0 == fileio_read(io, fd, buf, BLOCK, (uint64_t)BLOCK * BLOCKS - 10,
+                            oncomplete, &res));
+    assert(0 == fileio_read(io, -1, buf, BLOCK, 0, oncomplete, &res));
+    assert(2 == fileio_poll(io, 2, 1000));
+    assert(10 == res.bytes && -EBADF == res.error);
+    close(fd);
+
+    memset(&res, 0, sizeof(res));
+    unlink(s_file2);
+    assert(0 == fileio_rename(io, s_file, s_file2, oncomplete, &res));
+    assert(1 == fileio_poll(io, 1, 1000));
+    assert(1 == res.calls && 0 == res.error);
+    assert(0 == stat(s_file2, &st) && BLOCK * BLOCKS == st.st_size);
+    assert(0 == fileio_rename(io, s_file2, s_file, oncomplete, &res));
+    assert(1 == fileio_poll(io, 1, 1000));
+
+    free(fixed);
+    free(buf);
+}
+
+static void fileio_reader_test(fileio_t *io)
+{
+    fileio_reader_t *r;
+    char *buf, expect[BLOCK];
+    uint64_t clock;
+    int i, n, total;
+
+    r = fileio_reader_open(io, s_file, 256 * 1024, 4);
+    assert(r && (uint64_t)BLOCK * BLOCKS == fileio_reader_size(r));
+
+    // odd sizes across the block boundaries
+    clock = system_clock();
+    buf   = (char *)malloc(BLOCK);
+    for (total = 0; (n = fileio_reader_read(r, buf, 4099)) > 0; total += n) {
+        for (i = 0; i < n; i++) {
+            int off = total + i;
+            if (off >= 5 && off < 105)
+                assert('f' == buf[i]);
+            else
+                assert((char)((off / BLOCK) * 31 + off % BLOCK) == buf[i]);
+        }
+    }
+    assert(0 == n && BLOCK * BLOCKS == total);
+    assert((uint64_t)total == fileio_reader_tell(r));
+    printf("fileio %s: read-ahead 16MB in %ums\n",
+           FILEIO_URING == fileio_backend(io) ? "uring" : "threads",
+           (unsigned int)(system_clock() - clock));
+
+    // backward, then forward inside the read-ahead
+    assert(0 == fileio_reader_seek(r, 3 * BLOCK + 1));
+    assert(BLOCK == fileio_reader_read(r, buf, BLOCK));
+    fill(expect, 3);
+    assert(0 == memcmp(buf, expect + 1, BLOCK - 1));
+    assert(0 == fileio_reader_seek(r, 5 * BLOCK));
+    assert(BLOCK == fileio_reader_read(r, buf, BLOCK));
+    fill(expect, 5);
+    assert(0 == memcmp(buf, expect, BLOCK));
+    assert(0 == fileio_reader_seek(r, (uint64_t)BLOCK * BLOCKS - 1));
+    assert(1 == fileio_reader_read(r, buf, BLOCK));
+    assert(-EINVAL == fileio_reader_seek(r, (uint64_t)BLOCK * BLOCKS + 1));
+
+    fileio_reader_close(r);
+    free(buf);
+}
+
+static void on_fileio(evloop_t *loop, int fd, uint32_t events, void *param)
+{
+    (void)loop;
+    (void)fd;
+    (void)events;
+    fileio_poll((fileio_t *)param, 0, 0);
+}
+
+static void onread_stop(void *param, int result)
+{
+    evloop_t *loop = (evloop_t *)param;
+    assert(BLOCK == result);
+    evloop_stop(loop);
+}
+
+// completions delivered by the event loop through the eventfd
+static void fileio_evloop_test(fileio_t *io)
+{
+    evloop_t *loop;
+    char *buf;
+    int fd;
+
+    loop = evloop_create();
+    buf  = (char *)malloc(BLOCK);
+    fd   = open(s_file, O_RDONLY);
+    assert(0 == evloop_add(loop, fileio_fd(io), EVLOOP_READ, on_fileio, io));
+    assert(0 == fileio_read(io, fd, buf, BLOCK, BLOCK, onread_stop, loop));
+    assert(0 == evloop_run(loop));
+    assert(0 == fileio_inflight(io));
+
+    evloop_del(loop, fileio_fd(io));
+    evloop_destroy(loop);
+    close(fd);
+    free(buf);
+}
+
+static void fileio_test(int flags)
+{
+    fileio_t *io;
+
+    io = fileio_create(32, flags, NULL);
+    assert(io);
+    if (flags & FILEIO_FORCE_THREADS)
+        assert(FILEIO_THREADS == fileio_backend(io));
+
+    fileio_basic_test(io);
+    fileio_reader_test(io);
+    fileio_evloop_test(io);
+    fileio_destroy(io);
+}
+
+int main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    fileio_test(0);
+    fileio_test(FILEIO_FORCE_THREADS);
+    unlink(s_file);
+    return 0;
+}
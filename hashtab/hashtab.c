@@ -0,0 +1,562 @@
+/*
+ * hashtab.c - open addressing hash table
+ *
+ * Date   : 2021/04/30
+ */
+
+#include "hashtab.h"
+#include "jhash.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define HT_EMPTY ((uint8_t)0x80)
+#define HT_DELETED ((uint8_t)0xFE)
+#define HT_FULL(c) (0 == ((c)&0x80)) // 7 bits of hash
+#define HT_H2(hash) ((uint8_t)((hash) >> 25))
+#define HT_MIGRATE 32 // old slots moved per insert while growing
+
+/*
+ * A group is matched with one compare: bit i (SSE2) or bit 8i+7 (SWAR)
+ * of a mask is set for slot i of the group.
+ */
+#if defined(__SSE2__)
+#define HT_GROUP 16
+#define HT_SHIFT 0
+
+static inline uint64_t
+ht_match(const uint8_t *g, uint8_t h2)
+{
+    __m128i c = _mm_loadu_si128((const __m128i *)g);
+    return (uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8((char)h2)));
+}
+
+static inline uint64_t
+ht_match_empty(const uint8_t *g)
+{
+    return ht_match(g, HT_EMPTY);
+}
+
+// empty or deleted
+static inline uint64_t
+ht_match_free(const uint8_t *g)
+{
+    return (uint64_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)g));
+}
+
+// slots of the group after the last match
+static inline size_t
+ht_leading(uint64_t m)
+{
+    return (size_t)__builtin_clzll(m) - (64 - HT_GROUP);
+}
+#else
+#define HT_GROUP 8
+#define HT_SHIFT 3
+#define HT_LSB 0x0101010101010101ULL
+#define HT_MSB 0x8080808080808080ULL
+
+static inline uint64_t
+ht_load(const uint8_t *g)
+{
+    uint64_t x;
+
+    memcpy(&x, g, sizeof(x));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    x = __builtin_bswap64(x);
+#endif
+    return x;
+}
+
+// may report a false match right after a real one, the slot is checked
+static inline uint64_t
+ht_match(const uint8_t *g, uint8_t h2)
+{
+    uint64_t x = ht_load(g) ^ (HT_LSB * h2);
+    return (x - HT_LSB) & ~x & HT_MSB;
+}
+
+static inline uint64_t
+ht_match_empty(const uint8_t *g)
+{
+    uint64_t x = ht_load(g);
+    return x & (~x << 6) & HT_MSB; // 0x80 but not 0xFE
+}
+
+static inline uint64_t
+ht_match_free(const uint8_t *g)
+{
+    return ht_load(g) & HT_MSB;
+}
+
+static inline size_t
+ht_leading(uint64_t m)
+{
+    return (size_t)__builtin_clzll(m) >> 3;
+}
+#endif
+
+#define HT_INDEX(m) ((size_t)__builtin_ctzll(m) >> HT_SHIFT)
+
+struct ht_table {
+    uint8_t *ctrl; // mask + 1 + HT_GROUP, the first group mirrored at the end
+    hashtab_node_t **slots;
+    size_t mask;
+    size_t size;
+    size_t growth; // empty slots left to fill before growing
+};
+
+struct hashtab {
+    struct ht_table cur;
+    struct ht_table old; // being drained into cur, ctrl NULL if not
+    size_t migrate;      // old slots below are moved
+    hashtab_hash_fn hash;
+    hashtab_equal_fn equal;
+};
+
+static uint32_t
+ht_jhash(const void *key, size_t len)
+{
+    return jhash(key, (uint32_t)len, 0);
+}
+
+static int
+ht_table_init(struct ht_table *t, size_t cap)
+{
+    size_t ctrl = (cap + HT_GROUP + 7) & ~(size_t)7;
+
+    t->slots = (hashtab_node_t **)malloc(ctrl + cap * sizeof(t->slots[0]));
+    if (!t->slots)
+        return -ENOMEM;
+    t->ctrl = (uint8_t *)(t->slots + cap);
+    memset(t->ctrl, HT_EMPTY, cap + HT_GROUP);
+    t->mask   = cap - 1;
+    t->size   = 0;
+    t->growth = cap - cap / 8;
+    return 0;
+}
+
+static void
+ht_table_free(struct ht_table *t)
+{
+    free(t->slots);
+    memset(t, 0, sizeof(*t));
+}
+
+static inline void
+ht_set_ctrl(struct ht_table *t, size_t i, uint8_t c)
+{
+    t->ctrl[i] = c;
+    if (i < HT_GROUP)
+        t->ctrl[t->mask + 1 + i] = c;
+}
+
+// slot of key (or of node if given), -1 if not found
+static size_t
+ht_lookup(const hashtab_t *h, const struct ht_table *t, const void *key,
+          size_t len, uint32_t hash, const hashtab_node_t *node)
+{
+    const hashtab_node_t *n;
+    size_t pos = hash & t->mask, step = 0, i;
+    uint8_t h2 = HT_H2(hash);
+    uint64_t m;
+
+    for (;;) {
+        for (m = ht_match(t->ctrl + pos, h2); m; m &= m - 1) {
+            i = (pos + HT_INDEX(m)) & t->mask;
+            n = t->slots[i];
+            if (node ? n == node
+                     : n->hash == hash && h->equal(key, len, n))
+                return i;
+        }
+        if (ht_match_empty(t->ctrl + pos))
+            return (size_t)-1;
+        // triangular steps by group visit every group
+        step += HT_GROUP;
+        pos = (pos + step) & t->mask;
+    }
+}
+
+static size_t
+ht_find_free(const struct ht_table *t, uint32_t hash)
+{
+    size_t pos = hash & t->mask, step = 0;
+    uint64_t m;
+
+    for (;;) {
+        m = ht_match_free(t->ctrl + pos);
+        if (m)
+            return (pos + HT_INDEX(m)) & t->mask;
+        step += HT_GROUP;
+        pos = (pos + step) & t->mask;
+    }
+}
+
+static void
+ht_set(struct ht_table *t, size_t i, hashtab_node_t *node)
+{
+    if (HT_EMPTY == t->ctrl[i])
+        t->growth--;
+    ht_set_ctrl(t, i, HT_H2(node->hash));
+    t->slots[i] = node;
+    t->size++;
+}
+
+static void
+ht_erase_at(struct ht_table *t, size_t i)
+{
+    uint64_t after, before;
+
+    // no probe went on past slot i if some window over it has an empty
+    after  = ht_match_empty(t->ctrl + i);
+    before = ht_match_empty(t->ctrl + ((i - HT_GROUP) & t->mask));
+    if (after && before
+        && HT_INDEX(after) + ht_leading(before) < HT_GROUP) {
+        ht_set_ctrl(t, i, HT_EMPTY);
+        t->growth++;
+    } else {
+        ht_set_ctrl(t, i, HT_DELETED);
+    }
+    t->size--;
+}
+
+static void
+ht_migrate(hashtab_t *h, size_t n)
+{
+    struct ht_table *old = &h->old;
+    size_t i, end;
+
+    end = h->migrate + n;
+    if (end > old->mask + 1)
+        end = old->mask + 1;
+    for (i = h->migrate; i < end; i++) {
+        if (HT_FULL(old->ctrl[i])) {
+            ht_set(&h->cur, ht_find_free(&h->cur, old->slots[i]->hash),
+                   old->slots[i]);
+            ht_set_ctrl(old, i, HT_DELETED);
+            old->size--;
+        }
+    }
+    h->migrate = end;
+    if (end == old->mask + 1)
+        ht_table_free(old);
+}
+
+/*
+ * Out of empty slots: a table twice as big if more than 7/16 are live,
+ * else one as big to drop the tombstones. Either fits the live entries
+ * plus the inserts made while the old one drains (cap / HT_MIGRATE).
+ */
+static int
+ht_grow(hashtab_t *h)
+{
+    struct ht_table t;
+    size_t cap = h->cur.mask + 1;
+
+    if (h->old.ctrl)
+        ht_migrate(h, h->old.mask + 1);
+
+    if (h->cur.size * 16 > cap * 7)
+        cap *= 2;
+    if (0 != ht_table_init(&t, cap))
+        return -ENOMEM;
+
+    h->old     = h->cur;
+    h->cur     = t;
+    h->migrate = 0;
+    return 0;
+}
+
+hashtab_t *
+hashtab_create(size_t capacity, hashtab_hash_fn hash, hashtab_equal_fn equal)
+{
+    hashtab_t *h;
+    size_t cap = HT_GROUP;
+
+    if (!equal)
+        return NULL;
+    while (cap - cap / 8 < capacity)
+        cap *= 2;
+
+    h = (hashtab_t *)calloc(1, sizeof(*h));
+    if (!h)
+        return NULL;
+    h->hash  = hash ? hash : ht_jhash;
+    h->equal = equal;
+    if (0 != ht_table_init(&h->cur, cap)) {
+        free(h);
+        return NULL;
+    }
+    return h;
+}
+
+void
+hashtab_destroy(hashtab_t *h)
+{
+    ht_table_free(&h->cur);
+    if (h->old.ctrl)
+        ht_table_free(&h->old);
+    free(h);
+}
+
+size_t
+hashtab_count(hashtab_t *h)
+{
+    return h->cur.size + h->old.size;
+}
+
+int
+hashtab_insert(hashtab_t *h, const void *key, size_t len, hashtab_node_t *node,
+               hashtab_node_t **exist)
+{
+    uint32_t hash = h->hash(key, len);
+    size_t i;
+
+    if (h->old.ctrl)
+        ht_migrate(h, HT_MIGRATE);
+
+    i = ht_lookup(h, &h->cur, key, len, hash, NULL);
+    if ((size_t)-1 != i) {
+        if (exist)
+            *exist = h->cur.slots[i];
+        return -EEXIST;
+    }
+    if (h->old.ctrl
+        && (size_t)-1 != (i = ht_lookup(h, &h->old, key, len, hash, NULL))) {
+        if (exist)
+            *exist = h->old.slots[i];
+        return -EEXIST;
+    }
+
+    node->hash = hash;
+    i          = ht_find_free(&h->cur, hash);
+    if (HT_EMPTY == h->cur.ctrl[i] && 0 == h->cur.growth) {
+        if (0 != ht_grow(h))
+            return -ENOMEM;
+        i = ht_find_free(&h->cur, hash);
+    }
+    ht_set(&h->cur, i, node);
+    return 0;
+}
+
+hashtab_node_t *
+hashtab_find(hashtab_t *h, const void *key, size_t len)
+{
+    uint32_t hash = h->hash(key, len);
+    size_t i;
+
+    i = ht_lookup(h, &h->cur, key, len, hash, NULL);
+    if ((size_t)-1 != i)
+        return h->cur.slots[i];
+    if (h->old.ctrl
+        && (size_t)-1 != (i = ht_lookup(h, &h->old, key, len, hash, NULL)))
+        return h->old.slots[i];
+    return NULL;
+}
+
+// erase doesn't migrate, so erasing the node of an iteration is safe
+static hashtab_node_t *
+ht_erase(hashtab_t *h, const void *key, size_t len, uint32_t hash,
+         const hashtab_node_t *node)
+{
+    hashtab_node_t *n;
+    size_t i;
+
+    i = ht_lookup(h, &h->cur, key, len, hash, node);
+    if ((size_t)-1 != i) {
+        n = h->cur.slots[i];
+        ht_erase_at(&h->cur, i);
+        return n;
+    }
+    if (h->old.ctrl
+        && (size_t)-1 != (i = ht_lookup(h, &h->old, key, len, hash, node))) {
+        n = h->old.slots[i];
+        ht_erase_at(&h->old, i);
+        return n;
+    }
+    return NULL;
+}
+
+hashtab_node_t *
+hashtab_erase(hashtab_t *h, const void *key, size_t len)
+{
+    return ht_erase(h, key, len, h->hash(key, len), NULL);
+}
+
+void
+hashtab_remove(hashtab_t *h, hashtab_node_t *node)
+{
+    ht_erase(h, NULL, 0, node->hash, node);
+}
+
+static hashtab_node_t *
+ht_iter_scan(hashtab_t *h, hashtab_iter_t *it)
+{
+    const struct ht_table *t;
+
+    for (; it->table < 2; it->table++, it->pos = 0) {
+        t = it->table ? &h->old : &h->cur;
+        if (!t->ctrl)
+            continue;
+        for (; it->pos <= t->mask; it->pos++) {
+            if (HT_FULL(t->ctrl[it->pos]))
+                return t->slots[it->pos];
+        }
+    }
+    return NULL;
+}
+
+hashtab_node_t *
+hashtab_first(hashtab_t *h, hashtab_iter_t *it)
+{
+    it->table = 0;
+    it->pos   = 0;
+    return ht_iter_scan(h, it);
+}
+
+hashtab_node_t *
+hashtab_next(hashtab_t *h, hashtab_iter_t *it)
+{
+    it->pos++;
+    return ht_iter_scan(h, it);
+}
+
+//------------------------------------------------------------------------
+
+struct ht_kv_entry {
+    hashtab_node_t node;
+    uint32_t len;
+    void *value;
+    unsigned char key[1];
+};
+
+struct hashtab_kv {
+    hashtab_t h;
+};
+
+static int
+ht_kv_equal(const void *key, size_t len, const hashtab_node_t *node)
+{
+    const struct ht_kv_entry *e = hashtab_entry(node, struct ht_kv_entry, node);
+    return e->len == len && 0 == memcmp(e->key, key, len);
+}
+
+hashtab_kv_t *
+hashtab_kv_create(size_t capacity, hashtab_hash_fn hash)
+{
+    // the kv table is the plain one with its own equal
+    return (hashtab_kv_t *)hashtab_create(capacity, hash, ht_kv_equal);
+}
+
+void
+hashtab_kv_destroy(hashtab_kv_t *kv)
+{
+    hashtab_iter_t it;
+    hashtab_node_t *n, *next;
+
+    for (n = hashtab_first(&kv->h, &it); n; n = next) {
+        next = hashtab_next(&kv->h, &it);
+        free(hashtab_entry(n, struct ht_kv_entry, node));
+    }
+    hashtab_destroy(&kv->h);
+}
+
+size_t
+hashtab_kv_count(hashtab_kv_t *kv)
+{
+    return hashtab_count(&kv->h);
+}
+
+int
+hashtab_kv_put(hashtab_kv_t *kv, const void *key, size_t len, void *value,
+               void **old)
+{
+    struct ht_kv_entry *e;
+    hashtab_node_t *n;
+    int r;
+
+    n = hashtab_find(&kv->h, key, len);
+    if (n) {
+        e = hashtab_entry(n, struct ht_kv_entry, node);
+        if (old)
+            *old = e->value;
+        e->value = value;
+        return 0;
+    }
+
+    e = (struct ht_kv_entry *)malloc(offsetof(struct ht_kv_entry, key) + len);
+    if (!e)
+        return -ENOMEM;
+    e->len   = (uint32_t)len;
+    e->value = value;
+    memcpy(e->key, key, len);
+    r = hashtab_insert(&kv->h, key, len, &e->node, NULL);
+    if (0 != r) {
+        free(e);
+        return r;
+    }
+    if (old)
+        *old = NULL;
+    return 0;
+}
+
+int
+hashtab_kv_get(hashtab_kv_t *kv, const void *key, size_t len, void **value)
+{
+    hashtab_node_t *n = hashtab_find(&kv->h, key, len);
+
+    if (!n)
+        return -ENOENT;
+    *value = hashtab_entry(n, struct ht_kv_entry, node)->value;
+    return 0;
+}
+
+int
+hashtab_kv_del(hashtab_kv_t *kv, const void *key, size_t len, void **value)
+{
+    struct ht_kv_entry *e;
+    hashtab_node_t *n;
+
+    n = hashtab_erase(&kv->h, key, len);
+    if (!n)
+        return -ENOENT;
+    e = hashtab_entry(n, struct ht_kv_entry, node);
+    if (value)
+        *value = e->value;
+    free(e);
+    return 0;
+}
+
+static int
+ht_kv_out(hashtab_node_t *n, const void **key, size_t *len, void **value)
+{
+    const struct ht_kv_entry *e;
+
+    if (!n)
+        return 0;
+    e = hashtab_entry(n, struct ht_kv_entry, node);
+    if (key)
+        *key = e->key;
+    if (len)
+        *len = e->len;
+    if (value)
+        *value = e->value;
+    return 1;
+}
+
+int
+hashtab_kv_first(hashtab_kv_t *kv, hashtab_iter_t *it, const void **key,
+                 size_t *len, void **value)
+{
+    return ht_kv_out(hashtab_first(&kv->h, it), key, len, value);
+}
+
+int
+hashtab_kv_next(hashtab_kv_t *kv, hashtab_iter_t *it, const void **key,
+                size_t *len, void **value)
+{
+    return ht_kv_out(hashtab_next(&kv->h, it), key, len, value);
+}
@@ -0,0 +1,103 @@
+/*
+ * hashtab.h - open addressing hash table
+ *
+ * Date   : 2021/04/30
+ */
+#ifndef __HASHTAB_H__
+#define __HASHTAB_H__
+
+#include "macro.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * SwissTable layout: a control byte per slot holds 7 bits of the hash,
+ * a group of 16 control bytes (SSE2, 8 with the portable code) is
+ * matched at once, the slots are only read for the candidates.
+ *
+ * Growing doesn't rehash at once: the new table takes the inserts and
+ * every insert moves a few slots of the old one, lookups and erases
+ * check both tables meanwhile.
+ */
+
+/// intrusive flavor, the node lives in the user struct as rbtree_node_t
+typedef struct hashtab_node {
+    uint32_t hash;
+} hashtab_node_t;
+
+#define hashtab_entry(ptr, type, member) container_of(ptr, type, member)
+
+typedef struct hashtab hashtab_t;
+
+/// NULL for hashtab_create means jhash(key, len, 0)
+typedef uint32_t (*hashtab_hash_fn)(const void *key, size_t len);
+/// @return 1 if node has the key
+typedef int (*hashtab_equal_fn)(const void *key, size_t len,
+                                const hashtab_node_t *node);
+
+typedef struct hashtab_iter {
+    int table; // 0 the current, 1 the one being drained
+    size_t pos;
+} hashtab_iter_t;
+
+/// @param capacity expected entries, 0 for the minimum
+/// @param hash NULL for jhash
+/// @param equal required
+hashtab_t *hashtab_create(size_t capacity, hashtab_hash_fn hash,
+                          hashtab_equal_fn equal);
+/// the nodes are the caller's
+void hashtab_destroy(hashtab_t *t);
+size_t hashtab_count(hashtab_t *t);
+
+/// @param exist optional, the node with the same key
+/// @return 0-ok, -EEXIST, -ENOMEM
+int hashtab_insert(hashtab_t *t, const void *key, size_t len,
+                   hashtab_node_t *node, hashtab_node_t **exist);
+hashtab_node_t *hashtab_find(hashtab_t *t, const void *key, size_t len);
+/// @return the node removed, NULL if not found
+hashtab_node_t *hashtab_erase(hashtab_t *t, const void *key, size_t len);
+/// remove a node known to be in the table
+void hashtab_remove(hashtab_t *t, hashtab_node_t *node);
+
+/// any order, invalidated by insert/erase/remove except of the node
+/// returned last
+hashtab_node_t *hashtab_first(hashtab_t *t, hashtab_iter_t *it);
+hashtab_node_t *hashtab_next(hashtab_t *t, hashtab_iter_t *it);
+
+/*
+ * key/value flavor: the key is copied, compared with memcmp.
+ */
+typedef struct hashtab_kv hashtab_kv_t;
+
+hashtab_kv_t *hashtab_kv_create(size_t capacity, hashtab_hash_fn hash);
+/// the values are the caller's
+void hashtab_kv_destroy(hashtab_kv_t *kv);
+size_t hashtab_kv_count(hashtab_kv_t *kv);
+
+/// insert or replace
+/// @param old optional, the value replaced, NULL if the key is new
+/// @return 0-ok, -ENOMEM
+int hashtab_kv_put(hashtab_kv_t *kv, const void *key, size_t len, void *value,
+                   void **old);
+/// @return 0-ok, -ENOENT
+int hashtab_kv_get(hashtab_kv_t *kv, const void *key, size_t len,
+                   void **value);
+/// @param value optional, the value removed
+/// @return 0-ok, -ENOENT
+int hashtab_kv_del(hashtab_kv_t *kv, const void *key, size_t len,
+                   void **value);
+
+/// @return 1 with key/len/value set, 0 at end
+int hashtab_kv_first(hashtab_kv_t *kv, hashtab_iter_t *it, const void **key,
+                     size_t *len, void **value);
+int hashtab_kv_next(hashtab_kv_t *kv, hashtab_iter_t *it, const void **key,
+                    size_t *len, void **value);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
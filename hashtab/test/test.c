@@ -0,0 +1,315 @@
+/*
+ * test.c - test
+ *
+ * Date   : 2021/04/30
+ */
+
+#include "hashtab.h"
+#include "rbtree.h"
+#include "system.h"
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KEYS 100000
+
+struct item {
+    hashtab_node_t node;
+    uint64_t key;
+};
+
+static uint64_t s_seed = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t rand64(void)
+{
+    s_seed ^= s_seed << 13;
+    s_seed ^= s_seed >> 7;
+    s_seed ^= s_seed << 17;
+    return s_seed;
+}
+
+static int item_equal(const void *key, size_t len, const hashtab_node_t *node)
+{
+    (void)len;
+    return *(const uint64_t *)key
+           == hashtab_entry(node, struct item, node)->key;
+}
+
+// few buckets: long probes, lots of tombstones
+static uint32_t bad_hash(const void *key, size_t len)
+{
+    (void)len;
+    return (uint32_t)(*(const uint64_t *)key % 61) * 0x9e3779b9u;
+}
+
+static void hashtab_basic_test(void)
+{
+    struct item *items, dup, *p;
+    hashtab_node_t *n, *exist;
+    hashtab_iter_t it;
+    hashtab_t *t;
+    size_t count;
+    uint64_t k;
+    int i;
+
+    items = (struct item *)malloc(KEYS * sizeof(items[0]));
+    t     = hashtab_create(0, NULL, item_equal);
+    assert(t && 0 == hashtab_count(t));
+    assert(NULL == hashtab_first(t, &it));
+
+    // grows many times, every key stays findable while the old drains
+    for (i = 0; i < KEYS; i++) {
+        items[i].key = (uint64_t)i * 7919;
+        assert(0 == hashtab_insert(t, &items[i].key, sizeof(k), &items[i].node,
+                                   NULL));
+        if (0 == i % 1000) {
+            k = (uint64_t)(i / 2) * 7919;
+            n = hashtab_find(t, &k, sizeof(k));
+            assert(n == &items[i / 2].node);
+        }
+    }
+    assert(KEYS == hashtab_count(t));
+
+    dup.key = 7919 * 5;
+    assert(-EEXIST
+           == hashtab_insert(t, &dup.key, sizeof(k), &dup.node, &exist));
+    assert(exist == &items[5].node);
+
+    for (i = 0; i < KEYS; i++) {
+        k = (uint64_t)i * 7919;
+        assert(hashtab_find(t, &k, sizeof(k)) == &items[i].node);
+        k++;
+        assert(NULL == hashtab_find(t, &k, sizeof(k)));
+    }
+
+    for (i = 0; i < KEYS; i += 2) {
+        k = items[i].key;
+        assert(hashtab_erase(t, &k, sizeof(k)) == &items[i].node);
+        assert(NULL == hashtab_erase(t, &k, sizeof(k)));
+    }
+    for (i = 1; i < KEYS; i += 4)
+        hashtab_remove(t, &items[i].node);
+    assert(KEYS / 4 == hashtab_count(t));
+
+    // erase what the walk returns
+    count = 0;
+    for (n = hashtab_first(t, &it); n; n = hashtab_next(t, &it)) {
+        p = hashtab_entry(n, struct item, node);
+        assert(3 == (p->key / 7919) % 4);
+        if (3 == (p->key / 7919) % 8)
+            hashtab_remove(t, n);
+        count++;
+    }
+    assert(KEYS / 4 == count);
+    assert(KEYS / 8 == hashtab_count(t));
+    for (i = 3; i < KEYS; i += 4) {
+        n = hashtab_find(t, &items[i].key, sizeof(k));
+        assert(3 == i % 8 ? !n : n == &items[i].node);
+    }
+
+    hashtab_destroy(t);
+    free(items);
+}
+
+// random inserts/erases against a reference
+static void hashtab_random_test(hashtab_hash_fn hash, int range, int ops)
+{
+    struct item *items;
+    char *in;
+    hashtab_iter_t it;
+    hashtab_node_t *n;
+    hashtab_t *t;
+    size_t count = 0;
+    int i, k;
+
+    items = (struct item *)calloc(range, sizeof(items[0]));
+    in    = (char *)calloc(range, 1);
+    t     = hashtab_create(16, hash, item_equal);
+    for (i = 0; i < range; i++)
+        items[i].key = (uint64_t)i << 20;
+
+    for (i = 0; i < ops; i++) {
+        k = (int)(rand64() % range);
+        if (rand64() % 2) {
+            assert((in[k] ? -EEXIST : 0)
+                   == hashtab_insert(t, &items[k].key, sizeof(uint64_t),
+                                     &items[k].node, NULL));
+            count += !in[k];
+            in[k] = 1;
+        } else {
+            n = hashtab_erase(t, &items[k].key, sizeof(uint64_t));
+            assert(in[k] ? n == &items[k].node : !n);
+            count -= in[k];
+            in[k] = 0;
+        }
+        assert(count == hashtab_count(t));
+    }
+    for (i = 0; i < range; i++) {
+        n = hashtab_find(t, &items[i].key, sizeof(uint64_t));
+        assert(in[i] ? n == &items[i].node : !n);
+    }
+    for (count = 0, n = hashtab_first(t, &it); n; n = hashtab_next(t, &it))
+        count++;
+    assert(count == hashtab_count(t));
+
+    hashtab_destroy(t);
+    free(items);
+    free(in);
+}
+
+static void hashtab_kv_test(void)
+{
+    hashtab_kv_t *kv;
+    hashtab_iter_t it;
+    const void *key;
+    void *value;
+    char buf[32];
+    size_t len, count;
+    int i, r;
+
+    kv = hashtab_kv_create(0, NULL);
+    assert(kv && 0 == hashtab_kv_count(kv));
+
+    for (i = 0; i < 10000; i++) {
+        len = (size_t)snprintf(buf, sizeof(buf), "key-%d", i);
+        assert(0 == hashtab_kv_put(kv, buf, len, (void *)(intptr_t)i, &value));
+        assert(NULL == value);
+    }
+    // replace
+    assert(0 == hashtab_kv_put(kv, "key-42", 6, (void *)(intptr_t)-42, &value));
+    assert(42 == (intptr_t)value);
+    assert(10000 == hashtab_kv_count(kv));
+
+    // a prefix is another key
+    assert(-ENOENT == hashtab_kv_get(kv, "key-4", 4, &value));
+    assert(0 == hashtab_kv_get(kv, "key-4", 5, &value) && 4 == (intptr_t)value);
+    assert(0 == hashtab_kv_get(kv, "key-42", 6, &value)
+           && -42 == (intptr_t)value);
+
+    for (i = 0; i < 10000; i += 2) {
+        len = (size_t)snprintf(buf, sizeof(buf), "key-%d", i);
+        assert(0 == hashtab_kv_del(kv, buf, len, NULL));
+        assert(-ENOENT == hashtab_kv_del(kv, buf, len, NULL));
+    }
+    assert(5000 == hashtab_kv_count(kv));
+
+    count = 0;
+    for (r = hashtab_kv_first(kv, &it, &key, &len, &value); r;
+         r = hashtab_kv_next(kv, &it, &key, &len, &value)) {
+        snprintf(buf, sizeof(buf), "key-%d", (int)(intptr_t)value);
+        assert(len == strlen(buf) && 0 == memcmp(key, buf, len));
+        assert(1 == (intptr_t)value % 2);
+        count++;
+    }
+    assert(5000 == count);
+    hashtab_kv_destroy(kv);
+}
+
+//------------------------------------------------------------------------
+
+struct rb_item {
+    rbtree_node_t node;
+    uint64_t key;
+};
+
+static void report(const char *name, size_t n, uint64_t insert,
+                   uint64_t find, uint64_t erase)
+{
+    printf("%-8s %9lu: insert %6ums find %6ums erase %6ums\n", name,
+           (unsigned long)n, (unsigned int)insert, (unsigned int)find,
+           (unsigned int)erase);
+}
+
+static const rbtree_node_t *rb_find(const rbtree_root_t *root, uint64_t key)
+{
+    const rbtree_node_t *rn = root->node;
+    uint64_t k;
+
+    while (rn) {
+        k = rbtree_entry(rn, struct rb_item, node)->key;
+        if (k == key)
+            break;
+        rn = key < k ? rn->left : rn->right;
+    }
+    return rn;
+}
+
+// insert n random keys, find them all, erase them all
+static void hashtab_bench(size_t n)
+{
+    struct item *items;
+    struct rb_item *rbs;
+    rbtree_root_t rbroot = {NULL};
+    rbtree_node_t **link, *parent;
+    hashtab_t *t;
+    uint64_t *keys, clock, t1, t2, sum = 0;
+    size_t i;
+
+    keys = (uint64_t *)malloc(n * sizeof(keys[0]));
+    for (i = 0; i < n; i++)
+        keys[i] = rand64();
+
+    items = (struct item *)malloc(n * sizeof(items[0]));
+    t     = hashtab_create(0, NULL, item_equal);
+    clock = system_clock();
+    for (i = 0; i < n; i++) {
+        items[i].key = keys[i];
+        hashtab_insert(t, &keys[i], sizeof(keys[i]), &items[i].node, NULL);
+    }
+    t1 = system_clock();
+    for (i = 0; i < n; i++)
+        sum += (uintptr_t)hashtab_find(t, &keys[i], sizeof(keys[i]));
+    t2 = system_clock();
+    for (i = 0; i < n; i++)
+        sum += (uintptr_t)hashtab_erase(t, &keys[i], sizeof(keys[i]));
+    report("hashtab", n, t1 - clock, t2 - t1, system_clock() - t2);
+    hashtab_destroy(t);
+    free(items);
+
+    rbs   = (struct rb_item *)malloc(n * sizeof(rbs[0]));
+    clock = system_clock();
+    for (i = 0; i < n; i++) {
+        rbs[i].key = keys[i];
+        link       = &rbroot.node;
+        parent     = NULL;
+        while (*link) {
+            parent = *link;
+            link   = keys[i] < rbtree_entry(parent, struct rb_item, node)->key
+                         ? &parent->left
+                         : &parent->right;
+        }
+        rbtree_insert(&rbroot, parent, link, &rbs[i].node);
+    }
+    t1 = system_clock();
+    for (i = 0; i < n; i++)
+        sum += (uintptr_t)rb_find(&rbroot, keys[i]);
+    t2 = system_clock();
+    for (i = 0; i < n; i++)
+        rbtree_delete(&rbroot,
+                      (rbtree_node_t *)rb_find(&rbroot, keys[i]));
+    report("rbtree", n, t1 - clock, t2 - t1, system_clock() - t2);
+    free(rbs);
+
+    printf("(%u)\n", (unsigned int)sum);
+    free(keys);
+}
+
+/// hashtab_test [max entries], 1M by default (100M needs ~5GB)
+int main(int argc, char *argv[])
+{
+    size_t n, max = argc > 1 ? (size_t)strtoull(argv[1], NULL, 0) : 1000000;
+
+    hashtab_basic_test();
+    hashtab_random_test(NULL, 5000, 200000);
+    hashtab_random_test(bad_hash, 2000, 200000);
+    hashtab_kv_test();
+    for (n = 1000; n <= max; n *= 10)
+        hashtab_bench(n);
+    return 0;
+}
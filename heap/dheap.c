@@ -0,0 +1,265 @@
+/*
+ * dheap.c - d-ary heap with inline keys
+ *
+ * Date   : 2021/04/25
+ */
+
+// https://en.wikipedia.org/wiki/D-ary_heap
+
+#include "dheap.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DHEAP_CACHELINE 64
+
+struct dheap {
+    dheap_node_t *nodes; // nodes[0] is the root
+    void *mem;
+    int size;
+    int capacity;
+    int shift; // log2(arity)
+    int idx_offset;
+};
+
+#define DHEAP_TRACK(heap, i)                                                   \
+    do {                                                                       \
+        if ((heap)->idx_offset >= 0)                                           \
+            *(int *)((char *)(heap)->nodes[i].ptr + (heap)->idx_offset) = (i); \
+    } while (0)
+
+dheap_t *
+dheap_create(int arity, int idx_offset)
+{
+    struct dheap *heap;
+
+    if (arity != 2 && arity != 4 && arity != 8) {
+        return NULL;
+    }
+
+    heap = (struct dheap *)calloc(1, sizeof(*heap));
+    if (heap) {
+        heap->shift      = arity == 2 ? 1 : (arity == 4 ? 2 : 3);
+        heap->idx_offset = idx_offset;
+    }
+    return heap;
+}
+
+void
+dheap_destroy(dheap_t *heap)
+{
+    free(heap->mem);
+    free(heap);
+}
+
+int
+dheap_reserve(dheap_t *heap, int size)
+{
+    void *mem;
+    int pad;
+
+    if (size <= heap->capacity) {
+        return 0;
+    }
+
+    // the children of i are (i << shift) + 1 ..., arity - 1 leading slots
+    // put every group of siblings at the start of a cache line
+    pad = (1 << heap->shift) - 1;
+    mem = aligned_alloc(DHEAP_CACHELINE,
+                        (sizeof(dheap_node_t) * (size + pad) + DHEAP_CACHELINE
+                         - 1) / DHEAP_CACHELINE * DHEAP_CACHELINE);
+    if (!mem) {
+        return -ENOMEM;
+    }
+
+    if (heap->size > 0) {
+        memcpy((dheap_node_t *)mem + pad, heap->nodes,
+               sizeof(dheap_node_t) * heap->size);
+    }
+    free(heap->mem);
+    heap->mem      = mem;
+    heap->nodes    = (dheap_node_t *)mem + pad;
+    heap->capacity = size;
+    return 0;
+}
+
+int
+dheap_size(dheap_t *heap)
+{
+    return heap->size;
+}
+
+int
+dheap_empty(dheap_t *heap)
+{
+    return !heap->size;
+}
+
+/*
+ * Constant shift once inlined, the loop over the siblings unrolls.
+ */
+static inline __attribute__((always_inline)) void
+dheap_sift_up_d(dheap_t *heap, int i, const int shift)
+{
+    dheap_node_t *nodes = heap->nodes;
+    dheap_node_t x      = nodes[i];
+    int p;
+
+    while (i > 0) {
+        p = (i - 1) >> shift;
+        if (nodes[p].key <= x.key) {
+            break;
+        }
+        nodes[i] = nodes[p];
+        DHEAP_TRACK(heap, i);
+        i = p;
+    }
+    nodes[i] = x;
+    DHEAP_TRACK(heap, i);
+}
+
+static inline __attribute__((always_inline)) void
+dheap_sift_down_d(dheap_t *heap, int i, const int shift)
+{
+    dheap_node_t *nodes = heap->nodes;
+    dheap_node_t x      = nodes[i];
+    int c, j, m, end, size = heap->size;
+
+    while ((c = (i << shift) + 1) < size) {
+        m = c;
+        if (c + (1 << shift) <= size) {
+            for (j = c + 1; j < c + (1 << shift); j++) {
+                if (nodes[j].key < nodes[m].key)
+                    m = j;
+            }
+        } else {
+            for (j = c + 1, end = size; j < end; j++) {
+                if (nodes[j].key < nodes[m].key)
+                    m = j;
+            }
+        }
+
+        if (x.key <= nodes[m].key) {
+            break;
+        }
+        nodes[i] = nodes[m];
+        DHEAP_TRACK(heap, i);
+        i = m;
+    }
+    nodes[i] = x;
+    DHEAP_TRACK(heap, i);
+}
+
+static void
+dheap_sift_up(dheap_t *heap, int i)
+{
+    switch (heap->shift) {
+    case 1: dheap_sift_up_d(heap, i, 1); break;
+    case 2: dheap_sift_up_d(heap, i, 2); break;
+    default: dheap_sift_up_d(heap, i, 3); break;
+    }
+}
+
+static void
+dheap_sift_down(dheap_t *heap, int i)
+{
+    switch (heap->shift) {
+    case 1: dheap_sift_down_d(heap, i, 1); break;
+    case 2: dheap_sift_down_d(heap, i, 2); break;
+    default: dheap_sift_down_d(heap, i, 3); break;
+    }
+}
+
+int
+dheap_push(dheap_t *heap, uint64_t key, void *ptr)
+{
+    if (heap->size >= heap->capacity
+        && dheap_reserve(heap, heap->capacity ? heap->capacity * 2 : 64) != 0) {
+        return -ENOMEM;
+    }
+
+    heap->nodes[heap->size].key = key;
+    heap->nodes[heap->size].ptr = ptr;
+    dheap_sift_up(heap, heap->size++);
+    return 0;
+}
+
+void *
+dheap_top(dheap_t *heap, uint64_t *key)
+{
+    if (heap->size < 1) {
+        return NULL;
+    }
+    if (key) {
+        *key = heap->nodes[0].key;
+    }
+    return heap->nodes[0].ptr;
+}
+
+void *
+dheap_pop(dheap_t *heap, uint64_t *key)
+{
+    if (heap->size < 1) {
+        return NULL;
+    }
+    if (key) {
+        *key = heap->nodes[0].key;
+    }
+    return dheap_remove_at(heap, 0);
+}
+
+int
+dheap_update(dheap_t *heap, int index, uint64_t key)
+{
+    if (index < 0 || index >= heap->size) {
+        return -EINVAL;
+    }
+
+    heap->nodes[index].key = key;
+    if (index > 0 && key < heap->nodes[(index - 1) >> heap->shift].key) {
+        dheap_sift_up(heap, index);
+    } else {
+        dheap_sift_down(heap, index);
+    }
+    return 0;
+}
+
+void *
+dheap_remove_at(dheap_t *heap, int index)
+{
+    void *ptr;
+
+    if (index < 0 || index >= heap->size) {
+        return NULL;
+    }
+
+    ptr = heap->nodes[index].ptr;
+    if (index != --heap->size) {
+        heap->nodes[index] = heap->nodes[heap->size];
+        dheap_update(heap, index, heap->nodes[index].key);
+    }
+    return ptr;
+}
+
+int
+dheap_build(dheap_t *heap, const dheap_node_t *nodes, int n)
+{
+    int i;
+
+    if (n < 0 || dheap_reserve(heap, n) != 0) {
+        return -ENOMEM;
+    }
+
+    memcpy(heap->nodes, nodes, sizeof(dheap_node_t) * n);
+    heap->size = n;
+    for (i = 0; i < n; i++) {
+        DHEAP_TRACK(heap, i);
+    }
+
+    // the last parent down to the root, O(n) overall
+    for (i = n > 1 ? (n - 2) >> heap->shift : -1; i >= 0; i--) {
+        dheap_sift_down(heap, i);
+    }
+    return 0;
+}
@@ -0,0 +1,186 @@
+/*
+ * dheap.h - d-ary heap with inline keys
+ *
+ * Date   : 2021/04/25
+ */
+#ifndef __DHEAP_H__
+#define __DHEAP_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A min-heap of (key, ptr) nodes, d = 2, 4 or 8 children per node.
+ * The key lives next to the pointer, comparing never leaves the array,
+ * and the children of a node share a cache line (two for d = 8).
+ * Use ~key for a max-heap.
+ */
+typedef struct {
+    uint64_t key;
+    void *ptr;
+} dheap_node_t;
+
+typedef struct dheap dheap_t;
+
+/// @param arity 2, 4 or 8
+/// @param idx_offset offsetof an int member of the elements, the heap
+///        keeps their index there for dheap_update/dheap_remove_at,
+///        -1 if the elements don't track it
+/// @return NULL if arity is invalid or out of memory
+dheap_t *dheap_create(int arity, int idx_offset);
+void dheap_destroy(dheap_t *heap);
+
+/// @return 0-ok, -ENOMEM
+int dheap_reserve(dheap_t *heap, int size);
+
+int dheap_size(dheap_t *heap);
+int dheap_empty(dheap_t *heap);
+
+/// @return 0-ok, -ENOMEM
+int dheap_push(dheap_t *heap, uint64_t key, void *ptr);
+/// @return the minimum, NULL if empty, key is optional
+void *dheap_top(dheap_t *heap, uint64_t *key);
+void *dheap_pop(dheap_t *heap, uint64_t *key);
+
+/// change the key of the node at index, up or down. O(log n)
+/// @return 0-ok, -EINVAL if index is out of range
+int dheap_update(dheap_t *heap, int index, uint64_t key);
+/// @return the pointer removed, NULL if index is out of range. O(log n)
+void *dheap_remove_at(dheap_t *heap, int index);
+
+/// replace the content with n nodes, heapified bottom-up. O(n)
+/// @return 0-ok, -ENOMEM
+int dheap_build(dheap_t *heap, const dheap_node_t *nodes, int n);
+
+/*
+ * Typed heap with an inlined comparator, e.g. of 64-bit keys:
+ *   DHEAP_DEFINE(u64heap, uint64_t, 4, DHEAP_LESS)
+ *   u64heap_t h = {0};
+ *   u64heap_push(&h, 42); ... u64heap_pop(&h); u64heap_free(&h);
+ * defines static inline name_reserve/push/pop/top/update/remove_at/build
+ * and name_free. D is the arity, less(a, b) is non-zero if a < b.
+ */
+#define DHEAP_LESS(a, b) ((a) < (b))
+
+#define DHEAP_DEFINE(name, type, D, less)                                      \
+    typedef struct {                                                           \
+        type *v;                                                               \
+        int size;                                                              \
+        int capacity;                                                          \
+    } name##_t;                                                                \
+                                                                               \
+    static inline int name##_reserve(name##_t *h, int n)                       \
+    {                                                                          \
+        type *v;                                                               \
+        if (n <= h->capacity)                                                  \
+            return 0;                                                          \
+        v = (type *)realloc(h->v, sizeof(type) * n);                           \
+        if (!v)                                                                \
+            return -1;                                                         \
+        h->v        = v;                                                       \
+        h->capacity = n;                                                       \
+        return 0;                                                              \
+    }                                                                          \
+                                                                               \
+    static inline void name##_sift_up(name##_t *h, int i)                      \
+    {                                                                          \
+        type x = h->v[i];                                                      \
+        int p;                                                                 \
+        while (i > 0) {                                                        \
+            p = (i - 1) / (D);                                                 \
+            if (!less(x, h->v[p]))                                             \
+                break;                                                         \
+            h->v[i] = h->v[p];                                                 \
+            i       = p;                                                       \
+        }                                                                      \
+        h->v[i] = x;                                                           \
+    }                                                                          \
+                                                                               \
+    static inline void name##_sift_down(name##_t *h, int i)                    \
+    {                                                                          \
+        type x = h->v[i];                                                      \
+        int c, j, m, end;                                                      \
+        while ((c = i * (D) + 1) < h->size) {                                  \
+            end = c + (D) < h->size ? c + (D) : h->size;                       \
+            for (m = c, j = c + 1; j < end; j++) {                             \
+                if (less(h->v[j], h->v[m]))                                    \
+                    m = j;                                                     \
+            }                                                                  \
+            if (!less(h->v[m], x))                                             \
+                break;                                                         \
+            h->v[i] = h->v[m];                                                 \
+            i       = m;                                                       \
+        }                                                                      \
+        h->v[i] = x;                                                           \
+    }                                                                          \
+                                                                               \
+    static inline int name##_push(name##_t *h, type x)                         \
+    {                                                                          \
+        if (h->size >= h->capacity                                             \
+            && name##_reserve(h, h->capacity ? h->capacity * 2 : 64) != 0)     \
+            return -1;                                                         \
+        h->v[h->size] = x;                                                     \
+        name##_sift_up(h, h->size++);                                          \
+        return 0;                                                              \
+    }                                                                          \
+                                                                               \
+    /* h must not be empty */                                                  \
+    static inline type name##_top(name##_t *h) { return h->v[0]; }             \
+                                                                               \
+    static inline type name##_pop(name##_t *h)                                 \
+    {                                                                          \
+        type x = h->v[0];                                                      \
+        if (--h->size > 0) {                                                   \
+            h->v[0] = h->v[h->size];                                           \
+            name##_sift_down(h, 0);                                            \
+        }                                                                      \
+        return x;                                                              \
+    }                                                                          \
+                                                                               \
+    static inline void name##_update(name##_t *h, int i, type x)               \
+    {                                                                          \
+        h->v[i] = x;                                                           \
+        if (i > 0 && less(x, h->v[(i - 1) / (D)]))                             \
+            name##_sift_up(h, i);                                              \
+        else                                                                   \
+            name##_sift_down(h, i);                                            \
+    }                                                                          \
+                                                                               \
+    static inline type name##_remove_at(name##_t *h, int i)                    \
+    {                                                                          \
+        type x = h->v[i];                                                      \
+        if (i != --h->size)                                                    \
+            name##_update(h, i, h->v[h->size]);                                \
+        return x;                                                              \
+    }                                                                          \
+                                                                               \
+    static inline int name##_build(name##_t *h, const type *v, int n)          \
+    {                                                                          \
+        int i;                                                                 \
+        if (name##_reserve(h, n) != 0)                                         \
+            return -1;                                                         \
+        for (i = 0; i < n; i++)                                                \
+            h->v[i] = v[i];                                                    \
+        h->size = n;                                                           \
+        for (i = (n - 2) / (D); n > 1 && i >= 0; i--)                          \
+            name##_sift_down(h, i);                                            \
+        return 0;                                                              \
+    }                                                                          \
+                                                                               \
+    static inline void name##_free(name##_t *h)                                \
+    {                                                                          \
+        free(h->v);                                                            \
+        h->v        = NULL;                                                    \
+        h->size     = 0;                                                       \
+        h->capacity = 0;                                                       \
+    }
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
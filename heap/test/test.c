@@ -4,9 +4,15 @@
  * Date   : 2021/03/14
  */
 #include "heap.h"
+#include "dheap.h"
+#include "system.h"
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <time.h>
 #include <stdlib.h>
+#include <inttypes.h>
+#include <errno.h>
 
 #ifdef NDEBUG
 #undef NDEBUG
@@ -55,9 +61,171 @@ void heap_test(void)
 	printf("heap test ok\n");
 }
 
+typedef struct {
+    uint64_t key;
+    int idx; // kept by the heap
+} dheap_item_t;
+
+DHEAP_DEFINE(u64heap, uint64_t, 4, DHEAP_LESS)
+
+void dheap_test(void)
+{
+    int i, d, n;
+    uint64_t key, last;
+    dheap_t *heap;
+    dheap_item_t *items, *it;
+    dheap_node_t *nodes;
+    u64heap_t th = {0};
+
+    assert(dheap_create(3, -1) == NULL);
+    items = (dheap_item_t *)calloc(N * 10, sizeof(dheap_item_t));
+    nodes = (dheap_node_t *)calloc(N * 10, sizeof(dheap_node_t));
+    assert(items && nodes);
+
+    for (d = 2; d <= 8; d *= 2) {
+        heap = dheap_create(d, offsetof(dheap_item_t, idx));
+        assert(heap);
+
+        for (i = 0; i < N * 10; i++) {
+            items[i].key = rand() % 1000;
+            assert(0 == dheap_push(heap, items[i].key, &items[i]));
+        }
+
+        // decrease, increase and remove through the tracked index
+        for (i = 0; i < N * 10; i += 7) {
+            items[i].key = (i % 2) ? items[i].key / 2 : items[i].key + 500;
+            assert(0 == dheap_update(heap, items[i].idx, items[i].key));
+        }
+        for (i = 3, n = 0; i < N * 10; i += 10, n++) {
+            assert(dheap_remove_at(heap, items[i].idx) == &items[i]);
+        }
+        assert(dheap_size(heap) == N * 10 - n);
+        assert(dheap_update(heap, -1, 0) == -EINVAL);
+        assert(dheap_remove_at(heap, dheap_size(heap)) == NULL);
+
+        for (last = 0; !dheap_empty(heap); last = key) {
+            it = (dheap_item_t *)dheap_pop(heap, &key);
+            assert(it && it->key == key && last <= key);
+        }
+        assert(dheap_pop(heap, NULL) == NULL);
+
+        // heapify bottom-up
+        for (i = 0; i < N * 10; i++) {
+            nodes[i].key = items[i].key = rand();
+            nodes[i].ptr = &items[i];
+        }
+        assert(0 == dheap_build(heap, nodes, N * 10));
+        for (i = 0; i < N * 10; i++) {
+            it = (dheap_item_t *)nodes[i].ptr;
+            assert(dheap_remove_at(heap, it->idx) == it);
+            if (i % 2)
+                assert(0 == dheap_push(heap, it->key, it));
+        }
+        for (last = 0; dheap_pop(heap, &key); last = key)
+            assert(last <= key);
+        dheap_destroy(heap);
+    }
+
+    // typed, inlined comparator
+    for (i = 0; i < N * 10; i++)
+        assert(0 == u64heap_push(&th, rand() % 1000));
+    u64heap_update(&th, th.size / 2, 0);
+    assert(u64heap_top(&th) == 0);
+    u64heap_remove_at(&th, th.size / 3);
+    for (last = 0; th.size > 0; last = key) {
+        key = u64heap_pop(&th);
+        assert(last <= key);
+    }
+    u64heap_free(&th);
+
+    free(nodes);
+    free(items);
+    printf("dheap test ok\n");
+}
+
+#define BENCH_N (10 * 1000 * 1000)
+
+static int bench_less(void* param, const void* p1, const void* p2)
+{
+    (void)param;
+    return *(const uint64_t*)p1 < *(const uint64_t*)p2;
+}
+
+void heap_benchmark(void)
+{
+    int i, d;
+    uint64_t *keys, key, last, start, push, pop;
+    heap_t *heap;
+    dheap_t *dh;
+    dheap_node_t *nodes;
+    u64heap_t th = {0};
+
+    keys = (uint64_t *)malloc(sizeof(uint64_t) * BENCH_N);
+    nodes = (dheap_node_t *)malloc(sizeof(dheap_node_t) * BENCH_N);
+    assert(keys && nodes);
+    for (i = 0; i < BENCH_N; i++) {
+        keys[i] = ((uint64_t)rand() << 31) ^ rand();
+        nodes[i].key = keys[i];
+        nodes[i].ptr = &keys[i];
+    }
+
+    heap = heap_create(bench_less, NULL);
+    heap_reserve(heap, BENCH_N + 1);
+    start = system_clock();
+    for (i = 0; i < BENCH_N; i++)
+        heap_push(heap, &keys[i]);
+    push = system_clock() - start;
+    for (last = 0; !heap_empty(heap); last = key) {
+        key = *(uint64_t *)heap_top(heap);
+        heap_pop(heap);
+        assert(last <= key);
+    }
+    pop = system_clock() - start - push;
+    printf("heap      %d push: %5"PRIu64"ms pop: %5"PRIu64"ms\n",
+           BENCH_N, push, pop);
+    heap_destroy(heap);
+
+    for (d = 2; d <= 8; d *= 2) {
+        dh = dheap_create(d, -1);
+        dheap_reserve(dh, BENCH_N);
+        start = system_clock();
+        for (i = 0; i < BENCH_N; i++)
+            dheap_push(dh, keys[i], &keys[i]);
+        push = system_clock() - start;
+        for (last = 0; dheap_pop(dh, &key); last = key)
+            assert(last <= key);
+        pop = system_clock() - start - push;
+
+        start = system_clock();
+        dheap_build(dh, nodes, BENCH_N);
+        printf("dheap(%d)  %d push: %5"PRIu64"ms pop: %5"PRIu64"ms "
+               "build: %4"PRIu64"ms\n", d, BENCH_N, push, pop,
+               system_clock() - start);
+        dheap_destroy(dh);
+    }
+
+    u64heap_reserve(&th, BENCH_N);
+    start = system_clock();
+    for (i = 0; i < BENCH_N; i++)
+        u64heap_push(&th, keys[i]);
+    push = system_clock() - start;
+    for (last = 0; th.size > 0; last = key) {
+        key = u64heap_pop(&th);
+        assert(last <= key);
+    }
+    pop = system_clock() - start - push;
+    printf("u64heap(4) %d push: %5"PRIu64"ms pop: %5"PRIu64"ms\n",
+           BENCH_N, push, pop);
+    u64heap_free(&th);
+
+    free(nodes);
+    free(keys);
+}
 
 int main(void)
 {
     heap_test();
+    dheap_test();
+    heap_benchmark();
     return 0;
 }
@@ -4,116 +4,131 @@
  * Date   : 2021/03/23
  */
 #include "heap_timer.h"
+#include "mpool.h"
 #include "system.h"
 #include <assert.h>
 #include <stdlib.h>
 #include <time.h>
 
+#define EVENT_DETACHED UINT32_MAX // not in the heap
+#define HEAP_TIMER_MIN_EVTS 64
+#define HEAP_TIMER_CHUNK_EVTS 1024
+
 struct timer_event {
     uint64_t clock;
     timer_cb_t cb;
     void *data;
 
-    uint32_t delay;
+    uint32_t idx; // index in the heap, for cancel/modify in place
     uint32_t interval;
     uint32_t count;
-    uint32_t enable;
 };
 
 struct heap_timer {
     uint32_t nevts;
-    uint32_t max_evts;
+    uint32_t max_evts; // capacity of heap, doubled when full
     struct timer_event **heap;
+    struct timer_event *firing; // its callback is running
+    mpool_ctx_t *pool;          // of struct timer_event
 };
 
 static void
-heap_insert(struct timer_event **heap, uint32_t idx)
+event_sift_up(struct heap_timer *ctx, uint32_t idx)
 {
-    assert(heap && *heap);
-
-    if (idx <= 0) {
-        return;
-    }
+    struct timer_event **heap = ctx->heap;
+    struct timer_event *ev    = heap[idx];
+    uint32_t p;
 
-    uint32_t p = (idx - 1) >> 1;
-    if (heap[p]->clock <= heap[idx]->clock) {
-        return;
-    } else {
-        struct timer_event *tmp = heap[p];
-        heap[p]                 = heap[idx];
-        heap[idx]               = tmp;
-        heap_insert(heap, p);
+    while (idx > 0) {
+        p = (idx - 1) >> 1;
+        if (heap[p]->clock <= ev->clock) {
+            break;
+        }
+        heap[idx]      = heap[p];
+        heap[idx]->idx = idx;
+        idx            = p;
     }
+    heap[idx] = ev;
+    ev->idx   = idx;
 }
 
 static void
-heap_delete(struct timer_event **heap, uint32_t nevts, uint32_t idx)
+event_sift_down(struct heap_timer *ctx, uint32_t idx)
 {
-    assert(heap && *heap);
-    if (idx >= nevts) {
-        return;
-    }
-
-    uint32_t lchild = idx * 2 + 1;
-    uint32_t rchild = idx * 2 + 2;
-    uint32_t i      = idx;
+    struct timer_event **heap = ctx->heap;
+    struct timer_event *ev    = heap[idx];
+    uint32_t nevts            = ctx->nevts;
+    uint32_t child;
 
-    if (lchild < nevts && (heap[i]->clock > heap[lchild]->clock)) {
-        i = lchild;
-    }
-    if (rchild < nevts && (heap[i]->clock > heap[rchild]->clock)) {
-        i = rchild;
-    }
-    if (i != idx) {
-        struct timer_event *tmp = heap[i];
-        heap[i]                 = heap[idx];
-        heap[idx]               = tmp;
-        heap_delete(heap, nevts, i);
+    while ((child = idx * 2 + 1) < nevts) {
+        if (child + 1 < nevts && heap[child + 1]->clock < heap[child]->clock) {
+            child++;
+        }
+        if (ev->clock <= heap[child]->clock) {
+            break;
+        }
+        heap[idx]      = heap[child];
+        heap[idx]->idx = idx;
+        idx            = child;
     }
+    heap[idx] = ev;
+    ev->idx   = idx;
 }
 
+/*
+ * Restore the heap after the clock of the event at idx changed.
+ */
 static void
+event_heap_fix(struct heap_timer *ctx, uint32_t idx)
+{
+    if (idx > 0 && ctx->heap[(idx - 1) >> 1]->clock > ctx->heap[idx]->clock) {
+        event_sift_up(ctx, idx);
+    } else {
+        event_sift_down(ctx, idx);
+    }
+}
+
+static int
 event_heap_push(struct heap_timer *ctx, struct timer_event *ev)
 {
+    struct timer_event **heap;
+    uint32_t max;
+
     assert(ctx);
     assert(ev);
 
-    struct timer_event **heap = ctx->heap;
-    uint32_t idx              = ctx->nevts++;
-    heap[idx]                 = ev;
-    assert(idx < ctx->max_evts);
-    heap_insert(heap, idx);
-}
+    if (ctx->nevts >= ctx->max_evts) {
+        max  = ctx->max_evts * 2;
+        heap = (struct timer_event **)realloc(
+            ctx->heap, max * sizeof(struct timer_event *));
+        if (!heap) {
+            return -1;
+        }
+        ctx->heap     = heap;
+        ctx->max_evts = max;
+    }
 
-static struct timer_event *
-event_heap_pop(struct heap_timer *ctx)
-{
-    assert(ctx);
-    struct timer_event *ev = ctx->heap[0];
-    ctx->heap[0]           = ctx->heap[--ctx->nevts];
-    assert(ctx->nevts < ctx->max_evts);
-    heap_delete(ctx->heap, ctx->nevts, 0);
-    return ev;
+    ctx->heap[ctx->nevts] = ev;
+    event_sift_up(ctx, ctx->nevts++);
+    return 0;
 }
 
 static void
-event_re_enqueue(struct heap_timer *ctx, struct timer_event *ev)
+event_heap_remove(struct heap_timer *ctx, struct timer_event *ev)
 {
-    assert(ctx);
-    assert(ev);
-    if (ev->enable && ev->interval > 0) {
-        ev->clock += ev->interval;
-        if (ev->count > 0) {
-            ev->count--;
-            if (ev->count == 0) {
-                ev->interval = 0;
-            }
-        }
-        event_heap_push(ctx, ev);
-    } else {
-        /* free(ev); */
-        /* ev = NULL; */
+    struct timer_event *last;
+    uint32_t idx = ev->idx;
+
+    assert(idx < ctx->nevts && ctx->heap[idx] == ev);
+    ev->idx = EVENT_DETACHED;
+    last    = ctx->heap[--ctx->nevts];
+    if (idx == ctx->nevts) {
+        return;
     }
+
+    ctx->heap[idx] = last;
+    last->idx      = idx;
+    event_heap_fix(ctx, idx);
 }
 
 struct timer_event *
@@ -123,32 +138,23 @@ timer_event_register(struct heap_timer *ctx, timer_cb_t cb, void *data, uint32_t
     assert(ctx);
     struct timer_event *ev = NULL;
 
-    if (ctx->nevts >= ctx->max_evts) {
-        goto failed;
-    }
-
-    ev = (struct timer_event *)calloc(1, sizeof(struct timer_event));
+    ev = (struct timer_event *)mpool_get_nozero(ctx->pool);
     if (!ev) {
-        goto failed;
+        return NULL;
     }
 
     ev->cb       = cb;
     ev->data     = data;
-    ev->delay    = delay;
     ev->interval = interval;
     ev->count    = count;
-    ev->clock    = system_clock() + ev->delay;
-    ev->enable = 1;
-
-    event_heap_push(ctx, ev);
-    return ev;
+    ev->clock    = system_clock() + delay;
+    ev->idx      = EVENT_DETACHED;
 
-failed:
-    if (ev) {
-        free(ev);
-        ev = NULL;
+    if (event_heap_push(ctx, ev) != 0) {
+        mpool_put(ev);
+        return NULL;
     }
-    return NULL;
+    return ev;
 }
 
 void
@@ -156,27 +162,88 @@ timer_event_cancel(struct heap_timer *ctx, struct timer_event *ev)
 {
     assert(ctx);
     assert(ev);
-    ev->enable = 0;
+
+    if (ev->idx != EVENT_DETACHED) {
+        event_heap_remove(ctx, ev);
+    }
+
+    // heap_timer_run() releases it after the callback
+    if (ev != ctx->firing) {
+        mpool_put(ev);
+    }
+}
+
+int
+timer_event_modify(struct heap_timer *ctx, struct timer_event *ev,
+                   uint32_t delay)
+{
+    assert(ctx);
+    assert(ev);
+
+    ev->clock = system_clock() + delay;
+    if (ev->idx == EVENT_DETACHED) {
+        // re-armed from its last callback
+        return event_heap_push(ctx, ev);
+    }
+
+    event_heap_fix(ctx, ev->idx);
+    return 0;
 }
 
 void
 heap_timer_run(struct heap_timer *ctx)
 {
+    struct timer_event *ev;
+    uint64_t now;
+
     assert(ctx);
-    while (ctx->nevts > 0 && ctx->heap[0]->clock <= system_clock()) {
-        struct timer_event *ev = event_heap_pop(ctx);
-        if (ev->enable && ev->cb) {
+    now = system_clock();
+    while (ctx->nevts > 0 && ctx->heap[0]->clock <= now) {
+        ev = ctx->heap[0];
+
+        // a repeating event stays in the heap, moved to its next clock
+        if (ev->interval > 0) {
+            ev->clock += ev->interval;
+            if (ev->count > 0) {
+                ev->count--;
+                if (ev->count == 0) {
+                    ev->interval = 0;
+                }
+            }
+            event_sift_down(ctx, 0);
+        } else {
+            event_heap_remove(ctx, ev);
+        }
+
+        if (ev->cb) {
+            ctx->firing = ev;
             ev->cb(ev->data);
+            ctx->firing = NULL;
+        }
+
+        // the last run, or cancelled from the callback
+        if (ev->idx == EVENT_DETACHED) {
+            mpool_put(ev);
         }
-        event_re_enqueue(ctx, ev);
     }
 }
 
+uint32_t
+heap_timer_count(struct heap_timer *ctx)
+{
+    assert(ctx);
+    return ctx->nevts;
+}
+
 struct heap_timer *
 heap_timer_create(int max_evts)
 {
     struct heap_timer *ctx = NULL;
 
+    if (max_evts < HEAP_TIMER_MIN_EVTS) {
+        max_evts = HEAP_TIMER_MIN_EVTS;
+    }
+
     ctx = (struct heap_timer *)calloc(1, sizeof(struct heap_timer));
     if (!ctx) {
         goto failed;
@@ -187,6 +254,13 @@ heap_timer_create(int max_evts)
         goto failed;
     }
 
+    // a heap isn't shared between threads, per-thread caches only cost
+    ctx->pool = mpool_create(sizeof(struct timer_event), HEAP_TIMER_CHUNK_EVTS,
+                             MPOOL_MAX_CHUNKS, MPOOL_FLAG_NOCACHE);
+    if (!ctx->pool) {
+        goto failed;
+    }
+
     ctx->max_evts = max_evts;
     ctx->nevts    = 0;
 
@@ -209,6 +283,11 @@ void
 heap_timer_destroy(struct heap_timer *ctx)
 {
     if (ctx) {
+        // events not run to the end go with the pool
+        if (ctx->pool) {
+            mpool_cleanup(ctx->pool);
+            ctx->pool = NULL;
+        }
         if (ctx->heap) {
             free(ctx->heap);
             ctx->heap = NULL;
@@ -16,10 +16,13 @@ typedef struct heap_timer heap_timer_t;
 typedef struct timer_event timer_event_t;
 typedef void (*timer_cb_t)(void *data);
 
-/* @max_evts  max timer_event_t num */
+/* @max_evts  initial timer_event_t num, the heap grows as needed */
 heap_timer_t *heap_timer_create(int max_evts);
+/* events not run to the end are released too */
 void heap_timer_destroy(heap_timer_t *ctx);
 void heap_timer_run(heap_timer_t *ctx);
+/* events in the heap */
+uint32_t heap_timer_count(heap_timer_t *ctx);
 
 /* @ctx         heap_timer_t ctx
  * @cb          timer_event callback
@@ -31,8 +34,21 @@ void heap_timer_run(heap_timer_t *ctx);
 timer_event_t *timer_event_register(heap_timer_t *ctx, timer_cb_t cb,
                                     void *data, uint32_t delay,
                                     uint32_t interval, uint32_t count);
+
+/*
+ * Events belong to ctx, an event is released after its last callback
+ * returns or when cancelled, the pointer is invalid from then on.
+ */
+
+/* remove ev from the heap and release it, O(log n) */
 void timer_event_cancel(heap_timer_t *ctx, timer_event_t *ev);
 
+/* move the next run of ev to delay from now, e.g. to refresh an idle
+ * timeout, or re-arm ev from its last callback. O(log n)
+ * @return 0-ok, -1-out of memory
+ */
+int timer_event_modify(heap_timer_t *ctx, timer_event_t *ev, uint32_t delay);
+
 
 #ifdef __cplusplus
 }
@@ -7,6 +7,9 @@
 #include "system.h"
 #include <stdio.h>
 #include <stdlib.h>
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
 #include <assert.h>
 #include <inttypes.h>
 
@@ -43,11 +46,12 @@ void heap_test1()
         heap_timer_run(ctx);
         system_sleep(1);
     }
+    system_sleep(1);
+    heap_timer_run(ctx);
 
-    for (i = 0; i < N; i++) {
-        free(ev[i]);
-        ev[i] = NULL;
-    }
+    // one-shot events are released after their callback
+    assert(counter == N);
+    assert(heap_timer_count(ctx) == 0);
     free(ev);
 
     heap_timer_destroy(ctx);
@@ -74,8 +78,8 @@ void heap_test2()
     heap_timer_run(ctx);
     printf("end: %"PRIu64"\n", system_clock());
 
-
-    free(ev);
+    timer_event_cancel(ctx, ev);
+    assert(heap_timer_count(ctx) == 0);
     heap_timer_destroy(ctx);
 }
 
@@ -109,12 +113,205 @@ void heap_test3()
     heap_timer_run(ctx);
     printf("end: %"PRIu64"\n", system_clock());
 
+    // cancelled events left the heap at once
+    assert(heap_timer_count(ctx) <= N / 2);
+    free(ev);
+    heap_timer_destroy(ctx);
+}
+
+static heap_timer_t *s_ctx;
+static timer_event_t *s_ev;
+static int s_fired;
+
+static void onrearm(void *param)
+{
+    (void)param;
+    // re-arm from the last run, then cancel from a callback
+    if (++s_fired == 1) {
+        assert(0 == timer_event_modify(s_ctx, s_ev, 0));
+    } else {
+        timer_event_cancel(s_ctx, s_ev);
+    }
+}
+
+static void onnothing(void *param)
+{
+    (void)param;
+    assert(0);
+}
+
+void heap_test_modify()
+{
+    int i;
+    heap_timer_t *ctx = NULL;
+    timer_event_t *ev[N];
+
+    ctx = heap_timer_create(0);
+    assert(ctx);
+
+    // the heap grows past its initial size
     for (i = 0; i < N; i++) {
-        free(ev[i]);
-        ev[i] = NULL;
+        ev[i] = timer_event_register(ctx, onnothing, NULL, 1000 + i, 0, 0);
+        assert(ev[i]);
     }
-    free(ev);
+    assert(heap_timer_count(ctx) == N);
+
+    // cancel in the middle and refresh the rest, then nothing is due
+    for (i = 0; i < N; i += 3) {
+        timer_event_cancel(ctx, ev[i]);
+    }
+    assert(heap_timer_count(ctx) == N - (N + 2) / 3);
+    for (i = 1; i < N; i++) {
+        if (i % 3) {
+            assert(0 == timer_event_modify(ctx, ev[i], 60000 - i));
+        }
+    }
+    system_sleep(1);
+    heap_timer_run(ctx);
+
+    s_ctx = ctx;
+    s_fired = 0;
+    s_ev = timer_event_register(ctx, onrearm, NULL, 0, 0, 0);
+    assert(s_ev);
+    heap_timer_run(ctx);
+    system_sleep(1);
+    heap_timer_run(ctx);
+    assert(s_fired == 2);
+    assert(heap_timer_count(ctx) == N - (N + 2) / 3);
+
+    heap_timer_destroy(ctx);
+}
+
+/*
+ * The former strategy for comparison: calloc'd events, cancel only
+ * disables them, they leave the heap when they surface.
+ */
+typedef struct {
+    uint64_t clock;
+    int enable;
+} lazy_event_t;
+
+typedef struct {
+    uint32_t nevts;
+    uint32_t max_evts;
+    lazy_event_t **heap;
+} lazy_timer_t;
+
+static lazy_event_t *lazy_register(lazy_timer_t *ctx, uint32_t delay)
+{
+    uint32_t i, p;
+    lazy_event_t *ev = (lazy_event_t *)calloc(1, sizeof(lazy_event_t));
+
+    assert(ev && ctx->nevts < ctx->max_evts);
+    ev->clock = system_clock() + delay;
+    ev->enable = 1;
+    for (i = ctx->nevts++; i > 0; i = p) {
+        p = (i - 1) >> 1;
+        if (ctx->heap[p]->clock <= ev->clock)
+            break;
+        ctx->heap[i] = ctx->heap[p];
+    }
+    ctx->heap[i] = ev;
+    return ev;
+}
+
+/* the cost left for later, what a run pays when they surface */
+static void lazy_drain(lazy_timer_t *ctx)
+{
+    uint32_t i, c, n;
+    lazy_event_t *last;
+
+    while (ctx->nevts > 0) {
+        free(ctx->heap[0]);
+        last = ctx->heap[--ctx->nevts];
+        n = ctx->nevts;
+        for (i = 0; (c = i * 2 + 1) < n; i = c) {
+            if (c + 1 < n && ctx->heap[c + 1]->clock < ctx->heap[c]->clock)
+                c++;
+            if (last->clock <= ctx->heap[c]->clock)
+                break;
+            ctx->heap[i] = ctx->heap[c];
+        }
+        ctx->heap[i] = last;
+    }
+}
+
+#define BENCH_EVTS (1024 * 1024)
+#define BENCH_CONNS (64 * 1024)
+
+void heap_benchmark()
+{
+    int i, j;
+    uint64_t start, cost;
+    heap_timer_t *ctx;
+    lazy_timer_t lazy;
+    timer_event_t **ev;
+    lazy_event_t **lev;
+
+    ev = (timer_event_t **)calloc(BENCH_EVTS, sizeof(timer_event_t *));
+    lev = (lazy_event_t **)calloc(BENCH_EVTS, sizeof(lazy_event_t *));
+    lazy.max_evts = BENCH_EVTS + BENCH_CONNS * 16;
+    lazy.heap = (lazy_event_t **)calloc(lazy.max_evts, sizeof(lazy_event_t *));
+    assert(ev && lev && lazy.heap);
+
+    // register + cancel
+    lazy.nevts = 0;
+    start = system_clock();
+    for (i = 0; i < BENCH_EVTS; i++)
+        lev[i] = lazy_register(&lazy, 10000 + rand() % 10000);
+    for (i = 0; i < BENCH_EVTS; i++)
+        lev[i]->enable = 0;
+    printf("lazy    register+cancel %d: %5"PRIu64"ms heap: %u",
+           BENCH_EVTS, system_clock() - start, lazy.nevts);
+    lazy_drain(&lazy);
+    cost = system_clock() - start;
+    printf(" +drain: %"PRIu64"ms\n", cost);
+
+    ctx = heap_timer_create(0);
+    start = system_clock();
+    for (i = 0; i < BENCH_EVTS; i++)
+        ev[i] = timer_event_register(ctx, onnothing, NULL,
+                                     10000 + rand() % 10000, 0, 0);
+    for (i = 0; i < BENCH_EVTS; i++)
+        timer_event_cancel(ctx, ev[i]);
+    cost = system_clock() - start;
+    printf("indexed register+cancel %d: %5"PRIu64"ms heap: %u\n", BENCH_EVTS,
+           cost, heap_timer_count(ctx));
+    assert(heap_timer_count(ctx) == 0);
+
+    // idle timeout refresh, each connection sees 16 requests
+    lazy.nevts = 0;
+    start = system_clock();
+    for (i = 0; i < BENCH_CONNS; i++)
+        lev[i] = lazy_register(&lazy, 30000);
+    for (j = 0; j < 16; j++) {
+        for (i = 0; i < BENCH_CONNS; i++) {
+            lev[i]->enable = 0;
+            lev[i] = lazy_register(&lazy, 30000 + j);
+        }
+    }
+    printf("lazy    refresh %d x 16: %5"PRIu64"ms heap: %u", BENCH_CONNS,
+           system_clock() - start, lazy.nevts);
+    lazy_drain(&lazy);
+    cost = system_clock() - start;
+    printf(" +drain: %"PRIu64"ms\n", cost);
+
+    start = system_clock();
+    for (i = 0; i < BENCH_CONNS; i++)
+        ev[i] = timer_event_register(ctx, onnothing, NULL, 30000, 0, 0);
+    for (j = 0; j < 16; j++) {
+        for (i = 0; i < BENCH_CONNS; i++)
+            timer_event_modify(ctx, ev[i], 30000 + j);
+    }
+    cost = system_clock() - start;
+    printf("indexed refresh %d x 16: %5"PRIu64"ms heap: %u\n", BENCH_CONNS,
+           cost, heap_timer_count(ctx));
+    assert(heap_timer_count(ctx) == BENCH_CONNS);
+
     heap_timer_destroy(ctx);
+    free(lazy.heap);
+    free(lev);
+    free(ev);
 }
 
 int main(void)
@@ -122,5 +319,7 @@ int main(void)
     heap_test1();
     heap_test2();
     heap_test3();
+    heap_test_modify();
+    heap_benchmark();
     return 0;
 }
@@ -4,6 +4,7 @@
  * Date   : 2021/01/15
  */
 #include "file_output.h"
+#include "fileio.h"
 
 #include <errno.h>
 #include <inttypes.h>
@@ -12,10 +13,12 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <time.h>
+#include <unistd.h>
 
 #define MAX_FILE_PATH   256
 #define FLUSH_INTERVAL  200          // ms
 #define ROTATE_INTERVAL (60 * 1000)  // ms
+#define AFILE_BUF_SIZE  (64 * 1024)
 
 struct file_output_ctx {
     char *file_path;
@@ -31,6 +34,17 @@ struct file_output_ctx {
     uint64_t flush_timestamp;
     FILE *fp;
     char current_file_name[MAX_FILE_PATH];
+
+    // afile: abuf[acur] fills while abuf[!acur] is written by io
+    fileio_t *io;
+    pthread_mutex_t lock;
+    char *abuf[2];
+    size_t alen;
+    int acur;
+    volatile int awriting;
+    size_t awrite_len;
+    int aerror;
+    uint64_t aoffset; // file offset of abuf[acur]
 };
 
 /* pointer to environment */
@@ -69,6 +83,94 @@ dump_environment(struct log_output *output)
     fprintf(ctx->fp, "\n");
 }
 
+static void
+afile_onwrite(void *param, int result)
+{
+    struct file_output_ctx *ctx = (struct file_output_ctx *)param;
+
+    if (result < 0) {
+        ctx->aerror = result;
+    } else if ((size_t)result != ctx->awrite_len) {
+        ctx->aerror = -EIO;
+    }
+    ctx->awriting = 0;
+}
+
+static void
+afile_wait(struct file_output_ctx *ctx)
+{
+    while (ctx->awriting) {
+        fileio_poll(ctx->io, 1, -1);
+    }
+    if (ctx->aerror) {
+        ERROR_LOG("write %s failed: (%s)\n", ctx->current_file_name,
+                  strerror(-ctx->aerror));
+        ctx->aerror = 0;
+    }
+}
+
+// submit the filled buffer, waits only for the previous one
+static int
+afile_flush(struct file_output_ctx *ctx)
+{
+    int ret;
+
+    if (ctx->alen == 0) {
+        return 0;
+    }
+
+    // a rotated or truncated file is opened without O_APPEND, so every
+    // write carries its own offset; one write in flight keeps the order
+    afile_wait(ctx);
+    ctx->awriting   = 1;
+    ctx->awrite_len = ctx->alen;
+    ret = fileio_write(ctx->io, fileno(ctx->fp), ctx->abuf[ctx->acur],
+                       ctx->alen, ctx->aoffset, afile_onwrite, ctx);
+    if (ret < 0) {
+        ctx->awriting = 0;
+        ERROR_LOG("fileio_write failed: (%s) len:%lu\n", strerror(-ret),
+                  ctx->alen);
+        return -1;
+    }
+
+    ctx->aoffset += ctx->alen;
+    ctx->acur ^= 1;
+    ctx->alen = 0;
+    return 0;
+}
+
+static void
+afile_drain(struct file_output_ctx *ctx)
+{
+    if (ctx->io && ctx->fp) {
+        afile_flush(ctx);
+        afile_wait(ctx);
+    }
+}
+
+static int
+file_write(struct file_output_ctx *ctx, const char *data, size_t len)
+{
+    size_t n;
+
+    if (!ctx->io) {
+        return fwrite(data, len, 1, ctx->fp) == 1 ? 0 : -1;
+    }
+
+    while (len > 0) {
+        n = AFILE_BUF_SIZE - ctx->alen;
+        n = n < len ? n : len;
+        memcpy(ctx->abuf[ctx->acur] + ctx->alen, data, n);
+        ctx->alen += n;
+        data += n;
+        len -= n;
+        if (ctx->alen == AFILE_BUF_SIZE && afile_flush(ctx) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
 static size_t
 check_can_write_bytes(struct log_output *output, struct log_handler *handler)
 {
@@ -350,6 +452,7 @@ file_open_logfile(struct log_output *output)
     struct file_output_ctx *ctx = (struct file_output_ctx *)output->ctx;
 
     if (ctx->fp != NULL) {
+        afile_drain(ctx);
         fclose(ctx->fp);
         ctx->fp = NULL;
     }
@@ -390,6 +493,7 @@ file_open_logfile(struct log_output *output)
 
     // TODO: line buffer - low write speed
     // setvbuf(ctx->fp, NULL, _IOLBF, 0);
+    ctx->aoffset = ctx->data_offset;
     return 0;
 
 failed:
@@ -441,7 +545,7 @@ file_emit(struct log_output *output, struct log_handler *handler)
     size_t len       = buf_len(buf);
     size_t file_left = check_can_write_bytes(output, handler);
     if (file_left >= len) {
-        if (fwrite(buf->start, len, 1, ctx->fp) != 1) {
+        if (file_write(ctx, buf->start, len) != 0) {
             ERROR_LOG("fwrite failed: (%s) len:%lu\n", strerror(errno), len);
             return -1;
         }
@@ -450,7 +554,11 @@ file_emit(struct log_output *output, struct log_handler *handler)
         // flush
         uint64_t ts = log_get_ms();
         if (ts - ctx->flush_timestamp >= FLUSH_INTERVAL) {
-            fflush(ctx->fp);
+            if (ctx->io) {
+                afile_flush(ctx);
+            } else {
+                fflush(ctx->fp);
+            }
             /* fsync(fileno(ctx->fp)); */
             ctx->flush_timestamp = ts;
         }
@@ -464,7 +572,7 @@ file_emit(struct log_output *output, struct log_handler *handler)
             (len - total_write) > file_left ? file_left : (len - total_write);
 
         if (nwrite > 0) {
-            if (fwrite(buf->start + total_write, nwrite, 1, ctx->fp) != 1) {
+            if (file_write(ctx, buf->start + total_write, nwrite) != 0) {
                 ERROR_LOG(
                     "fwrite failed: (%s) nwrite: %lu total: %lu len: %lu left: "
                     "%lu\n",
@@ -538,9 +646,17 @@ file_ctx_uninit(struct log_output *output)
         ctx->log_name = NULL;
     }
     if (ctx->fp) {
+        afile_drain(ctx);
         fclose(ctx->fp);
         ctx->fp = NULL;
     }
+    if (ctx->io) {
+        fileio_destroy(ctx->io);
+        ctx->io = NULL;
+        free(ctx->abuf[0]);
+        free(ctx->abuf[1]);
+        pthread_mutex_destroy(&ctx->lock);
+    }
     free(ctx);
     ctx         = NULL;
     output->ctx = NULL;
@@ -611,3 +727,70 @@ struct log_output_priv file_output_priv = {
     .ctx_uninit = file_ctx_uninit,
     .dump       = file_ctx_dump,
 };
+
+static int
+afile_emit(struct log_output *output, struct log_handler *handler)
+{
+    struct file_output_ctx *ctx = NULL;
+    int ret;
+
+    if (!output || !output->ctx) {
+        ERROR_LOG("output is NULL\n");
+        return -1;
+    }
+
+    // an output may be shared by handlers, the buffers aren't
+    ctx = (struct file_output_ctx *)output->ctx;
+    pthread_mutex_lock(&ctx->lock);
+    ret = file_emit(output, handler);
+    pthread_mutex_unlock(&ctx->lock);
+    return ret;
+}
+
+static int
+afile_ctx_init(struct log_output *output, va_list ap)
+{
+    struct file_output_ctx *ctx = NULL;
+
+    if (!output) {
+        ERROR_LOG("output is NULL\n");
+        return -1;
+    }
+
+    // set up before file_ctx_init opens the file
+    output->ctx =
+        (struct file_output_ctx *)calloc(1, sizeof(struct file_output_ctx));
+    if (!output->ctx) {
+        ERROR_LOG("calloc failed: (%s)\n", strerror(errno));
+        return -1;
+    }
+    ctx = (struct file_output_ctx *)output->ctx;
+
+    pthread_mutex_init(&ctx->lock, NULL);
+    ctx->abuf[0] = (char *)malloc(AFILE_BUF_SIZE);
+    ctx->abuf[1] = (char *)malloc(AFILE_BUF_SIZE);
+    ctx->io      = fileio_create(2, 0, NULL);
+    if (!ctx->abuf[0] || !ctx->abuf[1] || !ctx->io) {
+        ERROR_LOG("fileio_create failed\n");
+        if (ctx->io) {
+            fileio_destroy(ctx->io);
+        }
+        free(ctx->abuf[0]);
+        free(ctx->abuf[1]);
+        pthread_mutex_destroy(&ctx->lock);
+        free(ctx);
+        output->ctx = NULL;
+        return -1;
+    }
+
+    return file_ctx_init(output, ap);
+}
+
+struct log_output_priv afile_output_priv = {
+    .type       = LOG_OUTTYPE_AFILE,
+    .type_name  = "afile",
+    .emit       = afile_emit,
+    .ctx_init   = afile_ctx_init,
+    .ctx_uninit = file_ctx_uninit,
+    .dump       = file_ctx_dump,
+};
@@ -8,5 +8,6 @@
 #include "log_priv.h"
 
 extern struct log_output_priv file_output_priv;
+extern struct log_output_priv afile_output_priv;
 
 #endif
@@ -40,6 +40,7 @@ enum LOG_OUTTYPE {
     LOG_OUTTYPE_LOGCAT = 0x0040,
     LOG_OUTTYPE_SYSLOG = 0x0080,
     LOG_OUTTYPE_USER   = 0x0100,
+    LOG_OUTTYPE_AFILE  = 0x0200,
     LOG_OUTTYPE_NONE   = 0x0000,
 };
 
@@ -94,6 +95,9 @@ void log_format_destroy(log_format_t *format);
 //                              int bakup_num
 //                          ROTATE_POLICE_BY_TIME
 //
+// LOG_OUTTYPE_AFILE   same as LOG_OUTTYPE_FILE, the writes are buffered
+//                     and submitted to fileio (io_uring or a thread pool)
+//
 // LOG_OUTTYPE_MMAP    char *file_path
 //                     char *log_name
 //                          ROTATE_POLICE_BY_SIZE
@@ -244,6 +244,9 @@ log_output_create_v(enum LOG_OUTTYPE type, va_list ap)
     case LOG_OUTTYPE_FILE:
         output->priv = &file_output_priv;
         break;
+    case LOG_OUTTYPE_AFILE:
+        output->priv = &afile_output_priv;
+        break;
     case LOG_OUTTYPE_MMAP:
         output->priv = &mmap_output_priv;
         break;
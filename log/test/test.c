@@ -12,7 +12,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/syslog.h>
+#include <sys/time.h>
 #include <unistd.h>
 
 #ifdef TAG
@@ -519,6 +521,100 @@ test_format()
     log_cleanup();
 }
 
+static long
+file_size(const char *file)
+{
+    struct stat st;
+    return stat(file, &st) == 0 ? (long)st.st_size : -1;
+}
+
+// same lines through stdio and through fileio, same bytes on disk
+void
+test_afile(void)
+{
+    int i, k;
+    uint64_t ts[2];
+    struct timeval tv;
+    const char *names[] = {"sfile", "afile"};
+    enum LOG_OUTTYPE types[] = {LOG_OUTTYPE_FILE, LOG_OUTTYPE_AFILE};
+
+    unlink("logs/sfile.log");
+    unlink("logs/afile.log");
+    for (k = 0; k < 2; k++) {
+        log_format_t *format = log_format_create("%V %m%n");
+        log_output_t *output =
+            log_output_create(types[k], "logs", names[k],
+                              ROTATE_POLICE_BY_SIZE, 1024 * 1024 * 1024, 4);
+        log_handler_t *handler = log_handler_create(names[k]);
+        log_rule_create(handler, format, output, -1, -1);
+
+        gettimeofday(&tv, NULL);
+        ts[k] = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+        for (i = 0; i < 1024 * 1024; i++) {
+            CLOGI(handler, "this is line %d of the %s output", i, names[k]);
+        }
+        log_cleanup();
+        gettimeofday(&tv, NULL);
+        ts[k] = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec - ts[k];
+    }
+
+    printf("1M lines: file %lums, afile %lums\n", (unsigned long)ts[0] / 1000,
+           (unsigned long)ts[1] / 1000);
+    if (file_size("logs/sfile.log") != file_size("logs/afile.log")) {
+        printf("afile size mismatch: %ld != %ld\n", file_size("logs/sfile.log"),
+               file_size("logs/afile.log"));
+        abort();
+    }
+}
+
+// rotate every 200K, each rotated file must match the stdio one
+void
+test_afile_rotate(void)
+{
+    int i, k;
+    char sname[64], aname[64];
+    const char *names[] = {"srfile", "arfile"};
+    enum LOG_OUTTYPE types[] = {LOG_OUTTYPE_FILE, LOG_OUTTYPE_AFILE};
+
+    for (k = 0; k < 2; k++) {
+        snprintf(sname, sizeof(sname), "logs/%s.log", names[k]);
+        unlink(sname);
+        for (i = 0; i < 4; i++) {
+            snprintf(sname, sizeof(sname), "logs/%s.log.%d", names[k], i);
+            unlink(sname);
+        }
+    }
+
+    for (k = 0; k < 2; k++) {
+        log_format_t *format = log_format_create("%m%n");
+        log_output_t *output =
+            log_output_create(types[k], "logs", names[k],
+                              ROTATE_POLICE_BY_SIZE, 200 * 1024, 4);
+        log_handler_t *handler = log_handler_create(names[k]);
+        log_rule_create(handler, format, output, -1, -1);
+
+        for (i = 0; i < 20000; i++) {
+            CLOGI(handler, "this is line %08d", i);
+        }
+        log_cleanup();
+    }
+
+    for (i = -1; i < 4; i++) {
+        if (i < 0) {
+            snprintf(sname, sizeof(sname), "logs/%s.log", names[0]);
+            snprintf(aname, sizeof(aname), "logs/%s.log", names[1]);
+        } else {
+            snprintf(sname, sizeof(sname), "logs/%s.log.%d", names[0], i);
+            snprintf(aname, sizeof(aname), "logs/%s.log.%d", names[1], i);
+        }
+        if (file_size(sname) != file_size(aname)) {
+            printf("afile rotate mismatch: %s %ld != %s %ld\n", sname,
+                   file_size(sname), aname, file_size(aname));
+            abort();
+        }
+    }
+}
+
 DEPRECATED_API void
 test_big_buf(void)
 {
@@ -582,6 +678,8 @@ int
 main(int argc, char *argv[])
 {
     test_misc();
+    test_afile();
+    test_afile_rotate();
     /* test_simple(); */
     /* test_size(); */
     /* test_callback(); */
@@ -4,7 +4,7 @@
  * Date   : 2021/03/24
  */
 #include "mpeg4-aac.h"
-#include "mpeg4-bits.h"
+#include "bits.h"
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
@@ -74,15 +74,15 @@ program_config_element()
 		comment_field_data[i];                  8 uimsbf
 }
 */
-static inline uint64_t mpeg4_bits_copy(struct mpeg4_bits_t* dst, struct mpeg4_bits_t* src, int n)
+static inline uint64_t mpeg4_bits_copy(bits_writer_t* dst, bits_reader_t* src, int n)
 {
 	uint64_t v;
-	v = mpeg4_bits_read_n(src, n);
-	mpeg4_bits_write_n(dst, v, n);
+	v = bits_reader_read_n(src, n);
+	bits_writer_write_n(dst, v, n);
 	return v;
 }
 
-static int mpeg4_aac_pce_load(struct mpeg4_bits_t* bits, struct mpeg4_aac_t* aac, struct mpeg4_bits_t* pce)
+static int mpeg4_aac_pce_load(bits_reader_t* bits, struct mpeg4_aac_t* aac, bits_writer_t* pce)
 {
 	uint64_t i, cpe, tag;
 	uint64_t element_instance_tag;
@@ -152,8 +152,8 @@ static int mpeg4_aac_pce_load(struct mpeg4_bits_t* bits, struct mpeg4_aac_t* aac
 		tag = mpeg4_bits_copy(pce, bits, 4); // valid_cc_element_tag_select
 	}
 
-	mpeg4_bits_aligment(bits, 8); // byte_alignment();
-	mpeg4_bits_aligment(pce, 8);
+	bits_reader_align(bits); // byte_alignment();
+	bits_writer_align(pce);
 
 	comment_field_bytes = mpeg4_bits_copy(pce, bits, 8);
 	for (i = 0; i < comment_field_bytes; i++)
@@ -161,7 +161,8 @@ static int mpeg4_aac_pce_load(struct mpeg4_bits_t* bits, struct mpeg4_aac_t* aac
 
 	assert(aac->sampling_frequency_index == sampling_frequency_index);
 	assert(aac->profile == object_type + 1);
-	return (int)((pce->bits + 7) / 8);
+	bits_writer_flush(pce);
+	return (int)((bits_writer_tell(pce) + 7) / 8);
 }
 
 // 4.4.1 Decoder configuration (GASpecificConfig) (p487)
@@ -197,100 +198,100 @@ GASpecificConfig (samplingFrequencyIndex, channelConfiguration, audioObjectType)
 	}
 }
 */
-static int mpeg4_aac_ga_specific_config_load(struct mpeg4_bits_t* bits, struct mpeg4_aac_t* aac)
+static int mpeg4_aac_ga_specific_config_load(bits_reader_t* bits, struct mpeg4_aac_t* aac)
 {
 	int extensionFlag;
-	struct mpeg4_bits_t pce;
+	bits_writer_t pce;
 
-	mpeg4_bits_read(bits); // frameLengthFlag
-	if (mpeg4_bits_read(bits)) // dependsOnCoreCoder
-		mpeg4_bits_read_uint16(bits, 14); // coreCoderDelay
-	extensionFlag = mpeg4_bits_read(bits); // extensionFlag
+	bits_reader_read(bits); // frameLengthFlag
+	if (bits_reader_read(bits)) // dependsOnCoreCoder
+		bits_reader_read_n(bits, 14); // coreCoderDelay
+	extensionFlag = bits_reader_read(bits); // extensionFlag
 
 	if (0 == aac->channel_configuration)
 	{
-		mpeg4_bits_init(&pce, aac->pce, sizeof(aac->pce));
+		bits_writer_init(&pce, aac->pce, sizeof(aac->pce));
 		aac->npce = mpeg4_aac_pce_load(bits, aac, &pce); // update channel count
 	}
 
 	if (6 == aac->profile || 20 == aac->profile)
-		mpeg4_bits_read_uint8(bits, 3); // layerNr
+		bits_reader_read_n(bits, 3); // layerNr
 
 	if (extensionFlag)
 	{
 		if (22 == aac->profile)
 		{
-			mpeg4_bits_read_uint8(bits, 5); // numOfSubFrame
-			mpeg4_bits_read_uint16(bits, 11); // layer_length
+			bits_reader_read_n(bits, 5); // numOfSubFrame
+			bits_reader_read_n(bits, 11); // layer_length
 		}
 
 		if (17 == aac->profile || 19 == aac->profile || 20 == aac->profile || 23 == aac->profile)
 		{
-			mpeg4_bits_read(bits); // aacSectionDataResilienceFlag
-			mpeg4_bits_read(bits); // aacScalefactorDataResilienceFlag
-			mpeg4_bits_read(bits); // aacSpectralDataResilienceFlag
+			bits_reader_read(bits); // aacSectionDataResilienceFlag
+			bits_reader_read(bits); // aacScalefactorDataResilienceFlag
+			bits_reader_read(bits); // aacSpectralDataResilienceFlag
 		}
 
-		if (mpeg4_bits_read(bits)) // extensionFlag3
+		if (bits_reader_read(bits)) // extensionFlag3
 		{
 			// tbd in version 3
 			assert(0);
 		}
 	}
 
-	return mpeg4_bits_error(bits);
+	return bits->error;
 }
 
-static int mpeg4_aac_celp_specific_config_load(struct mpeg4_bits_t* bits, struct mpeg4_aac_t* aac)
+static int mpeg4_aac_celp_specific_config_load(bits_reader_t* bits, struct mpeg4_aac_t* aac)
 {
 	int ExcitationMode;
-	if (mpeg4_bits_read(bits)) // isBaseLayer
+	if (bits_reader_read(bits)) // isBaseLayer
 	{
 		// CelpHeader
 
-		ExcitationMode = mpeg4_bits_read(bits);
-		mpeg4_bits_read(bits); // SampleRateMode
-		mpeg4_bits_read(bits); // FineRateControl
+		ExcitationMode = bits_reader_read(bits);
+		bits_reader_read(bits); // SampleRateMode
+		bits_reader_read(bits); // FineRateControl
 
 		// Table 3.50 - Description of ExcitationMode
 		if (ExcitationMode == 1 /*RPE*/)
 		{
-			mpeg4_bits_read_n(bits, 3); // RPE_Configuration
+			bits_reader_read_n(bits, 3); // RPE_Configuration
 		}
 		if (ExcitationMode == 0 /*MPE*/)
 		{
-			mpeg4_bits_read_n(bits, 5); // MPE_Configuration
-			mpeg4_bits_read_n(bits, 2); // NumEnhLayers
-			mpeg4_bits_read(bits); // BandwidthScalabilityMode
+			bits_reader_read_n(bits, 5); // MPE_Configuration
+			bits_reader_read_n(bits, 2); // NumEnhLayers
+			bits_reader_read(bits); // BandwidthScalabilityMode
 		}
 	}
 	else
 	{
-		if (mpeg4_bits_read(bits)) // isBWSLayer
-			mpeg4_bits_read_n(bits, 2); // BWS_configuration
+		if (bits_reader_read(bits)) // isBWSLayer
+			bits_reader_read_n(bits, 2); // BWS_configuration
 		else
-			mpeg4_bits_read_n(bits, 2); // CELP-BRS-id
+			bits_reader_read_n(bits, 2); // CELP-BRS-id
 	}
 
-	return mpeg4_bits_error(bits);
+	return bits->error;
 }
 
-static inline uint8_t mpeg4_aac_get_audio_object_type(struct mpeg4_bits_t* bits)
+static inline uint8_t mpeg4_aac_get_audio_object_type(bits_reader_t* bits)
 {
 	uint8_t audioObjectType;
-	audioObjectType = mpeg4_bits_read_uint8(bits, 5);
+	audioObjectType = (uint8_t)bits_reader_read_n(bits, 5);
 	if (31 == audioObjectType)
-		audioObjectType = 32 + mpeg4_bits_read_uint8(bits, 6);
+		audioObjectType = 32 + (uint8_t)bits_reader_read_n(bits, 6);
 	return audioObjectType;
 }
 
-static inline uint8_t mpeg4_aac_get_sampling_frequency(struct mpeg4_bits_t* bits)
+static inline uint8_t mpeg4_aac_get_sampling_frequency(bits_reader_t* bits)
 {
 	uint8_t samplingFrequencyIndex;
 	uint32_t samplingFrequency;
-	samplingFrequencyIndex = mpeg4_bits_read_uint8(bits, 4);
+	samplingFrequencyIndex = (uint8_t)bits_reader_read_n(bits, 4);
 	if (0x0F == samplingFrequencyIndex)
-		samplingFrequency = mpeg4_bits_read_uint32(bits, 24);
+		samplingFrequency = (uint32_t)bits_reader_read_n(bits, 24);
 	return samplingFrequencyIndex;
 }
 
@@ -304,12 +305,12 @@ int mpeg4_aac_audio_specific_config_load2(const uint8_t* data, size_t bytes, str
 //	uint8_t channelConfiguration = 0;
 	uint8_t extensionChannelConfiguration = 0;
 	uint8_t epConfig;
-	struct mpeg4_bits_t bits;
-	mpeg4_bits_init(&bits, (void*)data, bytes);
+	bits_reader_t bits;
+	bits_reader_init(&bits, data, bytes);
 
 	aac->profile = mpeg4_aac_get_audio_object_type(&bits);
 	aac->sampling_frequency_index = mpeg4_aac_get_sampling_frequency(&bits);
-	aac->channel_configuration = mpeg4_bits_read_uint8(&bits, 4);
+	aac->channel_configuration = (uint8_t)bits_reader_read_n(&bits, 4);
 
 	if (5 == aac->profile || 29 == aac->profile)
 	{
@@ -320,7 +321,7 @@ int mpeg4_aac_audio_specific_config_load2(const uint8_t* data, size_t bytes, str
 		extensionSamplingFrequencyIndex = mpeg4_aac_get_sampling_frequency(&bits);
 		aac->profile = mpeg4_aac_get_audio_object_type(&bits);
 		if (22 == aac->profile)
-			extensionChannelConfiguration = mpeg4_bits_read_uint8(&bits, 4);
+			extensionChannelConfiguration = (uint8_t)bits_reader_read_n(&bits, 4);
 	}
 	else
 	{
@@ -347,7 +348,7 @@ int mpeg4_aac_audio_specific_config_load2(const uint8_t* data, size_t bytes, str
 	{
 	case 17: case 19: case 20: case 21: case 22:
 	case 23: case 24: case 25: case 26: case 27: case 39:
-		epConfig = mpeg4_bits_read_uint8(&bits, 2);
+		epConfig = (uint8_t)bits_reader_read_n(&bits, 2);
 		if (2 == epConfig || 3 == epConfig)
 		{
 			// 1.8.2.1 Error protection specific configuration (p96)
@@ -356,7 +357,7 @@ int mpeg4_aac_audio_specific_config_load2(const uint8_t* data, size_t bytes, str
 		}
 		if (3 == epConfig)
 		{
-			if (mpeg4_bits_read(&bits)) // directMapping
+			if (bits_reader_read(&bits)) // directMapping
 			{
 				// tbd
 				assert(0);
@@ -367,38 +368,38 @@ int mpeg4_aac_audio_specific_config_load2(const uint8_t* data, size_t bytes, str
 	default: break; // do nothing;
 	}
 
-	if (5 != extensionAudioObjectType && mpeg4_bits_remain(&bits) >= 16)
+	if (5 != extensionAudioObjectType && bits_reader_remain(&bits) >= 16)
 	{
-		syncExtensionType = mpeg4_bits_read_uint16(&bits, 11);
+		syncExtensionType = (uint16_t)bits_reader_read_n(&bits, 11);
 		if (0x2b7 == syncExtensionType)
 		{
 			extensionAudioObjectType = mpeg4_aac_get_audio_object_type(&bits);
 			if (5 == extensionAudioObjectType)
 			{
-				aac->sbr = mpeg4_bits_read(&bits);
+				aac->sbr = bits_reader_read(&bits);
 				if (aac->sbr)
 				{
 					extensionSamplingFrequencyIndex = mpeg4_aac_get_sampling_frequency(&bits);
-					if (mpeg4_bits_remain(&bits) >= 12)
+					if (bits_reader_remain(&bits) >= 12)
 					{
-						syncExtensionType = mpeg4_bits_read_uint16(&bits, 11);
+						syncExtensionType = (uint16_t)bits_reader_read_n(&bits, 11);
 						if (0x548 == syncExtensionType)
-							aac->ps = mpeg4_bits_read(&bits);
+							aac->ps = bits_reader_read(&bits);
 					}
 				}
 			}
 			if (22 == extensionAudioObjectType)
 			{
-				aac->sbr = mpeg4_bits_read(&bits);
+				aac->sbr = bits_reader_read(&bits);
 				if (aac->sbr)
 					extensionSamplingFrequencyIndex = mpeg4_aac_get_sampling_frequency(&bits);
-				extensionChannelConfiguration = mpeg4_bits_read_uint8(&bits, 4);
+				extensionChannelConfiguration = (uint8_t)bits_reader_read_n(&bits, 4);
 			}
 		}
 	}
 
-	mpeg4_bits_aligment(&bits, 8);
-	return mpeg4_bits_error(&bits) ? -1 : (int)(bits.bits / 8);
+	bits_reader_align(&bits);
+	return bits.error ? -1 : (int)(bits_reader_tell(&bits) / 8);
 }
 
 int mpeg4_aac_audio_specific_config_save2(const struct mpeg4_aac_t* aac, uint8_t* data, size_t bytes)
@@ -418,7 +419,8 @@ int mpeg4_aac_adts_pce_load(const uint8_t* data, size_t bytes, struct mpeg4_aac_
 {
 	uint8_t i;
 	size_t offset = 7;
-	struct mpeg4_bits_t bits, pce;
+	bits_reader_t bits;
+	bits_writer_t pce;
 
 	if (0 == (data[1] & 0x01)) // protection_absent
 	{
@@ -431,12 +433,12 @@ int mpeg4_aac_adts_pce_load(const uint8_t* data, size_t bytes, struct mpeg4_aac_
 	if (bytes <= offset)
 		return (int)offset;
 
-	mpeg4_bits_init(&bits, (uint8_t*)data + offset, bytes - offset);
-	if (ID_PCE == mpeg4_bits_read_uint8(&bits, 3))
+	bits_reader_init(&bits, data + offset, bytes - offset);
+	if (ID_PCE == bits_reader_read_n(&bits, 3))
 	{
-		mpeg4_bits_init(&pce, aac->pce, sizeof(aac->pce));
+		bits_writer_init(&pce, aac->pce, sizeof(aac->pce));
 		aac->npce = mpeg4_aac_pce_load(&bits, aac, &pce);
-		return mpeg4_bits_error(&bits) ? -1 : (int)(7 + (pce.bits + 7) / 8);
+		return bits.error ? -1 : 7 + aac->npce;
 	}
 	return 7;
 }
@@ -444,15 +446,17 @@ int mpeg4_aac_adts_pce_load(const uint8_t* data, size_t bytes, struct mpeg4_aac_
 int mpeg4_aac_adts_pce_save(uint8_t* data, size_t bytes, const struct mpeg4_aac_t* aac)
 {
 	struct mpeg4_aac_t src;
-	struct mpeg4_bits_t pce, adts;
+	int n;
+	bits_reader_t pce;
+	bits_writer_t adts;
 	if ((size_t)aac->npce + 7 > bytes)
 		return 0;
 	memcpy(&src, aac, sizeof(src));
 //	assert(data[1] & 0x01); // disable protection_absent
-	mpeg4_bits_init(&pce, (uint8_t*)aac->pce, aac->npce);
-	mpeg4_bits_init(&adts, (uint8_t*)data + 7, bytes - 7);
-	mpeg4_bits_write_uint8(&adts, ID_PCE, 3);
-	mpeg4_aac_pce_load(&pce, &src, &adts);
+	bits_reader_init(&pce, aac->pce, aac->npce);
+	bits_writer_init(&adts, data + 7, bytes - 7);
+	bits_writer_write_n(&adts, ID_PCE, 3);
+	n = mpeg4_aac_pce_load(&pce, &src, &adts);
 	assert(src.channels == aac->channels);
-	return mpeg4_bits_error(&pce) ? 0 : (int)((7 + (adts.bits+7) / 8));
+	return pce.error ? 0 : 7 + n;
 }
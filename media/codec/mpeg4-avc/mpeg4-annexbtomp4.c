@@ -11,6 +11,7 @@
 // 2. It is recommended encapsulating one NAL unit in one SL packet when it is delivered over lossy environment.
 
 #include "mpeg4-avc.h"
+#include "bits.h"
 #include <string.h>
 #include <assert.h>
 #include <stdint.h>
@@ -80,24 +81,14 @@ void mpeg4_h264_annexb_nalu(const void* h264, int bytes, void (*handler)(void* p
 
 uint8_t mpeg4_h264_read_ue(const uint8_t* data, int bytes, int* offset)
 {
-	int bit, i;
-	int leadingZeroBits = -1;
-
-	for (bit = 0; !bit && *offset / 8 < bytes; ++leadingZeroBits)
-	{
-		bit = (data[*offset / 8] >> (7 - (*offset % 8))) & 0x01;
-		++*offset;
-	}
-
-	bit = 0;
-	assert(leadingZeroBits < 32);
-	for (i = 0; i < leadingZeroBits && *offset / 8 < bytes; i++)
-	{
-		bit = (bit << 1) | ((data[*offset / 8] >> (7 - (*offset % 8))) & 0x01);
-		++*offset;
-	}
-
-	return (uint8_t)((1 << leadingZeroBits) - 1 + bit);
+	uint32_t v;
+	bits_reader_t bits;
+
+	bits_reader_init(&bits, data, bytes);
+	bits_reader_skip(&bits, *offset);
+	v = bits_reader_read_ue(&bits);
+	*offset = (int)bits_reader_tell(&bits);
+	return (uint8_t)v;
 }
 
 static void mpeg4_avc_remove(struct mpeg4_avc_t* avc, uint8_t* ptr, int bytes, const uint8_t* end)
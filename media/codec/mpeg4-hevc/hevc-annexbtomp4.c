@@ -5,6 +5,7 @@
  */
 #include "mpeg4-hevc.h"
 #include "mpeg4-avc.h"
+#include "bits.h"
 #include <string.h>
 #include <assert.h>
 
@@ -31,8 +32,6 @@ struct h265_annexbtomp4_handle_t
 	int capacity;
 };
 
-uint8_t mpeg4_h264_read_ue(const uint8_t* data, int bytes, int* offset);
-
 static int hevc_rbsp_decode(const uint8_t* nalu, int bytes, uint8_t* sodb)
 {
 	int i, j;
@@ -133,7 +132,7 @@ static uint8_t hevc_sps_id(const uint8_t* rbsp, int bytes, struct mpeg4_hevc_t*
 	uint8_t sps;
 	uint8_t sps_max_sub_layers_minus1;
 	uint8_t sps_temporal_id_nesting_flag;
-	uint8_t conformance_window_flag;
+	bits_reader_t bits;
 
 	sodb = hevc_rbsp_decode(rbsp, bytes, ptr);
 	if (sodb < 12+3)
@@ -146,23 +145,23 @@ static uint8_t hevc_sps_id(const uint8_t* rbsp, int bytes, struct mpeg4_hevc_t*
 	if (n <= 0)
 		return 0xFF;
 
-	n = (n + 3) * 8;
-	sps = mpeg4_h264_read_ue(ptr, sodb, &n);
-	hevc->chromaFormat = mpeg4_h264_read_ue(ptr, sodb, &n);
+	bits_reader_init(&bits, ptr, sodb);
+	bits_reader_skip(&bits, (n + 3) * 8);
+	sps = (uint8_t)bits_reader_read_ue(&bits);
+	hevc->chromaFormat = (uint8_t)bits_reader_read_ue(&bits);
 	if (3 == hevc->chromaFormat)
-		n++;
-	mpeg4_h264_read_ue(ptr, sodb, &n); // pic_width_in_luma_samples
-	mpeg4_h264_read_ue(ptr, sodb, &n); // pic_height_in_luma_samples
-	conformance_window_flag = BIT(ptr, n); n++; // conformance_window_flag
-	if (conformance_window_flag)
+		bits_reader_read(&bits); // separate_colour_plane_flag
+	bits_reader_read_ue(&bits); // pic_width_in_luma_samples
+	bits_reader_read_ue(&bits); // pic_height_in_luma_samples
+	if (bits_reader_read(&bits)) // conformance_window_flag
 	{
-		mpeg4_h264_read_ue(ptr, sodb, &n); // conf_win_left_offset
-		mpeg4_h264_read_ue(ptr, sodb, &n); // conf_win_right_offset
-		mpeg4_h264_read_ue(ptr, sodb, &n); // conf_win_top_offset
-		mpeg4_h264_read_ue(ptr, sodb, &n); // conf_win_bottom_offset
+		bits_reader_read_ue(&bits); // conf_win_left_offset
+		bits_reader_read_ue(&bits); // conf_win_right_offset
+		bits_reader_read_ue(&bits); // conf_win_top_offset
+		bits_reader_read_ue(&bits); // conf_win_bottom_offset
 	}
-	hevc->bitDepthLumaMinus8 = mpeg4_h264_read_ue(ptr, sodb, &n);
-	hevc->bitDepthChromaMinus8 = mpeg4_h264_read_ue(ptr, sodb, &n);
+	hevc->bitDepthLumaMinus8 = (uint8_t)bits_reader_read_ue(&bits);
+	hevc->bitDepthChromaMinus8 = (uint8_t)bits_reader_read_ue(&bits);
 
 	// TODO: vui_parameters
 	//mp4->hevc->min_spatial_segmentation_idc; // min_spatial_segmentation_idc
@@ -176,12 +175,14 @@ static uint8_t hevc_pps_id(const uint8_t* rbsp, int bytes, struct mpeg4_hevc_t*
 	(void)hevc;
 
 	int sodb;
-	int offset = 2 * 8;  // 2-nalu type
+	bits_reader_t bits;
 	sodb = hevc_rbsp_decode(rbsp, bytes, ptr);
 	if (sodb < 3)
 		return 0xFF;
-	*sps = mpeg4_h264_read_ue(ptr, sodb, &offset);
-	return mpeg4_h264_read_ue(ptr, sodb, &offset);
+	bits_reader_init(&bits, ptr, sodb);
+	bits_reader_skip(&bits, 2 * 8); // 2-nalu type
+	*sps = (uint8_t)bits_reader_read_ue(&bits);
+	return (uint8_t)bits_reader_read_ue(&bits);
 }
 
 static void mpeg4_hevc_remove(struct mpeg4_hevc_t* hevc, uint8_t* ptr, int bytes, const uint8_t* end)
@@ -6,6 +6,7 @@
 #include "flv-reader.h"
 #include "flv-header.h"
 #include "flv-proto.h"
+#include "fileio.h"
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
@@ -13,10 +14,13 @@
 
 #define FLV_HEADER_SIZE		9 // DataOffset included
 #define FLV_TAG_HEADER_SIZE	11 // StreamID included
+#define FLV_READ_AHEAD_BLOCK	(256 * 1024)
+#define FLV_READ_AHEAD_DEPTH	4
 
 struct flv_reader_t
 {
 	FILE* fp;
+	fileio_reader_t* stream; // flv_reader_create_async
 	int (*read)(void* param, void* buf, int len);
 	void* param;
 };
@@ -71,6 +75,30 @@ void* flv_reader_create(const char* file)
 	return flv;
 }
 
+static int stream_read(void* param, void* buf, int len)
+{
+	return fileio_reader_read((fileio_reader_t*)param, buf, len);
+}
+
+void* flv_reader_create_async(const char* file, struct fileio* io)
+{
+	fileio_reader_t* stream;
+	struct flv_reader_t* flv;
+	stream = fileio_reader_open(io, file, FLV_READ_AHEAD_BLOCK, FLV_READ_AHEAD_DEPTH);
+	if (!stream)
+		return NULL;
+
+	flv = flv_reader_create2(stream_read, stream);
+	if (!flv)
+	{
+		fileio_reader_close(stream);
+		return NULL;
+	}
+
+	flv->stream = stream;
+	return flv;
+}
+
 void* flv_reader_create2(int (*read)(void* param, void* buf, int len), void* param)
 {
 	struct flv_reader_t* flv;
@@ -97,6 +125,8 @@ void flv_reader_destroy(void* p)
 	{
 		if (flv->fp)
 			fclose(flv->fp);
+		if (flv->stream)
+			fileio_reader_close(flv->stream);
 		free(flv);
 	}
 }
@@ -13,7 +13,12 @@
 extern "C" {
 #endif
 
+struct fileio;
+
 void* flv_reader_create(const char* file);
+/// the file is read ahead through fileio while tags are parsed
+///@param[in] io fileio engine, polled by flv_reader_read when it waits
+void* flv_reader_create_async(const char* file, struct fileio* io);
 void* flv_reader_create2(int(*read)(void* param, void* buf, int len), void* param);
 void flv_reader_destroy(void* flv);
 
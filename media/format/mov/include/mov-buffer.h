@@ -34,5 +34,10 @@ struct mov_buffer_t {
 	uint64_t (*tell)(void* param);
 };
 
+/// read-only buffer over a fileio_reader_t* param, the file is read ahead
+/// while boxes are parsed, e.g.
+///   r = fileio_reader_open(io, "a.mp4", 256 * 1024, 4);
+///   mov = mov_reader_create(mov_fileio_buffer(), r);
+const struct mov_buffer_t* mov_fileio_buffer(void);
 
 #endif /* __MOV_BUFFER_H__ */
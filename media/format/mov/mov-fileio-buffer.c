@@ -0,0 +1,46 @@
+/*
+ * mov-fileio-buffer.c - mov-fileio-buffer
+ *
+ * Date   : 2021/04/28
+ */
+#include "mov-buffer.h"
+#include "fileio.h"
+#include <errno.h>
+
+static int mov_fileio_read(void* param, void* data, uint64_t bytes)
+{
+	int r;
+	if (bytes > INT32_MAX)
+		return -EINVAL;
+	r = fileio_reader_read((fileio_reader_t*)param, data, (size_t)bytes);
+	if (r < 0)
+		return r;
+	return (uint64_t)r == bytes ? 0 : -1 /*EOF*/;
+}
+
+static int mov_fileio_write(void* param, const void* data, uint64_t bytes)
+{
+	(void)param, (void)data, (void)bytes;
+	return -EBADF; // read only
+}
+
+static int mov_fileio_seek(void* param, uint64_t offset)
+{
+	return fileio_reader_seek((fileio_reader_t*)param, offset);
+}
+
+static uint64_t mov_fileio_tell(void* param)
+{
+	return fileio_reader_tell((fileio_reader_t*)param);
+}
+
+const struct mov_buffer_t* mov_fileio_buffer(void)
+{
+	static struct mov_buffer_t s_io = {
+		mov_fileio_read,
+		mov_fileio_write,
+		mov_fileio_seek,
+		mov_fileio_tell,
+	};
+	return &s_io;
+}
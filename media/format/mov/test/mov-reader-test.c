@@ -5,6 +5,8 @@
  */
 #include "mov-reader.h"
 #include "mov-format.h"
+#include "mov-buffer.h"
+#include "fileio.h"
 #include "mpeg4-hevc.h"
 #include "mpeg4-avc.h"
 #include "mpeg4-aac.h"
@@ -195,11 +197,8 @@ static void mov_subtitle_info(void* param, uint32_t track, uint8_t object, const
 	s_subtitle_track = track;
 }
 
-void mov_reader_test(const char* mp4)
+static void mov_reader_test_run(mov_reader_t* mov)
 {
-	FILE* fp = fopen(mp4, "rb");
-    assert(fp);
-	mov_reader_t* mov = mov_reader_create(mov_file_buffer(), fp);
 	uint64_t duration = mov_reader_getduration(mov);
 
 	struct mov_reader_trackinfo_t info = { mov_video_info, mov_audio_info, mov_subtitle_info };
@@ -215,5 +214,24 @@ void mov_reader_test(const char* mp4)
 	mov_reader_destroy(mov);
 	if(s_vfp) fclose(s_vfp);
 	if(s_afp) fclose(s_afp);
+}
+
+void mov_reader_test(const char* mp4)
+{
+	FILE* fp = fopen(mp4, "rb");
+    assert(fp);
+	mov_reader_t* mov = mov_reader_create(mov_file_buffer(), fp);
+	mov_reader_test_run(mov);
 	fclose(fp);
 }
+
+void mov_reader_test_async(const char* mp4)
+{
+	fileio_t* io = fileio_create(8, 0, NULL);
+	fileio_reader_t* r = fileio_reader_open(io, mp4, 256 * 1024, 4);
+	assert(io && r);
+	mov_reader_t* mov = mov_reader_create(mov_fileio_buffer(), r);
+	mov_reader_test_run(mov);
+	fileio_reader_close(r);
+	fileio_destroy(io);
+}
@@ -4,9 +4,11 @@
  * Date   : 2021/03/24
  */
 #include <stdio.h>
+#include <string.h>
 
 extern void fmp4_writer_test2(const char *mp4, const char *outmp4);
 extern void mov_reader_test(const char *mp4);
+extern void mov_reader_test_async(const char *mp4);
 extern void mov_writer_adts_test(const char *mp4, const char *outmp4);
 extern void mov_writer_audio(const char *audio, int type, const char *mp4);
 extern void mov_writer_h264(const char *h264, int width, int height,
@@ -27,10 +29,14 @@ main(int argc, char *argv[])
     /* mov_writer_h264("v.h264", 1280, 720, "out.mp4"); */
 
     if (argc < 2) {
-        printf("%s: <mp4 file>\n", argv[0]);
+        printf("%s: <mp4 file> [async]\n", argv[0]);
         return -1;
     }
-    mov_reader_test(argv[1]);
+    if (argc > 2 && 0 == strcmp(argv[2], "async")) {
+        mov_reader_test_async(argv[1]);
+    } else {
+        mov_reader_test(argv[1]);
+    }
 
     return 0;
 }
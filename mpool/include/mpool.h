@@ -10,42 +10,149 @@
 extern "C" {
 #endif
 
+#include <pthread.h>
 #include <stdint.h>
 #include <stddef.h>
 
-#define MPOOL_DBG
+/*
+ * Tracking level, MPOOL_TRACK is the highest level compiled in and
+ * mpool_set_track() picks one at runtime, a new pool starts at OFF:
+ *   MPOOL_TRACK_OFF      get/put is a pointer pop/push, nothing recorded.
+ *   MPOOL_TRACK_COUNT    count get/put/fail/error, see mpool_stat().
+ *   MPOOL_TRACK_HISTORY  also keep the last MPOOL_TRACK_DEPTH get/put call
+ *                        sites of every item, see mpool_dump().
+ * It changes mpool_item_t, so the library and its users must be built with
+ * the same MPOOL_TRACK: it is a build option of the library (cmake
+ * -DMPOOL_TRACK=0, HISTORY in Debug builds and COUNT otherwise) exported
+ * to everything linking it, and doesn't depend on per-file flags such as
+ * NDEBUG.
+ */
+#define MPOOL_TRACK_OFF 0
+#define MPOOL_TRACK_COUNT 1
+#define MPOOL_TRACK_HISTORY 2
+
+#ifndef MPOOL_TRACK
+#define MPOOL_TRACK MPOOL_TRACK_COUNT
+#endif
+
+#ifndef MPOOL_TRACK_DEPTH
+#define MPOOL_TRACK_DEPTH 8
+#endif
 
 #define MPOOL_FLAG_ALLOC 0x01U
 #define MPOOL_FLAG_READY 0x02U
+#define MPOOL_FLAG_GROW 0x04U    // add chunks when exhausted, mpool_create()
+#define MPOOL_FLAG_HUGETLB 0x08U // chunks from MAP_HUGETLB, else THP
+#define MPOOL_FLAG_THP 0x10U     // madvise(MADV_HUGEPAGE) the chunks
+#define MPOOL_FLAG_NOCACHE 0x20U // no per-thread caches, mpool_create()
+
+#define MPOOL_HUGEPAGE_SIZE (2UL * 1024 * 1024)
+#ifndef MPOOL_MAX_CHUNKS
+#define MPOOL_MAX_CHUNKS 4096
+#endif
+
+#define ALIGN_SIZE 16 // members are aligned like malloc(), max_align_t
+#define MPOOL_CACHELINE 64
+
+/*
+ * Per-thread cache (magazine): items move between a thread's cache and
+ * the shared free list MPOOL_CACHE_BATCH at a time, a cache holds at most
+ * 2 * MPOOL_CACHE_BATCH items. A cache is flushed when its thread exits,
+ * one pthread key serves all pools, and a get that finds the pool
+ * exhausted pulls the items parked in the caches of other threads before
+ * it fails.
+ * Pools smaller than MPOOL_CACHE_MIN_ITEMS and pools in caller memory,
+ * see mpool_init(), don't use caches.
+ */
+#ifndef MPOOL_CACHE_BATCH
+#define MPOOL_CACHE_BATCH 32
+#endif
+#ifndef MPOOL_CACHE_MIN_ITEMS
+#define MPOOL_CACHE_MIN_ITEMS (64 * MPOOL_CACHE_BATCH)
+#endif
 
-#define ALIGN_SIZE 8
 typedef volatile uint32_t vuint32_t;
 typedef volatile int32_t vint32_t;
 typedef vint32_t atomic_t;
 
+#define MPOOL_OP_GET 0
+#define MPOOL_OP_PUT 1
+#define MPOOL_OP_INC 2
+#define MPOOL_OP_DEC 3
+
+typedef struct {
+    const char *file; // __FILE__, not copied
+    int line;
+    int op;
+} mpool_loc_t;
+
 typedef struct {
     void *ctx;
     atomic_t ref;
+    vuint32_t next; // index + 1 of the next free item, 0 is the end
+    uint32_t idx;   // see mpool_get_idx()
 
     //For debug
-#ifdef MPOOL_DBG
-    void *get;
-    void *put;
+#if MPOOL_TRACK >= MPOOL_TRACK_HISTORY
+    vuint32_t hist_pos;
+    mpool_loc_t hist[MPOOL_TRACK_DEPTH]; // ring of the last call sites
 #endif
-    uint8_t data[0];
+    uint8_t data[0] __attribute__((aligned(ALIGN_SIZE)));
 } mpool_item_t;
 
+typedef struct {
+    int64_t get;   // items handed out
+    int64_t put;   // items given back
+    int64_t fail;  // get on an exhausted pool
+    int64_t error; // double free, unexpected ref
+    int64_t cached; // members parked in per-thread caches, in mpool_stat()
+} mpool_stat_t;
+
+
+struct mpool_cache;
+struct mpool_chunk;
 
 typedef struct {
-    size_t size;   //size of a mpool_item_t, align to 8 bytes
+    size_t size;   //size of a mpool_item_t, align to ALIGN_SIZE
     size_t msize;  //size of a member, sizeof(*mpool_item_t->data)
     uint32_t max;  // capacity
     uint32_t flag;
     atomic_t ref;
-    vuint32_t head;
-    vuint32_t tail;
-    mpool_item_t **queue; // array of mpool_item_t pointer
+    uint32_t batch; // per-thread cache batch, 0 if caches are disabled
+
+    // process-local, only set up if batch != 0
+    uint32_t id; // slot of the pool in the per-thread cache tables
+    pthread_spinlock_t lock; // protect caches
+    struct mpool_cache *caches;
     uint8_t *pool; // data
+
+    // an item index is (chunk << shift | offset), chunks[chunk] is the
+    // memory of a chunk. A fixed pool is chunk 0 and chunks is &pool.
+    uint8_t **chunks;
+    uint32_t shift;
+    uint32_t mask;
+    uint32_t chunk_items; // items per chunk
+    uint32_t nchunks;     // slots in chunks
+    struct mpool_chunk *chunk_info; // growable pool only
+    // the mapped chunks sorted by address, for mpool_get_idx(); a
+    // seqlock, order_seq is odd while mpool_grow() inserts
+    uint32_t *order;
+    uint32_t norder;
+    vuint32_t order_seq;
+    uint32_t idle;        // ms a chunk stays free before mpool_trim() drops it
+    pthread_mutex_t grow_lock;
+
+    uint32_t track; // runtime tracking level, <= MPOOL_TRACK
+    mpool_stat_t stat; // counters of threads without a cache
+
+    // keeps top off the cache lines of the fields above, whatever the
+    // alignment of the ctx is
+    uint8_t pad[MPOOL_CACHELINE];
+
+    // free list: a stack of items linked by mpool_item_t->next,
+    // top is (tag << 32 | index + 1), the tag makes it ABA safe.
+    volatile int64_t top;
+    vint32_t nfree; // items in the free list
 } mpool_ctx_t;
 
 /*
@@ -55,6 +162,10 @@ typedef struct {
  *             total_size  the size of total memory
  *             pool        a piece of memory to use. If NULL, mpool will alloc memory by itself.
  * Return: 0 on success, -1 on error.
+ * The ctx is at the start of pool, which must be 8 bytes aligned (as
+ * malloc() memory is). A pool in caller memory has no per-thread caches;
+ * the ctx and the items hold pointers, so processes sharing it must map
+ * it at the same address.
  */
 mpool_ctx_t *mpool_init(size_t msize, size_t total_size, void *pool);
 
@@ -68,15 +179,60 @@ mpool_ctx_t *mpool_init(size_t msize, size_t total_size, void *pool);
  */
 mpool_ctx_t *mpool_calloc(size_t nmem, size_t msize);
 
+/*
+ * Initialize a growable pool.
+ * Argument
+ *   @msize:       the size of a member
+ *   @chunk_items: members per chunk, rounded up to a power of 2
+ *   @max_chunks:  the pool never grows past it, <= MPOOL_MAX_CHUNKS
+ *   @flag:        MPOOL_FLAG_GROW, optionally MPOOL_FLAG_HUGETLB/MPOOL_FLAG_THP,
+ *                 MPOOL_FLAG_NOCACHE for a pool used by one thread
+ * Return
+ *   A pointer to mpool_ctx_t. NULL if init failed.
+ * Chunks are mmap'd on demand when mpool_get finds the pool exhausted.
+ */
+mpool_ctx_t *mpool_create(size_t msize, uint32_t chunk_items,
+                          uint32_t max_chunks, uint32_t flag);
+
+/*
+ * Set how long (ms) a chunk must stay entirely free before mpool_trim()
+ * gives its memory back to the OS, 0 means at the first trim.
+ */
+void mpool_set_idle(mpool_ctx_t *ctx, uint32_t idle);
+
+/*
+ * Give the memory of idle, entirely free chunks back to the OS, the
+ * address range stays reserved and is reused when the pool grows again.
+ * Call it periodically, e.g. from a timer. Members parked in per-thread
+ * caches keep their chunk alive.
+ * Return the number of chunks released.
+ */
+int mpool_trim(mpool_ctx_t *ctx);
+
 /*
  *  Cleanup
  */
 void mpool_cleanup(mpool_ctx_t *ctx);
 
 void *__mpool_get(mpool_ctx_t *ctx, const char *, int);
+void *__mpool_get_nozero(mpool_ctx_t *ctx, const char *, int);
 void __mpool_put(void *ptr, const char *, int);
 
+/*
+ * mpool_get returns a zeroed member, mpool_get_nozero leaves whatever the
+ * previous user wrote in it.
+ */
 #define mpool_get(ctx) __mpool_get(ctx, __FILE__, __LINE__)
+#define mpool_get_nozero(ctx) __mpool_get_nozero(ctx, __FILE__, __LINE__)
+
+/*
+ * Get up to n members, not zeroed, into ptrs.
+ * Return how many, a short count isn't counted as a fail: the caller
+ * decides whether it is one, e.g. when it has other pools to try.
+ */
+int __mpool_get_bulk(mpool_ctx_t *ctx, void **ptrs, int n, const char *, int);
+#define mpool_get_bulk(ctx, ptrs, n)                                           \
+    __mpool_get_bulk(ctx, ptrs, n, __FILE__, __LINE__)
 #define mpool_put(ptr) __mpool_put(ptr, __FILE__, __LINE__)
 
 /*
@@ -88,25 +244,45 @@ void __mpool_ref_dec(void *ptr, const char *, int);
 #define mpool_ref_dec(ptr) __mpool_ref_dec(ptr, __FILE__, __LINE__)
 
 /*
- *  Get index for a piece of memory
+ *  Set the runtime tracking level, clamped to MPOOL_TRACK.
+ *  Return the level in effect.
+ */
+int mpool_set_track(mpool_ctx_t *ctx, int level);
+
+/*
+ *  Sum the counters of all threads, zero unless level >= MPOOL_TRACK_COUNT.
+ */
+void mpool_stat(mpool_ctx_t *ctx, mpool_stat_t *stat);
+
+/*
+ *  Print the call site history of a member to stderr.
+ */
+void mpool_dump(void *ptr);
+
+/*
+ *  Get index for a piece of memory, for a growable pool the high bits
+ *  are the chunk, see mpool_ctx_t->shift.
  */
 int mpool_get_idx(mpool_ctx_t *ctx, void *ptr);
 void *mpool_get_by_idx(mpool_ctx_t *ctx, int idx);
 
 /*
  * Test if mpool is empty
+ * Note, items parked in per-thread caches are not in the free list, they
+ * are counted as in use by mpool_empty/mpool_full/mpool_count, see
+ * mpool_stat_t->cached.
  */
 static inline int
 mpool_empty(mpool_ctx_t *ctx)
 {
-    return ctx->tail - ctx->head >= ctx->max;
+    return ctx->nfree >= (int32_t)ctx->max;
 }
 
 static inline int
 mpool_full(mpool_ctx_t *ctx)
 {
-    //mpool is full means queue is empty
-    return ctx->tail == ctx->head;
+    //mpool is full means free list is empty
+    return ctx->nfree <= 0;
 }
 
 static inline int
@@ -118,7 +294,7 @@ mpool_size(mpool_ctx_t *ctx)
 static inline int
 mpool_count(mpool_ctx_t *ctx)
 {
-    return ctx->max + ctx->head - ctx->tail;
+    return ctx->max - ctx->nfree;
 }
 
 #ifdef __cplusplus
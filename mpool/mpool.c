@@ -13,70 +13,437 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <time.h>
 
 
-//Enable this macro to detect memory leak issues.
-#ifdef MPOOL_DBG
+/*
+ * Per-thread cache of free items, linked by mpool_item_t->next.
+ * The owner takes lock around every use, uncontended unless another
+ * thread is stealing the items, see mpool_cache_steal().
+ */
+typedef struct mpool_cache {
+    mpool_ctx_t *ctx;
+    pthread_spinlock_t lock;
+    uint32_t top;   // index + 1 of the first cached item
+    uint32_t count; // items in cache
+    mpool_stat_t stat;
+    struct mpool_cache *prev;
+    struct mpool_cache *next;
+} mpool_cache_t;
+
+/*
+ * The caches of a thread, indexed by mpool_ctx_t->id. One key for the
+ * whole library flushes them when the thread exits.
+ */
+typedef struct mpool_tls {
+    mpool_cache_t **caches;
+    uint32_t n; // slots in caches
+    struct mpool_tls *prev;
+    struct mpool_tls *next;
+} mpool_tls_t;
+
+// mpool_tls_lock protects the thread list, the pool ids and the slots a
+// pool has in other threads; it is taken before ctx->lock
+static pthread_mutex_t mpool_tls_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t mpool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t mpool_key;
+static int mpool_key_ok;
+static __thread mpool_tls_t *mpool_tls;
+static mpool_tls_t *mpool_threads;
+static uint8_t *mpool_ids; // 1 if the id is taken
+static uint32_t mpool_nids;
 
-#define LOC_MAX_FILE_LEN 16
-typedef struct _loc_t {
-    char file[LOC_MAX_FILE_LEN];
-    int line;
-    struct _loc_t *next;
-} loc_t;
+/*
+ * A chunk of a growable pool.
+ */
+typedef struct mpool_chunk {
+    size_t bytes;        // mapped length
+    uint64_t idle_since; // ms, first trim that found it entirely free
+    int live;            // items are in use or in the free list
+} mpool_chunk_t;
 
-static loc_t *
-loc_init(const char *file, int line)
+static inline mpool_cache_t *
+mpool_cache_find(mpool_ctx_t *ctx)
 {
-    loc_t *loc = (loc_t *)malloc(sizeof(loc_t));
-    strncpy(loc->file, file, LOC_MAX_FILE_LEN);
-    loc->file[LOC_MAX_FILE_LEN - 1] = '\0';
-    loc->line                       = line;
-    loc->next                       = NULL;
-    return loc;
+    mpool_tls_t *tls = mpool_tls;
+    return tls && ctx->id < tls->n ? tls->caches[ctx->id] : NULL;
 }
 
-static void *
-loc_list_insert(void *list, loc_t *record)
+#if MPOOL_TRACK >= MPOOL_TRACK_COUNT
+static void
+mpool_stat_inc(mpool_ctx_t *ctx, size_t off)
 {
-    if (list == NULL) {
-        return record;
+    mpool_cache_t *cache = NULL;
+
+    if (ctx->track < MPOOL_TRACK_COUNT) {
+        return;
+    }
+
+    // only the owner thread writes its cache counters
+    if (ctx->batch) {
+        cache = mpool_cache_find(ctx);
+    }
+    if (cache) {
+        (*(int64_t *)((uint8_t *)&cache->stat + off))++;
     } else {
-        loc_t *p = (loc_t *)list;
-        for (; p->next != NULL; p = p->next);  //seek to the last record
-        p->next = record;
-        return list;
+        atomic_increment64((volatile int64_t *)((uint8_t *)&ctx->stat + off));
+    }
+}
+#define MPOOL_STAT_INC(ctx, field)                                             \
+    mpool_stat_inc(ctx, offsetof(mpool_stat_t, field))
+#else
+#define MPOOL_STAT_INC(ctx, field) do {} while (0)
+#endif
+
+#if MPOOL_TRACK >= MPOOL_TRACK_HISTORY
+static inline void
+mpool_hist_add(mpool_item_t *ptr, const char *file, int line, int op)
+{
+    mpool_loc_t *loc;
+
+    if (((mpool_ctx_t *)ptr->ctx)->track < MPOOL_TRACK_HISTORY) {
+        return;
+    }
+
+    loc = &ptr->hist[(uint32_t)(atomic_increment32((vint32_t *)&ptr->hist_pos)
+                                - 1) % MPOOL_TRACK_DEPTH];
+    loc->file = file;
+    loc->line = line;
+    loc->op   = op;
+}
+#define MPOOL_HIST_ADD(ptr, file, line, op) mpool_hist_add(ptr, file, line, op)
+#else
+#define MPOOL_HIST_ADD(ptr, file, line, op) do {} while (0)
+#endif
+
+#if MPOOL_TRACK > MPOOL_TRACK_OFF
+static void
+mpool_error(mpool_item_t *ptr, const char *msg, const char *file, int line)
+{
+    MPOOL_STAT_INC((mpool_ctx_t *)ptr->ctx, error);
+    fprintf(stderr, "ATTENTION: %s ref: %d on %s:%d\n", msg,
+            atomic_load32(&ptr->ref), file ? file : "?", line);
+    mpool_dump(ptr->data);
+}
+#endif
+
+#define MPOOL_TOP(tag, idx) ((int64_t)((uint64_t)(tag) << 32 | (idx)))
+#define MPOOL_TOP_TAG(top) ((uint32_t)((uint64_t)(top) >> 32))
+#define MPOOL_TOP_IDX(top) ((uint32_t)(top))
+
+static inline mpool_item_t *
+mpool_item(mpool_ctx_t *ctx, uint32_t idx)
+{
+    // idx is index + 1, 0 is the end of a list
+    idx--;
+    return (mpool_item_t *)(ctx->chunks[idx >> ctx->shift]
+                            + (size_t)(idx & ctx->mask) * ctx->size);
+}
+
+static inline uint32_t
+mpool_item_idx(mpool_ctx_t *ctx, mpool_item_t *ptr)
+{
+    (void)ctx;
+    return ptr->idx + 1;
+}
+
+static inline uint64_t
+mpool_now(void)
+{
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return (uint64_t)tp.tv_sec * 1000 + tp.tv_nsec / 1000000;
+}
+
+/*
+ * Push the list first..last of n items to the free list.
+ */
+static void
+mpool_push(mpool_ctx_t *ctx, uint32_t first, uint32_t last, uint32_t n)
+{
+    int64_t top;
+    mpool_item_t *ptr = mpool_item(ctx, last);
+
+    do {
+        top       = atomic_load64(&ctx->top);
+        ptr->next = MPOOL_TOP_IDX(top);
+    } while (!atomic_cas64(&ctx->top, top,
+                           MPOOL_TOP(MPOOL_TOP_TAG(top) + 1, first)));
+
+    atomic_add32(&ctx->nfree, (int32_t)n);
+}
+
+/*
+ * Pop up to n items from the free list.
+ * Return the first index, *count is the number of items popped,
+ * the last one's next is undefined.
+ */
+static uint32_t
+mpool_pop(mpool_ctx_t *ctx, uint32_t n, uint32_t *count)
+{
+    int64_t top;
+    uint32_t first, last, i;
+
+    do {
+        top   = atomic_load64(&ctx->top);
+        first = MPOOL_TOP_IDX(top);
+        if (first == 0) {
+            *count = 0;
+            return 0;
+        }
+
+        // items never leave the pool memory, so reading next of an item
+        // popped by someone else is harmless, the tag makes the cas fail.
+        last = first;
+        for (i = 1; i < n && mpool_item(ctx, last)->next != 0; i++) {
+            last = mpool_item(ctx, last)->next;
+        }
+    } while (!atomic_cas64(&ctx->top, top,
+                           MPOOL_TOP(MPOOL_TOP_TAG(top) + 1,
+                                     mpool_item(ctx, last)->next)));
+
+    atomic_add32(&ctx->nfree, -(int32_t)i);
+    *count = i;
+    return first;
+}
+
+static void
+mpool_cache_flush(mpool_cache_t *cache, uint32_t n)
+{
+    mpool_ctx_t *ctx = cache->ctx;
+    uint32_t first, last, i;
+
+    if (n == 0 || cache->count == 0) {
+        return;
     }
+
+    first = last = cache->top;
+    for (i = 1; i < n && i < cache->count; i++) {
+        last = mpool_item(ctx, last)->next;
+    }
+
+    cache->top = mpool_item(ctx, last)->next;
+    cache->count -= i;
+    mpool_push(ctx, first, last, i);
 }
 
+/*
+ * Unlink the cache from its pool and give the cached items back,
+ * under mpool_tls_lock.
+ */
 static void
-loc_list_free(void *list)
+mpool_cache_destroy(mpool_cache_t *cache)
 {
-    loc_t *p = (loc_t *)list;
-    loc_t *q = NULL;
-    for (; p != NULL; p = q) {
-        q = p->next;
-        free(p);
-        p = NULL;
+    mpool_ctx_t *ctx = cache->ctx;
+
+    // unlinked first, nobody can steal from it any more
+    pthread_spin_lock(&ctx->lock);
+    atomic_add64(&ctx->stat.get, cache->stat.get);
+    atomic_add64(&ctx->stat.put, cache->stat.put);
+    atomic_add64(&ctx->stat.fail, cache->stat.fail);
+    atomic_add64(&ctx->stat.error, cache->stat.error);
+    if (cache->prev) {
+        cache->prev->next = cache->next;
+    } else {
+        ctx->caches = cache->next;
+    }
+    if (cache->next) {
+        cache->next->prev = cache->prev;
     }
+    pthread_spin_unlock(&ctx->lock);
+
+    mpool_cache_flush(cache, cache->count);
+    pthread_spin_destroy(&cache->lock);
+    free(cache);
 }
 
+/*
+ * Thread exit, give the cached items of every pool back.
+ */
 static void
-loc_list_dump(mpool_item_t *item)
+mpool_tls_destroy(void *arg)
 {
-    fprintf(stderr, "================ Dump block %p\n", item);
-    fprintf(stderr, "Get list:\n");
-    loc_t *p = (loc_t *)item->get;
-    for (; p != NULL; p = p->next) {
-        fprintf(stderr, "\t%s:%d\n", p->file, p->line);
+    mpool_tls_t *tls = (mpool_tls_t *)arg;
+    uint32_t i;
+
+    pthread_mutex_lock(&mpool_tls_lock);
+    for (i = 0; i < tls->n; i++) {
+        if (tls->caches[i]) {
+            mpool_cache_destroy(tls->caches[i]);
+        }
+    }
+    if (tls->prev) {
+        tls->prev->next = tls->next;
+    } else {
+        mpool_threads = tls->next;
     }
-    fprintf(stderr, "Put list:\n");
-    for (p = (loc_t *)item->put; p != NULL; p = p->next) {
-        fprintf(stderr, "\t%s:%d\n", p->file, p->line);
+    if (tls->next) {
+        tls->next->prev = tls->prev;
     }
-    fprintf(stderr, "================ Dump block %p finished!\n\n", item);
+    pthread_mutex_unlock(&mpool_tls_lock);
+
+    mpool_tls = NULL;
+    free(tls->caches);
+    free(tls);
+}
+
+static void
+mpool_tls_key(void)
+{
+    mpool_key_ok = pthread_key_create(&mpool_key, mpool_tls_destroy) == 0;
+}
+
+/*
+ * Give the pool a slot in the per-thread cache tables.
+ * Return 0 on success, -1 if the pool goes without caches.
+ */
+static int
+mpool_id_alloc(mpool_ctx_t *ctx)
+{
+    uint32_t id;
+    uint8_t *ids;
+
+    pthread_once(&mpool_once, mpool_tls_key);
+    if (!mpool_key_ok) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&mpool_tls_lock);
+    for (id = 0; id < mpool_nids && mpool_ids[id]; id++) {
+    }
+    if (id == mpool_nids) {
+        ids = (uint8_t *)realloc(mpool_ids, mpool_nids * 2 + 16);
+        if (!ids) {
+            pthread_mutex_unlock(&mpool_tls_lock);
+            return -1;
+        }
+        memset(ids + mpool_nids, 0, mpool_nids + 16);
+        mpool_ids = ids;
+        mpool_nids = mpool_nids * 2 + 16;
+    }
+    mpool_ids[id] = 1;
+    pthread_mutex_unlock(&mpool_tls_lock);
+
+    ctx->id = id;
+    return 0;
+}
+
+/*
+ * Drop the caches of all threads, threads still alive keep them until
+ * here, and give the id back.
+ */
+static void
+mpool_id_free(mpool_ctx_t *ctx)
+{
+    mpool_cache_t *cache, *next;
+    mpool_tls_t *tls;
+
+    pthread_mutex_lock(&mpool_tls_lock);
+    for (tls = mpool_threads; tls; tls = tls->next) {
+        if (ctx->id < tls->n) {
+            tls->caches[ctx->id] = NULL;
+        }
+    }
+    for (cache = ctx->caches; cache; cache = next) {
+        next = cache->next;
+        pthread_spin_destroy(&cache->lock);
+        free(cache);
+    }
+    ctx->caches = NULL;
+    mpool_ids[ctx->id] = 0;
+    pthread_mutex_unlock(&mpool_tls_lock);
+}
+
+/*
+ * Move the items parked in the caches of all threads to the free list.
+ * Return the number of items moved.
+ */
+static uint32_t
+mpool_cache_steal(mpool_ctx_t *ctx)
+{
+    mpool_cache_t *cache;
+    uint32_t n = 0;
+
+    pthread_spin_lock(&ctx->lock);
+    for (cache = ctx->caches; cache; cache = cache->next) {
+        pthread_spin_lock(&cache->lock);
+        n += cache->count;
+        mpool_cache_flush(cache, cache->count);
+        pthread_spin_unlock(&cache->lock);
+    }
+    pthread_spin_unlock(&ctx->lock);
+    return n;
+}
+
+static mpool_cache_t *
+mpool_cache_new(mpool_ctx_t *ctx)
+{
+    mpool_tls_t *tls = mpool_tls;
+    mpool_cache_t **caches;
+    mpool_cache_t *cache;
+    uint32_t n;
+
+    if (!tls) {
+        tls = (mpool_tls_t *)calloc(1, sizeof(mpool_tls_t));
+        if (!tls) {
+            return NULL;
+        }
+        if (pthread_setspecific(mpool_key, tls) != 0) {
+            free(tls);
+            return NULL;
+        }
+        pthread_mutex_lock(&mpool_tls_lock);
+        tls->next = mpool_threads;
+        if (mpool_threads) {
+            mpool_threads->prev = tls;
+        }
+        mpool_threads = tls;
+        pthread_mutex_unlock(&mpool_tls_lock);
+        mpool_tls = tls;
+    }
+
+    cache = (mpool_cache_t *)calloc(1, sizeof(mpool_cache_t));
+    if (!cache) {
+        return NULL;
+    }
+    cache->ctx = ctx;
+    pthread_spin_init(&cache->lock, PTHREAD_PROCESS_PRIVATE);
+
+    // mpool_id_free() writes the slots of other threads
+    pthread_mutex_lock(&mpool_tls_lock);
+    if (ctx->id >= tls->n) {
+        n      = ctx->id + 16;
+        caches = (mpool_cache_t **)realloc(tls->caches, n * sizeof(*caches));
+        if (!caches) {
+            pthread_mutex_unlock(&mpool_tls_lock);
+            pthread_spin_destroy(&cache->lock);
+            free(cache);
+            return NULL;
+        }
+        memset(caches + tls->n, 0, (n - tls->n) * sizeof(*caches));
+        tls->caches = caches;
+        tls->n      = n;
+    }
+    tls->caches[ctx->id] = cache;
+
+    pthread_spin_lock(&ctx->lock);
+    cache->next = ctx->caches;
+    if (ctx->caches) {
+        ctx->caches->prev = cache;
+    }
+    ctx->caches = cache;
+    pthread_spin_unlock(&ctx->lock);
+    pthread_mutex_unlock(&mpool_tls_lock);
+    return cache;
+}
+
+static inline mpool_cache_t *
+mpool_cache_get(mpool_ctx_t *ctx)
+{
+    mpool_cache_t *cache = mpool_cache_find(ctx);
+    return cache ? cache : mpool_cache_new(ctx);
 }
-#endif
 
 mpool_ctx_t *
 mpool_init(size_t msize, size_t total_size, void *pool)
@@ -84,20 +451,26 @@ mpool_init(size_t msize, size_t total_size, void *pool)
     mpool_ctx_t *ctx = NULL;
     size_t size = (sizeof(mpool_item_t) + msize + ALIGN_SIZE - 1) / ALIGN_SIZE
                   * ALIGN_SIZE;
-    if (msize == 0
-        || total_size < sizeof(mpool_ctx_t) + sizeof(void *) + size) {
+    // the items start at the first ALIGN_SIZE boundary after the ctx
+    size_t head = ALIGN((uintptr_t)pool + sizeof(mpool_ctx_t), ALIGN_SIZE)
+                  - (uintptr_t)pool;
+    if (msize == 0 || total_size < head + size) {
         //total_size must large enough to count 1 item at least.
         return NULL;
     }
 
     if (pool) {
+        if ((uintptr_t)pool % sizeof(int64_t) != 0) {
+            return NULL;
+        }
         ctx = (mpool_ctx_t *)pool;
     } else {
-        ctx = (mpool_ctx_t *)malloc(total_size);
-        memset(ctx, 0, total_size);
+        ctx = (mpool_ctx_t *)aligned_alloc(MPOOL_CACHELINE,
+                                           ALIGN(total_size, MPOOL_CACHELINE));
         if (!ctx) {
             return NULL;
         }
+        memset(ctx, 0, total_size);
     }
 
     if (ctx->flag & MPOOL_FLAG_READY) {
@@ -120,17 +493,47 @@ mpool_init(size_t msize, size_t total_size, void *pool)
 
     ctx->size  = size;
     ctx->msize = msize;
-    ctx->max =
-        (total_size - sizeof(mpool_ctx_t)) / (sizeof(void *) + ctx->size);
-    ctx->head  = 0;
-    ctx->tail  = ctx->max;
-    ctx->queue = (mpool_item_t **)((uint8_t *)ctx + sizeof(mpool_ctx_t));
-    ctx->pool  = (uint8_t *)ctx->queue + sizeof(void *) * ctx->max;
-
-    int i = 0;
+    ctx->max   = (total_size - head) / ctx->size;
+    ctx->pool  = (uint8_t *)ctx + head;
+
+    // a single chunk
+    ctx->chunks      = &ctx->pool;
+    ctx->shift       = 31;
+    ctx->mask        = (1U << 31) - 1;
+    ctx->chunk_items = ctx->max;
+    ctx->nchunks     = 1;
+    ctx->chunk_info  = NULL;
+    ctx->order       = NULL;
+    ctx->norder      = 0;
+    ctx->order_seq   = 0;
+
+    // the id, lock and caches are process-local, keep them out of
+    // caller memory
+    ctx->batch = 0;
+    ctx->caches = NULL;
+    if (ctx != pool && ctx->max >= MPOOL_CACHE_MIN_ITEMS
+        && mpool_id_alloc(ctx) == 0) {
+        ctx->batch = MPOOL_CACHE_BATCH;
+        pthread_spin_init(&ctx->lock, PTHREAD_PROCESS_PRIVATE);
+    }
+
+    ctx->track = MPOOL_TRACK_OFF;
+    memset(&ctx->stat, 0, sizeof(ctx->stat));
+
+    uint32_t i = 0;
     for (; i < ctx->max; i++) {
-        ctx->queue[i] = (mpool_item_t *)(ctx->pool + i * ctx->size);
+        mpool_item_t *ptr = mpool_item(ctx, i + 1);
+        ptr->ctx  = ctx;
+        ptr->ref  = 0;
+        ptr->idx  = i;
+#if MPOOL_TRACK >= MPOOL_TRACK_HISTORY
+        ptr->hist_pos = 0;
+        memset(ptr->hist, 0, sizeof(ptr->hist));
+#endif
+        ptr->next = (i + 1 < ctx->max) ? i + 2 : 0;
     }
+    ctx->top   = MPOOL_TOP(0, 1);
+    ctx->nfree = ctx->max;
 
     ctx->flag |= MPOOL_FLAG_READY;
     return ctx;
@@ -155,28 +558,379 @@ mpool_calloc(size_t nmem, size_t msize)
     size_t size = (sizeof(mpool_item_t) + msize + ALIGN_SIZE - 1) / ALIGN_SIZE
                   * ALIGN_SIZE;
 
-    size_t total_size =
-        sizeof(mpool_ctx_t) + sizeof(void *) * nmem + size * nmem;
+    size_t total_size = ALIGN(sizeof(mpool_ctx_t), ALIGN_SIZE) + size * nmem;
     return mpool_init(msize, total_size, NULL);
 }
 
+static uint8_t *
+mpool_chunk_map(mpool_ctx_t *ctx, size_t *bytes)
+{
+    void *mem = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    if (ctx->flag & MPOOL_FLAG_HUGETLB) {
+        // needs reserved hugepages (vm.nr_hugepages), fall back to THP
+        mem = mmap(NULL, ALIGN(*bytes, MPOOL_HUGEPAGE_SIZE),
+                   PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mem != MAP_FAILED) {
+            *bytes = ALIGN(*bytes, MPOOL_HUGEPAGE_SIZE);
+            return (uint8_t *)mem;
+        }
+    }
+#endif
+
+    mem = mmap(NULL, *bytes, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        return NULL;
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (ctx->flag & (MPOOL_FLAG_HUGETLB | MPOOL_FLAG_THP)) {
+        madvise(mem, *bytes, MADV_HUGEPAGE);
+    }
+#endif
+    return (uint8_t *)mem;
+}
+
+/*
+ * Link the items of chunk c and push them to the free list.
+ */
+static void
+mpool_chunk_init(mpool_ctx_t *ctx, uint32_t c)
+{
+    uint32_t i, base = c << ctx->shift;
+    mpool_item_t *ptr;
+
+    for (i = 0; i < ctx->chunk_items; i++) {
+        ptr      = mpool_item(ctx, base + i + 1);
+        ptr->ctx = ctx;
+        ptr->ref = 0;
+        ptr->idx = base + i;
+#if MPOOL_TRACK >= MPOOL_TRACK_HISTORY
+        ptr->hist_pos = 0;
+        memset(ptr->hist, 0, sizeof(ptr->hist));
+#endif
+        ptr->next = (i + 1 < ctx->chunk_items) ? base + i + 2 : 0;
+    }
+
+    atomic_add32((vint32_t *)&ctx->max, (int32_t)ctx->chunk_items);
+    mpool_push(ctx, base + 1, base + ctx->chunk_items, ctx->chunk_items);
+}
+
+/*
+ * Insert a newly mapped chunk into ctx->order, under grow_lock.
+ */
+static void
+mpool_order_add(mpool_ctx_t *ctx, uint32_t c)
+{
+    uint32_t i = ctx->norder;
+
+    __atomic_store_n(&ctx->order_seq, ctx->order_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (; i > 0 && ctx->chunks[ctx->order[i - 1]] > ctx->chunks[c]; i--) {
+        __atomic_store_n(&ctx->order[i], ctx->order[i - 1], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&ctx->order[i], c, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->norder, ctx->norder + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->order_seq, ctx->order_seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * The chunk holding ptr, binary search of ctx->order.
+ * Return the chunk, or -1 if ptr is below every chunk.
+ */
+static int
+mpool_order_find(mpool_ctx_t *ctx, uint8_t *ptr)
+{
+    uint32_t seq, lo, hi, mid, c;
+    int found;
+
+    do {
+        while ((seq = __atomic_load_n(&ctx->order_seq, __ATOMIC_ACQUIRE)) & 1) {
+        }
+
+        found = -1;
+        lo    = 0;
+        hi    = __atomic_load_n(&ctx->norder, __ATOMIC_RELAXED);
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            c   = __atomic_load_n(&ctx->order[mid], __ATOMIC_RELAXED);
+            if (ctx->chunks[c] <= ptr) {
+                found = (int)c;
+                lo    = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&ctx->order_seq, __ATOMIC_RELAXED) != seq);
+
+    return found;
+}
+
+/*
+ * Add a chunk to a growable pool.
+ * Return 0 if the free list may have items now, -1 if it can't grow.
+ */
+static int
+mpool_grow(mpool_ctx_t *ctx)
+{
+    mpool_chunk_t *info;
+    uint32_t c;
+    int ret = 0;
+
+    pthread_mutex_lock(&ctx->grow_lock);
+    if (MPOOL_TOP_IDX(atomic_load64(&ctx->top)) != 0) {
+        goto out; // someone else grew it
+    }
+
+    // a released chunk is still mapped, reuse it first
+    for (c = 0; c < ctx->nchunks; c++) {
+        if (ctx->chunks[c] && !ctx->chunk_info[c].live) {
+            break;
+        }
+    }
+
+    if (c == ctx->nchunks) {
+        for (c = 0; c < ctx->nchunks && ctx->chunks[c]; c++)
+            ;
+        if (c == ctx->nchunks) {
+            ret = -1;
+            goto out;
+        }
+
+        info        = &ctx->chunk_info[c];
+        info->bytes = (size_t)ctx->chunk_items * ctx->size;
+        ctx->chunks[c] = mpool_chunk_map(ctx, &info->bytes);
+        if (!ctx->chunks[c]) {
+            ret = -1;
+            goto out;
+        }
+        mpool_order_add(ctx, c);
+    }
+
+    ctx->chunk_info[c].live       = 1;
+    ctx->chunk_info[c].idle_since = 0;
+    mpool_chunk_init(ctx, c);
+
+out:
+    pthread_mutex_unlock(&ctx->grow_lock);
+    return ret;
+}
+
+mpool_ctx_t *
+mpool_create(size_t msize, uint32_t chunk_items, uint32_t max_chunks,
+             uint32_t flag)
+{
+    mpool_ctx_t *ctx = NULL;
+    uint32_t shift   = 0;
+    size_t size = (sizeof(mpool_item_t) + msize + ALIGN_SIZE - 1) / ALIGN_SIZE
+                  * ALIGN_SIZE;
+
+    if (msize == 0 || chunk_items == 0 || max_chunks == 0
+        || max_chunks > MPOOL_MAX_CHUNKS) {
+        return NULL;
+    }
+
+    while ((1U << shift) < chunk_items && shift < 31) {
+        shift++;
+    }
+    // indexes are returned as int by mpool_get_idx()
+    if (((uint64_t)max_chunks << shift) >= INT32_MAX) {
+        return NULL;
+    }
+
+    ctx = (mpool_ctx_t *)aligned_alloc(
+        MPOOL_CACHELINE, ALIGN(sizeof(mpool_ctx_t), MPOOL_CACHELINE));
+    if (!ctx) {
+        return NULL;
+    }
+    memset(ctx, 0, sizeof(mpool_ctx_t));
+
+    ctx->chunks     = (uint8_t **)calloc(max_chunks, sizeof(uint8_t *));
+    ctx->chunk_info = (mpool_chunk_t *)calloc(max_chunks, sizeof(mpool_chunk_t));
+    ctx->order      = (uint32_t *)calloc(max_chunks, sizeof(uint32_t));
+    if (!ctx->chunks || !ctx->chunk_info || !ctx->order) {
+        free(ctx->chunks);
+        free(ctx->chunk_info);
+        free(ctx->order);
+        free(ctx);
+        return NULL;
+    }
+
+    ctx->flag = MPOOL_FLAG_ALLOC | MPOOL_FLAG_GROW
+                | (flag & (MPOOL_FLAG_HUGETLB | MPOOL_FLAG_THP
+                           | MPOOL_FLAG_NOCACHE));
+    ctx->ref         = 1;
+    ctx->size        = size;
+    ctx->msize       = msize;
+    ctx->max         = 0;
+    ctx->pool        = NULL;
+    ctx->shift       = shift;
+    ctx->mask        = (1U << shift) - 1;
+    ctx->chunk_items = 1U << shift;
+    ctx->nchunks     = max_chunks;
+    ctx->idle        = 0;
+    pthread_mutex_init(&ctx->grow_lock, NULL);
+
+    // exhaustion isn't a concern, cache unless told not to
+    if (!(flag & MPOOL_FLAG_NOCACHE) && mpool_id_alloc(ctx) == 0) {
+        ctx->batch = MPOOL_CACHE_BATCH;
+        pthread_spin_init(&ctx->lock, PTHREAD_PROCESS_PRIVATE);
+    }
+
+    ctx->track = MPOOL_TRACK_OFF;
+    ctx->top   = MPOOL_TOP(0, 0);
+    ctx->nfree = 0;
+    ctx->flag |= MPOOL_FLAG_READY;
+
+    if (mpool_grow(ctx) != 0) {
+        mpool_cleanup(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+void
+mpool_set_idle(mpool_ctx_t *ctx, uint32_t idle)
+{
+    if (ctx) {
+        ctx->idle = idle;
+    }
+}
+
+int
+mpool_trim(mpool_ctx_t *ctx)
+{
+    mpool_chunk_t *info;
+    uint32_t *nfree, idx, next, c;
+    uint32_t first = 0, last = 0, removed = 0;
+    uint64_t now;
+    int64_t top;
+    int released = 0;
+
+    if (!ctx || !(ctx->flag & MPOOL_FLAG_GROW)) {
+        return 0;
+    }
+
+    nfree = (uint32_t *)calloc(ctx->nchunks, sizeof(uint32_t));
+    if (!nfree) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&ctx->grow_lock);
+
+    // take the whole free list, poppers racing with us fail on the tag
+    do {
+        top = atomic_load64(&ctx->top);
+    } while (!atomic_cas64(&ctx->top, top,
+                           MPOOL_TOP(MPOOL_TOP_TAG(top) + 1, 0)));
+
+    for (idx = MPOOL_TOP_IDX(top); idx; idx = mpool_item(ctx, idx)->next) {
+        nfree[(idx - 1) >> ctx->shift]++;
+    }
+
+    // nfree[c] stays non-zero only for the chunks to release
+    now = mpool_now();
+    for (c = 0; c < ctx->nchunks; c++) {
+        info = &ctx->chunk_info[c];
+        if (!info->live || nfree[c] != ctx->chunk_items) {
+            info->idle_since = 0;
+            nfree[c]         = 0;
+            continue;
+        }
+
+        if (info->idle_since == 0) {
+            info->idle_since = now;
+        }
+        if (now - info->idle_since < ctx->idle) {
+            nfree[c] = 0;
+        }
+    }
+
+    // relink the rest
+    for (idx = MPOOL_TOP_IDX(top); idx; idx = next) {
+        next = mpool_item(ctx, idx)->next;
+        if (nfree[(idx - 1) >> ctx->shift]) {
+            removed++;
+            continue;
+        }
+
+        if (last) {
+            mpool_item(ctx, last)->next = idx;
+        } else {
+            first = idx;
+        }
+        last = idx;
+    }
+
+    for (c = 0; c < ctx->nchunks; c++) {
+        if (!nfree[c]) {
+            continue;
+        }
+
+        // keep the range mapped: a racing popper may still read a stale
+        // next from it, it reads zero and its cas fails on the tag.
+        info = &ctx->chunk_info[c];
+        madvise(ctx->chunks[c], info->bytes, MADV_DONTNEED);
+        info->live       = 0;
+        info->idle_since = 0;
+        atomic_add32((vint32_t *)&ctx->max, -(int32_t)ctx->chunk_items);
+        released++;
+    }
+
+    atomic_add32(&ctx->nfree, -(int32_t)removed);
+    if (first) {
+        mpool_push(ctx, first, last, 0); // still counted in nfree
+    }
+
+    pthread_mutex_unlock(&ctx->grow_lock);
+    free(nfree);
+    return released;
+}
+
 void
 mpool_cleanup(mpool_ctx_t *ctx)
 {
     if (ctx) {
         if (atomic_decrement32(&(ctx->ref)) == 0) {
+            if (ctx->batch) {
+                mpool_id_free(ctx);
+                pthread_spin_destroy(&ctx->lock);
+            }
+
+            if (ctx->flag & MPOOL_FLAG_GROW) {
+                uint32_t c;
+                for (c = 0; c < ctx->nchunks; c++) {
+                    if (ctx->chunks[c]) {
+                        munmap(ctx->chunks[c], ctx->chunk_info[c].bytes);
+                    }
+                }
+                free(ctx->chunks);
+                free(ctx->chunk_info);
+                free(ctx->order);
+                pthread_mutex_destroy(&ctx->grow_lock);
+            }
+
             if (ctx->flag & MPOOL_FLAG_ALLOC) {
                 free(ctx);
             } else {
-#ifdef MPOOL_DBG
-                fprintf(stderr, "cleanup and ctx->flag: 0x%x\n", ctx->flag);
+#if MPOOL_TRACK > MPOOL_TRACK_OFF
+                if (ctx->track > MPOOL_TRACK_OFF) {
+                    fprintf(stderr, "cleanup and ctx->flag: 0x%x\n", ctx->flag);
+                }
 #endif
 
                 ctx->flag &= ~MPOOL_FLAG_READY;  //clear the ready flag
             }
         } else {
-#ifdef MPOOL_DBG
-            fprintf(stderr, "cleanup and ctx->ref == %d\n", ctx->ref);
+#if MPOOL_TRACK > MPOOL_TRACK_OFF
+            if (ctx->track > MPOOL_TRACK_OFF) {
+                fprintf(stderr, "cleanup and ctx->ref == %d\n", ctx->ref);
+            }
 #endif
         }
     }
@@ -185,81 +939,160 @@ mpool_cleanup(mpool_ctx_t *ctx)
 static inline void
 mpool_enqueue(mpool_ctx_t *ctx, mpool_item_t *ptr)
 {
-    while (1) {
-#ifdef MPOOL_DBG
-        if (mpool_empty(ctx)) {
-            fprintf(stderr, "Try to put a package in to an empty pool!\n");
-            /* loc_list_dump(ptr); */
-            return;
+    uint32_t idx = mpool_item_idx(ctx, ptr);
+    mpool_cache_t *cache;
+
+    if (ctx->batch && (cache = mpool_cache_get(ctx)) != NULL) {
+        pthread_spin_lock(&cache->lock);
+        ptr->next  = cache->top;
+        cache->top = idx;
+        if (++cache->count >= 2 * ctx->batch) {
+            mpool_cache_flush(cache, ctx->batch);
         }
-#endif
+        pthread_spin_unlock(&cache->lock);
+        return;
+    }
 
+    mpool_push(ctx, idx, idx, 1);
+}
+
+static inline mpool_item_t *
+mpool_dequeue_once(mpool_ctx_t *ctx)
+{
+    uint32_t idx, n;
+    mpool_cache_t *cache;
+
+    if (ctx->batch && (cache = mpool_cache_get(ctx)) != NULL) {
+        pthread_spin_lock(&cache->lock);
+        if (cache->count == 0) {
+            cache->top   = mpool_pop(ctx, ctx->batch, &n);
+            cache->count = n;
+        }
 
-        uint32_t idx = ctx->tail;
-        if (atomic_cas32((vint32_t *)&ctx->tail, idx, idx + 1)) {
-            ctx->queue[idx % ctx->max] = ptr;
-            return;
+        idx = 0;
+        if (cache->count) {
+            idx        = cache->top;
+            cache->top = mpool_item(ctx, idx)->next;
+            cache->count--;
         }
+        pthread_spin_unlock(&cache->lock);
+        return idx ? mpool_item(ctx, idx) : NULL;
     }
+
+    idx = mpool_pop(ctx, 1, &n);
+    return idx ? mpool_item(ctx, idx) : NULL;
 }
 
 static inline mpool_item_t *
 mpool_dequeue(mpool_ctx_t *ctx)
 {
-    while (1) {
-        if (mpool_full(ctx)) {
-            return NULL;
-        }
+    mpool_item_t *ptr;
 
-        uint32_t idx      = ctx->head;
-        mpool_item_t *ptr = NULL;
-        if (atomic_cas32((vint32_t *)&ctx->head, idx, idx + 1)) {
-            ptr = ctx->queue[idx % ctx->max];
+    for (;;) {
+        ptr = mpool_dequeue_once(ctx);
+        if (ptr) {
             return ptr;
         }
+        if ((ctx->flag & MPOOL_FLAG_GROW) && mpool_grow(ctx) == 0) {
+            continue;
+        }
+        // the rest may sit in the caches of other threads
+        if (!ctx->batch || mpool_cache_steal(ctx) == 0) {
+            return NULL;
+        }
     }
 }
 
-void *
-__mpool_get(mpool_ctx_t *ctx, const char *file, int line)
+static inline void *
+mpool_get_item(mpool_ctx_t *ctx, int zero, int fail, const char *file,
+               int line)
 {
     mpool_item_t *ptr = NULL;
-    void *ret         = NULL;
 
     if (!ctx) {
         return NULL;
     }
 
     ptr = mpool_dequeue(ctx);
-    if (ptr) {
-        if (atomic_cas32(&ptr->ref, 0, 1)) {
-#ifdef MPOOL_DBG
-            loc_list_free(ptr->get);
-            ptr->get = NULL;
-            loc_list_free(ptr->put);
-            ptr->put = NULL;
-            loc_t *loc = loc_init(file, line);
-            ptr->get   = loc_list_insert(ptr->get, loc);
-#endif
-            ptr->ctx = ctx;
-            memset(ptr->data, 0, ctx->msize);
-            ret = (void *)ptr->data;
-        } else {
-#ifdef MPOOL_DBG
-            fprintf(stderr, "Un-expected package in queue! ref: %d\n",
-                    atomic_load32(&ptr->ref));
-            loc_list_dump(ptr);
+    if (!ptr) {
+        if (fail) {
+            MPOOL_STAT_INC(ctx, fail);
+        }
+        return NULL;
+    }
+
+#if MPOOL_TRACK > MPOOL_TRACK_OFF
+    if (ctx->track > MPOOL_TRACK_OFF) {
+        if (!atomic_cas32(&ptr->ref, 0, 1)) {
+            mpool_error(ptr, "un-expected package in queue!", file, line);
+            return NULL;
+        }
+        MPOOL_STAT_INC(ctx, get);
+        MPOOL_HIST_ADD(ptr, file, line, MPOOL_OP_GET);
+    } else
 #endif
+    {
+        // nobody else can see a free item
+        ptr->ref = 1;
+    }
+
+    if (zero) {
+        memset(ptr->data, 0, ctx->msize);
+    }
+    return (void *)ptr->data;
+}
+
+void *
+__mpool_get(mpool_ctx_t *ctx, const char *file, int line)
+{
+    return mpool_get_item(ctx, 1, 1, file, line);
+}
+
+void *
+__mpool_get_nozero(mpool_ctx_t *ctx, const char *file, int line)
+{
+    return mpool_get_item(ctx, 0, 1, file, line);
+}
+
+int
+__mpool_get_bulk(mpool_ctx_t *ctx, void **ptrs, int n, const char *file,
+                 int line)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        ptrs[i] = mpool_get_item(ctx, 0, 0, file, line);
+        if (!ptrs[i]) {
+            break;
         }
     }
+    return i;
+}
 
-    return ret;
+static inline void
+mpool_item_put(void *p, const char *file, int line, int op)
+{
+    if (p) {
+        mpool_item_t *ptr = container_of(p, mpool_item_t, data);
+        mpool_ctx_t *ctx  = (mpool_ctx_t *)ptr->ctx;
+        MPOOL_HIST_ADD(ptr, file, line, op);
+        int32_t ref = atomic_decrement32(&(ptr->ref));
+        if (ref == 0) {
+            MPOOL_STAT_INC(ctx, put);
+            mpool_enqueue(ctx, ptr);
+        }
+#if MPOOL_TRACK > MPOOL_TRACK_OFF
+        else if (ref < 0 && ctx->track > MPOOL_TRACK_OFF) {
+            mpool_error(ptr, "double free", file, line);
+        }
+#endif
+    }
 }
 
 void
 __mpool_put(void *p, const char *file, int line)
 {
-    __mpool_ref_dec(p, file, line);
+    mpool_item_put(p, file, line, MPOOL_OP_PUT);
 }
 
 void
@@ -267,14 +1100,14 @@ __mpool_ref_inc(void *p, const char *file, int line)
 {
     if (p) {
         mpool_item_t *ptr = container_of(p, mpool_item_t, data);
-        atomic_increment32(&ptr->ref);
-#ifdef MPOOL_DBG
-        loc_t *loc = loc_init(file, line);
-        ptr->get   = loc_list_insert(ptr->get, loc);
-        if (atomic_load32(&ptr->ref) <= 1) {
-            fprintf(stderr, "ATTENTION: after ref inc %d on %s:%d\n", ptr->ref, file, line);
-            loc_list_dump(ptr);
+        int32_t ref       = atomic_increment32(&ptr->ref);
+        MPOOL_HIST_ADD(ptr, file, line, MPOOL_OP_INC);
+#if MPOOL_TRACK > MPOOL_TRACK_OFF
+        if (ref <= 1 && ((mpool_ctx_t *)ptr->ctx)->track > MPOOL_TRACK_OFF) {
+            mpool_error(ptr, "ref inc on a free member", file, line);
         }
+#else
+        (void)ref;
 #endif
     }
 }
@@ -282,44 +1115,122 @@ __mpool_ref_inc(void *p, const char *file, int line)
 void
 __mpool_ref_dec(void *p, const char *file, int line)
 {
-    if (p) {
-        mpool_item_t *ptr = container_of(p, mpool_item_t, data);
-        if (atomic_decrement32(&(ptr->ref)) == 0) {
-            mpool_enqueue(ptr->ctx, ptr);
-        }
-#ifdef MPOOL_DBG
-        loc_t *loc        = loc_init(file, line);
-        ptr->put          = loc_list_insert(ptr->put, loc);
-        if (atomic_load32(&ptr->ref) != 0) {
-            fprintf(stderr, "ATTENTION: double free on %s:%d!\n", file, line);
-            loc_list_dump(ptr);
-        }
-#endif
+    mpool_item_put(p, file, line, MPOOL_OP_DEC);
+}
+
+int
+mpool_set_track(mpool_ctx_t *ctx, int level)
+{
+    if (!ctx) {
+        return -EINVAL;
+    }
+
+    if (level < MPOOL_TRACK_OFF) {
+        level = MPOOL_TRACK_OFF;
+    } else if (level > MPOOL_TRACK) {
+        level = MPOOL_TRACK;
+    }
+    ctx->track = level;
+    return level;
+}
+
+void
+mpool_stat(mpool_ctx_t *ctx, mpool_stat_t *stat)
+{
+    mpool_cache_t *cache;
+
+    memset(stat, 0, sizeof(*stat));
+    if (!ctx) {
+        return;
+    }
+
+    stat->get   = atomic_load64(&ctx->stat.get);
+    stat->put   = atomic_load64(&ctx->stat.put);
+    stat->fail  = atomic_load64(&ctx->stat.fail);
+    stat->error = atomic_load64(&ctx->stat.error);
+    if (!ctx->batch) {
+        return;
+    }
+
+    pthread_spin_lock(&ctx->lock);
+    for (cache = ctx->caches; cache; cache = cache->next) {
+        stat->cached += cache->count;
+        stat->get += cache->stat.get;
+        stat->put += cache->stat.put;
+        stat->fail += cache->stat.fail;
+        stat->error += cache->stat.error;
+    }
+    pthread_spin_unlock(&ctx->lock);
+}
+
+void
+mpool_dump(void *p)
+{
+    mpool_item_t *ptr = container_of(p, mpool_item_t, data);
+
+    fprintf(stderr, "================ Dump block %p ref: %d\n", ptr,
+            atomic_load32(&ptr->ref));
+#if MPOOL_TRACK >= MPOOL_TRACK_HISTORY
+    static const char *ops[] = {"get", "put", "inc", "dec"};
+    uint32_t end = ptr->hist_pos, i;
+    i = end > MPOOL_TRACK_DEPTH ? end - MPOOL_TRACK_DEPTH : 0;
+    for (; i != end; i++) {
+        mpool_loc_t *loc = &ptr->hist[i % MPOOL_TRACK_DEPTH];
+        fprintf(stderr, "\t%s %s:%d\n", ops[loc->op & 3],
+                loc->file ? loc->file : "?", loc->line);
     }
+#endif
+    fprintf(stderr, "================ Dump block %p finished!\n\n", ptr);
 }
 
 int
 mpool_get_idx(mpool_ctx_t *ctx, void *p)
 {
-    mpool_item_t *ptr = container_of(p, mpool_item_t, data);
-    int64_t l         = (int64_t)((uint8_t *)ptr - ctx->pool);
-    if (l < 0 || l % ctx->size != 0) {
+    uint8_t *ptr = (uint8_t *)container_of(p, mpool_item_t, data);
+    size_t off;
+    uint32_t c;
+
+    if (!ctx || !p) {
         return -EINVAL;
     }
-    int idx = (int)(l / ctx->size);
-    if (idx >= ctx->max) {
+
+    // find the chunk by address, the item header of a foreign pointer
+    // can't be read
+    if (ctx->flag & MPOOL_FLAG_GROW) {
+        int found = mpool_order_find(ctx, ptr);
+        if (found < 0 || !ctx->chunk_info[found].live) {
+            return -EINVAL;
+        }
+        c = (uint32_t)found;
+    } else {
+        c = 0;
+        if (ptr < ctx->chunks[0]) {
+            return -EINVAL;
+        }
+    }
+
+    off = (size_t)(ptr - ctx->chunks[c]);
+    if (off >= (size_t)ctx->chunk_items * ctx->size || off % ctx->size != 0) {
         return -EINVAL;
     }
-    return idx;
+    return (int)(c << ctx->shift | (uint32_t)(off / ctx->size));
 }
 
 void *
 mpool_get_by_idx(mpool_ctx_t *ctx, int idx)
 {
-    if (!ctx || idx < 0 || idx >= ctx->max) {
+    uint32_t c;
+
+    if (!ctx || idx < 0) {
+        return NULL;
+    }
+
+    c = (uint32_t)idx >> ctx->shift;
+    if (c >= ctx->nchunks || !ctx->chunks[c]
+        || ((uint32_t)idx & ctx->mask) >= ctx->chunk_items
+        || (ctx->chunk_info && !ctx->chunk_info[c].live)) {
         return NULL;
     }
 
-    mpool_item_t *ptr = (mpool_item_t *)(ctx->pool + idx * ctx->size);
-    return ptr->data;
+    return mpool_item(ctx, (uint32_t)idx + 1)->data;
 }
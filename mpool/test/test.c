@@ -13,6 +13,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #ifdef NDEBUG
 #undef NDEBUG
 #endif
@@ -24,6 +25,10 @@ typedef struct {
     int id;
 } item_t;
 
+#define SCALE_ITEMS (64 * 1024)
+#define SCALE_BURST 16
+#define SCALE_LOOPS 20000
+
 int
 mpool_test(void)
 {
@@ -42,11 +47,9 @@ mpool_test(void)
                 snprintf(p->str, sizeof(p->str), "this is %lx", (long)thread_self());
                 queue[i] = p;
                 printf(
-                    "get [%2d] idx: %2d ref: %3d %p size: %2d count: %2d head: %2d "
-                    "tail: %2d\n",
+                    "get [%2d] idx: %2d ref: %3d %p size: %2d count: %2d nfree: %2d\n",
                     i, p->id, ptr->ref, p,
-                    mpool_size(ctx), mpool_count(ctx), ctx->head,
-                    ctx->tail);
+                    mpool_size(ctx), mpool_count(ctx), ctx->nfree);
             }
         }
 
@@ -57,11 +60,9 @@ mpool_test(void)
                 mpool_item_t *ptr = container_of((void *)p, mpool_item_t, data);
                 mpool_put(p);
                 printf(
-                    "put [%2d] idx: %2d ref: %3d %p size: %2d count: %2d head: %2d "
-                    "tail: %2d\n",
+                    "put [%2d] idx: %2d ref: %3d %p size: %2d count: %2d nfree: %2d\n",
                     i, p->id, ptr->ref, p,
-                    mpool_size(ctx), mpool_count(ctx), ctx->head,
-                    ctx->tail);
+                    mpool_size(ctx), mpool_count(ctx), ctx->nfree);
             }
         }
     }
@@ -97,20 +98,20 @@ mpool_benchmark(void)
             assert(p);
         }
 
-        /* printf("get idx: %d %p  size: %d count: %d head: %d tail: %d\n", i,
-         * p, mpool_size(ctx), mpool_count(ctx), ctx->head, ctx->tail); */
+        /* printf("get idx: %d %p  size: %d count: %d nfree: %d\n", i,
+         * p, mpool_size(ctx), mpool_count(ctx), ctx->nfree); */
 
         for (i = 0; i < mpool_size(ctx); i++) {
             p = mpool_get_by_idx(ctx, i);
             assert(p);
             mpool_put(p);
         }
-        /* printf("put idx: %d %p  size: %d count: %d head: %d tail: %d\n", i,
-         * p, mpool_size(ctx), mpool_count(ctx), ctx->head, ctx->tail); */
+        /* printf("put idx: %d %p  size: %d count: %d nfree: %d\n", i,
+         * p, mpool_size(ctx), mpool_count(ctx), ctx->nfree); */
     }
 
-    printf("idx: %d %p  size: %d count: %d head: %d tail: %d\n",
-           i, p, mpool_size(ctx), mpool_count(ctx), ctx->head, ctx->tail);
+    printf("idx: %d %p  size: %d count: %d nfree: %d\n",
+           i, p, mpool_size(ctx), mpool_count(ctx), ctx->nfree);
     mpool_cleanup(ctx);
     return 0;
 }
@@ -159,16 +160,285 @@ mpool_thread(void)
      *         printf("[%d] id: %d str: %s\n", i, p->id, p->str);
      *     }
      * } */
-    printf("size: %d count: %d head: %d tail: %d\n", mpool_size(ctx),
-           mpool_count(ctx), ctx->head, ctx->tail);
+    printf("size: %d count: %d nfree: %d\n", mpool_size(ctx),
+           mpool_count(ctx), ctx->nfree);
+    mpool_cleanup(ctx);
+    return 0;
+}
+
+int
+mpool_track_test(void)
+{
+    static const char *levels[] = {"off", "count", "history"};
+    mpool_ctx_t *ctx = NULL;
+    mpool_stat_t stat;
+    item_t *p, *q;
+    uint64_t start, cost;
+    int i, level;
+
+    ctx = mpool_calloc(16, sizeof(item_t));
+    assert(ctx);
+
+    level = mpool_set_track(ctx, MPOOL_TRACK_COUNT);
+    p     = mpool_get(ctx);
+    p->id = 42;
+    mpool_put(p);
+
+    // LIFO free list, a small pool has no thread cache
+    q = mpool_get_nozero(ctx);
+    assert(q == p && q->id == 42);
+    mpool_put(q);
+    q = mpool_get(ctx);
+    assert(q == p && q->id == 0);
+    mpool_put(q);
+
+    mpool_stat(ctx, &stat);
+    printf("track: %s get: %ld put: %ld fail: %ld error: %ld\n",
+           levels[level], (long)stat.get, (long)stat.put, (long)stat.fail,
+           (long)stat.error);
+    if (level >= MPOOL_TRACK_COUNT) {
+        assert(stat.get == 3 && stat.put == 3 && stat.error == 0);
+    }
+    mpool_cleanup(ctx);
+
+    ctx = mpool_calloc(SCALE_ITEMS, sizeof(item_t));
+    assert(ctx);
+    for (level = MPOOL_TRACK_OFF; level <= MPOOL_TRACK; level++) {
+        mpool_set_track(ctx, level);
+        start = system_clock();
+        for (i = 0; i < 10000000; i++) {
+            p = mpool_get_nozero(ctx);
+            p->id = i;
+            mpool_put(p);
+        }
+        cost = system_clock() - start;
+        printf("track: %-7s get/put: %d cost: %lums %.1f ns/op\n",
+               levels[level], i, (unsigned long)cost, cost * 1000000.0 / i);
+    }
+    mpool_cleanup(ctx);
+    return 0;
+}
+
+int
+mpool_grow_test(void)
+{
+    mpool_ctx_t *ctx = NULL;
+    static item_t *items[5000];
+    item_t *p;
+    int i, idx, released;
+
+    ctx = mpool_create(sizeof(item_t), 1000, 8, MPOOL_FLAG_THP);
+    assert(ctx);
+    printf("chunk items: %u size: %d\n", ctx->chunk_items, mpool_size(ctx));
+
+    for (i = 0; i < (int)ARRAY_SIZE(items); i++) {
+        items[i] = mpool_get(ctx);
+        assert(items[i]);
+        items[i]->id = i;
+    }
+    printf("grow: size: %d count: %d\n", mpool_size(ctx), mpool_count(ctx));
+    assert(mpool_size(ctx) >= (int)ARRAY_SIZE(items));
+
+    // indexes carry the chunk in the high bits
+    for (i = 0; i < (int)ARRAY_SIZE(items); i++) {
+        idx = mpool_get_idx(ctx, items[i]);
+        assert(idx >= 0);
+        p = mpool_get_by_idx(ctx, idx);
+        assert(p == items[i] && p->id == i);
+    }
+    p = (item_t *)malloc(sizeof(item_t));
+    assert(mpool_get_idx(ctx, p) < 0);
+    assert(mpool_get_idx(ctx, (uint8_t *)items[0] + 1) < 0);
+    free(p);
+
+    // the cache of this thread holds some items back
+    for (i = 0; i < (int)ARRAY_SIZE(items); i++) {
+        mpool_put(items[i]);
+    }
+
+    mpool_set_idle(ctx, 50);
+    released = mpool_trim(ctx);
+    assert(released == 0); // idle from now on
+    usleep(60 * 1000);
+    released = mpool_trim(ctx);
+    printf("trim: released: %d size: %d count: %d\n", released,
+           mpool_size(ctx), mpool_count(ctx));
+    assert(released > 0);
+
+    // released chunks come back on demand
+    for (i = 0; i < (int)ARRAY_SIZE(items); i++) {
+        items[i] = mpool_get(ctx);
+        assert(items[i]);
+    }
+    for (i = 0; i < (int)ARRAY_SIZE(items); i++) {
+        mpool_put(items[i]);
+    }
+    printf("regrow: size: %d count: %d\n", mpool_size(ctx), mpool_count(ctx));
+    mpool_cleanup(ctx);
+
+    // bounded by max_chunks
+    ctx = mpool_create(sizeof(item_t), 64, 2, 0);
+    assert(ctx);
+    for (i = 0; i < 128; i++) {
+        items[i] = mpool_get(ctx);
+        assert(items[i]);
+    }
+    assert(mpool_get(ctx) == NULL);
+    for (i = 0; i < 128; i++) {
+        mpool_put(items[i]);
+    }
     mpool_cleanup(ctx);
     return 0;
 }
+
+static int park_done;
+static int park_exit;
+
+int
+park_run(void *arg)
+{
+    mpool_ctx_t *ctx = (mpool_ctx_t *)arg;
+    item_t *p[MPOOL_CACHE_BATCH];
+    int i;
+
+    // leaves a batch in the cache of this thread
+    for (i = 0; i < MPOOL_CACHE_BATCH; i++) {
+        p[i] = mpool_get(ctx);
+        assert(p[i]);
+    }
+    for (i = 0; i < MPOOL_CACHE_BATCH; i++) {
+        mpool_put(p[i]);
+    }
+
+    __atomic_store_n(&park_done, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(&park_exit, __ATOMIC_ACQUIRE)) {
+        usleep(1000);
+    }
+    return 0;
+}
+
+int
+mpool_steal_test(void)
+{
+    static item_t *items[MPOOL_CACHE_MIN_ITEMS];
+    mpool_ctx_t *ctx = NULL;
+    pthread_t t;
+    int i;
+
+    ctx = mpool_calloc(MPOOL_CACHE_MIN_ITEMS, sizeof(item_t));
+    assert(ctx && ctx->batch);
+
+    thread_create(&t, park_run, (void *)ctx);
+    while (!__atomic_load_n(&park_done, __ATOMIC_ACQUIRE)) {
+        usleep(1000);
+    }
+
+    // the items parked by the other thread are pulled from its cache
+    for (i = 0; i < MPOOL_CACHE_MIN_ITEMS; i++) {
+        items[i] = mpool_get(ctx);
+        assert(items[i]);
+    }
+    assert(mpool_get(ctx) == NULL);
+    for (i = 0; i < MPOOL_CACHE_MIN_ITEMS; i++) {
+        mpool_put(items[i]);
+    }
+    printf("steal: size: %d count: %d\n", mpool_size(ctx), mpool_count(ctx));
+
+    __atomic_store_n(&park_exit, 1, __ATOMIC_RELEASE);
+    thread_destroy(t);
+    mpool_cleanup(ctx);
+    return 0;
+}
+
+int
+mpool_init_test(void)
+{
+    size_t total = 1024 * 1024;
+    mpool_ctx_t *ctx = NULL;
+    uint8_t *mem;
+    item_t *p;
+
+    mem = (uint8_t *)calloc(1, total + 8);
+    assert(mem);
+
+    // zeroed caller memory needs no more than 8 bytes alignment, and gets
+    // no caches
+    ctx = mpool_init(sizeof(item_t), total, mem + 8);
+    assert(ctx && (uint8_t *)ctx == mem + 8 && ctx->batch == 0);
+    assert(mpool_size(ctx) >= MPOOL_CACHE_MIN_ITEMS);
+    p = mpool_get(ctx);
+    assert(p && ((uintptr_t)p & (ALIGN_SIZE - 1)) == 0);
+    mpool_put(p);
+    assert(mpool_count(ctx) == 0);
+    mpool_cleanup(ctx);
+
+    assert(mpool_init(sizeof(item_t), total, mem + 4) == NULL);
+    free(mem);
+    return 0;
+}
+
+int
+scale_run(void *arg)
+{
+    mpool_ctx_t *ctx = (mpool_ctx_t *)arg;
+    item_t *burst[SCALE_BURST];
+    int i, j;
+
+    for (i = 0; i < SCALE_LOOPS; i++) {
+        for (j = 0; j < SCALE_BURST; j++) {
+            burst[j] = mpool_get(ctx);
+            assert(burst[j]);
+            burst[j]->id = j;
+        }
+        for (j = 0; j < SCALE_BURST; j++) {
+            mpool_put(burst[j]);
+        }
+    }
+
+    return 0;
+}
+
+int
+mpool_scale_benchmark(void)
+{
+    pthread_t t[32];
+    int i, n;
+    uint64_t start, cost;
+    mpool_ctx_t *ctx = NULL;
+
+    for (n = 1; n <= (int)ARRAY_SIZE(t); n *= 2) {
+        ctx = mpool_calloc(SCALE_ITEMS, sizeof(item_t));
+        assert(ctx);
+
+        start = system_clock();
+        for (i = 0; i < n; i++) {
+            thread_create(&t[i], scale_run, (void *)ctx);
+        }
+        for (i = 0; i < n; i++) {
+            thread_destroy(t[i]);
+        }
+        cost = system_clock() - start;
+
+        printf("threads: %2d get/put: %9d cost: %5lums %.2f Mops/s count: %d\n",
+               n, n * SCALE_LOOPS * SCALE_BURST, (unsigned long)cost,
+               (double)n * SCALE_LOOPS * SCALE_BURST / (cost ? cost : 1) / 1000,
+               mpool_count(ctx));
+        assert(mpool_count(ctx) == 0);
+        mpool_cleanup(ctx);
+    }
+    return 0;
+}
+
 int
 main(int argc, char *argv[])
 {
     /* mpool_test(); */
     /* mpool_benchmark(); */
     mpool_thread();
+    mpool_track_test();
+    mpool_grow_test();
+    mpool_steal_test();
+    mpool_init_test();
+    mpool_scale_benchmark();
     return 0;
 }
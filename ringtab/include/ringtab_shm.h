@@ -0,0 +1,115 @@
+/*
+ * ringtab_shm.h - ringtab in POSIX shared memory
+ *
+ * Date   : 2021/04/20
+ */
+#ifndef __RINGTAB_SHM_H__
+#define __RINGTAB_SHM_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "ringtab.h"
+
+#define RINGTAB_SHM_MAGIC 0x52544253 /* "RTBS" */
+#define RINGTAB_SHM_CACHELINE 64
+
+/*
+ * A ringtab living in a named POSIX shared-memory segment, so one
+ * producer process can hand items to one consumer process without copies
+ * through a socket or pipe.
+ *
+ * The ringtab primitives publish a slot as soon as ringtab_put_item()
+ * returns it and both sides update hdr.flags.full, which is fine inside
+ * one thread but not across processes. So the shared table is driven by
+ * two monotonic sequence counters instead: wr_seq and hdr.tail are only
+ * written by the producer, rd_seq and hdr.head only by the consumer, and
+ * an item becomes visible when the producer commits it. The counters
+ * double as futex words, a side blocks on an empty or full table and is
+ * woken by the other side's commit. Do not mix ringtab_put_item() or
+ * ringtab_get_item() with the ringtab_shm_* calls on the same table.
+ *
+ * Layout of the segment: ringtab_shm_t followed by the ringtab data.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t map_size;
+    uint8_t pad0[RINGTAB_SHM_CACHELINE - 2 * sizeof(uint32_t)];
+
+    volatile uint32_t wr_seq;     /* items committed by producer */
+    volatile uint32_t wr_waiters; /* producers blocked on full */
+    uint8_t pad1[RINGTAB_SHM_CACHELINE - 2 * sizeof(uint32_t)];
+
+    volatile uint32_t rd_seq;     /* items released by consumer */
+    volatile uint32_t rd_waiters; /* consumers blocked on empty */
+    uint8_t pad2[RINGTAB_SHM_CACHELINE - 2 * sizeof(uint32_t)];
+
+    ringtab_hdr_t rtab;
+} ringtab_shm_t;
+
+/*
+ * Create the named segment (shm_open() name, e.g. "/capture0") holding an
+ * n_items x item_size table. If it already exists with the same geometry
+ * it is attached instead.
+ * Return NULL on error, errno is set.
+ */
+ringtab_shm_t *ringtab_shm_create(const char *name,
+                                  int16_t n_items,
+                                  int16_t item_size);
+
+/*
+ * Attach an existing segment created by ringtab_shm_create().
+ * Return NULL on error, errno is set (EAGAIN if the creator has not
+ * finished initialization yet).
+ */
+ringtab_shm_t *ringtab_shm_attach(const char *name);
+
+/*
+ * Unmap the segment from this process.
+ */
+void ringtab_shm_detach(ringtab_shm_t *shm);
+
+/*
+ * Remove the segment name, mappings stay valid until detached.
+ */
+int ringtab_shm_unlink(const char *name);
+
+/*
+ * The number of committed items not yet released by the consumer.
+ */
+int16_t ringtab_shm_items_used(ringtab_shm_t *shm);
+
+/*
+ * Producer gets the slot to write the next item to.
+ * timeout: ms to wait while the table is full, 0 no wait, -1 forever.
+ * Return NULL on timeout.
+ */
+void *ringtab_shm_put_begin(ringtab_shm_t *shm, int timeout);
+
+/*
+ * Producer publishes the slot returned by ringtab_shm_put_begin() and
+ * wakes a blocked consumer.
+ */
+void ringtab_shm_put_commit(ringtab_shm_t *shm);
+
+/*
+ * Consumer gets the oldest committed item, it stays valid until
+ * ringtab_shm_get_commit().
+ * timeout: ms to wait while the table is empty, 0 no wait, -1 forever.
+ * Return NULL on timeout.
+ */
+void *ringtab_shm_get_begin(ringtab_shm_t *shm, int timeout);
+
+/*
+ * Consumer releases the item returned by ringtab_shm_get_begin() and
+ * wakes a blocked producer.
+ */
+void ringtab_shm_get_commit(ringtab_shm_t *shm);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
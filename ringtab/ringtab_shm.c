@@ -0,0 +1,300 @@
+/*
+ * ringtab_shm.c - ringtab in POSIX shared memory
+ *
+ * Date   : 2021/04/20
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "ringtab_shm.h"
+
+/*
+ * The counters are shared between processes, so no FUTEX_PRIVATE_FLAG.
+ */
+static void
+ringtab_shm_futex_wait(volatile uint32_t *word, uint32_t val,
+                       const struct timespec *ts)
+{
+    syscall(SYS_futex, word, FUTEX_WAIT, val, ts, NULL, 0);
+}
+
+static void
+ringtab_shm_futex_wake(volatile uint32_t *word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static void
+ringtab_shm_deadline(struct timespec *deadline, int timeout)
+{
+    if (timeout <= 0) {
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += timeout / 1000;
+    deadline->tv_nsec += (timeout % 1000) * 1000000;
+    deadline->tv_sec += deadline->tv_nsec / 1000000000;
+    deadline->tv_nsec %= 1000000000;
+}
+
+/*
+ * Sleep while *word == val.
+ * Return 0 if woken up (or spurious), -1 if timed out.
+ */
+static int
+ringtab_shm_wait(volatile uint32_t *word, uint32_t val,
+                 volatile uint32_t *waiters,
+                 int timeout, const struct timespec *deadline)
+{
+    struct timespec now, ts, *pts = NULL;
+
+    if (timeout == 0) {
+        return -1;
+    }
+
+    if (timeout > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        ts.tv_sec = deadline->tv_sec - now.tv_sec;
+        ts.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+        if (ts.tv_nsec < 0) {
+            ts.tv_sec--;
+            ts.tv_nsec += 1000000000;
+        }
+        if (ts.tv_sec < 0) {
+            return -1;
+        }
+        pts = &ts;
+    }
+
+    /*
+     * Pairs with the seq_cst store + waiters load in the commit path:
+     * either the committer sees us waiting or we see its new counter.
+     */
+    __atomic_add_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(word, __ATOMIC_SEQ_CST) == val) {
+        ringtab_shm_futex_wait(word, val, pts);
+    }
+    __atomic_sub_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+
+    return 0;
+}
+
+static inline void *
+ringtab_shm_slot(ringtab_hdr_t *rtab, int16_t idx)
+{
+    return (rtab->data + idx * rtab->item_size);
+}
+
+/*
+ * Map the segment and check it is initialized.
+ */
+static ringtab_shm_t *
+ringtab_shm_map(int fd)
+{
+    struct stat st;
+    ringtab_shm_t *shm;
+
+    if (fstat(fd, &st) < 0) {
+        return NULL;
+    }
+
+    if (st.st_size < (off_t)sizeof(ringtab_shm_t)) {
+        errno = EAGAIN;
+        return NULL;
+    }
+
+    shm = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shm == MAP_FAILED) {
+        return NULL;
+    }
+
+    if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != RINGTAB_SHM_MAGIC
+        || shm->map_size != (uint32_t)st.st_size) {
+        munmap(shm, st.st_size);
+        errno = EAGAIN;
+        return NULL;
+    }
+
+    return shm;
+}
+
+ringtab_shm_t *
+ringtab_shm_create(const char *name,
+                   int16_t n_items,
+                   int16_t item_size)
+{
+    int fd;
+    size_t size;
+    ringtab_shm_t *shm;
+
+    if (name == NULL || n_items <= 0 || item_size <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    size = sizeof(ringtab_shm_t) + (size_t)n_items * item_size;
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        if (errno != EEXIST) {
+            return NULL;
+        }
+
+        shm = ringtab_shm_attach(name);
+        if (shm != NULL && (shm->rtab.n_items != n_items
+                            || shm->rtab.item_size != item_size)) {
+            ringtab_shm_detach(shm);
+            errno = EINVAL;
+            return NULL;
+        }
+        return shm;
+    }
+
+    if (ftruncate(fd, size) < 0) {
+        goto fail;
+    }
+
+    shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shm == MAP_FAILED) {
+        goto fail;
+    }
+    close(fd);
+
+    memset(shm, 0, sizeof(*shm));
+    ringtab_init(&shm->rtab, n_items, item_size);
+    shm->map_size = size;
+
+    /* publish last, attachers check the magic */
+    __atomic_store_n(&shm->magic, RINGTAB_SHM_MAGIC, __ATOMIC_RELEASE);
+    return shm;
+
+fail:
+    close(fd);
+    shm_unlink(name);
+    return NULL;
+}
+
+ringtab_shm_t *
+ringtab_shm_attach(const char *name)
+{
+    int fd;
+    ringtab_shm_t *shm;
+
+    if (name == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    fd = shm_open(name, O_RDWR, 0600);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    shm = ringtab_shm_map(fd);
+    close(fd);
+    return shm;
+}
+
+void
+ringtab_shm_detach(ringtab_shm_t *shm)
+{
+    if (shm != NULL) {
+        munmap(shm, shm->map_size);
+    }
+}
+
+int
+ringtab_shm_unlink(const char *name)
+{
+    return shm_unlink(name);
+}
+
+int16_t
+ringtab_shm_items_used(ringtab_shm_t *shm)
+{
+    uint32_t wr = __atomic_load_n(&shm->wr_seq, __ATOMIC_ACQUIRE);
+    uint32_t rd = __atomic_load_n(&shm->rd_seq, __ATOMIC_ACQUIRE);
+
+    return (int16_t)(wr - rd);
+}
+
+/*
+ * Producer: wait while n_items are committed and not released.
+ */
+void *
+ringtab_shm_put_begin(ringtab_shm_t *shm, int timeout)
+{
+    struct timespec deadline;
+    uint32_t wr, rd;
+
+    ringtab_shm_deadline(&deadline, timeout);
+
+    wr = shm->wr_seq; /* only written by us */
+    for (;;) {
+        rd = __atomic_load_n(&shm->rd_seq, __ATOMIC_ACQUIRE);
+        if (wr - rd < (uint32_t)shm->rtab.n_items) {
+            break;
+        }
+
+        if (ringtab_shm_wait(&shm->rd_seq, rd, &shm->wr_waiters,
+                             timeout, &deadline) != 0) {
+            return NULL;
+        }
+    }
+
+    return ringtab_shm_slot(&shm->rtab, shm->rtab.tail);
+}
+
+void
+ringtab_shm_put_commit(ringtab_shm_t *shm)
+{
+    shm->rtab.tail++;
+    shm->rtab.tail %= shm->rtab.n_items;
+
+    __atomic_store_n(&shm->wr_seq, shm->wr_seq + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&shm->rd_waiters, __ATOMIC_SEQ_CST) != 0) {
+        ringtab_shm_futex_wake(&shm->wr_seq);
+    }
+}
+
+/*
+ * Consumer: wait while nothing is committed.
+ */
+void *
+ringtab_shm_get_begin(ringtab_shm_t *shm, int timeout)
+{
+    struct timespec deadline;
+    uint32_t rd;
+
+    ringtab_shm_deadline(&deadline, timeout);
+
+    rd = shm->rd_seq; /* only written by us */
+    while (__atomic_load_n(&shm->wr_seq, __ATOMIC_ACQUIRE) == rd) {
+        if (ringtab_shm_wait(&shm->wr_seq, rd, &shm->rd_waiters,
+                             timeout, &deadline) != 0) {
+            return NULL;
+        }
+    }
+
+    return ringtab_shm_slot(&shm->rtab, shm->rtab.head);
+}
+
+void
+ringtab_shm_get_commit(ringtab_shm_t *shm)
+{
+    shm->rtab.head++;
+    shm->rtab.head %= shm->rtab.n_items;
+
+    __atomic_store_n(&shm->rd_seq, shm->rd_seq + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&shm->wr_waiters, __ATOMIC_SEQ_CST) != 0) {
+        ringtab_shm_futex_wake(&shm->rd_seq);
+    }
+}
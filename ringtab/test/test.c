@@ -4,7 +4,16 @@
  * Date   : 2020/04/27
  */
 #include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <assert.h>
 #include "ringtab.h"
+#include "ringtab_shm.h"
 
 typedef struct {
     uint8_t data;
@@ -376,6 +385,112 @@ ringtab_test_Producer_Consumer_Cleanup (void)
     printf("\n\n");
 }
 
+#define MY_SHM_NAME "/ringtab_test_shm"
+#define MY_SHM_DEPTH 256
+#define MY_SHM_COUNT 1000000
+
+typedef struct {
+    uint64_t seq;
+    uint64_t ts; /* CLOCK_MONOTONIC ns at produce */
+    char payload[48];
+} my_frame_t;
+
+static uint64_t
+my_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+ringtab_shm_producer(void)
+{
+    ringtab_shm_t *shm;
+    my_frame_t *frame;
+    uint64_t i;
+
+    /* the parent created it before fork, attach like an unrelated process */
+    shm = ringtab_shm_attach(MY_SHM_NAME);
+    if (shm == NULL) {
+        perror("ringtab_shm_attach");
+        exit(1);
+    }
+
+    for (i = 0; i < MY_SHM_COUNT; i++) {
+        frame = ringtab_shm_put_begin(shm, -1);
+        frame->seq = i;
+        frame->payload[0] = (char)i;
+        frame->ts = my_now_ns();
+        ringtab_shm_put_commit(shm);
+    }
+
+    ringtab_shm_detach(shm);
+    exit(0);
+}
+
+void
+ringtab_test_shm(void)
+{
+    ringtab_shm_t *shm;
+    my_frame_t *frame;
+    pid_t pid;
+    uint64_t i, lat, lat_sum = 0, lat_max = 0, start, cost;
+    int status, errors = 0;
+
+    printf("\n********************* in %s *************************",
+           __FUNCTION__);
+
+    ringtab_shm_unlink(MY_SHM_NAME);
+    shm = ringtab_shm_create(MY_SHM_NAME, MY_SHM_DEPTH, sizeof(my_frame_t));
+    if (shm == NULL) {
+        perror("ringtab_shm_create");
+        return;
+    }
+
+    frame = ringtab_shm_get_begin(shm, 10);
+    printf("\nringtab_shm_get_begin() on empty table: %s",
+           frame == NULL ? "timeout" : "---- ERROR!");
+
+    start = my_now_ns();
+    pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        ringtab_shm_producer();
+    }
+
+    for (i = 0; i < MY_SHM_COUNT; i++) {
+        frame = ringtab_shm_get_begin(shm, 5000);
+        if (frame == NULL) {
+            printf("\nringtab_shm_get_begin(): timeout at %lu ---- ERROR!", i);
+            errors++;
+            break;
+        }
+        lat = my_now_ns() - frame->ts;
+        lat_sum += lat;
+        if (lat > lat_max) {
+            lat_max = lat;
+        }
+        if (frame->seq != i || frame->payload[0] != (char)i) {
+            errors++;
+        }
+        ringtab_shm_get_commit(shm);
+    }
+    cost = my_now_ns() - start;
+
+    waitpid(pid, &status, 0);
+    printf("\n%lu frames of %zu bytes through %d-item table: %.2f Mframes/s",
+           i, sizeof(my_frame_t), MY_SHM_DEPTH,
+           i * 1000.0 / (cost ? cost : 1));
+    printf("\nlatency avg=%luns max=%luns",
+           i ? lat_sum / i : 0, lat_max);
+    printf("\nsequence errors=%d%s", errors, errors ? " ---- ERROR!" : "");
+
+    ringtab_shm_detach(shm);
+    ringtab_shm_unlink(MY_SHM_NAME);
+    printf("\n\n");
+}
+
 int
 main (int argc, char *const argv[])
 {
@@ -383,5 +498,6 @@ main (int argc, char *const argv[])
     ringtab_test_2();
     ringtab_test_Producer_Consumer();
     ringtab_test_Producer_Consumer_Cleanup();
+    ringtab_test_shm();
     return(0);
 }
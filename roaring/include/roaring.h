@@ -0,0 +1,92 @@
+/*
+ * roaring.h - compressed bitmap
+ *
+ * Date   : 2021/04/30
+ */
+#ifndef __ROARING_H__
+#define __ROARING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Roaring bitmap of uint32_t: the high 16 bits pick a chunk, each chunk
+ * keeps its low 16 bits in the smallest of three containers:
+ *  - array, sorted uint16_t, up to 4096 values
+ *  - bitset, 65536 bits
+ *  - run, sorted [start, start + len] ranges
+ * add/remove switch between array and bitset at 4096 values, runs come
+ * from add_range, the set operations and roaring_optimize.
+ */
+typedef struct roaring roaring_t;
+
+typedef struct roaring_iter {
+    const roaring_t *r;
+    uint32_t chunk; // container index
+    uint32_t pos;   // array index, bitset word, run index
+    uint32_t off;   // run offset
+    uint64_t word;  // bitset bits left in word pos
+} roaring_iter_t;
+
+roaring_t *roaring_create(void);
+void roaring_destroy(roaring_t *r);
+roaring_t *roaring_copy(const roaring_t *r);
+
+/// @return 1-added, 0-already in, -ENOMEM
+int roaring_add(roaring_t *r, uint32_t x);
+/// [start, end)
+/// @return 0-ok, -ENOMEM
+int roaring_add_range(roaring_t *r, uint32_t start, uint64_t end);
+/// @return 1-removed, 0-not in
+int roaring_remove(roaring_t *r, uint32_t x);
+int roaring_contains(const roaring_t *r, uint32_t x);
+uint64_t roaring_count(const roaring_t *r);
+/// @return 1-same values
+int roaring_equal(const roaring_t *a, const roaring_t *b);
+
+/// turn chunks into runs where that is smaller, and back
+/// @return 0-ok, -ENOMEM
+int roaring_optimize(roaring_t *r);
+
+/// new bitmaps, NULL if out of memory
+roaring_t *roaring_or(const roaring_t *a, const roaring_t *b);
+roaring_t *roaring_and(const roaring_t *a, const roaring_t *b);
+/// a and not b
+roaring_t *roaring_andnot(const roaring_t *a, const roaring_t *b);
+uint64_t roaring_and_count(const roaring_t *a, const roaring_t *b);
+
+/// @return values <= x
+uint64_t roaring_rank(const roaring_t *r, uint32_t x);
+/// @param rank 0 for the smallest value
+/// @return 0-ok, -1-rank >= count
+int roaring_select(const roaring_t *r, uint64_t rank, uint32_t *x);
+
+/// ascending, the bitmap must not change meanwhile
+void roaring_iter_init(const roaring_t *r, roaring_iter_t *it);
+/// @return 1-x set, 0-end
+int roaring_iter_next(roaring_iter_t *it, uint32_t *x);
+/// @param out room for roaring_count values
+/// @return values written
+size_t roaring_to_array(const roaring_t *r, uint32_t *out);
+
+/// the portable format of the Roaring spec (CRoaring, Java, Go read it)
+size_t roaring_serialize_size(const roaring_t *r);
+/// @param buf room for roaring_serialize_size bytes
+/// @return bytes written
+size_t roaring_serialize(const roaring_t *r, void *buf);
+/// @param used optional, bytes read
+/// @return NULL if malformed, truncated or out of memory
+roaring_t *roaring_deserialize(const void *buf, size_t len, size_t *used);
+
+/// bytes allocated
+size_t roaring_memory(const roaring_t *r);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
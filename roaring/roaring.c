@@ -0,0 +1,1667 @@
+/*
+ * roaring.c - compressed bitmap
+ *
+ * Date   : 2021/04/30
+ */
+
+#include "roaring.h"
+#include "bitops.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RC_ARRAY 1
+#define RC_BITSET 2
+#define RC_RUN 3
+
+#define RC_BITS 65536
+#define RC_LONGS BITS_TO_LONGS(RC_BITS)
+#define RC_ARRAY_MAX 4096 // more values take more room than a bitset
+#define RC_TOP_BIT (1UL << (BITS_PER_LONG - 1))
+
+// portable format
+#define SERIAL_COOKIE_NO_RUNCONTAINER 12346
+#define SERIAL_COOKIE 12347
+#define NO_OFFSET_THRESHOLD 4
+#define SERIAL_BITSET_BYTES (RC_BITS / 8)
+
+typedef struct rc_run {
+    uint16_t start;
+    uint16_t len; // start..start + len
+} rc_run_t;
+
+// container
+typedef struct rc {
+    uint32_t type;
+    uint32_t card;
+    uint32_t n;   // array values, runs
+    uint32_t cap; // array/run slots
+    union {
+        uint16_t *a;
+        unsigned long *b;
+        rc_run_t *r;
+        void *p;
+    };
+} rc_t;
+
+struct roaring {
+    uint32_t n;
+    uint32_t cap;
+    uint16_t *keys; // sorted, searched apart from the containers
+    rc_t *c;
+};
+
+static inline uint32_t
+rc_run_end(const rc_run_t *r)
+{
+    return (uint32_t)r->start + r->len;
+}
+
+static void
+rc_free(rc_t *c)
+{
+    free(c->p);
+    memset(c, 0, sizeof(*c));
+}
+
+static int
+rc_reserve(rc_t *c, uint32_t n)
+{
+    size_t size = RC_RUN == c->type ? sizeof(rc_run_t) : sizeof(uint16_t);
+    uint32_t cap = c->cap ? c->cap : 4;
+    void *p;
+
+    if (n <= c->cap)
+        return 0;
+    while (cap < n)
+        cap *= 2;
+    p = realloc(c->p, cap * size);
+    if (!p)
+        return -ENOMEM;
+    c->p   = p;
+    c->cap = cap;
+    return 0;
+}
+
+static int
+rc_init(rc_t *c, uint32_t type, uint32_t cap)
+{
+    memset(c, 0, sizeof(*c));
+    c->type = type;
+    if (RC_BITSET == type) {
+        c->b = (unsigned long *)calloc(RC_LONGS, sizeof(unsigned long));
+        return c->b ? 0 : -ENOMEM;
+    }
+    return rc_reserve(c, cap ? cap : 1);
+}
+
+static int
+rc_clone(const rc_t *src, rc_t *dst)
+{
+    size_t size;
+
+    *dst = *src;
+    if (RC_BITSET == src->type)
+        size = RC_LONGS * sizeof(unsigned long);
+    else
+        size = src->cap * (RC_RUN == src->type ? sizeof(rc_run_t) : sizeof(uint16_t));
+    dst->p = malloc(size);
+    if (!dst->p)
+        return -ENOMEM;
+    memcpy(dst->p, src->p, size);
+    return 0;
+}
+
+// index of v, -(insert point) - 1 if not in
+static inline int32_t
+rc_array_find(const uint16_t *a, uint32_t n, uint16_t v)
+{
+    int32_t lo = 0, hi = (int32_t)n - 1, mid;
+
+    while (lo <= hi) {
+        mid = (lo + hi) >> 1;
+        if (a[mid] < v)
+            lo = mid + 1;
+        else if (a[mid] > v)
+            hi = mid - 1;
+        else
+            return mid;
+    }
+    return -lo - 1;
+}
+
+// the last run starting at or before v, -1 if none
+static inline int32_t
+rc_run_find(const rc_run_t *r, uint32_t n, uint16_t v)
+{
+    int32_t lo = 0, hi = (int32_t)n - 1, mid;
+
+    while (lo <= hi) {
+        mid = (lo + hi) >> 1;
+        if (r[mid].start <= v)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return lo - 1;
+}
+
+static int
+rc_contains(const rc_t *c, uint16_t v)
+{
+    int32_t i;
+
+    switch (c->type) {
+    case RC_ARRAY:
+        return rc_array_find(c->a, c->n, v) >= 0;
+    case RC_BITSET:
+        return test_bit(v, c->b);
+    default:
+        i = rc_run_find(c->r, c->n, v);
+        return i >= 0 && v <= rc_run_end(&c->r[i]);
+    }
+}
+
+static uint32_t
+rc_count_runs(const rc_t *c)
+{
+    unsigned long w, carry = 0;
+    uint32_t i, n = 0;
+
+    switch (c->type) {
+    case RC_ARRAY:
+        for (i = 0; i < c->n; i++)
+            n += 0 == i || c->a[i] != c->a[i - 1] + 1;
+        return n;
+    case RC_BITSET:
+        // a run starts at each set bit whose lower neighbour is clear
+        for (i = 0; i < RC_LONGS; i++) {
+            w = c->b[i];
+            n += (uint32_t)__builtin_popcountl(w & ~((w << 1) | carry));
+            carry = w >> (BITS_PER_LONG - 1);
+        }
+        return n;
+    default:
+        return c->n;
+    }
+}
+
+static int
+rc_to_bitset(rc_t *c)
+{
+    unsigned long *b = (unsigned long *)calloc(RC_LONGS, sizeof(unsigned long));
+    uint32_t i;
+
+    if (!b)
+        return -ENOMEM;
+    if (RC_ARRAY == c->type) {
+        for (i = 0; i < c->n; i++)
+            set_bit(c->a[i], b);
+    } else {
+        for (i = 0; i < c->n; i++)
+            bitmap_long_set(b, c->r[i].start, c->r[i].len + 1u);
+    }
+    free(c->p);
+    c->b    = b;
+    c->type = RC_BITSET;
+    c->n = c->cap = 0;
+    return 0;
+}
+
+// card <= RC_ARRAY_MAX
+static int
+rc_to_array(rc_t *c)
+{
+    uint16_t *a = (uint16_t *)malloc((c->card ? c->card : 1) * sizeof(uint16_t));
+    uint32_t i, j, n = 0;
+    unsigned long w;
+
+    if (!a)
+        return -ENOMEM;
+    if (RC_BITSET == c->type) {
+        for (i = 0; i < RC_LONGS; i++) {
+            for (w = c->b[i]; w; w &= w - 1)
+                a[n++] = (uint16_t)(i * BITS_PER_LONG + (uint32_t)__builtin_ctzl(w));
+        }
+    } else {
+        for (i = 0; i < c->n; i++) {
+            for (j = c->r[i].start; j <= rc_run_end(&c->r[i]); j++)
+                a[n++] = (uint16_t)j;
+        }
+    }
+    free(c->p);
+    c->a    = a;
+    c->type = RC_ARRAY;
+    c->n    = n;
+    c->cap  = c->card ? c->card : 1;
+    return 0;
+}
+
+static int
+rc_to_run(rc_t *c, uint32_t nruns)
+{
+    rc_run_t *r = (rc_run_t *)malloc((nruns ? nruns : 1) * sizeof(rc_run_t));
+    size_t i, j;
+    uint32_t n = 0;
+
+    if (!r)
+        return -ENOMEM;
+    if (RC_ARRAY == c->type) {
+        for (i = 0; i < c->n; i++) {
+            if (n && c->a[i] == rc_run_end(&r[n - 1]) + 1) {
+                r[n - 1].len++;
+            } else {
+                r[n].start = c->a[i];
+                r[n++].len = 0;
+            }
+        }
+    } else {
+        for (i = find_first_bit(c->b, RC_BITS); i < RC_BITS;
+             i = find_next_bit(c->b, RC_BITS, j)) {
+            j          = find_next_zero_bit(c->b, RC_BITS, i);
+            r[n].start = (uint16_t)i;
+            r[n++].len = (uint16_t)(j - i - 1);
+        }
+    }
+    free(c->p);
+    c->r    = r;
+    c->type = RC_RUN;
+    c->n = n;
+    c->cap  = nruns ? nruns : 1;
+    return 0;
+}
+
+// the smallest of the three, sizes as serialized
+static uint32_t
+rc_best(uint32_t card, uint32_t nruns)
+{
+    uint32_t run = 2 + 4 * nruns;
+    uint32_t other = card <= RC_ARRAY_MAX ? 2 * card : SERIAL_BITSET_BYTES;
+
+    if (run < other)
+        return RC_RUN;
+    return card <= RC_ARRAY_MAX ? RC_ARRAY : RC_BITSET;
+}
+
+static int
+rc_convert(rc_t *c, uint32_t type, uint32_t nruns)
+{
+    if (type == c->type)
+        return 0;
+    switch (type) {
+    case RC_ARRAY:
+        return rc_to_array(c);
+    case RC_BITSET:
+        return rc_to_bitset(c);
+    default:
+        return rc_to_run(c, nruns);
+    }
+}
+
+// the conversions are best effort: a bitset may be left with few values,
+// the serializer goes by the count
+static int
+rc_optimize(rc_t *c)
+{
+    uint32_t nruns = rc_count_runs(c);
+    return rc_convert(c, rc_best(c->card, nruns), nruns);
+}
+
+// array or bitset by the count, runs stay
+static int
+rc_normalize(rc_t *c)
+{
+    if (RC_BITSET == c->type && c->card <= RC_ARRAY_MAX)
+        return rc_to_array(c);
+    if (RC_ARRAY == c->type && c->card > RC_ARRAY_MAX)
+        return rc_to_bitset(c);
+    return 0;
+}
+
+// a run container after a change, n is its run count
+static int
+rc_run_check(rc_t *c)
+{
+    uint32_t type = rc_best(c->card, c->n);
+    return RC_RUN == type ? 0 : rc_convert(c, type, c->n);
+}
+
+// @return 1-added, 0-in, -ENOMEM
+static int
+rc_add(rc_t *c, uint16_t v)
+{
+    rc_run_t *r;
+    int32_t i;
+
+    switch (c->type) {
+    case RC_ARRAY:
+        i = rc_array_find(c->a, c->n, v);
+        if (i >= 0)
+            return 0;
+        if (c->n >= RC_ARRAY_MAX) {
+            if (rc_to_bitset(c))
+                return -ENOMEM;
+            return rc_add(c, v);
+        }
+        if (rc_reserve(c, c->n + 1))
+            return -ENOMEM;
+        i = -i - 1;
+        memmove(c->a + i + 1, c->a + i, (c->n - i) * sizeof(uint16_t));
+        c->a[i] = v;
+        c->n++;
+        break;
+
+    case RC_BITSET:
+        if (test_bit(v, c->b))
+            return 0;
+        set_bit(v, c->b);
+        break;
+
+    default:
+        i = rc_run_find(c->r, c->n, v);
+        r = c->r;
+        if (i >= 0 && v <= rc_run_end(&r[i]))
+            return 0;
+        if (i >= 0 && v == rc_run_end(&r[i]) + 1) {
+            r[i].len++;
+            if (i + 1 < (int32_t)c->n && r[i + 1].start == v + 1) {
+                r[i].len += r[i + 1].len + 1;
+                memmove(r + i + 1, r + i + 2, (c->n - i - 2) * sizeof(rc_run_t));
+                c->n--;
+            }
+        } else if (i + 1 < (int32_t)c->n && r[i + 1].start == v + 1) {
+            r[i + 1].start--;
+            r[i + 1].len++;
+        } else {
+            if (rc_reserve(c, c->n + 1))
+                return -ENOMEM;
+            r = c->r;
+            memmove(r + i + 2, r + i + 1, (c->n - i - 1) * sizeof(rc_run_t));
+            r[i + 1].start = v;
+            r[i + 1].len   = 0;
+            c->n++;
+        }
+        c->card++;
+        rc_run_check(c); // a failure leaves the runs
+        return 1;
+    }
+    c->card++;
+    return 1;
+}
+
+// @return 1-removed, 0-not in, -ENOMEM
+static int
+rc_remove(rc_t *c, uint16_t v)
+{
+    rc_run_t *r;
+    uint32_t end;
+    int32_t i;
+
+    switch (c->type) {
+    case RC_ARRAY:
+        i = rc_array_find(c->a, c->n, v);
+        if (i < 0)
+            return 0;
+        memmove(c->a + i, c->a + i + 1, (c->n - i - 1) * sizeof(uint16_t));
+        c->n--;
+        c->card--;
+        return 1;
+
+    case RC_BITSET:
+        if (!test_bit(v, c->b))
+            return 0;
+        clear_bit(v, c->b);
+        if (--c->card <= RC_ARRAY_MAX)
+            rc_to_array(c); // a failure leaves the bitset
+        return 1;
+
+    default:
+        i = rc_run_find(c->r, c->n, v);
+        if (i < 0 || v > rc_run_end(&c->r[i]))
+            return 0;
+        r   = &c->r[i];
+        end = rc_run_end(r);
+        if (0 == r->len) {
+            memmove(r, r + 1, (c->n - i - 1) * sizeof(rc_run_t));
+            c->n--;
+        } else if (v == r->start) {
+            r->start++;
+            r->len--;
+        } else if (v == end) {
+            r->len--;
+        } else {
+            if (rc_reserve(c, c->n + 1))
+                return -ENOMEM;
+            r = &c->r[i];
+            memmove(r + 2, r + 1, (c->n - i - 1) * sizeof(rc_run_t));
+            r->len         = (uint16_t)(v - r->start - 1);
+            r[1].start     = (uint16_t)(v + 1);
+            r[1].len       = (uint16_t)(end - v - 1);
+            c->n++;
+        }
+        c->card--;
+        rc_run_check(c);
+        return 1;
+    }
+}
+
+// [lo, hi]
+static int
+rc_add_range(rc_t *c, uint32_t lo, uint32_t hi)
+{
+    rc_run_t *r;
+    uint32_t i, j, k, s, e, removed = 0;
+
+    if (RC_BITSET == c->type) {
+        bitmap_long_set(c->b, lo, hi - lo + 1);
+        c->card = (uint32_t)bitmap_long_weight(c->b, RC_BITS);
+        return 0;
+    }
+    if (RC_ARRAY == c->type && rc_to_run(c, rc_count_runs(c)))
+        return -ENOMEM;
+    if (rc_reserve(c, c->n + 1))
+        return -ENOMEM;
+
+    // runs i..j-1 touch [lo, hi] and become one
+    r = c->r;
+    for (i = 0; i < c->n && rc_run_end(&r[i]) + 1 < lo; i++)
+        ;
+    for (j = i; j < c->n && r[j].start <= hi + 1; j++)
+        ;
+    s = lo;
+    e = hi;
+    if (i < j) {
+        s = r[i].start < lo ? r[i].start : lo;
+        e = rc_run_end(&r[j - 1]) > hi ? rc_run_end(&r[j - 1]) : hi;
+        for (k = i; k < j; k++)
+            removed += r[k].len + 1u;
+        memmove(r + i + 1, r + j, (c->n - j) * sizeof(rc_run_t));
+        c->n -= j - i - 1;
+    } else {
+        memmove(r + i + 1, r + i, (c->n - i) * sizeof(rc_run_t));
+        c->n++;
+    }
+    r[i].start = (uint16_t)s;
+    r[i].len   = (uint16_t)(e - s);
+    c->card    = c->card - removed + (e - s + 1);
+    rc_optimize(c);
+    return 0;
+}
+
+// run container as array/bitset, for the set operations
+static int
+rc_materialize(const rc_t *src, rc_t *tmp)
+{
+    if (rc_clone(src, tmp))
+        return -ENOMEM;
+    if (tmp->card <= RC_ARRAY_MAX ? rc_to_array(tmp) : rc_to_bitset(tmp)) {
+        rc_free(tmp);
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+static void
+rc_bitset_card(rc_t *c)
+{
+    c->card = (uint32_t)bitmap_long_weight(c->b, RC_BITS);
+}
+
+static int
+rc_run_or(const rc_t *a, const rc_t *b, rc_t *out)
+{
+    const rc_run_t *cur;
+    rc_run_t *last;
+    uint32_t i = 0, j = 0;
+
+    if (rc_init(out, RC_RUN, a->n + b->n))
+        return -ENOMEM;
+    while (i < a->n || j < b->n) {
+        if (j >= b->n || (i < a->n && a->r[i].start <= b->r[j].start))
+            cur = &a->r[i++];
+        else
+            cur = &b->r[j++];
+        last = out->n ? &out->r[out->n - 1] : NULL;
+        if (last && cur->start <= rc_run_end(last) + 1) {
+            if (rc_run_end(cur) > rc_run_end(last))
+                last->len = (uint16_t)(rc_run_end(cur) - last->start);
+        } else {
+            out->r[out->n++] = *cur;
+        }
+    }
+    for (i = 0; i < out->n; i++)
+        out->card += out->r[i].len + 1u;
+    rc_optimize(out);
+    return 0;
+}
+
+static int
+rc_run_and(const rc_t *a, const rc_t *b, rc_t *out)
+{
+    uint32_t i = 0, j = 0, s, e, ae, be;
+
+    if (rc_init(out, RC_RUN, a->n + b->n))
+        return -ENOMEM;
+    while (i < a->n && j < b->n) {
+        ae = rc_run_end(&a->r[i]);
+        be = rc_run_end(&b->r[j]);
+        s  = a->r[i].start > b->r[j].start ? a->r[i].start : b->r[j].start;
+        e  = ae < be ? ae : be;
+        if (s <= e) {
+            out->r[out->n].start   = (uint16_t)s;
+            out->r[out->n++].len   = (uint16_t)(e - s);
+            out->card             += e - s + 1;
+        }
+        if (ae < be)
+            i++;
+        else
+            j++;
+    }
+    if (out->card)
+        rc_optimize(out);
+    return 0;
+}
+
+static int
+rc_run_andnot(const rc_t *a, const rc_t *b, rc_t *out)
+{
+    uint32_t i, j = 0, k, s, e;
+
+    if (rc_init(out, RC_RUN, a->n + b->n))
+        return -ENOMEM;
+    for (i = 0; i < a->n; i++) {
+        s = a->r[i].start;
+        e = rc_run_end(&a->r[i]);
+        // b runs before this one are before the next ones too
+        while (j < b->n && rc_run_end(&b->r[j]) < s)
+            j++;
+        for (k = j; k < b->n && b->r[k].start <= e && s <= e; k++) {
+            if (b->r[k].start > s) {
+                out->r[out->n].start = (uint16_t)s;
+                out->r[out->n++].len = (uint16_t)(b->r[k].start - 1 - s);
+                out->card += b->r[k].start - s;
+            }
+            if (rc_run_end(&b->r[k]) + 1 > s)
+                s = rc_run_end(&b->r[k]) + 1;
+        }
+        if (s <= e) {
+            out->r[out->n].start = (uint16_t)s;
+            out->r[out->n++].len = (uint16_t)(e - s);
+            out->card += e - s + 1;
+        }
+    }
+    if (out->card)
+        rc_optimize(out);
+    return 0;
+}
+
+// an array or a bitset holding words
+static int
+rc_from_words(rc_t *out, const unsigned long *words)
+{
+    uint32_t i, n = 0, card = (uint32_t)bitmap_long_weight(words, RC_BITS);
+    unsigned long w;
+    uint16_t *a;
+
+    if (card > RC_ARRAY_MAX) {
+        if (rc_init(out, RC_BITSET, 0))
+            return -ENOMEM;
+        memcpy(out->b, words, RC_LONGS * sizeof(unsigned long));
+        out->card = card;
+        return 0;
+    }
+    // one spare slot, the first two bits of a word are taken without a
+    // branch on whether they exist, sparse words would mispredict
+    if (rc_init(out, RC_ARRAY, card + 1))
+        return -ENOMEM;
+    a = out->a;
+    for (i = 0; i < RC_LONGS; i++) {
+        w    = words[i];
+        a[n] = (uint16_t)(i * BITS_PER_LONG + (uint32_t)__builtin_ctzl(w | RC_TOP_BIT));
+        n += 0 != w;
+        w &= w - 1;
+        a[n] = (uint16_t)(i * BITS_PER_LONG + (uint32_t)__builtin_ctzl(w | RC_TOP_BIT));
+        n += 0 != w;
+        w &= w - 1;
+        for (; w; w &= w - 1)
+            a[n++] = (uint16_t)(i * BITS_PER_LONG + (uint32_t)__builtin_ctzl(w));
+    }
+    out->n = out->card = card;
+    return 0;
+}
+
+// the merges don't branch on the values, the loops are short for a predictor
+static uint32_t
+array_or(const uint16_t *a, uint32_t na, const uint16_t *b, uint32_t nb, uint16_t *out)
+{
+    uint32_t i = 0, j = 0, n = 0;
+    uint16_t va, vb;
+
+    while (i < na && j < nb) {
+        va       = a[i];
+        vb       = b[j];
+        out[n++] = va < vb ? va : vb;
+        i += va <= vb;
+        j += vb <= va;
+    }
+    memcpy(out + n, a + i, (na - i) * sizeof(uint16_t));
+    n += na - i;
+    memcpy(out + n, b + j, (nb - j) * sizeof(uint16_t));
+    return n + nb - j;
+}
+
+static uint32_t
+array_and(const uint16_t *a, uint32_t na, const uint16_t *b, uint32_t nb, uint16_t *out)
+{
+    uint32_t i = 0, j = 0, n = 0;
+    uint16_t va, vb;
+
+    while (i < na && j < nb) {
+        va     = a[i];
+        vb     = b[j];
+        out[n] = va;
+        n += va == vb;
+        i += va <= vb;
+        j += vb <= va;
+    }
+    return n;
+}
+
+static uint32_t
+array_andnot(const uint16_t *a, uint32_t na, const uint16_t *b, uint32_t nb, uint16_t *out)
+{
+    uint32_t i = 0, j = 0, n = 0;
+    uint16_t va, vb;
+
+    while (i < na && j < nb) {
+        va     = a[i];
+        vb     = b[j];
+        out[n] = va;
+        n += va < vb;
+        i += va <= vb;
+        j += vb <= va;
+    }
+    memcpy(out + n, a + i, (na - i) * sizeof(uint16_t));
+    return n + na - i;
+}
+
+static int
+rc_or(const rc_t *a, const rc_t *b, rc_t *out)
+{
+    const rc_t *t;
+    rc_t tmp;
+    uint32_t i;
+    int ret;
+
+    if (RC_RUN == a->type && RC_RUN == b->type)
+        return rc_run_or(a, b, out);
+    if (RC_RUN == a->type || RC_RUN == b->type) {
+        if (RC_RUN == b->type) {
+            t = a;
+            a = b;
+            b = t;
+        }
+        if (RC_BITS == a->card)
+            return rc_clone(a, out);
+        if (rc_materialize(a, &tmp))
+            return -ENOMEM;
+        ret = rc_or(&tmp, b, out);
+        rc_free(&tmp);
+        return ret;
+    }
+
+    if (RC_ARRAY == a->type && RC_ARRAY == b->type) {
+        if (a->card + b->card > RC_ARRAY_MAX) {
+            if (rc_init(out, RC_BITSET, 0))
+                return -ENOMEM;
+            for (i = 0; i < a->n; i++)
+                set_bit(a->a[i], out->b);
+            for (i = 0; i < b->n; i++)
+                set_bit(b->a[i], out->b);
+            rc_bitset_card(out);
+            rc_normalize(out);
+            return 0;
+        }
+        if (rc_init(out, RC_ARRAY, a->n + b->n))
+            return -ENOMEM;
+        out->n = out->card = array_or(a->a, a->n, b->a, b->n, out->a);
+        return 0;
+    }
+
+    if (RC_BITSET != a->type) {
+        t = a;
+        a = b;
+        b = t;
+    }
+    if (RC_BITSET == b->type) {
+        if (rc_init(out, RC_BITSET, 0))
+            return -ENOMEM;
+        bitmap_long_or(out->b, a->b, b->b, RC_BITS);
+        rc_bitset_card(out);
+        return 0;
+    }
+    if (rc_clone(a, out))
+        return -ENOMEM;
+    for (i = 0; i < b->n; i++) {
+        if (!test_bit(b->a[i], out->b)) {
+            set_bit(b->a[i], out->b);
+            out->card++;
+        }
+    }
+    return 0;
+}
+
+static int
+rc_and(const rc_t *a, const rc_t *b, rc_t *out)
+{
+    unsigned long words[RC_LONGS];
+    const rc_t *t;
+    uint32_t i;
+
+    if (RC_RUN == a->type && RC_RUN == b->type)
+        return rc_run_and(a, b, out);
+
+    if (RC_ARRAY == b->type) {
+        t = a;
+        a = b;
+        b = t;
+    }
+    if (RC_ARRAY == a->type) {
+        if (rc_init(out, RC_ARRAY, a->n))
+            return -ENOMEM;
+        if (RC_ARRAY == b->type) {
+            out->n = array_and(a->a, a->n, b->a, b->n, out->a);
+        } else {
+            for (i = 0; i < a->n; i++) {
+                out->a[out->n] = a->a[i];
+                out->n += rc_contains(b, a->a[i]);
+            }
+        }
+        out->card = out->n;
+        return 0;
+    }
+
+    // bitset and bitset/run
+    if (RC_RUN == a->type) {
+        t = a;
+        a = b;
+        b = t;
+    }
+    if (RC_RUN == b->type) {
+        memset(words, 0, sizeof(words));
+        for (i = 0; i < b->n; i++)
+            bitmap_long_set(words, b->r[i].start, b->r[i].len + 1u);
+        bitmap_long_and(words, words, a->b, RC_BITS);
+    } else {
+        bitmap_long_and(words, a->b, b->b, RC_BITS);
+    }
+    return rc_from_words(out, words);
+}
+
+// bitsets and runs, no container built
+static uint32_t
+rc_and_card(const rc_t *a, const rc_t *b)
+{
+    unsigned long words[RC_LONGS];
+    rc_t c;
+    uint32_t card;
+
+    if (RC_BITSET == a->type && RC_BITSET == b->type) {
+        bitmap_long_and(words, a->b, b->b, RC_BITS);
+        return (uint32_t)bitmap_long_weight(words, RC_BITS);
+    }
+    if (rc_and(a, b, &c))
+        return 0;
+    card = c.card;
+    rc_free(&c);
+    return card;
+}
+
+static int
+rc_andnot(const rc_t *a, const rc_t *b, rc_t *out)
+{
+    unsigned long words[RC_LONGS];
+    rc_t tmp;
+    uint32_t i;
+    int ret;
+
+    switch (a->type) {
+    case RC_ARRAY:
+        if (rc_init(out, RC_ARRAY, a->n))
+            return -ENOMEM;
+        if (RC_ARRAY == b->type) {
+            out->n = array_andnot(a->a, a->n, b->a, b->n, out->a);
+        } else {
+            for (i = 0; i < a->n; i++) {
+                out->a[out->n] = a->a[i];
+                out->n += !rc_contains(b, a->a[i]);
+            }
+        }
+        out->card = out->n;
+        return 0;
+
+    case RC_RUN:
+        if (RC_RUN == b->type)
+            return rc_run_andnot(a, b, out);
+        if (rc_materialize(a, &tmp))
+            return -ENOMEM;
+        ret = rc_andnot(&tmp, b, out);
+        rc_free(&tmp);
+        return ret;
+
+    default:
+        if (RC_BITSET == b->type) {
+            bitmap_long_andnot(words, a->b, b->b, RC_BITS);
+        } else {
+            memcpy(words, a->b, sizeof(words));
+            if (RC_ARRAY == b->type) {
+                for (i = 0; i < b->n; i++)
+                    clear_bit(b->a[i], words);
+            } else {
+                for (i = 0; i < b->n; i++)
+                    bitmap_long_clear(words, b->r[i].start, b->r[i].len + 1u);
+            }
+        }
+        return rc_from_words(out, words);
+    }
+}
+
+// values <= v
+static uint32_t
+rc_rank(const rc_t *c, uint16_t v)
+{
+    uint32_t i, n = 0;
+    int32_t k;
+
+    switch (c->type) {
+    case RC_ARRAY:
+        k = rc_array_find(c->a, c->n, v);
+        return k >= 0 ? (uint32_t)k + 1 : (uint32_t)(-k - 1);
+    case RC_BITSET:
+        return (uint32_t)bitmap_long_weight(c->b, (size_t)v + 1);
+    default:
+        for (i = 0; i < c->n && c->r[i].start <= v; i++)
+            n += (v < rc_run_end(&c->r[i]) ? v - c->r[i].start : c->r[i].len) + 1u;
+        return n;
+    }
+}
+
+// rank < card
+static uint16_t
+rc_select(const rc_t *c, uint32_t rank)
+{
+    unsigned long w;
+    uint32_t i, k;
+
+    switch (c->type) {
+    case RC_ARRAY:
+        return c->a[rank];
+    case RC_BITSET:
+        for (i = 0;; i++) {
+            w = c->b[i];
+            k = (uint32_t)__builtin_popcountl(w);
+            if (rank < k)
+                break;
+            rank -= k;
+        }
+        while (rank--)
+            w &= w - 1;
+        return (uint16_t)(i * BITS_PER_LONG + (uint32_t)__builtin_ctzl(w));
+    default:
+        for (i = 0; rank > c->r[i].len; i++)
+            rank -= c->r[i].len + 1u;
+        return (uint16_t)(c->r[i].start + rank);
+    }
+}
+
+//------------------------------------------------------------------------
+
+static int32_t
+ro_find(const roaring_t *r, uint16_t key)
+{
+    return rc_array_find(r->keys, r->n, key);
+}
+
+static int
+ro_reserve(roaring_t *r, uint32_t n)
+{
+    uint32_t cap = r->cap ? r->cap : 4;
+    uint16_t *keys;
+    rc_t *c;
+
+    if (n <= r->cap)
+        return 0;
+    while (cap < n)
+        cap *= 2;
+    keys = (uint16_t *)realloc(r->keys, cap * sizeof(uint16_t));
+    if (!keys)
+        return -ENOMEM;
+    r->keys = keys;
+    c       = (rc_t *)realloc(r->c, cap * sizeof(rc_t));
+    if (!c)
+        return -ENOMEM;
+    r->c   = c;
+    r->cap = cap;
+    return 0;
+}
+
+// an empty slot at i
+static rc_t *
+ro_insert_at(roaring_t *r, uint32_t i, uint16_t key)
+{
+    if (ro_reserve(r, r->n + 1))
+        return NULL;
+    memmove(r->keys + i + 1, r->keys + i, (r->n - i) * sizeof(uint16_t));
+    memmove(r->c + i + 1, r->c + i, (r->n - i) * sizeof(rc_t));
+    r->keys[i] = key;
+    memset(&r->c[i], 0, sizeof(rc_t));
+    r->n++;
+    return &r->c[i];
+}
+
+static void
+ro_remove_at(roaring_t *r, uint32_t i)
+{
+    rc_free(&r->c[i]);
+    memmove(r->keys + i, r->keys + i + 1, (r->n - i - 1) * sizeof(uint16_t));
+    memmove(r->c + i, r->c + i + 1, (r->n - i - 1) * sizeof(rc_t));
+    r->n--;
+}
+
+// takes c, room reserved before
+static void
+ro_append(roaring_t *r, uint16_t key, rc_t *c)
+{
+    if (0 == c->card) {
+        rc_free(c);
+        return;
+    }
+    r->keys[r->n] = key;
+    r->c[r->n++]  = *c;
+}
+
+roaring_t *
+roaring_create(void)
+{
+    return (roaring_t *)calloc(1, sizeof(roaring_t));
+}
+
+void
+roaring_destroy(roaring_t *r)
+{
+    uint32_t i;
+
+    if (!r)
+        return;
+    for (i = 0; i < r->n; i++)
+        rc_free(&r->c[i]);
+    free(r->keys);
+    free(r->c);
+    free(r);
+}
+
+roaring_t *
+roaring_copy(const roaring_t *r)
+{
+    roaring_t *dst = roaring_create();
+    rc_t c;
+    uint32_t i;
+
+    if (!dst || ro_reserve(dst, r->n))
+        goto fail;
+    for (i = 0; i < r->n; i++) {
+        if (rc_clone(&r->c[i], &c))
+            goto fail;
+        ro_append(dst, r->keys[i], &c);
+    }
+    return dst;
+
+fail:
+    roaring_destroy(dst);
+    return NULL;
+}
+
+int
+roaring_add(roaring_t *r, uint32_t x)
+{
+    int32_t i = ro_find(r, (uint16_t)(x >> 16));
+    rc_t *c;
+    int ret;
+
+    if (i >= 0)
+        return rc_add(&r->c[i], (uint16_t)x);
+
+    i = -i - 1;
+    c = ro_insert_at(r, (uint32_t)i, (uint16_t)(x >> 16));
+    if (!c || rc_init(c, RC_ARRAY, 4)) {
+        if (c)
+            ro_remove_at(r, (uint32_t)i);
+        return -ENOMEM;
+    }
+    ret = rc_add(c, (uint16_t)x);
+    if (ret < 0)
+        ro_remove_at(r, (uint32_t)i);
+    return ret;
+}
+
+int
+roaring_add_range(roaring_t *r, uint32_t start, uint64_t end)
+{
+    uint32_t key, lo, hi, last;
+    int32_t i;
+    rc_t *c;
+
+    if (end > (1ULL << 32))
+        end = 1ULL << 32;
+    if (start >= end)
+        return 0;
+
+    last = (uint32_t)((end - 1) >> 16);
+    for (key = start >> 16; key <= last; key++) {
+        lo = key == start >> 16 ? start & 0xFFFF : 0;
+        hi = key == last ? (uint32_t)(end - 1) & 0xFFFF : 0xFFFF;
+        i  = ro_find(r, (uint16_t)key);
+        if (i >= 0) {
+            if (rc_add_range(&r->c[i], lo, hi))
+                return -ENOMEM;
+            continue;
+        }
+
+        i = -i - 1;
+        c = ro_insert_at(r, (uint32_t)i, (uint16_t)key);
+        if (!c || rc_init(c, RC_RUN, 1)) {
+            if (c)
+                ro_remove_at(r, (uint32_t)i);
+            return -ENOMEM;
+        }
+        c->r[0].start = (uint16_t)lo;
+        c->r[0].len   = (uint16_t)(hi - lo);
+        c->n          = 1;
+        c->card       = hi - lo + 1;
+        rc_optimize(c);
+    }
+    return 0;
+}
+
+int
+roaring_remove(roaring_t *r, uint32_t x)
+{
+    int32_t i = ro_find(r, (uint16_t)(x >> 16));
+    int ret;
+
+    if (i < 0)
+        return 0;
+    ret = rc_remove(&r->c[i], (uint16_t)x);
+    if (0 == r->c[i].card)
+        ro_remove_at(r, (uint32_t)i);
+    return ret;
+}
+
+int
+roaring_contains(const roaring_t *r, uint32_t x)
+{
+    int32_t i = ro_find(r, (uint16_t)(x >> 16));
+    return i >= 0 && rc_contains(&r->c[i], (uint16_t)x);
+}
+
+uint64_t
+roaring_count(const roaring_t *r)
+{
+    uint64_t n = 0;
+    uint32_t i;
+
+    for (i = 0; i < r->n; i++)
+        n += r->c[i].card;
+    return n;
+}
+
+static int
+rc_equal(const rc_t *a, const rc_t *b)
+{
+    rc_t ta, tb;
+    int ret;
+
+    if (a->card != b->card)
+        return 0;
+    if (a->type == b->type) {
+        if (RC_BITSET == a->type)
+            return 0 == memcmp(a->b, b->b, RC_LONGS * sizeof(unsigned long));
+        return a->n == b->n
+               && 0 == memcmp(a->p, b->p, a->n * (RC_RUN == a->type ? sizeof(rc_run_t) : sizeof(uint16_t)));
+    }
+
+    // the same count: the same kind unless one is runs
+    if (rc_clone(a, &ta))
+        return 0;
+    if (rc_clone(b, &tb)) {
+        rc_free(&ta);
+        return 0;
+    }
+    ret = 0 == rc_to_bitset(&ta) && 0 == rc_to_bitset(&tb)
+          && 0 == memcmp(ta.b, tb.b, RC_LONGS * sizeof(unsigned long));
+    rc_free(&ta);
+    rc_free(&tb);
+    return ret;
+}
+
+int
+roaring_equal(const roaring_t *a, const roaring_t *b)
+{
+    uint32_t i;
+
+    if (a->n != b->n || memcmp(a->keys, b->keys, a->n * sizeof(uint16_t)))
+        return 0;
+    for (i = 0; i < a->n; i++) {
+        if (!rc_equal(&a->c[i], &b->c[i]))
+            return 0;
+    }
+    return 1;
+}
+
+int
+roaring_optimize(roaring_t *r)
+{
+    uint32_t i;
+
+    for (i = 0; i < r->n; i++) {
+        if (rc_optimize(&r->c[i]))
+            return -ENOMEM;
+    }
+    return 0;
+}
+
+roaring_t *
+roaring_or(const roaring_t *a, const roaring_t *b)
+{
+    roaring_t *r = roaring_create();
+    uint32_t i = 0, j = 0;
+    rc_t c;
+
+    if (!r || ro_reserve(r, a->n + b->n))
+        goto fail;
+    while (i < a->n || j < b->n) {
+        if (j >= b->n || (i < a->n && a->keys[i] < b->keys[j])) {
+            if (rc_clone(&a->c[i], &c))
+                goto fail;
+            ro_append(r, a->keys[i++], &c);
+        } else if (i >= a->n || b->keys[j] < a->keys[i]) {
+            if (rc_clone(&b->c[j], &c))
+                goto fail;
+            ro_append(r, b->keys[j++], &c);
+        } else {
+            if (rc_or(&a->c[i], &b->c[j], &c))
+                goto fail;
+            ro_append(r, a->keys[i], &c);
+            i++;
+            j++;
+        }
+    }
+    return r;
+
+fail:
+    roaring_destroy(r);
+    return NULL;
+}
+
+roaring_t *
+roaring_and(const roaring_t *a, const roaring_t *b)
+{
+    roaring_t *r = roaring_create();
+    uint32_t i = 0, j = 0;
+    rc_t c;
+
+    if (!r || ro_reserve(r, a->n < b->n ? a->n : b->n))
+        goto fail;
+    while (i < a->n && j < b->n) {
+        if (a->keys[i] < b->keys[j]) {
+            i++;
+        } else if (a->keys[i] > b->keys[j]) {
+            j++;
+        } else {
+            if (rc_and(&a->c[i], &b->c[j], &c))
+                goto fail;
+            ro_append(r, a->keys[i], &c);
+            i++;
+            j++;
+        }
+    }
+    return r;
+
+fail:
+    roaring_destroy(r);
+    return NULL;
+}
+
+roaring_t *
+roaring_andnot(const roaring_t *a, const roaring_t *b)
+{
+    roaring_t *r = roaring_create();
+    uint32_t i, j = 0;
+    rc_t c;
+
+    if (!r || ro_reserve(r, a->n))
+        goto fail;
+    for (i = 0; i < a->n; i++) {
+        while (j < b->n && b->keys[j] < a->keys[i])
+            j++;
+        if (j < b->n && b->keys[j] == a->keys[i]) {
+            if (rc_andnot(&a->c[i], &b->c[j], &c))
+                goto fail;
+        } else if (rc_clone(&a->c[i], &c)) {
+            goto fail;
+        }
+        ro_append(r, a->keys[i], &c);
+    }
+    return r;
+
+fail:
+    roaring_destroy(r);
+    return NULL;
+}
+
+uint64_t
+roaring_and_count(const roaring_t *a, const roaring_t *b)
+{
+    uint32_t i = 0, j = 0, k;
+    uint64_t n = 0;
+
+    while (i < a->n && j < b->n) {
+        if (a->keys[i] < b->keys[j]) {
+            i++;
+        } else if (a->keys[i] > b->keys[j]) {
+            j++;
+        } else {
+            // probe the array, no result built
+            if (RC_ARRAY == a->c[i].type || RC_ARRAY == b->c[j].type) {
+                const rc_t *x = RC_ARRAY == a->c[i].type ? &a->c[i] : &b->c[j];
+                const rc_t *y = x == &a->c[i] ? &b->c[j] : &a->c[i];
+                for (k = 0; k < x->n; k++)
+                    n += rc_contains(y, x->a[k]);
+            } else {
+                n += rc_and_card(&a->c[i], &b->c[j]);
+            }
+            i++;
+            j++;
+        }
+    }
+    return n;
+}
+
+uint64_t
+roaring_rank(const roaring_t *r, uint32_t x)
+{
+    uint16_t key = (uint16_t)(x >> 16);
+    uint64_t n   = 0;
+    uint32_t i;
+
+    for (i = 0; i < r->n && r->keys[i] < key; i++)
+        n += r->c[i].card;
+    if (i < r->n && r->keys[i] == key)
+        n += rc_rank(&r->c[i], (uint16_t)x);
+    return n;
+}
+
+int
+roaring_select(const roaring_t *r, uint64_t rank, uint32_t *x)
+{
+    uint32_t i;
+
+    for (i = 0; i < r->n; i++) {
+        if (rank < r->c[i].card) {
+            *x = (uint32_t)r->keys[i] << 16 | rc_select(&r->c[i], (uint32_t)rank);
+            return 0;
+        }
+        rank -= r->c[i].card;
+    }
+    return -1;
+}
+
+void
+roaring_iter_init(const roaring_t *r, roaring_iter_t *it)
+{
+    memset(it, 0, sizeof(*it));
+    it->r = r;
+}
+
+int
+roaring_iter_next(roaring_iter_t *it, uint32_t *x)
+{
+    const roaring_t *r = it->r;
+    const rc_t *c;
+    uint32_t hi;
+
+    while (it->chunk < r->n) {
+        c  = &r->c[it->chunk];
+        hi = (uint32_t)r->keys[it->chunk] << 16;
+        switch (c->type) {
+        case RC_ARRAY:
+            if (it->pos < c->n) {
+                *x = hi | c->a[it->pos++];
+                return 1;
+            }
+            break;
+        case RC_BITSET:
+            while (0 == it->word && it->pos < RC_LONGS)
+                it->word = c->b[it->pos++];
+            if (it->word) {
+                *x = hi | ((it->pos - 1) * BITS_PER_LONG + (uint32_t)__builtin_ctzl(it->word));
+                it->word &= it->word - 1;
+                return 1;
+            }
+            break;
+        default:
+            if (it->pos < c->n) {
+                *x = hi | (c->r[it->pos].start + it->off);
+                if (it->off++ == c->r[it->pos].len) {
+                    it->pos++;
+                    it->off = 0;
+                }
+                return 1;
+            }
+            break;
+        }
+        it->chunk++;
+        it->pos  = 0;
+        it->off  = 0;
+        it->word = 0;
+    }
+    return 0;
+}
+
+size_t
+roaring_to_array(const roaring_t *r, uint32_t *out)
+{
+    const rc_t *c;
+    unsigned long w;
+    uint32_t i, j, k, hi;
+    size_t n = 0;
+
+    for (i = 0; i < r->n; i++) {
+        c  = &r->c[i];
+        hi = (uint32_t)r->keys[i] << 16;
+        switch (c->type) {
+        case RC_ARRAY:
+            for (j = 0; j < c->n; j++)
+                out[n++] = hi | c->a[j];
+            break;
+        case RC_BITSET:
+            for (j = 0; j < RC_LONGS; j++) {
+                for (w = c->b[j]; w; w &= w - 1)
+                    out[n++] = hi | (j * BITS_PER_LONG + (uint32_t)__builtin_ctzl(w));
+            }
+            break;
+        default:
+            for (j = 0; j < c->n; j++) {
+                for (k = c->r[j].start; k <= rc_run_end(&c->r[j]); k++)
+                    out[n++] = hi | k;
+            }
+            break;
+        }
+    }
+    return n;
+}
+
+//------------------------------------------------------------------------
+// serialization, little endian
+
+static inline void
+put16(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static inline void
+put32(uint8_t *p, uint32_t v)
+{
+    put16(p, v);
+    put16(p + 2, v >> 16);
+}
+
+static inline uint32_t
+get16(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8;
+}
+
+static inline uint32_t
+get32(const uint8_t *p)
+{
+    return get16(p) | get16(p + 2) << 16;
+}
+
+static int
+ro_has_run(const roaring_t *r)
+{
+    uint32_t i;
+
+    for (i = 0; i < r->n; i++) {
+        if (RC_RUN == r->c[i].type)
+            return 1;
+    }
+    return 0;
+}
+
+static size_t
+rc_serialize_size(const rc_t *c)
+{
+    switch (c->type) {
+    case RC_ARRAY:
+    case RC_BITSET:
+        return c->card <= RC_ARRAY_MAX ? 2 * (size_t)c->card : SERIAL_BITSET_BYTES;
+    default:
+        return 2 + 4 * (size_t)c->n;
+    }
+}
+
+// cookie, run flags, key/count pairs, offsets
+static size_t
+ro_header_size(const roaring_t *r)
+{
+    if (ro_has_run(r))
+        return 4 + (r->n + 7) / 8 + 4 * (size_t)r->n + (r->n >= NO_OFFSET_THRESHOLD ? 4 * (size_t)r->n : 0);
+    return 8 + 8 * (size_t)r->n;
+}
+
+size_t
+roaring_serialize_size(const roaring_t *r)
+{
+    size_t n = ro_header_size(r);
+    uint32_t i;
+
+    for (i = 0; i < r->n; i++)
+        n += rc_serialize_size(&r->c[i]);
+    return n;
+}
+
+size_t
+roaring_serialize(const roaring_t *r, void *buf)
+{
+    uint8_t *p = (uint8_t *)buf;
+    uint8_t *flags = NULL;
+    int run        = ro_has_run(r);
+    size_t offset  = ro_header_size(r);
+    const rc_t *c;
+    unsigned long w;
+    uint32_t i, j, k;
+
+    if (run) {
+        put32(p, SERIAL_COOKIE | (r->n - 1) << 16);
+        p += 4;
+        flags = p;
+        memset(flags, 0, (r->n + 7) / 8);
+        p += (r->n + 7) / 8;
+    } else {
+        put32(p, SERIAL_COOKIE_NO_RUNCONTAINER);
+        put32(p + 4, r->n);
+        p += 8;
+    }
+    for (i = 0; i < r->n; i++) {
+        put16(p, r->keys[i]);
+        put16(p + 2, r->c[i].card - 1);
+        p += 4;
+        if (RC_RUN == r->c[i].type)
+            flags[i / 8] |= (uint8_t)(1 << (i % 8));
+    }
+    if (!run || r->n >= NO_OFFSET_THRESHOLD) {
+        for (i = 0; i < r->n; i++) {
+            put32(p, (uint32_t)offset);
+            p += 4;
+            offset += rc_serialize_size(&r->c[i]);
+        }
+    }
+
+    for (i = 0; i < r->n; i++) {
+        c = &r->c[i];
+        switch (c->type) {
+        case RC_ARRAY:
+            for (j = 0; j < c->n; j++, p += 2)
+                put16(p, c->a[j]);
+            break;
+        case RC_BITSET:
+            if (c->card <= RC_ARRAY_MAX) {
+                for (j = find_first_bit(c->b, RC_BITS); j < RC_BITS; j = find_next_bit(c->b, RC_BITS, j + 1), p += 2)
+                    put16(p, j);
+                break;
+            }
+            // 64 bit words, whatever the long
+            for (j = 0; j < RC_LONGS; j++) {
+                w = c->b[j];
+                for (k = 0; k < sizeof(unsigned long); k++, w >>= 8)
+                    *p++ = (uint8_t)w;
+            }
+            break;
+        default:
+            put16(p, c->n);
+            p += 2;
+            for (j = 0; j < c->n; j++, p += 4) {
+                put16(p, c->r[j].start);
+                put16(p + 2, c->r[j].len);
+            }
+            break;
+        }
+    }
+    return (size_t)(p - (uint8_t *)buf);
+}
+
+roaring_t *
+roaring_deserialize(const void *buf, size_t len, size_t *used)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+    const uint8_t *end = p + len;
+    const uint8_t *flags = NULL;
+    const uint8_t *desc;
+    roaring_t *r = NULL;
+    uint32_t cookie, n, i, j, k, key, card, prev;
+    unsigned long w;
+    rc_t c;
+
+    if (len < 4)
+        return NULL;
+    cookie = get32(p);
+    p += 4;
+    if (SERIAL_COOKIE == (cookie & 0xFFFF)) {
+        n = (cookie >> 16) + 1;
+        if ((size_t)(end - p) < (n + 7) / 8)
+            return NULL;
+        flags = p;
+        p += (n + 7) / 8;
+    } else if (SERIAL_COOKIE_NO_RUNCONTAINER == cookie) {
+        if (end - p < 4)
+            return NULL;
+        n = get32(p);
+        p += 4;
+        if (n > 65536)
+            return NULL;
+    } else {
+        return NULL;
+    }
+
+    if ((size_t)(end - p) < 4 * (size_t)n)
+        return NULL;
+    desc = p;
+    p += 4 * (size_t)n;
+    if (!flags || n >= NO_OFFSET_THRESHOLD) {
+        if ((size_t)(end - p) < 4 * (size_t)n)
+            return NULL;
+        p += 4 * (size_t)n;
+    }
+
+    r = roaring_create();
+    if (!r || ro_reserve(r, n))
+        goto fail;
+    for (i = 0; i < n; i++) {
+        key  = get16(desc + 4 * i);
+        card = get16(desc + 4 * i + 2) + 1;
+        if (i && key <= r->keys[r->n - 1])
+            goto fail;
+
+        memset(&c, 0, sizeof(c));
+        if (flags && (flags[i / 8] >> (i % 8) & 1)) {
+            if (end - p < 2)
+                goto fail;
+            k = get16(p);
+            p += 2;
+            if ((size_t)(end - p) < 4 * (size_t)k || rc_init(&c, RC_RUN, k))
+                goto fail;
+            for (j = 0, prev = 0; j < k; j++, p += 4) {
+                c.r[j].start = (uint16_t)get16(p);
+                c.r[j].len   = (uint16_t)get16(p + 2);
+                // sorted, apart, inside the chunk
+                if ((j && c.r[j].start <= prev) || rc_run_end(&c.r[j]) > 0xFFFF)
+                    goto fail_c;
+                prev = rc_run_end(&c.r[j]);
+                c.card += c.r[j].len + 1u;
+            }
+            c.n = k;
+            if (c.card != card)
+                goto fail_c;
+        } else if (card <= RC_ARRAY_MAX) {
+            if ((size_t)(end - p) < 2 * (size_t)card || rc_init(&c, RC_ARRAY, card))
+                goto fail;
+            for (j = 0; j < card; j++, p += 2) {
+                c.a[j] = (uint16_t)get16(p);
+                if (j && c.a[j] <= c.a[j - 1])
+                    goto fail_c;
+            }
+            c.n = c.card = card;
+        } else {
+            if (end - p < SERIAL_BITSET_BYTES || rc_init(&c, RC_BITSET, 0))
+                goto fail;
+            for (j = 0; j < RC_LONGS; j++) {
+                for (k = 0, w = 0; k < sizeof(unsigned long); k++)
+                    w |= (unsigned long)*p++ << (8 * k);
+                c.b[j] = w;
+            }
+            rc_bitset_card(&c);
+            if (c.card != card)
+                goto fail_c;
+        }
+        ro_append(r, (uint16_t)key, &c);
+    }
+
+    if (used)
+        *used = (size_t)(p - (const uint8_t *)buf);
+    return r;
+
+fail_c:
+    rc_free(&c);
+fail:
+    roaring_destroy(r);
+    return NULL;
+}
+
+size_t
+roaring_memory(const roaring_t *r)
+{
+    size_t n = sizeof(*r) + r->cap * (sizeof(uint16_t) + sizeof(rc_t));
+    uint32_t i;
+
+    for (i = 0; i < r->n; i++) {
+        if (RC_BITSET == r->c[i].type)
+            n += RC_LONGS * sizeof(unsigned long);
+        else
+            n += r->c[i].cap * (RC_RUN == r->c[i].type ? sizeof(rc_run_t) : sizeof(uint16_t));
+    }
+    return n;
+}
@@ -0,0 +1,401 @@
+/*
+ * test.c - test
+ *
+ * Date   : 2021/04/30
+ */
+
+#include "roaring.h"
+#include "bitops.h"
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CHUNKS 6
+#define U (CHUNKS * 65536)
+
+static uint64_t s_seed = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t rand64(void)
+{
+    s_seed ^= s_seed << 13;
+    s_seed ^= s_seed >> 7;
+    s_seed ^= s_seed << 17;
+    return s_seed;
+}
+
+// everything against a byte per value
+static void check(const roaring_t *r, const char *ref)
+{
+    static uint32_t out[U];
+    roaring_iter_t it;
+    uint64_t count = 0;
+    uint32_t x, v;
+    size_t n, i;
+
+    for (x = 0; x < U; x++) {
+        assert(!!ref[x] == roaring_contains(r, x));
+        count += ref[x];
+    }
+    assert(count == roaring_count(r));
+    assert(!roaring_contains(r, U) && !roaring_contains(r, UINT32_MAX));
+
+    roaring_iter_init(r, &it);
+    for (x = 0, n = 0; roaring_iter_next(&it, &v); x = v + 1, n++) {
+        while (x < v)
+            assert(!ref[x++]);
+        assert(ref[v]);
+    }
+    assert(n == count);
+
+    assert(count == roaring_to_array(r, out));
+    for (i = 0; i < n; i += 1 + rand64() % 97) {
+        assert(0 == roaring_select(r, i, &x) && x == out[i]);
+        assert(i + 1 == roaring_rank(r, out[i]));
+    }
+    assert(-1 == roaring_select(r, count, &x));
+    assert(count == roaring_rank(r, UINT32_MAX));
+}
+
+// chunk k is sparse, dense or runs by k % 3, the last is left empty
+static roaring_t *make_set(char *ref, int shift)
+{
+    roaring_t *r = roaring_create();
+    uint32_t k, i, x, len;
+
+    memset(ref, 0, U);
+    for (k = 0; k + 1 < CHUNKS; k++) {
+        switch ((k + shift) % 3) {
+        case 0:
+            for (i = 0; i < 1000; i++) {
+                x = k << 16 | (uint32_t)(rand64() & 0xFFFF);
+                assert((ref[x] ? 0 : 1) == roaring_add(r, x));
+                ref[x] = 1;
+            }
+            break;
+        case 1:
+            for (i = 0; i < 30000; i++) {
+                x = k << 16 | (uint32_t)(rand64() & 0xFFFF);
+                assert((ref[x] ? 0 : 1) == roaring_add(r, x));
+                ref[x] = 1;
+            }
+            break;
+        default:
+            for (i = 0; i < 40; i++) {
+                x   = k << 16 | (uint32_t)(rand64() & 0xFFFF);
+                len = (uint32_t)(rand64() % 2000);
+                if (x + len > (k + 1) << 16 && i % 2)
+                    len = ((k + 1) << 16) - x;
+                assert(0 == roaring_add_range(r, x, (uint64_t)x + len));
+                memset(ref + x, 1, len < U - x ? len : U - x);
+            }
+            break;
+        }
+    }
+    return r;
+}
+
+static void roaring_basic_test(void)
+{
+    static char ref[U];
+    roaring_t *r = roaring_create(), *c;
+    uint32_t x, i;
+
+    memset(ref, 0, sizeof(ref));
+    check(r, ref);
+
+    // an array grows into a bitset and shrinks back
+    for (i = 0; i < 200000; i++) {
+        x = (uint32_t)(rand64() % (2 * 65536));
+        if (i < 100000 || rand64() % 2) {
+            assert((ref[x] ? 0 : 1) == roaring_add(r, x));
+            ref[x] = 1;
+        } else {
+            assert((ref[x] ? 1 : 0) == roaring_remove(r, x));
+            ref[x] = 0;
+        }
+    }
+    check(r, ref);
+    for (x = 0; x < U; x++) {
+        if (ref[x] && x % 16) {
+            assert(1 == roaring_remove(r, x));
+            ref[x] = 0;
+        }
+    }
+    check(r, ref);
+
+    // runs split and join by single values
+    assert(0 == roaring_add_range(r, 3 * 65536 + 100, 5 * 65536 + 100));
+    memset(ref + 3 * 65536 + 100, 1, 2 * 65536);
+    check(r, ref);
+    for (i = 0; i < 20000; i++) {
+        x = 3 * 65536 + (uint32_t)(rand64() % (2 * 65536 + 200));
+        if (rand64() % 2) {
+            assert((ref[x] ? 0 : 1) == roaring_add(r, x));
+            ref[x] = 1;
+        } else {
+            assert((ref[x] ? 1 : 0) == roaring_remove(r, x));
+            ref[x] = 0;
+        }
+    }
+    check(r, ref);
+
+    c = roaring_copy(r);
+    assert(0 == roaring_optimize(c));
+    check(c, ref);
+    assert(roaring_equal(r, c));
+    roaring_remove(c, 3 * 65536 + 5000);
+    assert(!roaring_equal(r, c));
+    roaring_destroy(c);
+
+    // all of them
+    roaring_destroy(r);
+    r = roaring_create();
+    assert(0 == roaring_add_range(r, 0, 1ULL << 32));
+    assert((1ULL << 32) == roaring_count(r));
+    assert(roaring_contains(r, UINT32_MAX) && 1 == roaring_remove(r, 77));
+    assert(0 == roaring_select(r, 77, &x) && 78 == x);
+    assert(0 == roaring_add_range(r, 5, 5));
+    roaring_destroy(r);
+}
+
+static void roaring_setop_test(void)
+{
+    static char ra[U], rb[U], rr[U];
+    roaring_t *a, *b, *r;
+    int round, op;
+    uint32_t x;
+    uint64_t n;
+
+    for (round = 0; round < 6; round++) {
+        a = make_set(ra, round);
+        b = make_set(rb, round / 2);
+        if (round % 2) {
+            roaring_optimize(a);
+            roaring_optimize(b);
+        }
+
+        for (op = 0; op < 3; op++) {
+            r = 0 == op ? roaring_or(a, b) : (1 == op ? roaring_and(a, b) : roaring_andnot(a, b));
+            for (x = 0, n = 0; x < U; x++) {
+                rr[x] = 0 == op ? ra[x] | rb[x] : (1 == op ? ra[x] & rb[x] : ra[x] & !rb[x]);
+                n += ra[x] & rb[x];
+            }
+            check(r, rr);
+            if (1 == op)
+                assert(n == roaring_and_count(a, b));
+            roaring_destroy(r);
+        }
+
+        // with itself and the empty one
+        r = roaring_or(a, a);
+        assert(roaring_equal(r, a));
+        roaring_destroy(r);
+        r = roaring_andnot(a, a);
+        assert(0 == roaring_count(r));
+        roaring_destroy(r);
+
+        roaring_destroy(a);
+        roaring_destroy(b);
+    }
+}
+
+static void roaring_serialize_test(void)
+{
+    static const uint8_t array[] = {
+        0x3A, 0x30, 0, 0, 1, 0, 0, 0,   // no runs, one container
+        0, 0, 2, 0, 16, 0, 0, 0,        // key 0, 3 values, at 16
+        1, 0, 2, 0, 3, 0};
+    static const uint8_t run[] = {
+        0x3B, 0x30, 0, 0, 0x01,         // runs, one container, a run one
+        1, 0, 99, 0,                    // key 1, 100 values, no offsets
+        1, 0, 10, 0, 99, 0};            // 65536 + 10 .. 65536 + 109
+    uint8_t overlap[] = {
+        0x3B, 0x30, 0, 0, 0x01,
+        1, 0, 199, 0,
+        2, 0, 10, 0, 99, 0, 50, 0, 99, 0};
+    static char ref[U];
+    static uint8_t buf[1 << 20];
+    roaring_t *r, *back;
+    size_t len, used, i;
+    int round;
+
+    r = roaring_create();
+    roaring_add(r, 3);
+    roaring_add(r, 1);
+    roaring_add(r, 2);
+    assert(sizeof(array) == roaring_serialize_size(r));
+    assert(sizeof(array) == roaring_serialize(r, buf));
+    assert(0 == memcmp(buf, array, sizeof(array)));
+    roaring_destroy(r);
+
+    r = roaring_create();
+    roaring_add_range(r, 65536 + 10, 65536 + 110);
+    assert(sizeof(run) == roaring_serialize(r, buf));
+    assert(0 == memcmp(buf, run, sizeof(run)));
+    back = roaring_deserialize(run, sizeof(run), &used);
+    assert(back && used == sizeof(run) && roaring_equal(r, back));
+    roaring_destroy(back);
+    roaring_destroy(r);
+
+    for (round = 0; round < 4; round++) {
+        r = make_set(ref, round);
+        if (round % 2)
+            roaring_optimize(r);
+        len = roaring_serialize(r, buf);
+        assert(len == roaring_serialize_size(r));
+        back = roaring_deserialize(buf, len + 7, &used);
+        assert(back && used == len);
+        check(back, ref);
+        roaring_destroy(back);
+
+        // every cut fails
+        for (i = 0; i < len; i += 1 + i / 64)
+            assert(NULL == roaring_deserialize(buf, i, NULL));
+        roaring_destroy(r);
+    }
+
+    // a value out of order
+    memcpy(buf, array, sizeof(array));
+    buf[18] = 5;
+    assert(NULL == roaring_deserialize(buf, sizeof(array), NULL));
+    // overlapping runs, the count adds up
+    assert(NULL == roaring_deserialize(overlap, sizeof(overlap), NULL));
+    overlap[15] = 110;
+    back = roaring_deserialize(overlap, sizeof(overlap), NULL);
+    assert(back && 200 == roaring_count(back));
+    roaring_destroy(back);
+}
+
+//------------------------------------------------------------------------
+
+#define BENCH_BITS (1u << 24)
+
+static double ms(clock_t start)
+{
+    return (clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+static void bench_fill(roaring_t *r, unsigned long *flat, double density, int runs)
+{
+    uint32_t x, len;
+    uint64_t i, n = (uint64_t)(BENCH_BITS * density);
+
+    if (runs) {
+        // runs of ~1000
+        for (i = 0; i < n; i += len) {
+            x   = (uint32_t)(rand64() % BENCH_BITS);
+            len = 500 + (uint32_t)(rand64() % 1000);
+            if (x + len > BENCH_BITS)
+                len = BENCH_BITS - x;
+            roaring_add_range(r, x, (uint64_t)x + len);
+            bitmap_long_set(flat, x, len);
+        }
+        roaring_optimize(r);
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        x = (uint32_t)(rand64() % BENCH_BITS);
+        roaring_add(r, x);
+        set_bit(x, flat);
+    }
+}
+
+// set operations against the flat word bitmap, 16M values
+static void roaring_bench(double density, int runs)
+{
+    size_t words = BITS_TO_LONGS(BENCH_BITS);
+    unsigned long *fa = calloc(words, sizeof(long));
+    unsigned long *fb = calloc(words, sizeof(long));
+    unsigned long *fr = calloc(words, sizeof(long));
+    roaring_t *a = roaring_create(), *b = roaring_create(), *r;
+    double t_or, t_and, t_andnot, f_or, f_and, f_andnot;
+    uint64_t sum = 0;
+    clock_t start;
+    int i, loops = 10;
+
+    bench_fill(a, fa, density, runs);
+    bench_fill(b, fb, density, runs);
+
+    start = clock();
+    for (i = 0; i < loops; i++) {
+        r = roaring_or(a, b);
+        sum += roaring_count(r);
+        roaring_destroy(r);
+    }
+    t_or = ms(start) / loops;
+    start = clock();
+    for (i = 0; i < loops; i++) {
+        r = roaring_and(a, b);
+        sum += roaring_count(r);
+        roaring_destroy(r);
+    }
+    t_and = ms(start) / loops;
+    start = clock();
+    for (i = 0; i < loops; i++) {
+        r = roaring_andnot(a, b);
+        sum += roaring_count(r);
+        roaring_destroy(r);
+    }
+    t_andnot = ms(start) / loops;
+
+    // the flat ones count too, roaring results know theirs
+    start = clock();
+    for (i = 0; i < loops; i++) {
+        bitmap_long_or(fr, fa, fb, BENCH_BITS);
+        sum -= bitmap_long_weight(fr, BENCH_BITS);
+    }
+    f_or = ms(start) / loops;
+    start = clock();
+    for (i = 0; i < loops; i++) {
+        bitmap_long_and(fr, fa, fb, BENCH_BITS);
+        sum -= bitmap_long_weight(fr, BENCH_BITS);
+    }
+    f_and = ms(start) / loops;
+    start = clock();
+    for (i = 0; i < loops; i++) {
+        bitmap_long_andnot(fr, fa, fb, BENCH_BITS);
+        sum -= bitmap_long_weight(fr, BENCH_BITS);
+    }
+    f_andnot = ms(start) / loops;
+    assert(0 == sum);
+
+    printf("%-5s %7.3f%%: %8lu bytes (%7lu serialized) or %7.3fms and %7.3fms andnot %7.3fms\n",
+           runs ? "runs" : "rand", density * 100, (unsigned long)roaring_memory(a),
+           (unsigned long)roaring_serialize_size(a), t_or, t_and, t_andnot);
+    printf("%-5s %7s : %8lu bytes                     or %7.3fms and %7.3fms andnot %7.3fms\n",
+           "flat", "", (unsigned long)(words * sizeof(long)), f_or, f_and, f_andnot);
+
+    roaring_destroy(a);
+    roaring_destroy(b);
+    free(fa);
+    free(fb);
+    free(fr);
+}
+
+int main(int argc, char *argv[])
+{
+    static const double densities[] = {0.0001, 0.001, 0.01, 0.1, 0.5};
+    size_t i;
+
+    (void)argc;
+    (void)argv;
+
+    roaring_basic_test();
+    roaring_setop_test();
+    roaring_serialize_test();
+    printf("roaring test ok\n");
+
+    printf("%u values, per operation:\n", BENCH_BITS);
+    for (i = 0; i < sizeof(densities) / sizeof(densities[0]); i++)
+        roaring_bench(densities[i], 0);
+    roaring_bench(0.01, 1);
+    roaring_bench(0.5, 1);
+    return 0;
+}
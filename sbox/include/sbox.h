@@ -10,6 +10,7 @@ extern "C" {
 #endif
 
 #include "rbtree.h"
+#include "hashtab.h"
 #include <stdint.h>
 #include <string.h>
 
@@ -26,11 +27,17 @@ typedef enum __sbox_type {
 } sbox_type;
 
 typedef struct rb_root sbox_dict_root;
+/* list slot, the slot after the last one holds NULL */
 typedef struct __sbox_list_node {
     void*    data;
-    struct __sbox_list_node *next;
 } sbox_list_node;
 
+typedef struct __sbox_list {
+    sbox_list_node *v;  //cap + 1 slots
+    uint32_t n;
+    uint32_t cap;
+} sbox_list;
+
 typedef struct __sbox {
     uint32_t type;
     uint32_t len;       //data length
@@ -40,8 +47,11 @@ typedef struct __sbox {
         double  f;      //float
         char    c[0];    //char
         uint8_t b[0];    //bytes
-        sbox_dict_root root; //dict
-        sbox_list_node* h; //list header
+        struct {
+            sbox_dict_root root;    //dict
+            struct __sbox_hdict *hd; //hashed dict if set
+        };
+        sbox_list l;    //list
     } d;                //must be the last member
 } sbox_t, *sbox_ptr;
 
@@ -51,7 +61,15 @@ typedef struct __sbox {
 typedef struct __sbox_dict_node {
     sbox_ptr        key;
     sbox_ptr        value;
-    struct rb_node  node;
+    uint32_t        hashed;     //in a hashed dict
+    hashtab_node_t  hnode;
+    union {
+        struct rb_node  node;   //dict, key order
+        struct {
+            struct __sbox_dict_node *prev;
+            struct __sbox_dict_node *next;
+        } l;                    //hashed dict, insertion order
+    };
 } sbox_kv_pair;
 
 typedef struct __sbox_iter {
@@ -117,8 +135,13 @@ extern int sbox_tostr(sbox_ptr box, char* buff);
 extern sbox_ptr sbox_new_int(int64_t i);
 extern sbox_ptr sbox_new_float(double d);
 extern sbox_ptr sbox_new_str(const char* str);
+/* len bytes, NUL appended */
+extern sbox_ptr sbox_new_strn(const char* str, uint32_t len);
 extern sbox_ptr sbox_new_bytes(void* data, uint32_t len);
 extern sbox_ptr sbox_new_dict(void);
+/* hashed dict: same calls as the dict, O(1) lookups, iterates in
+ * insertion order; float keys hash by their bits */
+extern sbox_ptr sbox_new_hdict(void);
 extern sbox_ptr sbox_new_list(void);
 
 extern void sbox_dict_insert(sbox_ptr dict, sbox_ptr key, sbox_ptr value);
@@ -130,15 +153,147 @@ extern sbox_kv_pair* sbox_dict_last(sbox_ptr dict);
 extern sbox_kv_pair* sbox_dict_next(sbox_kv_pair *pair);
 extern sbox_kv_pair* sbox_dict_prev(sbox_kv_pair *pair);
 
+/* append is amortized O(1), get O(1); append/del move the slots, a
+ * sbox_list_node from first/next is valid until the list changes */
 extern void sbox_list_append(sbox_ptr list, sbox_ptr data);
+extern int sbox_list_reserve(sbox_ptr list, uint32_t n);
+extern uint32_t sbox_list_len(sbox_ptr list);
 extern sbox_ptr sbox_list_get(sbox_ptr list, uint32_t idx);
 extern void sbox_list_del(sbox_ptr list, sbox_ptr target);
 extern sbox_list_node* sbox_list_first(sbox_ptr list);
 extern sbox_list_node* sbox_list_next(sbox_list_node *cur);
 
+/* shared boxed string, held for the caller: equal keys are one box,
+ * a hashed dict then matches them by pointer */
+extern sbox_ptr sbox_intern(const char *str);
+/* drop the interned strings nobody else holds */
+extern void sbox_intern_purge(void);
+
 extern sbox_ptr sbox_hold(sbox_ptr box);
 extern void sbox_release(sbox_ptr box);
 
+/*
+ * Arena for request scoped documents: the boxes, the list slots and the
+ * dict pairs are bumped from big chunks and go away together on reset or
+ * destroy. Arena boxes are not counted, hold and release do nothing on
+ * them and a container never releases what it holds, so only put arena
+ * boxes (or boxes outliving the arena) into arena containers. Not thread
+ * safe.
+ */
+typedef struct __sbox_arena sbox_arena_t;
+
+#define SBOX_COUNT_ARENA ((atomic_t)-1)
+
+/* the arena of an arena box, sitting in front of it; NULL for others */
+static inline sbox_arena_t *sbox_arena_of(sbox_ptr box)
+{
+    if (box && box->count < 0) {
+        return ((sbox_arena_t **)box)[-1];
+    }
+    return NULL;
+}
+
+/* chunk 0 for 64K, bigger allocations get their own block */
+extern sbox_arena_t* sbox_arena_create(size_t chunk);
+/* free everything but the first chunk, for the next document */
+extern void sbox_arena_reset(sbox_arena_t *arena);
+extern void sbox_arena_destroy(sbox_arena_t *arena);
+/* 8 bytes aligned, NULL if out of memory */
+extern void* sbox_arena_alloc(sbox_arena_t *arena, size_t size);
+/* fn(arg) on reset/destroy, newest first */
+extern int sbox_arena_on_free(sbox_arena_t *arena, void (*fn)(void *arg), void *arg);
+extern size_t sbox_arena_used(sbox_arena_t *arena);
+
+/* arena NULL is the same as sbox_new_xxx */
+extern sbox_ptr sbox_arena_new_int(sbox_arena_t *arena, int64_t i);
+extern sbox_ptr sbox_arena_new_float(sbox_arena_t *arena, double d);
+extern sbox_ptr sbox_arena_new_str(sbox_arena_t *arena, const char* str);
+extern sbox_ptr sbox_arena_new_strn(sbox_arena_t *arena, const char* str, uint32_t len);
+extern sbox_ptr sbox_arena_new_bytes(sbox_arena_t *arena, void* data, uint32_t len);
+extern sbox_ptr sbox_arena_new_dict(sbox_arena_t *arena);
+extern sbox_ptr sbox_arena_new_hdict(sbox_arena_t *arena);
+extern sbox_ptr sbox_arena_new_list(sbox_arena_t *arena);
+
+/*
+ * MessagePack encoding: int -> int (the shortest), float -> float 64,
+ * str -> str, bytes -> bin, list -> array, dict -> map, NULL -> nil.
+ *
+ * The packer writes into the caller buffer, when it is full write is
+ * called with what it holds (no write: the value must fit). After an
+ * error every call fails.
+ */
+typedef int (*sbox_write_fn)(void *param, const void *data, size_t len);
+
+typedef struct __sbox_packer {
+    uint8_t *buf;
+    size_t size;
+    size_t pos;
+    sbox_write_fn write;
+    void *param;
+    int error;
+} sbox_packer_t;
+
+extern void sbox_packer_init(sbox_packer_t *pk, void *buf, size_t size,
+                             sbox_write_fn write, void *param);
+/* hands the buffered bytes to write */
+extern int sbox_packer_flush(sbox_packer_t *pk);
+
+/* 0 ok, -1 full or write failed */
+extern int sbox_pack(sbox_packer_t *pk, sbox_ptr box);
+extern int sbox_pack_nil(sbox_packer_t *pk);
+extern int sbox_pack_int(sbox_packer_t *pk, int64_t i);
+extern int sbox_pack_float(sbox_packer_t *pk, double f);
+extern int sbox_pack_str(sbox_packer_t *pk, const char *str, uint32_t len);
+extern int sbox_pack_bytes(sbox_packer_t *pk, const void *data, uint32_t len);
+/* headers, n values or n key/value pairs follow */
+extern int sbox_pack_list(sbox_packer_t *pk, uint32_t n);
+extern int sbox_pack_dict(sbox_packer_t *pk, uint32_t n);
+
+/* bytes written, -1 if it doesn't fit */
+extern ssize_t sbox_pack_buf(sbox_ptr box, void *buf, size_t size);
+extern size_t sbox_pack_size(sbox_ptr box);
+
+/*
+ * Read-only view of an encoded value, pointing into the input buffer.
+ * sbox_view_init checks the whole value once, the other calls trust it.
+ * Strings are not NUL terminated.
+ */
+typedef struct __sbox_view {
+    const uint8_t *p;
+} sbox_view_t;
+
+typedef struct __sbox_view_iter {
+    const uint8_t *p;
+    uint64_t left;
+} sbox_view_iter_t;
+
+/* bytes of the value at buf, -1 if malformed or truncated */
+extern ssize_t sbox_view_init(sbox_view_t *v, const void *buf, size_t len);
+/* sbox_type, -1 for nil and extensions; bool reads as int */
+extern int sbox_view_type(const sbox_view_t *v);
+extern int64_t sbox_view_int(const sbox_view_t *v);
+extern double sbox_view_float(const sbox_view_t *v);
+extern const char *sbox_view_str(const sbox_view_t *v, uint32_t *len);
+extern const void *sbox_view_bytes(const sbox_view_t *v, uint32_t *len);
+/* list elements, dict pairs */
+extern uint32_t sbox_view_len(const sbox_view_t *v);
+
+/* list elements in order, dict keys and values in turn
+ * 1 with out set, 0 at the end */
+extern void sbox_view_iter(const sbox_view_t *v, sbox_view_iter_t *it);
+extern int sbox_view_next(sbox_view_iter_t *it, sbox_view_t *out);
+/* 0 ok, -1 not found */
+extern int sbox_view_list_get(const sbox_view_t *v, uint32_t idx, sbox_view_t *out);
+extern int sbox_view_dict_get(const sbox_view_t *v, const char *key, uint32_t len,
+                              sbox_view_t *out);
+
+/* boxes copied from a view, NULL for nil or nesting over 64 */
+extern sbox_ptr sbox_view_box(const sbox_view_t *v);
+extern sbox_ptr sbox_unpack(const void *buf, size_t len);
+/* the same into an arena, keys are not interned */
+extern sbox_ptr sbox_arena_view_box(sbox_arena_t *arena, const sbox_view_t *v);
+extern sbox_ptr sbox_arena_unpack(sbox_arena_t *arena, const void *buf, size_t len);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
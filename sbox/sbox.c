@@ -6,6 +6,7 @@
 
 #include "sbox.h"
 #include "atomic.h"
+#include "jhash.h"
 #include "macro.h"
 
 #include <stdlib.h>
@@ -14,12 +15,26 @@
 #include <stdint.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
+
+typedef struct __sbox_hdict {
+    hashtab_t *t;
+    sbox_kv_pair *head;
+    sbox_kv_pair *tail;
+} sbox_hdict;
+
+typedef struct __sbox_intern_node {
+    hashtab_node_t node;
+    sbox_ptr box;
+} sbox_intern_node;
+
+static hashtab_t *s_intern;
+static pthread_mutex_t s_intern_lock = PTHREAD_MUTEX_INITIALIZER;
 
 int sbox_cmp(sbox_ptr a, sbox_ptr b)
 {
     uint32_t i;
     int j;
-    void *ret = NULL;
 
     if (a == b) {
         return 0;
@@ -37,9 +52,9 @@ int sbox_cmp(sbox_ptr a, sbox_ptr b)
             return strcmp(a->d.c, b->d.c);
         case so_bytes:
             i = MIN(a->len, b->len);
-            ret = memcpy((uint8_t*)(a->d.b), (uint8_t *)(b->d.b), i);
-            if (ret != NULL) {
-                return i;
+            j = memcmp(a->d.b, b->d.b, i);
+            if (j != 0) {
+                return j;
             } else {
                 return a->len == b->len ? 0 : (a->len > b->len ? 1 : -1);
             }
@@ -49,94 +64,272 @@ int sbox_cmp(sbox_ptr a, sbox_ptr b)
     }
 }
 
-sbox_ptr sbox_new_int(int64_t i)
+/* arena NULL: malloc'd and refcounted */
+static sbox_ptr __box_new(sbox_arena_t *arena, uint32_t type, uint32_t size, uint32_t len)
 {
-    sbox_ptr box = (sbox_ptr)malloc(sizeof(sbox_t));
+    sbox_arena_t **p = NULL;
+    sbox_ptr box = NULL;
+    if (arena) {
+        p = (sbox_arena_t **)sbox_arena_alloc(arena, sizeof(*p) + size);
+        if (p) {
+            *p = arena;
+            box = (sbox_ptr)(p + 1);
+            box->count = SBOX_COUNT_ARENA;
+        }
+    } else {
+        box = (sbox_ptr)malloc(size);
+        if (box) {
+            box->count = 1;
+        }
+    }
+    if (box) {
+        box->type = type;
+        box->len = len;
+    }
+    return box;
+}
+
+/* memory owned by a container, from its arena if it has one */
+static void *__mem_alloc(sbox_ptr box, size_t size)
+{
+    if (box->count < 0) {
+        return sbox_arena_alloc(sbox_arena_of(box), size);
+    }
+    return malloc(size);
+}
+
+static void __mem_free(sbox_ptr box, void *p)
+{
+    if (box->count >= 0) {
+        free(p);
+    }
+}
+
+sbox_ptr sbox_arena_new_int(sbox_arena_t *arena, int64_t i)
+{
+    sbox_ptr box = __box_new(arena, so_int, sizeof(sbox_t), sizeof(int64_t));
     if (box) {
-        box->type = so_int;
-        box->len = sizeof(int64_t);
-        atomic_increment32(&box->count);
         box->d.i = i;
     }
     return box;
 }
 
-sbox_ptr sobx_new_float(double d)
+sbox_ptr sbox_arena_new_float(sbox_arena_t *arena, double d)
 {
-    sbox_ptr box = (sbox_ptr)malloc(sizeof(sbox_t));
+    sbox_ptr box = __box_new(arena, so_float, sizeof(sbox_t), sizeof(double));
     if (box) {
-        box->type = so_float;
-        box->len = sizeof(double);
-        atomic_increment32(&box->count);
         box->d.f = d;
     }
     return box;
 }
 
-sbox_ptr sbox_new_str(const char *str)
+sbox_ptr sbox_arena_new_strn(sbox_arena_t *arena, const char *str, uint32_t len)
 {
-    uint32_t size, len;
     sbox_ptr box = NULL;
     if (str == NULL) {
         return NULL;
     }
-    len = strlen(str) + 1;
-    size = sbox_size(len);
-    box = (sbox_ptr)malloc(size);
+    box = __box_new(arena, so_str, sbox_size(len + 1), len + 1);
     if (box) {
-        memset(box, 0, len);
-        box->type = so_str;
-        box->len = len;
-        atomic_increment32(&box->count);
-        strcpy(box->d.c, str);
+        memcpy(box->d.c, str, len);
+        box->d.c[len] = '\0';
     }
     return box;
 }
 
-sbox_ptr sbox_new_bytes(void *data, uint32_t len)
+sbox_ptr sbox_arena_new_str(sbox_arena_t *arena, const char *str)
+{
+    if (str == NULL) {
+        return NULL;
+    }
+    return sbox_arena_new_strn(arena, str, strlen(str));
+}
+
+sbox_ptr sbox_arena_new_bytes(sbox_arena_t *arena, void *data, uint32_t len)
 {
     uint32_t size = sbox_size(len);
     sbox_ptr box = NULL;
     if (data == NULL) {
         return NULL;
     }
-    box = (sbox_ptr)malloc(size);
+    box = __box_new(arena, so_bytes, size, len);
     if (box) {
-        memset(box, 0, size);
-        box->type = so_bytes;
-        box->len = len;
-        atomic_increment32(&box->count);
+        memset(box->d.b, 0, size - offsetof(sbox_t, d));
         memcpy(box->d.b, data, len);
     }
     return box;
 }
 
-sbox_ptr sbox_new_dict()
+sbox_ptr sbox_arena_new_dict(sbox_arena_t *arena)
 {
-    sbox_ptr box = (sbox_ptr)malloc(sizeof(sbox_t));
+    sbox_ptr box = __box_new(arena, so_dict, sizeof(sbox_t), sizeof(sbox_t));
     if (box) {
-        memset(box, 0, sizeof(sbox_t));
-        box->type = so_dict;
-        box->len = sizeof(sbox_t);
-        atomic_increment32(&box->count);
+        memset(&box->d, 0, sizeof(box->d));
     }
     return box;
 }
 
+sbox_ptr sbox_new_int(int64_t i)
+{
+    return sbox_arena_new_int(NULL, i);
+}
+
+sbox_ptr sbox_new_float(double d)
+{
+    return sbox_arena_new_float(NULL, d);
+}
+
+sbox_ptr sbox_new_str(const char *str)
+{
+    return sbox_arena_new_str(NULL, str);
+}
+
+sbox_ptr sbox_new_strn(const char *str, uint32_t len)
+{
+    return sbox_arena_new_strn(NULL, str, len);
+}
+
+sbox_ptr sbox_new_bytes(void *data, uint32_t len)
+{
+    return sbox_arena_new_bytes(NULL, data, len);
+}
+
+sbox_ptr sbox_new_dict()
+{
+    return sbox_arena_new_dict(NULL);
+}
+
 sbox_ptr sbox_hold(sbox_ptr box)
 {
-    if (box) {
+    /* arena boxes are not counted */
+    if (box && box->count >= 0) {
         /* FIXME: should inc only if not zero */
         atomic_increment32(&box->count);
     }
     return box;
 }
 
+/* key is the sbox_ptr, len unused */
+static uint32_t __hdict_hash(const void *key, size_t len)
+{
+    sbox_ptr k = (sbox_ptr)key;
+    (void)len;
+
+    switch (k->type) {
+    case so_int:
+    case so_float:
+        return jhash(&k->d.i, sizeof(k->d.i), 0);
+    case so_str:
+        return jhash(k->d.c, k->len - 1, 0);
+    case so_bytes:
+        return jhash(k->d.b, k->len, 0);
+    default:
+        return jhash(&k, sizeof(k), 0);
+    }
+}
+
+static int __hdict_equal(const void *key, size_t len, const hashtab_node_t *node)
+{
+    sbox_ptr k = (sbox_ptr)key;
+    sbox_kv_pair *pair = hashtab_entry(node, sbox_kv_pair, hnode);
+    (void)len;
+
+    /* interned keys stop here */
+    if (k == pair->key) {
+        return 1;
+    }
+    return k->type == pair->key->type && sbox_cmp(k, pair->key) == 0;
+}
+
+static void __hdict_cleanup(void *arg)
+{
+    hashtab_destroy(((sbox_hdict *)arg)->t);
+}
+
+sbox_ptr sbox_arena_new_hdict(sbox_arena_t *arena)
+{
+    sbox_ptr box = sbox_arena_new_dict(arena);
+    sbox_hdict *hd = NULL;
+    if (!box) {
+        return NULL;
+    }
+    hd = (sbox_hdict *)__mem_alloc(box, sizeof(sbox_hdict));
+    if (hd) {
+        memset(hd, 0, sizeof(sbox_hdict));
+        hd->t = hashtab_create(0, __hdict_hash, __hdict_equal);
+        /* the table is malloc'd, the arena drops it */
+        if (hd->t && arena && sbox_arena_on_free(arena, __hdict_cleanup, hd) != 0) {
+            hashtab_destroy(hd->t);
+            hd->t = NULL;
+        }
+    }
+    if (!hd || !hd->t) {
+        __mem_free(box, hd);
+        __mem_free(box, box);
+        return NULL;
+    }
+    box->d.hd = hd;
+    return box;
+}
+
+sbox_ptr sbox_new_hdict(void)
+{
+    return sbox_arena_new_hdict(NULL);
+}
+
+static sbox_kv_pair *__hdict_get(sbox_ptr dict, sbox_ptr key)
+{
+    hashtab_node_t *node = hashtab_find(dict->d.hd->t, key, 0);
+    return node ? hashtab_entry(node, sbox_kv_pair, hnode) : NULL;
+}
+
+static void __hdict_insert(sbox_ptr dict, sbox_kv_pair *new)
+{
+    sbox_hdict *hd = dict->d.hd;
+
+    if (hashtab_insert(hd->t, new->key, 0, &new->hnode, NULL) != 0) {
+        /* out of memory */
+        sbox_release(new->key);
+        sbox_release(new->value);
+        __mem_free(dict, new);
+        return;
+    }
+    new->hashed = 1;
+    new->l.prev = hd->tail;
+    new->l.next = NULL;
+    if (hd->tail) {
+        hd->tail->l.next = new;
+    } else {
+        hd->head = new;
+    }
+    hd->tail = new;
+}
+
+static void __hdict_erase(sbox_ptr dict, sbox_kv_pair *pair)
+{
+    sbox_hdict *hd = dict->d.hd;
+
+    hashtab_remove(hd->t, &pair->hnode);
+    if (pair->l.prev) {
+        pair->l.prev->l.next = pair->l.next;
+    } else {
+        hd->head = pair->l.next;
+    }
+    if (pair->l.next) {
+        pair->l.next->l.prev = pair->l.prev;
+    } else {
+        hd->tail = pair->l.prev;
+    }
+}
+
 static sbox_kv_pair *__dict_get(sbox_ptr dict, sbox_ptr key)
 {
     sbox_kv_pair *node = NULL;
     struct rb_node *p = dict->d.root.rb_node;
     int i;
+    if (dict->d.hd) {
+        return __hdict_get(dict, key);
+    }
     while(p) {
         node = rb_entry(p, sbox_kv_pair, node);
         i = sbox_cmp(key, node->key);
@@ -191,15 +384,21 @@ void sbox_dict_insert(sbox_ptr dict, sbox_ptr key, sbox_ptr value)
             sbox_release(node->value);
             node->key = key;
             node->value = value;
+        } else if (node->key != key) {
+            sbox_release(key);
         }
     } else {
         /* insert */
-        node = (sbox_kv_pair *)malloc(sizeof(sbox_kv_pair));
+        node = (sbox_kv_pair *)__mem_alloc(dict, sizeof(sbox_kv_pair));
         if (node) {
             memset(node, 0, sizeof(sbox_kv_pair));
             node->key = key;
             node->value = value;
-            __dict_insert(dict, node);
+            if (dict->d.hd) {
+                __hdict_insert(dict, node);
+            } else {
+                __dict_insert(dict, node);
+            }
         }
     }
 }
@@ -224,10 +423,14 @@ void sbox_dict_del(sbox_ptr dict, sbox_ptr key)
     if (dict && dict->type == so_dict && key) {
         node = __dict_get(dict, key);
         if (node) {
-            rb_erase(&node->node, &(dict->d.root));
+            if (dict->d.hd) {
+                __hdict_erase(dict, node);
+            } else {
+                rb_erase(&node->node, &(dict->d.root));
+            }
             sbox_release(node->key);
             sbox_release(node->value);
-            free(node);
+            __mem_free(dict, node);
         }
     }
     sbox_release(key);
@@ -237,6 +440,9 @@ void sbox_dict_del(sbox_ptr dict, sbox_ptr key)
 sbox_kv_pair *sbox_dict_first(sbox_ptr dict)
 {
     sbox_kv_pair *pair = NULL;
+    if (dict && dict->type == so_dict && dict->d.hd) {
+        return dict->d.hd->head;
+    }
     if (dict && dict->type == so_dict) {
         struct rb_node *first = rb_first(&(dict->d.root));
         if (first) {
@@ -249,6 +455,9 @@ sbox_kv_pair *sbox_dict_first(sbox_ptr dict)
 sbox_kv_pair *sbox_dict_last(sbox_ptr dict)
 {
     sbox_kv_pair *pair = NULL;
+    if (dict && dict->type == so_dict && dict->d.hd) {
+        return dict->d.hd->tail;
+    }
     if (dict && dict->type == so_dict) {
         struct rb_node *last = rb_last(&(dict->d.root));
         if (last) {
@@ -261,6 +470,9 @@ sbox_kv_pair *sbox_dict_last(sbox_ptr dict)
 sbox_kv_pair *sbox_dict_next(sbox_kv_pair *pair)
 {
     sbox_kv_pair *next_pair = NULL;
+    if (pair && pair->hashed) {
+        return pair->l.next;
+    }
     if (pair) {
         struct rb_node *next = rb_next(&pair->node);
         if (next) {
@@ -273,6 +485,9 @@ sbox_kv_pair *sbox_dict_next(sbox_kv_pair *pair)
 sbox_kv_pair *sbox_dict_prev(sbox_kv_pair *pair)
 {
     sbox_kv_pair *prev_pair = NULL;
+    if (pair && pair->hashed) {
+        return pair->l.prev;
+    }
     if (pair) {
         struct rb_node *prev = rb_prev(&pair->node);
         if (prev) {
@@ -282,22 +497,52 @@ sbox_kv_pair *sbox_dict_prev(sbox_kv_pair *pair)
     return prev_pair;
 }
 
-sbox_ptr sbox_new_list(void)
+sbox_ptr sbox_arena_new_list(sbox_arena_t *arena)
 {
-    sbox_ptr box = (sbox_ptr) malloc(sizeof(sbox_t));
+    sbox_ptr box = __box_new(arena, so_list, sizeof(sbox_t), sizeof(sbox_t));
     if (box) {
-        memset(box, 0, sizeof(sbox_t));
-        box->type = so_list;
-        box->len = sizeof(sbox_t);
-        atomic_increment32(&box->count);
+        memset(&box->d, 0, sizeof(box->d));
     }
     return box;
 }
 
-void sbox_list_append(sbox_ptr list, sbox_ptr data)
+sbox_ptr sbox_new_list(void)
 {
-    sbox_list_node *node = NULL;
+    return sbox_arena_new_list(NULL);
+}
+
+static int __list_grow(sbox_ptr list, uint32_t n)
+{
+    sbox_list_node *v = NULL;
+    uint32_t cap = list->d.l.cap ? list->d.l.cap : 4;
+
+    if (n <= list->d.l.cap) {
+        return 0;
+    }
+    while (cap < n) {
+        cap *= 2;
+    }
 
+    if (list->count < 0) {
+        /* no realloc in the arena, the old slots stay until the reset */
+        v = (sbox_list_node *)__mem_alloc(list, (cap + 1) * sizeof(sbox_list_node));
+        if (v && list->d.l.v) {
+            memcpy(v, list->d.l.v, list->d.l.n * sizeof(sbox_list_node));
+        }
+    } else {
+        v = (sbox_list_node *)realloc(list->d.l.v, (cap + 1) * sizeof(sbox_list_node));
+    }
+    if (!v) {
+        return -1;
+    }
+    v[list->d.l.n].data = NULL;
+    list->d.l.v = v;
+    list->d.l.cap = cap;
+    return 0;
+}
+
+void sbox_list_append(sbox_ptr list, sbox_ptr data)
+{
     if (!list || !data) {
         return;
     }
@@ -306,86 +551,71 @@ void sbox_list_append(sbox_ptr list, sbox_ptr data)
         return;
     }
 
-    node = (sbox_list_node *)malloc(sizeof(sbox_list_node));
-    if (node) {
-        node->data = data;
-        node->next = NULL;
-        if (!list->d.h) {
-            /* header is null */
-            list->d.h = node;
-            return;
-        } else {
-            sbox_list_node *p = list->d.h;
-            while (p->next) {
-                p = p->next;
-            }
-            p->next = node;
-            return;
-        }
+    if (list->d.l.n == list->d.l.cap && __list_grow(list, list->d.l.n + 1)) {
+        return;
     }
+    list->d.l.v[list->d.l.n++].data = data;
+    list->d.l.v[list->d.l.n].data = NULL;
 }
 
-sbox_ptr sbox_list_get(sbox_ptr list, uint32_t idx)
+int sbox_list_reserve(sbox_ptr list, uint32_t n)
 {
-    uint32_t i = 0;
-    sbox_list_node *p = list->d.h;
-    if (!list || list->type != so_list || !list->d.h) {
-        return NULL;
+    if (!list || list->type != so_list) {
+        return -1;
     }
+    return __list_grow(list, n);
+}
 
-    while (p && i <= idx) {
-        if (i == idx) {
-            return (sbox_ptr)p->data;
-        } else {
-            i++;
-            p = p->next;
-        }
+uint32_t sbox_list_len(sbox_ptr list)
+{
+    if (!list || list->type != so_list) {
+        return 0;
     }
-    return NULL;
+    return list->d.l.n;
+}
+
+sbox_ptr sbox_list_get(sbox_ptr list, uint32_t idx)
+{
+    if (!list || list->type != so_list || idx >= list->d.l.n) {
+        return NULL;
+    }
+    return (sbox_ptr)list->d.l.v[idx].data;
 }
 
 void sbox_list_del(sbox_ptr list, sbox_ptr target)
 {
-    sbox_list_node *p = NULL;
-    sbox_list_node *q = NULL;
+    uint32_t i;
     if (!list || list->type != so_list || !target) {
         return;
     }
-    p = list->d.h;
 
-    if (p->data == target) {
-        q = p;
-        list->d.h = q->next;
-    } else {
-        while (p->next) {
-            if (p->next->data == target) {
-                q = p->next;
-                p->next = q->next;
-            }
+    for (i = 0; i < list->d.l.n; i++) {
+        if (list->d.l.v[i].data == target) {
+            /* the NULL slot moves down too */
+            memmove(&list->d.l.v[i], &list->d.l.v[i + 1],
+                    (list->d.l.n - i) * sizeof(sbox_list_node));
+            list->d.l.n--;
+            sbox_release(target);
+            return;
         }
     }
-
-    if (q) {
-        sbox_release(q->data);
-        free(q);
-    }
 }
 
 sbox_list_node *sbox_list_first(sbox_ptr list)
 {
-    if (!list || list->type != so_list) {
+    if (!list || list->type != so_list || !list->d.l.n) {
         return NULL;
     }
 
-    return list->d.h;
+    return list->d.l.v;
 }
 
 sbox_list_node *sbox_list_next(sbox_list_node *cur)
 {
-    if (!cur) {
+    if (!cur || !cur[1].data) {
         return NULL;
     }
-    return cur->next;
+    return cur + 1;
 }
 
 static int byte2str(void *data, size_t size, char *buf)
@@ -484,28 +714,45 @@ static void __dict_free_helper(struct rb_node *rb_node)
     return;
 }
 
-static void __list_free_helper(sbox_ptr list)
+static void __hdict_free_helper(sbox_hdict *hd)
 {
-    sbox_list_node *p = list->d.h;
-    sbox_list_node *q = NULL;
+    sbox_kv_pair *p = hd->head;
+    sbox_kv_pair *q = NULL;
     while (p) {
         q = p;
-        p = q->next;
-        sbox_release(q->data);
+        p = q->l.next;
+        sbox_release(q->key);
+        sbox_release(q->value);
         free(q);
     }
+    hashtab_destroy(hd->t);
+    free(hd);
+}
+
+static void __list_free_helper(sbox_ptr list)
+{
+    uint32_t i;
+    for (i = 0; i < list->d.l.n; i++) {
+        sbox_release(list->d.l.v[i].data);
+    }
+    free(list->d.l.v);
 }
 
 void sbox_release(sbox_ptr box)
 {
-    if (box) {
+    /* arena boxes go with their arena */
+    if (box && box->count >= 0) {
         if (atomic_decrement32(&box->count) == 0) {
             switch (box->type) {
             case so_list:
                 __list_free_helper(box);
                 break;
             case so_dict:
-                __dict_free_helper(box->d.root.rb_node);
+                if (box->d.hd) {
+                    __hdict_free_helper(box->d.hd);
+                } else {
+                    __dict_free_helper(box->d.root.rb_node);
+                }
                 break;
             default:
                 break;
@@ -515,3 +762,67 @@ void sbox_release(sbox_ptr box)
     }
     return;
 }
+
+static int __intern_equal(const void *key, size_t len, const hashtab_node_t *node)
+{
+    sbox_ptr box = hashtab_entry(node, sbox_intern_node, node)->box;
+    return box->len - 1 == len && memcmp(box->d.c, key, len) == 0;
+}
+
+sbox_ptr sbox_intern(const char *str)
+{
+    sbox_intern_node *node = NULL;
+    hashtab_node_t *n = NULL;
+    sbox_ptr box = NULL;
+    size_t len;
+
+    if (str == NULL) {
+        return NULL;
+    }
+    len = strlen(str);
+
+    pthread_mutex_lock(&s_intern_lock);
+    if (!s_intern) {
+        /* the same hash as a so_str key of a hashed dict */
+        s_intern = hashtab_create(0, NULL, __intern_equal);
+    }
+    if (s_intern) {
+        n = hashtab_find(s_intern, str, len);
+    }
+    if (n) {
+        box = sbox_hold(hashtab_entry(n, sbox_intern_node, node)->box);
+    } else {
+        box = sbox_new_str(str);
+        node = (sbox_intern_node *)malloc(sizeof(sbox_intern_node));
+        if (box && node && s_intern
+            && hashtab_insert(s_intern, str, len, &node->node, NULL) == 0) {
+            /* one reference for the table */
+            node->box = sbox_hold(box);
+        } else {
+            free(node);
+        }
+    }
+    pthread_mutex_unlock(&s_intern_lock);
+    return box;
+}
+
+void sbox_intern_purge(void)
+{
+    sbox_intern_node *node = NULL;
+    hashtab_node_t *n = NULL;
+    hashtab_iter_t it;
+
+    pthread_mutex_lock(&s_intern_lock);
+    if (s_intern) {
+        for (n = hashtab_first(s_intern, &it); n; n = hashtab_next(s_intern, &it)) {
+            node = hashtab_entry(n, sbox_intern_node, node);
+            /* held by the table only, nobody can get it but through us */
+            if (atomic_load32(&node->box->count) == 1) {
+                hashtab_remove(s_intern, n);
+                sbox_release(node->box);
+                free(node);
+            }
+        }
+    }
+    pthread_mutex_unlock(&s_intern_lock);
+}
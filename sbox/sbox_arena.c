@@ -0,0 +1,184 @@
+/*
+ * sbox_arena.c - sbox arena
+ *
+ * Date   : 2021/04/30
+ */
+
+#include "sbox.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SBOX_ARENA_CHUNK_DEFAULT (64 * 1024)
+#define SBOX_ARENA_ALIGN 8
+
+typedef struct __sbox_arena_chunk {
+    struct __sbox_arena_chunk *next;
+    size_t size;
+    size_t used;
+    uint64_t data[];
+} sbox_arena_chunk;
+
+typedef struct __sbox_arena_cleanup {
+    struct __sbox_arena_cleanup *next;
+    void (*fn)(void *arg);
+    void *arg;
+} sbox_arena_cleanup;
+
+struct __sbox_arena {
+    sbox_arena_chunk *head;     //bump from here, older chunks follow
+    sbox_arena_chunk *big;      //one allocation each
+    sbox_arena_cleanup *cleanup;
+    size_t chunk;
+};
+
+static sbox_arena_chunk *__chunk_new(size_t size)
+{
+    sbox_arena_chunk *c = (sbox_arena_chunk *)malloc(sizeof(sbox_arena_chunk) + size);
+    if (c) {
+        c->next = NULL;
+        c->size = size;
+        c->used = 0;
+    }
+    return c;
+}
+
+static void __chunk_free(sbox_arena_chunk *c)
+{
+    sbox_arena_chunk *next = NULL;
+    while (c) {
+        next = c->next;
+        free(c);
+        c = next;
+    }
+}
+
+static void __cleanup_run(sbox_arena_t *arena)
+{
+    sbox_arena_cleanup *c = arena->cleanup;
+    /* newest first, the entries live in the chunks */
+    while (c) {
+        c->fn(c->arg);
+        c = c->next;
+    }
+    arena->cleanup = NULL;
+}
+
+sbox_arena_t *sbox_arena_create(size_t chunk)
+{
+    sbox_arena_t *arena = NULL;
+    if (chunk == 0) {
+        chunk = SBOX_ARENA_CHUNK_DEFAULT;
+    }
+    chunk = (chunk + SBOX_ARENA_ALIGN - 1) & ~(size_t)(SBOX_ARENA_ALIGN - 1);
+
+    arena = (sbox_arena_t *)calloc(1, sizeof(sbox_arena_t));
+    if (arena) {
+        arena->chunk = chunk;
+        arena->head = __chunk_new(chunk);
+        if (!arena->head) {
+            free(arena);
+            return NULL;
+        }
+    }
+    return arena;
+}
+
+void *sbox_arena_alloc(sbox_arena_t *arena, size_t size)
+{
+    sbox_arena_chunk *c = arena->head;
+    void *p = NULL;
+
+    size = (size + SBOX_ARENA_ALIGN - 1) & ~(size_t)(SBOX_ARENA_ALIGN - 1);
+    if (size <= c->size - c->used) {
+        p = (uint8_t *)c->data + c->used;
+        c->used += size;
+        return p;
+    }
+
+    /* big ones don't waste the rest of the chunk */
+    if (size > arena->chunk / 4) {
+        c = __chunk_new(size);
+        if (!c) {
+            return NULL;
+        }
+        c->used = size;
+        c->next = arena->big;
+        arena->big = c;
+        return c->data;
+    }
+
+    c = __chunk_new(arena->chunk);
+    if (!c) {
+        return NULL;
+    }
+    c->used = size;
+    c->next = arena->head;
+    arena->head = c;
+    return c->data;
+}
+
+int sbox_arena_on_free(sbox_arena_t *arena, void (*fn)(void *arg), void *arg)
+{
+    sbox_arena_cleanup *c = NULL;
+    if (!arena || !fn) {
+        return -1;
+    }
+    c = (sbox_arena_cleanup *)sbox_arena_alloc(arena, sizeof(sbox_arena_cleanup));
+    if (!c) {
+        return -1;
+    }
+    c->fn = fn;
+    c->arg = arg;
+    c->next = arena->cleanup;
+    arena->cleanup = c;
+    return 0;
+}
+
+void sbox_arena_reset(sbox_arena_t *arena)
+{
+    sbox_arena_chunk *c = NULL;
+    if (!arena) {
+        return;
+    }
+
+    __cleanup_run(arena);
+    __chunk_free(arena->big);
+    arena->big = NULL;
+
+    /* keep the first chunk, the one from create */
+    c = arena->head;
+    while (c->next) {
+        arena->head = c->next;
+        free(c);
+        c = arena->head;
+    }
+    c->used = 0;
+}
+
+void sbox_arena_destroy(sbox_arena_t *arena)
+{
+    if (!arena) {
+        return;
+    }
+    __cleanup_run(arena);
+    __chunk_free(arena->big);
+    __chunk_free(arena->head);
+    free(arena);
+}
+
+size_t sbox_arena_used(sbox_arena_t *arena)
+{
+    sbox_arena_chunk *c = NULL;
+    size_t used = 0;
+    if (arena) {
+        for (c = arena->head; c; c = c->next) {
+            used += c->used;
+        }
+        for (c = arena->big; c; c = c->next) {
+            used += c->used;
+        }
+    }
+    return used;
+}
@@ -0,0 +1,653 @@
+/*
+ * sbox_pack.c - sbox MessagePack encoding
+ *
+ * Date   : 2021/04/30
+ */
+
+#include "sbox.h"
+#include "macro.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SBOX_VIEW_DEPTH 64
+
+typedef struct __mp_head {
+    int type;           //sbox_type, -1 nil/ext
+    uint64_t n;         //array elements, map pairs
+    uint64_t payload;   //str/bin/ext bytes after the header
+    int64_t i;
+    double f;
+} mp_head;
+
+static inline uint64_t __be(const uint8_t *p, int n)
+{
+    uint64_t v = 0;
+    int i;
+    for (i = 0; i < n; i++) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+/* @return the data after the header, NULL if avail is short or c1 */
+static const uint8_t *__mp_head(const uint8_t *p, size_t avail, mp_head *h)
+{
+    uint8_t c;
+    size_t need = 1;
+    uint64_t u;
+
+    if (avail < 1) {
+        return NULL;
+    }
+    c = p[0];
+    memset(h, 0, sizeof(*h));
+    h->type = so_int;
+
+    if (c <= 0x7f) {
+        h->i = c;
+    } else if (c >= 0xe0) {
+        h->i = (int8_t)c;
+    } else if ((c & 0xe0) == 0xa0) {
+        h->type = so_str;
+        h->payload = c & 0x1f;
+    } else if ((c & 0xf0) == 0x90) {
+        h->type = so_list;
+        h->n = c & 0x0f;
+    } else if ((c & 0xf0) == 0x80) {
+        h->type = so_dict;
+        h->n = c & 0x0f;
+    } else {
+        /* the size of the header */
+        switch (c) {
+        case 0xc0: case 0xc2: case 0xc3:
+            break;
+        case 0xd4: case 0xd5: case 0xd6: case 0xd7: case 0xd8:
+            break;
+        case 0xcc: case 0xd0: case 0xc4: case 0xd9: case 0xc7:
+            need = 2;
+            break;
+        case 0xcd: case 0xd1: case 0xc5: case 0xda: case 0xc8: case 0xdc:
+        case 0xde:
+            need = 3;
+            break;
+        case 0xce: case 0xd2: case 0xca: case 0xc6: case 0xdb: case 0xc9:
+        case 0xdd: case 0xdf:
+            need = 5;
+            break;
+        case 0xcf: case 0xd3: case 0xcb:
+            need = 9;
+            break;
+        default:
+            return NULL;
+        }
+        if (avail < need) {
+            return NULL;
+        }
+
+        switch (c) {
+        case 0xc0:
+            h->type = -1;
+            break;
+        case 0xc2: case 0xc3:
+            h->i = c & 1;
+            break;
+        case 0xcc: case 0xcd: case 0xce: case 0xcf:
+            h->i = (int64_t)__be(p + 1, need - 1);
+            break;
+        case 0xd0:
+            h->i = (int8_t)p[1];
+            break;
+        case 0xd1:
+            h->i = (int16_t)__be(p + 1, 2);
+            break;
+        case 0xd2:
+            h->i = (int32_t)__be(p + 1, 4);
+            break;
+        case 0xd3:
+            h->i = (int64_t)__be(p + 1, 8);
+            break;
+        case 0xca: {
+            uint32_t bits = (uint32_t)__be(p + 1, 4);
+            float f;
+            memcpy(&f, &bits, sizeof(f));
+            h->type = so_float;
+            h->f = f;
+            break;
+        }
+        case 0xcb:
+            u = __be(p + 1, 8);
+            h->type = so_float;
+            memcpy(&h->f, &u, sizeof(h->f));
+            break;
+        case 0xd9: case 0xda: case 0xdb:
+            h->type = so_str;
+            h->payload = __be(p + 1, need - 1);
+            break;
+        case 0xc4: case 0xc5: case 0xc6:
+            h->type = so_bytes;
+            h->payload = __be(p + 1, need - 1);
+            break;
+        case 0xdc: case 0xdd:
+            h->type = so_list;
+            h->n = __be(p + 1, need - 1);
+            break;
+        case 0xde: case 0xdf:
+            h->type = so_dict;
+            h->n = __be(p + 1, need - 1);
+            break;
+        case 0xd4: case 0xd5: case 0xd6: case 0xd7: case 0xd8:
+            /* fixext: type byte and 1..16 bytes */
+            h->type = -1;
+            h->payload = 1 + (1u << (c - 0xd4));
+            break;
+        case 0xc7: case 0xc8: case 0xc9:
+            /* type byte and data */
+            h->type = -1;
+            h->payload = __be(p + 1, need - 1) + 1;
+            break;
+        }
+    }
+    return p + need;
+}
+
+/* @return the end of the value at p, NULL if it runs past avail */
+static const uint8_t *__mp_skip(const uint8_t *p, size_t avail)
+{
+    uint64_t pending = 1;
+    const uint8_t *q = NULL;
+    mp_head h;
+
+    while (pending) {
+        pending--;
+        q = __mp_head(p, avail, &h);
+        if (!q) {
+            return NULL;
+        }
+        avail -= (size_t)(q - p);
+        if (h.payload > avail) {
+            return NULL;
+        }
+        p = q + h.payload;
+        avail -= (size_t)h.payload;
+
+        if (h.type == so_list) {
+            pending += h.n;
+        } else if (h.type == so_dict) {
+            pending += 2 * h.n;
+        }
+        /* every value takes a byte at least */
+        if (pending > avail) {
+            return NULL;
+        }
+    }
+    return p;
+}
+
+/*------------------------------------------------------------------------*/
+
+void sbox_packer_init(sbox_packer_t *pk, void *buf, size_t size,
+                      sbox_write_fn write, void *param)
+{
+    pk->buf = (uint8_t *)buf;
+    pk->size = size;
+    pk->pos = 0;
+    pk->write = write;
+    pk->param = param;
+    pk->error = 0;
+}
+
+int sbox_packer_flush(sbox_packer_t *pk)
+{
+    if (pk->error) {
+        return -1;
+    }
+    if (pk->pos && pk->write) {
+        if (pk->write(pk->param, pk->buf, pk->pos) != 0) {
+            pk->error = 1;
+            return -1;
+        }
+        pk->pos = 0;
+    }
+    return 0;
+}
+
+static int __put(sbox_packer_t *pk, const void *data, size_t len)
+{
+    if (pk->error) {
+        return -1;
+    }
+    if (pk->size - pk->pos < len) {
+        if (!pk->write || sbox_packer_flush(pk) != 0) {
+            pk->error = 1;
+            return -1;
+        }
+        if (len > pk->size) {
+            /* bigger than the buffer, straight through */
+            if (pk->write(pk->param, data, len) != 0) {
+                pk->error = 1;
+                return -1;
+            }
+            return 0;
+        }
+    }
+    memcpy(pk->buf + pk->pos, data, len);
+    pk->pos += len;
+    return 0;
+}
+
+/* code and the low n bytes of v, big endian */
+static int __put_head(sbox_packer_t *pk, uint8_t code, uint64_t v, int n)
+{
+    uint8_t b[9];
+    int i;
+
+    b[0] = code;
+    for (i = n; i > 0; i--) {
+        b[i] = (uint8_t)v;
+        v >>= 8;
+    }
+    return __put(pk, b, n + 1);
+}
+
+/* fix form (none if fix is 0), then 8, 16, 32 bits of length */
+static int __put_len(sbox_packer_t *pk, uint32_t n, uint8_t fix, uint32_t fixmax,
+                     uint8_t code8, uint8_t code16)
+{
+    if (fix && n <= fixmax) {
+        return __put_head(pk, (uint8_t)(fix | n), 0, 0);
+    } else if (code8 && n <= 0xff) {
+        return __put_head(pk, code8, n, 1);
+    } else if (n <= 0xffff) {
+        return __put_head(pk, code16, n, 2);
+    } else {
+        return __put_head(pk, code16 + 1, n, 4);
+    }
+}
+
+int sbox_pack_nil(sbox_packer_t *pk)
+{
+    return __put_head(pk, 0xc0, 0, 0);
+}
+
+int sbox_pack_int(sbox_packer_t *pk, int64_t i)
+{
+    if (i >= 0) {
+        if (i <= 0x7f) {
+            return __put_head(pk, (uint8_t)i, 0, 0);
+        } else if (i <= 0xff) {
+            return __put_head(pk, 0xcc, (uint64_t)i, 1);
+        } else if (i <= 0xffff) {
+            return __put_head(pk, 0xcd, (uint64_t)i, 2);
+        } else if (i <= 0xffffffffLL) {
+            return __put_head(pk, 0xce, (uint64_t)i, 4);
+        }
+        return __put_head(pk, 0xcf, (uint64_t)i, 8);
+    }
+    if (i >= -32) {
+        return __put_head(pk, (uint8_t)i, 0, 0);
+    } else if (i >= INT8_MIN) {
+        return __put_head(pk, 0xd0, (uint64_t)i, 1);
+    } else if (i >= INT16_MIN) {
+        return __put_head(pk, 0xd1, (uint64_t)i, 2);
+    } else if (i >= INT32_MIN) {
+        return __put_head(pk, 0xd2, (uint64_t)i, 4);
+    }
+    return __put_head(pk, 0xd3, (uint64_t)i, 8);
+}
+
+int sbox_pack_float(sbox_packer_t *pk, double f)
+{
+    uint64_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return __put_head(pk, 0xcb, bits, 8);
+}
+
+int sbox_pack_str(sbox_packer_t *pk, const char *str, uint32_t len)
+{
+    if (__put_len(pk, len, 0xa0, 0x1f, 0xd9, 0xda) != 0) {
+        return -1;
+    }
+    return __put(pk, str, len);
+}
+
+int sbox_pack_bytes(sbox_packer_t *pk, const void *data, uint32_t len)
+{
+    if (__put_len(pk, len, 0, 0, 0xc4, 0xc5) != 0) {
+        return -1;
+    }
+    return __put(pk, data, len);
+}
+
+int sbox_pack_list(sbox_packer_t *pk, uint32_t n)
+{
+    return __put_len(pk, n, 0x90, 0x0f, 0, 0xdc);
+}
+
+int sbox_pack_dict(sbox_packer_t *pk, uint32_t n)
+{
+    return __put_len(pk, n, 0x80, 0x0f, 0, 0xde);
+}
+
+int sbox_pack(sbox_packer_t *pk, sbox_ptr box)
+{
+    sbox_list_node *node = NULL;
+    sbox_kv_pair *pair = NULL;
+    uint32_t n = 0;
+
+    if (!box) {
+        return sbox_pack_nil(pk);
+    }
+
+    switch (box->type) {
+    case so_int:
+        return sbox_pack_int(pk, box->d.i);
+    case so_float:
+        return sbox_pack_float(pk, box->d.f);
+    case so_str:
+        return sbox_pack_str(pk, box->d.c, box->len - 1);
+    case so_bytes:
+        return sbox_pack_bytes(pk, box->d.b, box->len);
+    case so_list:
+        sbox_pack_list(pk, sbox_list_len(box));
+        for (node = sbox_list_first(box); node; node = sbox_list_next(node)) {
+            sbox_pack(pk, node->data);
+        }
+        break;
+    case so_dict:
+        for (pair = sbox_dict_first(box); pair; pair = sbox_dict_next(pair)) {
+            n++;
+        }
+        sbox_pack_dict(pk, n);
+        for (pair = sbox_dict_first(box); pair; pair = sbox_dict_next(pair)) {
+            sbox_pack(pk, pair->key);
+            sbox_pack(pk, pair->value);
+        }
+        break;
+    default:
+        return sbox_pack_nil(pk);
+    }
+    return pk->error ? -1 : 0;
+}
+
+ssize_t sbox_pack_buf(sbox_ptr box, void *buf, size_t size)
+{
+    sbox_packer_t pk;
+
+    sbox_packer_init(&pk, buf, size, NULL, NULL);
+    if (sbox_pack(&pk, box) != 0) {
+        return -1;
+    }
+    return (ssize_t)pk.pos;
+}
+
+static int __count(void *param, const void *data, size_t len)
+{
+    (void)data;
+    *(size_t *)param += len;
+    return 0;
+}
+
+size_t sbox_pack_size(sbox_ptr box)
+{
+    uint8_t buf[256];
+    size_t size = 0;
+    sbox_packer_t pk;
+
+    sbox_packer_init(&pk, buf, sizeof(buf), __count, &size);
+    sbox_pack(&pk, box);
+    sbox_packer_flush(&pk);
+    return size;
+}
+
+/*------------------------------------------------------------------------*/
+
+ssize_t sbox_view_init(sbox_view_t *v, const void *buf, size_t len)
+{
+    const uint8_t *end = NULL;
+
+    if (!buf) {
+        return -1;
+    }
+    end = __mp_skip((const uint8_t *)buf, len);
+    if (!end) {
+        return -1;
+    }
+    v->p = (const uint8_t *)buf;
+    return (ssize_t)(end - v->p);
+}
+
+int sbox_view_type(const sbox_view_t *v)
+{
+    mp_head h;
+    __mp_head(v->p, SIZE_MAX, &h);
+    return h.type;
+}
+
+int64_t sbox_view_int(const sbox_view_t *v)
+{
+    mp_head h;
+    __mp_head(v->p, SIZE_MAX, &h);
+    return h.type == so_int ? h.i : (int64_t)-1;
+}
+
+double sbox_view_float(const sbox_view_t *v)
+{
+    mp_head h;
+    __mp_head(v->p, SIZE_MAX, &h);
+    return h.type == so_float ? h.f : (double)0.0;
+}
+
+const char *sbox_view_str(const sbox_view_t *v, uint32_t *len)
+{
+    const uint8_t *data = NULL;
+    mp_head h;
+
+    data = __mp_head(v->p, SIZE_MAX, &h);
+    if (h.type != so_str) {
+        return NULL;
+    }
+    if (len) {
+        *len = (uint32_t)h.payload;
+    }
+    return (const char *)data;
+}
+
+const void *sbox_view_bytes(const sbox_view_t *v, uint32_t *len)
+{
+    const uint8_t *data = NULL;
+    mp_head h;
+
+    data = __mp_head(v->p, SIZE_MAX, &h);
+    if (h.type != so_bytes) {
+        return NULL;
+    }
+    if (len) {
+        *len = (uint32_t)h.payload;
+    }
+    return data;
+}
+
+uint32_t sbox_view_len(const sbox_view_t *v)
+{
+    mp_head h;
+    __mp_head(v->p, SIZE_MAX, &h);
+    return (h.type == so_list || h.type == so_dict) ? (uint32_t)h.n : 0;
+}
+
+void sbox_view_iter(const sbox_view_t *v, sbox_view_iter_t *it)
+{
+    mp_head h;
+
+    it->p = __mp_head(v->p, SIZE_MAX, &h);
+    if (h.type == so_list) {
+        it->left = h.n;
+    } else if (h.type == so_dict) {
+        it->left = 2 * h.n;
+    } else {
+        it->left = 0;
+    }
+}
+
+int sbox_view_next(sbox_view_iter_t *it, sbox_view_t *out)
+{
+    if (!it->left) {
+        return 0;
+    }
+    out->p = it->p;
+    it->p = __mp_skip(it->p, SIZE_MAX);
+    it->left--;
+    return 1;
+}
+
+int sbox_view_list_get(const sbox_view_t *v, uint32_t idx, sbox_view_t *out)
+{
+    sbox_view_iter_t it;
+    uint32_t i;
+
+    if (sbox_view_type(v) != so_list || idx >= sbox_view_len(v)) {
+        return -1;
+    }
+    sbox_view_iter(v, &it);
+    for (i = 0; i <= idx; i++) {
+        sbox_view_next(&it, out);
+    }
+    return 0;
+}
+
+int sbox_view_dict_get(const sbox_view_t *v, const char *key, uint32_t len,
+                       sbox_view_t *out)
+{
+    sbox_view_iter_t it;
+    sbox_view_t k;
+    const char *s = NULL;
+    uint32_t n;
+
+    if (sbox_view_type(v) != so_dict) {
+        return -1;
+    }
+    sbox_view_iter(v, &it);
+    while (sbox_view_next(&it, &k) && sbox_view_next(&it, out)) {
+        s = sbox_view_str(&k, &n);
+        if (s && n == len && memcmp(s, key, len) == 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static sbox_ptr __view_box(sbox_arena_t *arena, const uint8_t *p, int depth)
+{
+    const uint8_t *data = NULL;
+    sbox_ptr box = NULL;
+    sbox_ptr key = NULL;
+    sbox_ptr value = NULL;
+    sbox_view_iter_t it;
+    sbox_view_t k, e;
+    mp_head h;
+
+    if (depth > SBOX_VIEW_DEPTH) {
+        return NULL;
+    }
+    data = __mp_head(p, SIZE_MAX, &h);
+    switch (h.type) {
+    case so_int:
+        return sbox_arena_new_int(arena, h.i);
+    case so_float:
+        return sbox_arena_new_float(arena, h.f);
+    case so_str:
+        return sbox_arena_new_strn(arena, (const char *)data, (uint32_t)h.payload);
+    case so_bytes:
+        return sbox_arena_new_bytes(arena, (void *)data, (uint32_t)h.payload);
+    case so_list:
+        box = sbox_arena_new_list(arena);
+        if (!box || sbox_list_reserve(box, (uint32_t)h.n) != 0) {
+            sbox_release(box);
+            return NULL;
+        }
+        it.p = data;
+        it.left = h.n;
+        while (sbox_view_next(&it, &e)) {
+            /* a list holds no NULL, nil is dropped */
+            value = __view_box(arena, e.p, depth + 1);
+            if (value) {
+                sbox_list_append(box, value);
+            } else if (sbox_view_type(&e) != -1) {
+                sbox_release(box);
+                return NULL;
+            }
+        }
+        return box;
+    case so_dict:
+        /* wire order kept, string keys shared (not in an arena, the
+         * dict would never release them) */
+        box = sbox_arena_new_hdict(arena);
+        if (!box) {
+            return NULL;
+        }
+        it.p = data;
+        it.left = 2 * h.n;
+        while (sbox_view_next(&it, &k) && sbox_view_next(&it, &e)) {
+            if (sbox_view_type(&k) == so_str) {
+                uint32_t len = 0;
+                const char *s = sbox_view_str(&k, &len);
+                char buf[64];
+                if (!arena && len < sizeof(buf) && !memchr(s, 0, len)) {
+                    memcpy(buf, s, len);
+                    buf[len] = '\0';
+                    key = sbox_intern(buf);
+                } else {
+                    key = sbox_arena_new_strn(arena, s, len);
+                }
+            } else {
+                key = __view_box(arena, k.p, depth + 1);
+            }
+            value = __view_box(arena, e.p, depth + 1);
+            if (key && value) {
+                sbox_dict_insert(box, key, value);
+            } else {
+                sbox_release(key);
+                sbox_release(value);
+                if ((!key && sbox_view_type(&k) != -1)
+                    || (!value && sbox_view_type(&e) != -1)) {
+                    sbox_release(box);
+                    return NULL;
+                }
+            }
+        }
+        return box;
+    default:
+        return NULL;
+    }
+}
+
+sbox_ptr sbox_view_box(const sbox_view_t *v)
+{
+    return __view_box(NULL, v->p, 0);
+}
+
+sbox_ptr sbox_arena_view_box(sbox_arena_t *arena, const sbox_view_t *v)
+{
+    return __view_box(arena, v->p, 0);
+}
+
+sbox_ptr sbox_unpack(const void *buf, size_t len)
+{
+    sbox_view_t v;
+
+    if (sbox_view_init(&v, buf, len) < 0) {
+        return NULL;
+    }
+    return sbox_view_box(&v);
+}
+
+sbox_ptr sbox_arena_unpack(sbox_arena_t *arena, const void *buf, size_t len)
+{
+    sbox_view_t v;
+
+    if (sbox_view_init(&v, buf, len) < 0) {
+        return NULL;
+    }
+    return sbox_arena_view_box(arena, &v);
+}
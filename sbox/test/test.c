@@ -9,6 +9,10 @@
 #include <string.h>
 #include <stdint.h>
 #include <unistd.h>
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <assert.h>
 
 #include <time.h>
 
@@ -107,6 +111,446 @@ void list_test(void)
 
 }
 
+void list_bulk_test(void)
+{
+    sbox_ptr list = sbox_new_list();
+    sbox_ptr p = NULL;
+    sbox_list_node *node = NULL;
+    clock_t start;
+    int64_t sum = 0;
+    uint32_t i, n = 1000000;
+
+    start = clock();
+    for (i = 0; i < n; i++) {
+        sbox_list_append(list, sbox_new_int(i));
+    }
+    printf("append %u: %.1fms\n", n, (clock() - start) * 1000.0 / CLOCKS_PER_SEC);
+    assert(sbox_list_len(list) == n);
+
+    start = clock();
+    for (i = 0; i < n; i++) {
+        sum += sbox_get_int(sbox_list_get(list, (uint32_t)((uint64_t)i * 7919 % n)));
+    }
+    printf("get %u: %.1fms\n", n, (clock() - start) * 1000.0 / CLOCKS_PER_SEC);
+    assert(sum == (int64_t)n * (n - 1) / 2);
+    assert(sbox_list_get(list, n) == NULL);
+
+    p = sbox_list_get(list, 10);
+    sbox_list_del(list, p);
+    assert(sbox_list_len(list) == n - 1);
+    assert(sbox_get_int(sbox_list_get(list, 10)) == 11);
+    sbox_list_del(list, sbox_list_get(list, n - 2));
+
+    for (i = 0, node = sbox_list_first(list); node; node = sbox_list_next(node), i++) {
+        assert(sbox_get_int(node->data) == (i < 10 ? i : i + 1));
+    }
+    assert(i == n - 2);
+    sbox_release(list);
+
+    list = sbox_new_list();
+    assert(sbox_list_first(list) == NULL);
+    assert(sbox_list_reserve(list, 1000) == 0);
+    assert(sbox_list_len(list) == 0 && sbox_list_first(list) == NULL);
+    sbox_list_append(list, sbox_new_str("x"));
+    node = sbox_list_first(list);
+    assert(node && sbox_list_next(node) == NULL);
+    sbox_release(list);
+}
+
+void hdict_test(void)
+{
+    sbox_ptr dict = sbox_new_hdict();
+    sbox_ptr a = sbox_intern("alpha");
+    sbox_ptr b = NULL;
+    sbox_kv_pair *pair = NULL;
+    char buf[64];
+    int i;
+
+    b = sbox_intern("alpha");
+    assert(a == b);
+    sbox_release(b);
+
+    sbox_dict_insert(dict, sbox_hold(a), sbox_new_int(1));
+    sbox_dict_insert(dict, sbox_intern("beta"), sbox_new_int(2));
+    sbox_dict_insert(dict, sbox_new_str("gamma"), sbox_new_int(3));
+    sbox_dict_insert(dict, sbox_new_int(4), sbox_new_str("four"));
+    /* update keeps the place */
+    sbox_dict_insert(dict, sbox_intern("beta"), sbox_new_int(20));
+    walk(dict);
+
+    /* a key found by content as well as by pointer */
+    assert(sbox_get_int(sbox_dict_get(dict, sbox_new_str("alpha"))) == 1);
+    assert(sbox_get_int(sbox_dict_get(dict, sbox_intern("gamma"))) == 3);
+    assert(sbox_get_int(sbox_dict_get(dict, sbox_intern("beta"))) == 20);
+    assert(strcmp(sbox_get_str(sbox_dict_get(dict, sbox_new_int(4))), "four") == 0);
+    assert(sbox_dict_get(dict, sbox_new_str("delta")) == NULL);
+
+    sbox_dict_del(dict, sbox_intern("beta"));
+    assert(sbox_dict_get(dict, sbox_intern("beta")) == NULL);
+    pair = sbox_dict_last(dict);
+    assert(sbox_get_int(pair->key) == 4);
+    pair = sbox_dict_prev(pair);
+    assert(strcmp(sbox_get_str(pair->key), "gamma") == 0);
+    walk(dict);
+
+    for (i = 0; i < 10000; i++) {
+        snprintf(buf, sizeof(buf), "k%d", i);
+        sbox_dict_insert(dict, sbox_intern(buf), sbox_new_int(i));
+    }
+    for (i = 0; i < 10000; i += 3) {
+        snprintf(buf, sizeof(buf), "k%d", i);
+        assert(sbox_get_int(sbox_dict_get(dict, sbox_new_str(buf))) == i);
+    }
+    for (i = 0, pair = sbox_dict_first(dict); pair; pair = sbox_dict_next(pair)) {
+        i++;
+    }
+    assert(i == 10003);
+
+    sbox_release(a);
+    sbox_release(dict);
+    sbox_intern_purge();
+    /* purged, boxed again */
+    a = sbox_intern("alpha");
+    assert(a->count == 2);
+    sbox_release(a);
+    sbox_intern_purge();
+}
+
+#define BENCH_FIELDS 20
+#define BENCH_OBJECTS 20000
+
+/* config-like objects: build and read them back */
+void dict_bench(void)
+{
+    static const char *fields[BENCH_FIELDS] = {
+        "id", "name", "host", "port", "user", "password", "timeout", "retry",
+        "path", "mode", "level", "enable", "version", "type", "size",
+        "count", "interval", "address", "mask", "gateway"};
+    sbox_ptr keys[BENCH_FIELDS];
+    sbox_ptr obj = NULL;
+    clock_t start, build, get;
+    int64_t sum = 0;
+    int i, j, hashed;
+
+    for (hashed = 0; hashed < 2; hashed++) {
+        for (j = 0; j < BENCH_FIELDS; j++) {
+            keys[j] = sbox_intern(fields[j]);
+        }
+        build = get = 0;
+        for (i = 0; i < BENCH_OBJECTS; i++) {
+            start = clock();
+            obj = hashed ? sbox_new_hdict() : sbox_new_dict();
+            for (j = 0; j < BENCH_FIELDS; j++) {
+                sbox_dict_insert(obj, hashed ? sbox_hold(keys[j])
+                                             : sbox_new_str(fields[j]),
+                                 sbox_new_int(j));
+            }
+            build += clock() - start;
+
+            start = clock();
+            for (j = 0; j < BENCH_FIELDS; j++) {
+                sum += sbox_get_int(sbox_dict_get(obj, hashed ? sbox_hold(keys[j])
+                                                             : sbox_new_str(fields[j])));
+            }
+            get += clock() - start;
+            sbox_release(obj);
+        }
+        printf("%s: build %.1fms get %.1fms\n",
+               hashed ? "hdict, interned keys" : "dict, boxed keys",
+               build * 1000.0 / CLOCKS_PER_SEC, get * 1000.0 / CLOCKS_PER_SEC);
+        for (j = 0; j < BENCH_FIELDS; j++) {
+            sbox_release(keys[j]);
+        }
+    }
+    assert(sum == 2LL * BENCH_OBJECTS * (BENCH_FIELDS - 1) * BENCH_FIELDS / 2);
+    sbox_intern_purge();
+}
+
+struct sink {
+    uint8_t data[1 << 16];
+    size_t len;
+};
+
+static int sink_write(void *param, const void *data, size_t len)
+{
+    struct sink *s = (struct sink *)param;
+    if (s->len + len > sizeof(s->data)) {
+        return -1;
+    }
+    memcpy(s->data + s->len, data, len);
+    s->len += len;
+    return 0;
+}
+
+void pack_test(void)
+{
+    static const uint8_t expect[] = {0x83, 0xa1, 'a', 0x01, 0xa1, 'b', 0x94, 0xd0,
+                                     0x80, 0xcd, 0x01, 0x00, 0xa2, 'h', 'i', 0xc4,
+                                     0x02, 0x00, 0xff, 0xa1, 'c', 0xcb, 0x3f, 0xf8,
+                                     0, 0, 0, 0, 0, 0};
+    static struct sink sink;
+    sbox_ptr obj = sbox_new_hdict();
+    sbox_ptr list = sbox_new_list();
+    sbox_ptr back = NULL;
+    sbox_packer_t pk;
+    sbox_view_t v, e;
+    sbox_view_iter_t it;
+    static uint8_t buf[1 << 16];
+    uint8_t small[8];
+    uint8_t bin[2] = {0x00, 0xff};
+    const char *s = NULL;
+    char str1[4096], str2[4096];
+    uint32_t len;
+    ssize_t n;
+    int i;
+
+    sbox_list_append(list, sbox_new_int(-128));
+    sbox_list_append(list, sbox_new_int(256));
+    sbox_list_append(list, sbox_new_str("hi"));
+    sbox_list_append(list, sbox_new_bytes(bin, 2));
+    sbox_dict_insert(obj, sbox_intern("a"), sbox_new_int(1));
+    sbox_dict_insert(obj, sbox_intern("b"), list);
+    sbox_dict_insert(obj, sbox_intern("c"), sbox_new_float(1.5));
+
+    n = sbox_pack_buf(obj, buf, sizeof(buf));
+    assert(n == sizeof(expect) && memcmp(buf, expect, n) == 0);
+    assert(sbox_pack_size(obj) == (size_t)n);
+    assert(sbox_pack_buf(obj, buf, n - 1) == -1);
+
+    /* views point into buf */
+    assert(sbox_view_init(&v, buf, n) == n);
+    assert(sbox_view_type(&v) == so_dict && sbox_view_len(&v) == 3);
+    assert(sbox_view_dict_get(&v, "b", 1, &e) == 0 && sbox_view_len(&e) == 4);
+    assert(sbox_view_list_get(&e, 0, &e) == 0 && sbox_view_int(&e) == -128);
+    assert(sbox_view_dict_get(&v, "b", 1, &e) == 0 && sbox_view_list_get(&e, 2, &e) == 0);
+    s = sbox_view_str(&e, &len);
+    assert(len == 2 && memcmp(s, "hi", 2) == 0 && (const uint8_t *)s > buf
+           && (const uint8_t *)s < buf + n);
+    assert(sbox_view_dict_get(&v, "c", 1, &e) == 0 && sbox_view_float(&e) == 1.5);
+    assert(sbox_view_dict_get(&v, "d", 1, &e) == -1);
+    sbox_view_iter(&v, &it);
+    for (i = 0; sbox_view_next(&it, &e); i++) {
+    }
+    assert(i == 6);
+
+    /* every cut is rejected */
+    for (i = 0; i < n; i++) {
+        assert(sbox_view_init(&v, buf, i) == -1);
+    }
+    buf[0] = 0xc1;
+    assert(sbox_view_init(&v, buf, n) == -1);
+    buf[0] = 0x83;
+
+    /* boxes back, printed the same */
+    back = sbox_unpack(buf, n);
+    memset(str1, 0, sizeof(str1));
+    memset(str2, 0, sizeof(str2));
+    sbox_tostr(obj, str1);
+    sbox_tostr(back, str2);
+    assert(strcmp(str1, str2) == 0);
+    printf("%s\n", str2);
+    sbox_release(back);
+
+    /* streamed through an 8 byte buffer */
+    for (i = 0; i < 1000; i++) {
+        sbox_list_append(list, sbox_new_int(i * 1000));
+    }
+    sink.len = 0;
+    sbox_packer_init(&pk, small, sizeof(small), sink_write, &sink);
+    assert(sbox_pack(&pk, obj) == 0 && sbox_packer_flush(&pk) == 0);
+    assert(sink.len == sbox_pack_size(obj));
+    assert(sbox_pack_buf(obj, buf, sizeof(buf)) == (ssize_t)sink.len);
+    assert(memcmp(buf, sink.data, sink.len) == 0);
+    assert(sbox_view_init(&v, sink.data, sink.len) == (ssize_t)sink.len);
+    assert(sbox_view_dict_get(&v, "b", 1, &e) == 0 && sbox_view_len(&e) == 1004);
+    assert(sbox_view_list_get(&e, 1003, &e) == 0 && sbox_view_int(&e) == 999000);
+
+    sbox_release(obj);
+    sbox_intern_purge();
+}
+
+void pack_bench(void)
+{
+    static uint8_t buf[1 << 20];
+    sbox_ptr obj = sbox_new_hdict();
+    sbox_ptr back = NULL;
+    sbox_view_t v, e;
+    clock_t start;
+    char key[32];
+    int64_t sum = 0;
+    ssize_t n;
+    int i, j;
+
+    for (i = 0; i < 1000; i++) {
+        snprintf(key, sizeof(key), "field%d", i);
+        sbox_dict_insert(obj, sbox_intern(key), sbox_new_int(i));
+    }
+    n = sbox_pack_buf(obj, buf, sizeof(buf));
+
+    start = clock();
+    for (j = 0; j < 200; j++) {
+        back = sbox_unpack(buf, n);
+        sum += sbox_get_int(sbox_dict_get(back, sbox_intern("field500")));
+        sbox_release(back);
+    }
+    printf("unpack to boxes: %.1fms\n", (clock() - start) * 1000.0 / CLOCKS_PER_SEC);
+
+    start = clock();
+    for (j = 0; j < 200; j++) {
+        sbox_view_init(&v, buf, n);
+        sbox_view_dict_get(&v, "field500", 8, &e);
+        sum += sbox_view_int(&e);
+    }
+    printf("view: %.1fms\n", (clock() - start) * 1000.0 / CLOCKS_PER_SEC);
+    assert(sum == 400 * 500);
+
+    sbox_release(obj);
+    sbox_intern_purge();
+}
+
+void arena_test(void)
+{
+    sbox_arena_t *arena = sbox_arena_create(1024);
+    sbox_ptr doc, list, key, back;
+    sbox_list_node *node = NULL;
+    sbox_kv_pair *pair = NULL;
+    static uint8_t buf[16384];
+    uint8_t big[2048];
+    char k[32];
+    ssize_t n;
+    int i, round;
+
+    assert(arena && sbox_arena_used(arena) == 0);
+    memset(big, 0xa5, sizeof(big));
+
+    for (round = 0; round < 3; round++) {
+        doc = sbox_arena_new_hdict(arena);
+        assert(sbox_arena_of(doc) == arena);
+        list = sbox_arena_new_list(arena);
+        for (i = 0; i < 300; i++) {
+            sbox_list_append(list, sbox_arena_new_int(arena, i));
+        }
+        sbox_dict_insert(doc, sbox_arena_new_str(arena, "list"), list);
+        for (i = 0; i < 100; i++) {
+            snprintf(k, sizeof(k), "k%d", i);
+            sbox_dict_insert(doc, sbox_arena_new_str(arena, k), sbox_arena_new_float(arena, i / 2.0));
+        }
+        /* replace, delete: the old ones stay in the arena */
+        sbox_dict_insert(doc, sbox_arena_new_str(arena, "k7"), sbox_arena_new_str(arena, "seven"));
+        sbox_dict_del(doc, sbox_arena_new_str(arena, "k8"));
+        sbox_list_del(list, sbox_list_get(list, 0));
+        sbox_dict_insert(doc, sbox_arena_new_str(arena, "big"), sbox_arena_new_bytes(arena, big, sizeof(big)));
+
+        /* no counting */
+        assert(sbox_hold(doc) == doc);
+        sbox_release(doc);
+        sbox_release(doc);
+
+        assert(sbox_list_len(list) == 299 && sbox_get_int(sbox_list_get(list, 298)) == 299);
+        for (i = 1, node = sbox_list_first(list); node; node = sbox_list_next(node), i++) {
+            assert(sbox_get_int(node->data) == i);
+        }
+        assert(i == 300);
+        key = sbox_arena_new_str(arena, "k7");
+        assert(strcmp(sbox_get_str(sbox_dict_get(doc, key)), "seven") == 0);
+        assert(sbox_dict_get(doc, sbox_arena_new_str(arena, "k8")) == NULL);
+        assert(sbox_get_float(sbox_dict_get(doc, sbox_arena_new_str(arena, "k99"))) == 49.5);
+        pair = sbox_dict_first(doc);
+        assert(strcmp(sbox_get_str(pair->key), "list") == 0);
+
+        /* the same document from the wire */
+        n = sbox_pack_buf(doc, buf, sizeof(buf));
+        assert(n > 0);
+        back = sbox_arena_unpack(arena, buf, n);
+        assert(sbox_arena_of(back) == arena);
+        assert(sbox_pack_buf(back, buf + n, sizeof(buf) - n) == n);
+        assert(memcmp(buf, buf + n, n) == 0);
+        back = sbox_dict_get(back, sbox_arena_new_str(arena, "big"));
+        assert(back->len == sizeof(big) && memcmp(back->d.b, big, sizeof(big)) == 0);
+
+        assert(sbox_arena_used(arena) > 8192);
+        sbox_arena_reset(arena);
+        assert(sbox_arena_used(arena) == 0);
+    }
+
+    key = sbox_new_int(0);
+    assert(sbox_arena_of(key) == NULL && sbox_arena_of(NULL) == NULL);
+    sbox_release(key);
+    sbox_arena_destroy(arena);
+}
+
+#define ARENA_DOCS 20000
+
+static sbox_ptr build_doc(sbox_arena_t *arena)
+{
+    sbox_ptr doc = sbox_arena_new_hdict(arena);
+    sbox_ptr tags = sbox_arena_new_list(arena);
+    char key[16];
+    int i;
+
+    for (i = 0; i < 10; i++) {
+        snprintf(key, sizeof(key), "field%d", i);
+        sbox_dict_insert(doc, sbox_arena_new_str(arena, key), sbox_arena_new_int(arena, i));
+    }
+    for (i = 0; i < 20; i++) {
+        sbox_list_append(tags, sbox_arena_new_str(arena, "tag"));
+    }
+    sbox_dict_insert(doc, sbox_arena_new_str(arena, "tags"), tags);
+    return doc;
+}
+
+void arena_bench(void)
+{
+    static uint8_t buf[4096];
+    sbox_arena_t *arena = sbox_arena_create(0);
+    sbox_ptr doc = NULL;
+    clock_t start;
+    size_t sum = 0;
+    ssize_t n;
+    int i;
+
+    /* build and free a request sized document */
+    start = clock();
+    for (i = 0; i < ARENA_DOCS; i++) {
+        doc = build_doc(NULL);
+        sum += sbox_list_len(sbox_dict_get(doc, sbox_new_str("tags")));
+        sbox_release(doc);
+    }
+    printf("build docs, malloc: %.1fms\n", (clock() - start) * 1000.0 / CLOCKS_PER_SEC);
+
+    start = clock();
+    for (i = 0; i < ARENA_DOCS; i++) {
+        doc = build_doc(arena);
+        sum += sbox_list_len(sbox_dict_get(doc, sbox_arena_new_str(arena, "tags")));
+        sbox_arena_reset(arena);
+    }
+    printf("build docs, arena: %.1fms\n", (clock() - start) * 1000.0 / CLOCKS_PER_SEC);
+
+    doc = build_doc(NULL);
+    n = sbox_pack_buf(doc, buf, sizeof(buf));
+    sbox_release(doc);
+
+    start = clock();
+    for (i = 0; i < ARENA_DOCS; i++) {
+        doc = sbox_unpack(buf, n);
+        sum += sbox_list_len(sbox_dict_get(doc, sbox_intern("tags")));
+        sbox_release(doc);
+    }
+    printf("unpack docs, malloc: %.1fms\n", (clock() - start) * 1000.0 / CLOCKS_PER_SEC);
+
+    start = clock();
+    for (i = 0; i < ARENA_DOCS; i++) {
+        doc = sbox_arena_unpack(arena, buf, n);
+        sum += sbox_list_len(sbox_dict_get(doc, sbox_arena_new_str(arena, "tags")));
+        sbox_arena_reset(arena);
+    }
+    printf("unpack docs, arena: %.1fms\n", (clock() - start) * 1000.0 / CLOCKS_PER_SEC);
+    assert(sum == 4 * 20 * ARENA_DOCS);
+
+    sbox_arena_destroy(arena);
+    sbox_intern_purge();
+}
+
 int main(int argc, char* argv[])
 {
     dict_test();
@@ -119,6 +563,13 @@ int main(int argc, char* argv[])
 #endif
 
     list_test();
+    list_bulk_test();
+    hdict_test();
+    dict_bench();
+    pack_test();
+    pack_bench();
+    arena_test();
+    arena_bench();
 
 #if 0
     while(1) {
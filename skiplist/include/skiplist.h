@@ -0,0 +1,80 @@
+/*
+ * skiplist.h - lock-free skiplist
+ *
+ * Date   : 2021/04/30
+ */
+#ifndef __SKIPLIST_H__
+#define __SKIPLIST_H__
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Ordered set of objects, any thread may insert, delete, find and
+ * iterate at the same time without locks (marked next pointers, deleted
+ * nodes are unlinked by whoever walks past them).
+ *
+ * Nodes and deleted objects are reclaimed by epochs: a thread inside
+ * skiplist_read_lock/unlock, or an iteration, keeps every node and
+ * object it may still see alive. Deleted objects go to free_fn once no
+ * such thread is left.
+ */
+typedef struct skiplist skiplist_t;
+
+/// @return <0 if obj_one is less than obj_two, 0 equal, >0 greater.
+/// The key passed to find/delete/seek is the obj_two of the calls
+typedef int (*skiplist_compare_fn)(const void *obj_one, const void *obj_two);
+typedef void (*skiplist_free_fn)(void *obj);
+
+/// @param free_fn deleted objects, after the grace period, NULL to keep
+skiplist_t *skiplist_create(skiplist_compare_fn compare_fn,
+                            skiplist_free_fn free_fn);
+/// no other thread may use it, remaining objects go to free_fn
+void skiplist_destroy(skiplist_t *sl);
+
+/// @param existing_object optional, the object with the same key
+/// @return 0-ok, -EEXIST, -ENOMEM
+int skiplist_insert(skiplist_t *sl, void *object, void **existing_object);
+/// @param deleted_object optional, readable until the grace period ends
+/// @return 0-ok, -ENOENT
+int skiplist_delete(skiplist_t *sl, const void *key, void **deleted_object);
+/// the object may be freed once it returns, unless inside
+/// skiplist_read_lock/unlock
+/// @return NULL if not found
+void *skiplist_find(skiplist_t *sl, const void *key);
+
+/// sum of per-thread counters, exact when no writer runs
+size_t skiplist_count(skiplist_t *sl);
+
+/// nestable, keeps the objects found alive, don't block inside
+void skiplist_read_lock(void);
+void skiplist_read_unlock(void);
+
+/*
+ * Range iteration: objects deleted during the walk may or may not be
+ * returned, inserted ones too, the order holds. The walk holds the read
+ * lock until skiplist_iter_end.
+ *
+ *   for (obj = skiplist_iter_seek(sl, &it, &from); obj && cmp(obj, &to) < 0;
+ *        obj = skiplist_iter_next(&it)) {...}
+ *   skiplist_iter_end(&it);
+ */
+typedef struct skiplist_iter {
+    skiplist_t *sl;
+    struct skiplist_node *node;
+} skiplist_iter_t;
+
+/// @return the first object, NULL if empty
+void *skiplist_iter_first(skiplist_t *sl, skiplist_iter_t *it);
+/// @return the first object >= key, NULL if none
+void *skiplist_iter_seek(skiplist_t *sl, skiplist_iter_t *it, const void *key);
+void *skiplist_iter_next(skiplist_iter_t *it);
+void skiplist_iter_end(skiplist_iter_t *it);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
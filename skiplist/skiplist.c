@@ -0,0 +1,592 @@
+/*
+ * skiplist.c - lock-free skiplist
+ *
+ * Date   : 2021/04/30
+ */
+
+#include "skiplist.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SL_MAX_LEVEL 16 // p = 1/4, fine up to 4^16 objects
+#define SL_COUNTERS 16  // striped element count
+#define EBR_BATCH 64    // retires between tries to advance the epoch
+
+// the low bit of a next pointer marks its node deleted at that level
+#define SL_MARKED(p) ((p) & (uintptr_t)1)
+#define SL_PTR(p) ((struct skiplist_node *)((p) & ~(uintptr_t)1))
+#define SL_LOAD(slot) __atomic_load_n(&(slot), __ATOMIC_ACQUIRE)
+
+struct skiplist_node {
+    void *obj;
+    skiplist_free_fn free_fn;
+    struct skiplist_node *gc_next; // limbo list
+    int refs;                      // insert + delete, the last retires it
+    int level;
+    uintptr_t next[1]; // [level]
+};
+
+struct sl_counter {
+    volatile long n;
+    char pad[64 - sizeof(long)];
+};
+
+struct skiplist {
+    skiplist_compare_fn compare_fn;
+    skiplist_free_fn free_fn;
+    int level; // highest level in use
+    struct sl_counter counts[SL_COUNTERS];
+    struct skiplist_node *head;
+};
+
+//------------------------------------------------------------------------
+// epoch based reclamation, one domain for all the skiplists
+
+struct ebr_thread {
+    volatile uint64_t epoch; // (epoch << 1) | 1 inside a read section
+    int nest;
+    int used;
+    unsigned int id;
+    unsigned int retired;
+    uint32_t seed;
+    struct skiplist_node *limbo[3]; // retired at limbo_epoch, by epoch % 3
+    uint64_t limbo_epoch[3];
+    struct ebr_thread *next;
+};
+
+static uint64_t s_ebr_epoch;
+static struct ebr_thread *s_ebr_threads;
+static unsigned int s_ebr_ids;
+static pthread_once_t s_ebr_once = PTHREAD_ONCE_INIT;
+static pthread_key_t s_ebr_key;
+static pthread_mutex_t s_ebr_orphan_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct ebr_thread s_ebr_orphans; // limbo of the exited threads
+static __thread struct ebr_thread *t_ebr;
+
+static void
+sl_node_reclaim(struct skiplist_node *node)
+{
+    if (node->free_fn && node->obj)
+        node->free_fn(node->obj);
+    free(node);
+}
+
+static void
+ebr_free(struct skiplist_node *node)
+{
+    struct skiplist_node *next;
+
+    for (; node; node = next) {
+        next = node->gc_next;
+        sl_node_reclaim(node);
+    }
+}
+
+// nodes retired at epoch n are unreachable once the epoch is n + 2
+static void
+ebr_collect(struct ebr_thread *t, uint64_t epoch)
+{
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        if (t->limbo[i] && t->limbo_epoch[i] + 2 <= epoch) {
+            ebr_free(t->limbo[i]);
+            t->limbo[i] = NULL;
+        }
+    }
+}
+
+static void
+ebr_limbo_push(struct ebr_thread *t, struct skiplist_node *node, uint64_t epoch)
+{
+    int i = (int)(epoch % 3);
+
+    if (t->limbo_epoch[i] != epoch) {
+        ebr_free(t->limbo[i]); // 3 epochs old at least
+        t->limbo[i]       = NULL;
+        t->limbo_epoch[i] = epoch;
+    }
+    node->gc_next = t->limbo[i];
+    t->limbo[i]   = node;
+}
+
+static void
+ebr_thread_exit(void *param)
+{
+    struct ebr_thread *t = (struct ebr_thread *)param;
+    struct skiplist_node *node, *next;
+    uint64_t epoch;
+    int i;
+
+    epoch = __atomic_load_n(&s_ebr_epoch, __ATOMIC_ACQUIRE);
+    ebr_collect(t, epoch);
+
+    // the rest waits for the epoch to move on, stamped with the current one
+    pthread_mutex_lock(&s_ebr_orphan_lock);
+    for (i = 0; i < 3; i++) {
+        for (node = t->limbo[i]; node; node = next) {
+            next = node->gc_next;
+            ebr_limbo_push(&s_ebr_orphans, node, epoch);
+        }
+        t->limbo[i] = NULL;
+    }
+    pthread_mutex_unlock(&s_ebr_orphan_lock);
+
+    t->nest = 0;
+    __atomic_store_n(&t->epoch, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&t->used, 0, __ATOMIC_RELEASE);
+}
+
+static void
+ebr_init(void)
+{
+    pthread_key_create(&s_ebr_key, ebr_thread_exit);
+}
+
+static struct ebr_thread *
+ebr_self(void)
+{
+    struct ebr_thread *t;
+    int unused;
+
+    if (t_ebr)
+        return t_ebr;
+
+    pthread_once(&s_ebr_once, ebr_init);
+    for (t = __atomic_load_n(&s_ebr_threads, __ATOMIC_ACQUIRE); t; t = t->next) {
+        unused = 0;
+        if (__atomic_compare_exchange_n(&t->used, &unused, 1, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            break;
+    }
+
+    if (!t) {
+        // records are never freed, the walk in ebr_try_advance needs no lock
+        t = (struct ebr_thread *)calloc(1, sizeof(*t));
+        if (!t)
+            abort();
+        t->used = 1;
+        t->id   = __atomic_fetch_add(&s_ebr_ids, 1, __ATOMIC_RELAXED);
+        t->seed = t->id * 2654435761u + 1;
+        t->next = __atomic_load_n(&s_ebr_threads, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&s_ebr_threads, &t->next, t, 0,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+
+    t_ebr = t;
+    pthread_setspecific(s_ebr_key, t);
+    return t;
+}
+
+static void
+ebr_try_advance(void)
+{
+    struct ebr_thread *t;
+    uint64_t epoch, e;
+
+    epoch = __atomic_load_n(&s_ebr_epoch, __ATOMIC_SEQ_CST);
+    for (t = __atomic_load_n(&s_ebr_threads, __ATOMIC_ACQUIRE); t; t = t->next) {
+        e = __atomic_load_n(&t->epoch, __ATOMIC_SEQ_CST);
+        if ((e & 1) && (e >> 1) != epoch)
+            return; // a reader is still in an older epoch
+    }
+
+    if (__atomic_compare_exchange_n(&s_ebr_epoch, &epoch, epoch + 1, 0,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)
+        && 0 == pthread_mutex_trylock(&s_ebr_orphan_lock)) {
+        ebr_collect(&s_ebr_orphans, epoch + 1);
+        pthread_mutex_unlock(&s_ebr_orphan_lock);
+    }
+}
+
+static struct ebr_thread *
+ebr_enter(void)
+{
+    struct ebr_thread *t = ebr_self();
+    uint64_t epoch;
+
+    if (0 == t->nest++) {
+        epoch = __atomic_load_n(&s_ebr_epoch, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&t->epoch, (epoch << 1) | 1, __ATOMIC_SEQ_CST);
+        // announced before any node is read
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        ebr_collect(t, epoch);
+    }
+    return t;
+}
+
+static void
+ebr_leave(struct ebr_thread *t)
+{
+    if (0 == --t->nest)
+        __atomic_store_n(&t->epoch, 0, __ATOMIC_RELEASE);
+}
+
+// node is unlinked from every level
+static void
+ebr_retire(struct ebr_thread *t, struct skiplist_node *node)
+{
+    ebr_limbo_push(t, node, __atomic_load_n(&s_ebr_epoch, __ATOMIC_SEQ_CST));
+    if (0 == ++t->retired % EBR_BATCH)
+        ebr_try_advance();
+}
+
+void
+skiplist_read_lock(void)
+{
+    ebr_enter();
+}
+
+void
+skiplist_read_unlock(void)
+{
+    ebr_leave(t_ebr);
+}
+
+//------------------------------------------------------------------------
+
+static inline int
+sl_cas(uintptr_t *slot, uintptr_t old, uintptr_t new)
+{
+    return __atomic_compare_exchange_n(slot, &old, new, 0, __ATOMIC_ACQ_REL,
+                                       __ATOMIC_ACQUIRE);
+}
+
+static struct skiplist_node *
+sl_node_new(int level)
+{
+    struct skiplist_node *node;
+
+    node = (struct skiplist_node *)calloc(
+        1, offsetof(struct skiplist_node, next) + level * sizeof(uintptr_t));
+    if (node)
+        node->level = level;
+    return node;
+}
+
+static void
+sl_node_put(struct ebr_thread *t, struct skiplist_node *node)
+{
+    if (0 == __atomic_sub_fetch(&node->refs, 1, __ATOMIC_ACQ_REL))
+        ebr_retire(t, node);
+}
+
+static int
+sl_random_level(struct ebr_thread *t)
+{
+    uint32_t r;
+    int level = 1;
+
+    r = t->seed;
+    r ^= r << 13;
+    r ^= r >> 17;
+    r ^= r << 5;
+    t->seed = r;
+
+    while (level < SL_MAX_LEVEL && 0 == (r & 3)) {
+        level++;
+        r >>= 2;
+    }
+    return level;
+}
+
+static void
+sl_raise_level(skiplist_t *sl, int level)
+{
+    int top = __atomic_load_n(&sl->level, __ATOMIC_RELAXED);
+
+    while (top < level
+           && !__atomic_compare_exchange_n(&sl->level, &top, level, 0,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static inline void
+sl_count_add(skiplist_t *sl, struct ebr_thread *t, long n)
+{
+    __atomic_fetch_add(&sl->counts[t->id % SL_COUNTERS].n, n, __ATOMIC_RELAXED);
+}
+
+// preds/succs around key on each level, unlinking the marked nodes met
+// @return 1 if succs[0] holds key
+static int
+sl_find(skiplist_t *sl, const void *key, struct skiplist_node **preds,
+        struct skiplist_node **succs)
+{
+    struct skiplist_node *pred, *curr, *stop;
+    uintptr_t succ;
+    int l, top;
+
+retry:
+    top  = __atomic_load_n(&sl->level, __ATOMIC_RELAXED);
+    pred = sl->head;
+    for (l = SL_MAX_LEVEL - 1; l >= top; l--) {
+        preds[l] = pred;
+        succs[l] = SL_PTR(SL_LOAD(pred->next[l]));
+        if (succs[l])
+            goto retry; // a taller node came in
+    }
+
+    stop = NULL;
+    for (l = top - 1; l >= 0; l--) {
+        curr = SL_PTR(SL_LOAD(pred->next[l]));
+        while (curr) {
+            succ = SL_LOAD(curr->next[l]);
+            if (SL_MARKED(succ)) {
+                if (!sl_cas(&pred->next[l], (uintptr_t)curr, (uintptr_t)SL_PTR(succ)))
+                    goto retry; // pred changed or got marked
+                curr = SL_PTR(succ);
+                continue;
+            }
+            // the level above already compared it
+            if (curr == stop || sl->compare_fn(curr->obj, key) >= 0)
+                break;
+            pred = curr;
+            curr = SL_PTR(succ);
+        }
+        preds[l] = pred;
+        succs[l] = stop = curr;
+    }
+    return succs[0] && 0 == sl->compare_fn(succs[0]->obj, key);
+}
+
+// first node >= key, read only, marked nodes are skipped
+static struct skiplist_node *
+sl_lower(skiplist_t *sl, const void *key)
+{
+    struct skiplist_node *pred, *curr = NULL, *stop = NULL;
+    uintptr_t succ;
+    int l, r;
+
+    pred = sl->head;
+    for (l = __atomic_load_n(&sl->level, __ATOMIC_RELAXED) - 1; l >= 0;
+         l--, stop = curr) {
+        curr = SL_PTR(SL_LOAD(pred->next[l]));
+        while (curr) {
+            succ = SL_LOAD(curr->next[l]);
+            if (SL_MARKED(succ)) {
+                curr = SL_PTR(succ);
+                continue;
+            }
+            if (curr == stop)
+                break;
+            r = sl->compare_fn(curr->obj, key);
+            if (0 == r)
+                return curr; // not deleted at l, so not at 0 either
+            if (r > 0)
+                break;
+            pred = curr;
+            curr = SL_PTR(succ);
+        }
+    }
+    return curr;
+}
+
+static struct skiplist_node *
+sl_skip_marked(struct skiplist_node *node)
+{
+    while (node && SL_MARKED(SL_LOAD(node->next[0])))
+        node = SL_PTR(SL_LOAD(node->next[0]));
+    return node;
+}
+
+skiplist_t *
+skiplist_create(skiplist_compare_fn compare_fn, skiplist_free_fn free_fn)
+{
+    skiplist_t *sl;
+
+    if (!compare_fn)
+        return NULL;
+
+    if (0 != posix_memalign((void **)&sl, 64, sizeof(*sl)))
+        return NULL;
+    memset(sl, 0, sizeof(*sl));
+    sl->compare_fn = compare_fn;
+    sl->free_fn    = free_fn;
+    sl->level      = 1;
+    sl->head       = sl_node_new(SL_MAX_LEVEL);
+    if (!sl->head) {
+        free(sl);
+        return NULL;
+    }
+    return sl;
+}
+
+void
+skiplist_destroy(skiplist_t *sl)
+{
+    struct skiplist_node *node, *next;
+
+    for (node = SL_PTR(sl->head->next[0]); node; node = next) {
+        next = SL_PTR(node->next[0]);
+        sl_node_reclaim(node);
+    }
+    free(sl->head);
+    free(sl);
+}
+
+int
+skiplist_insert(skiplist_t *sl, void *object, void **existing_object)
+{
+    struct skiplist_node *preds[SL_MAX_LEVEL], *succs[SL_MAX_LEVEL], *node;
+    struct ebr_thread *t;
+    uintptr_t next;
+    int l;
+
+    t    = ebr_enter();
+    node = sl_node_new(sl_random_level(t));
+    if (!node) {
+        ebr_leave(t);
+        return -ENOMEM;
+    }
+    node->obj     = object;
+    node->free_fn = sl->free_fn;
+    node->refs    = 2;
+    sl_raise_level(sl, node->level);
+
+    // level 0 decides
+    for (;;) {
+        if (sl_find(sl, object, preds, succs)) {
+            if (existing_object)
+                *existing_object = succs[0]->obj;
+            ebr_leave(t);
+            free(node);
+            return -EEXIST;
+        }
+        for (l = 0; l < node->level; l++)
+            node->next[l] = (uintptr_t)succs[l];
+        if (sl_cas(&preds[0]->next[0], (uintptr_t)succs[0], (uintptr_t)node))
+            break;
+    }
+    sl_count_add(sl, t, 1);
+
+    // the upper levels are hints, stop once a delete marked the node
+    for (l = 1; l < node->level; l++) {
+        for (;;) {
+            next = SL_LOAD(node->next[l]);
+            if (SL_MARKED(next))
+                goto done;
+            if (SL_PTR(next) != succs[l]
+                && !sl_cas(&node->next[l], next, (uintptr_t)succs[l]))
+                goto done;
+            if (sl_cas(&preds[l]->next[l], (uintptr_t)succs[l], (uintptr_t)node))
+                break;
+            sl_find(sl, object, preds, succs);
+            if (succs[0] != node)
+                goto done;
+        }
+    }
+
+done:
+    // a delete that ran before the last link above couldn't unlink it
+    if (SL_MARKED(SL_LOAD(node->next[0])))
+        sl_find(sl, object, preds, succs);
+    sl_node_put(t, node);
+    ebr_leave(t);
+    return 0;
+}
+
+int
+skiplist_delete(skiplist_t *sl, const void *key, void **deleted_object)
+{
+    struct skiplist_node *preds[SL_MAX_LEVEL], *succs[SL_MAX_LEVEL], *node;
+    struct ebr_thread *t;
+    uintptr_t next;
+    int l;
+
+    t = ebr_enter();
+    if (!sl_find(sl, key, preds, succs)) {
+        ebr_leave(t);
+        return -ENOENT;
+    }
+    node = succs[0];
+
+    // top down, level 0 last: an unmarked upper level means alive
+    for (l = node->level - 1; l >= 1; l--) {
+        next = SL_LOAD(node->next[l]);
+        while (!SL_MARKED(next) && !sl_cas(&node->next[l], next, next | 1))
+            next = SL_LOAD(node->next[l]);
+    }
+    for (;;) {
+        next = SL_LOAD(node->next[0]);
+        if (SL_MARKED(next)) {
+            ebr_leave(t); // another delete won
+            return -ENOENT;
+        }
+        if (sl_cas(&node->next[0], next, next | 1))
+            break;
+    }
+    sl_count_add(sl, t, -1);
+
+    if (deleted_object)
+        *deleted_object = node->obj;
+    sl_find(sl, key, preds, succs); // unlinks it
+    sl_node_put(t, node);
+    ebr_leave(t);
+    return 0;
+}
+
+void *
+skiplist_find(skiplist_t *sl, const void *key)
+{
+    struct skiplist_node *node;
+    struct ebr_thread *t;
+    void *obj = NULL;
+
+    t    = ebr_enter();
+    node = sl_skip_marked(sl_lower(sl, key));
+    if (node && 0 == sl->compare_fn(node->obj, key))
+        obj = node->obj;
+    ebr_leave(t);
+    return obj;
+}
+
+size_t
+skiplist_count(skiplist_t *sl)
+{
+    long n = 0;
+    int i;
+
+    for (i = 0; i < SL_COUNTERS; i++)
+        n += __atomic_load_n(&sl->counts[i].n, __ATOMIC_RELAXED);
+    return n > 0 ? (size_t)n : 0;
+}
+
+void *
+skiplist_iter_first(skiplist_t *sl, skiplist_iter_t *it)
+{
+    ebr_enter();
+    it->sl   = sl;
+    it->node = sl_skip_marked(SL_PTR(SL_LOAD(sl->head->next[0])));
+    return it->node ? it->node->obj : NULL;
+}
+
+void *
+skiplist_iter_seek(skiplist_t *sl, skiplist_iter_t *it, const void *key)
+{
+    ebr_enter();
+    it->sl   = sl;
+    it->node = sl_skip_marked(sl_lower(sl, key));
+    return it->node ? it->node->obj : NULL;
+}
+
+void *
+skiplist_iter_next(skiplist_iter_t *it)
+{
+    if (!it->node)
+        return NULL;
+    it->node = sl_skip_marked(SL_PTR(SL_LOAD(it->node->next[0])));
+    return it->node ? it->node->obj : NULL;
+}
+
+void
+skiplist_iter_end(skiplist_iter_t *it)
+{
+    it->node = NULL;
+    ebr_leave(t_ebr);
+}
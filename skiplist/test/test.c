@@ -0,0 +1,352 @@
+/*
+ * test.c - test
+ *
+ * Date   : 2021/04/30
+ */
+
+#include "skiplist.h"
+#include "avl.h"
+#include "system.h"
+#include "thread.h"
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ITEM_MAGIC 0x5a5a5a5a
+#define ITEM_DEAD 0xdeaddead
+
+typedef struct item {
+    uint64_t key;
+    uint32_t magic;
+} item_t;
+
+static long s_allocs;
+static long s_frees;
+
+static int item_cmp(const void *obj_one, const void *obj_two)
+{
+    const item_t *a = (const item_t *)obj_one, *b = (const item_t *)obj_two;
+    return a->key < b->key ? -1 : (a->key > b->key ? 1 : 0);
+}
+
+static item_t *item_new(uint64_t key)
+{
+    item_t *it = (item_t *)malloc(sizeof(*it));
+    it->key    = key;
+    it->magic  = ITEM_MAGIC;
+    __atomic_fetch_add(&s_allocs, 1, __ATOMIC_RELAXED);
+    return it;
+}
+
+static void item_free(void *obj)
+{
+    item_t *it = (item_t *)obj;
+    assert(ITEM_MAGIC == it->magic);
+    it->magic = ITEM_DEAD;
+    __atomic_fetch_add(&s_frees, 1, __ATOMIC_RELAXED);
+    free(it);
+}
+
+static uint64_t rand64(uint64_t *seed)
+{
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+    return *seed;
+}
+
+static void skiplist_basic_test(void)
+{
+    skiplist_t *sl;
+    skiplist_iter_t it;
+    item_t key, *obj, *exist;
+    uint64_t k, last;
+    int i, n;
+
+    sl = skiplist_create(item_cmp, item_free);
+    assert(sl && 0 == skiplist_count(sl));
+    assert(NULL == skiplist_iter_first(sl, &it));
+    skiplist_iter_end(&it);
+
+    // odd keys, shuffled
+    for (i = 0; i < 1000; i++) {
+        k = (uint64_t)(i * 7919 % 1000) * 2 + 1;
+        assert(0 == skiplist_insert(sl, item_new(k), NULL));
+    }
+    obj = item_new(7);
+    assert(-EEXIST == skiplist_insert(sl, obj, (void **)&exist));
+    assert(exist != obj && 7 == exist->key);
+    item_free(obj);
+    assert(1000 == skiplist_count(sl));
+
+    for (k = 0; k < 2001; k++) {
+        key.key = k;
+        obj     = (item_t *)skiplist_find(sl, &key);
+        assert(k % 2 && k < 2000 ? obj && obj->key == k : !obj);
+    }
+
+    // range [100, 200)
+    key.key = 100;
+    for (n = 0, obj = (item_t *)skiplist_iter_seek(sl, &it, &key);
+         obj && obj->key < 200; obj = (item_t *)skiplist_iter_next(&it), n++)
+        assert(obj->key == (uint64_t)(101 + 2 * n));
+    skiplist_iter_end(&it);
+    assert(50 == n);
+
+    for (k = 1; k < 2000; k += 4) {
+        key.key = k;
+        assert(0 == skiplist_delete(sl, &key, NULL));
+        assert(-ENOENT == skiplist_delete(sl, &key, NULL));
+    }
+    assert(500 == skiplist_count(sl));
+
+    last = 0;
+    for (n = 0, obj = (item_t *)skiplist_iter_first(sl, &it); obj;
+         obj = (item_t *)skiplist_iter_next(&it), n++) {
+        assert(obj->key > last && 3 == obj->key % 4);
+        last = obj->key;
+    }
+    skiplist_iter_end(&it);
+    assert(500 == n);
+
+    skiplist_destroy(sl);
+}
+
+//------------------------------------------------------------------------
+
+#define STRESS_KEYS 4096
+#define STRESS_OPS 200000
+
+struct stress {
+    skiplist_t *sl;
+    int id;
+    int scans;
+    long inserted; // successful inserts - successful deletes
+};
+
+static int STDCALL stress_worker(void *param)
+{
+    struct stress *s = (struct stress *)param;
+    skiplist_iter_t it;
+    item_t key, *obj;
+    uint64_t seed = 0x9e3779b97f4a7c15ULL * (s->id + 1), r, last;
+    int i, n;
+
+    for (i = 0; i < STRESS_OPS; i++) {
+        r       = rand64(&seed);
+        key.key = r % STRESS_KEYS;
+        switch (r >> 60) {
+        case 0:
+        case 1:
+        case 2:
+        case 3:
+            obj = item_new(key.key);
+            if (0 == skiplist_insert(s->sl, obj, NULL))
+                s->inserted++;
+            else
+                item_free(obj);
+            break;
+        case 4:
+        case 5:
+        case 6:
+        case 7:
+            if (0 == skiplist_delete(s->sl, &key, NULL))
+                s->inserted--;
+            break;
+        case 8:
+            // ordered walk over a short range, objects stay readable
+            last = 0;
+            for (n = 0, obj = (item_t *)skiplist_iter_seek(s->sl, &it, &key);
+                 obj && n < 32; obj = (item_t *)skiplist_iter_next(&it), n++) {
+                assert(ITEM_MAGIC == obj->magic);
+                assert(0 == n || obj->key > last);
+                last = obj->key;
+            }
+            skiplist_iter_end(&it);
+            s->scans++;
+            break;
+        default:
+            skiplist_read_lock();
+            obj = (item_t *)skiplist_find(s->sl, &key);
+            assert(!obj || (ITEM_MAGIC == obj->magic && key.key == obj->key));
+            skiplist_read_unlock();
+            break;
+        }
+    }
+    return 0;
+}
+
+static void skiplist_stress_test(int nthreads)
+{
+    struct stress s[16];
+    pthread_t threads[16];
+    skiplist_iter_t it;
+    item_t *obj;
+    uint64_t clock, last = 0;
+    long inserted = 0;
+    size_t n = 0;
+    int i;
+
+    clock    = system_clock();
+    for (i = 0; i < nthreads; i++) {
+        memset(&s[i], 0, sizeof(s[i]));
+        s[i].sl = i ? s[0].sl : skiplist_create(item_cmp, item_free);
+        s[i].id = i;
+        thread_create(&threads[i], stress_worker, &s[i]);
+    }
+    for (i = 0; i < nthreads; i++) {
+        thread_destroy(threads[i]);
+        inserted += s[i].inserted;
+    }
+
+    // quiescent: exact count, strictly ordered
+    for (obj = (item_t *)skiplist_iter_first(s[0].sl, &it); obj;
+         obj = (item_t *)skiplist_iter_next(&it), n++) {
+        assert(0 == n || obj->key > last);
+        last = obj->key;
+    }
+    skiplist_iter_end(&it);
+    assert((size_t)inserted == n && n == skiplist_count(s[0].sl));
+
+    skiplist_destroy(s[0].sl);
+    assert(s_frees <= s_allocs); // the rest waits in the epoch lists
+    printf("skiplist stress %d threads: %d ops in %ums, %d left, %ld to "
+           "reclaim\n",
+           nthreads, nthreads * STRESS_OPS,
+           (unsigned int)(system_clock() - clock), (int)n, s_allocs - s_frees);
+}
+
+//------------------------------------------------------------------------
+
+#define BENCH_KEYS 100000
+#define BENCH_OPS 500000
+
+struct bench {
+    skiplist_t *sl;
+    avl_tree_h_td avl;
+    int id;
+    int nthreads;
+};
+
+static avl_tree_compare_code_td avl_item_cmp(void *obj_one, void *obj_two)
+{
+    int r = item_cmp(obj_one, obj_two);
+    return r < 0 ? AVL_TREE_LT : (r > 0 ? AVL_TREE_GT : AVL_TREE_EQ);
+}
+
+// 80% lookups, 10% inserts, 10% deletes; a thread only writes the keys
+// equal to its id modulo nthreads
+static int STDCALL bench_worker(void *param)
+{
+    struct bench *b = (struct bench *)param;
+    uint64_t seed   = 0x2545f4914f6cdd1dULL * (b->id + 1), r, k;
+    item_t key, *obj, *probe;
+    void *found;
+    int i;
+
+    if (b->avl)
+        avl_tree_allocate_object(b->avl, (void **)&probe, sizeof(item_t));
+    for (i = 0; i < BENCH_OPS; i++) {
+        r = rand64(&seed);
+        k = r % BENCH_KEYS;
+        if ((r >> 56) % 10 < 2)
+            k = k - k % b->nthreads + b->id;
+
+        if (b->sl) {
+            key.key = k;
+            if ((r >> 56) % 10 == 0) {
+                obj = item_new(k);
+                if (0 != skiplist_insert(b->sl, obj, NULL))
+                    item_free(obj);
+            } else if ((r >> 56) % 10 == 1) {
+                skiplist_delete(b->sl, &key, NULL);
+            } else {
+                skiplist_find(b->sl, &key);
+            }
+        } else {
+            probe->key = k;
+            if ((r >> 56) % 10 == 0) {
+                avl_tree_allocate_object(b->avl, (void **)&obj, sizeof(item_t));
+                obj->key = k;
+                if (0 != avl_tree_insert(b->avl, obj, NULL))
+                    avl_tree_free_object(b->avl, obj);
+            } else if ((r >> 56) % 10 == 1) {
+                avl_tree_delete(b->avl, probe, NULL);
+            } else {
+                avl_tree_search(b->avl, AVL_TREE_OPTION_EQ, probe, &found, NULL);
+            }
+        }
+    }
+    if (b->avl)
+        avl_tree_free_object(b->avl, probe);
+    return 0;
+}
+
+static uint64_t bench_run(skiplist_t *sl, avl_tree_h_td avl, int nthreads)
+{
+    struct bench b[16];
+    pthread_t threads[16];
+    uint64_t clock;
+    int i;
+
+    clock = system_clock();
+    for (i = 0; i < nthreads; i++) {
+        b[i].sl       = sl;
+        b[i].avl      = avl;
+        b[i].id       = i;
+        b[i].nthreads = nthreads;
+        thread_create(&threads[i], bench_worker, &b[i]);
+    }
+    for (i = 0; i < nthreads; i++)
+        thread_destroy(threads[i]);
+    return system_clock() - clock;
+}
+
+static void skiplist_bench(void)
+{
+    skiplist_t *sl;
+    avl_tree_h_td avl;
+    item_t *obj;
+    uint64_t tsl, tavl;
+    int i, n;
+
+    for (n = 1; n <= 8; n *= 2) {
+        sl = skiplist_create(item_cmp, item_free);
+        avl_tree_init(avl_item_cmp, AVL_TREE_OPTION_DEFAULT, &avl);
+        for (i = 0; i < BENCH_KEYS; i += 2) {
+            skiplist_insert(sl, item_new(i), NULL);
+            avl_tree_allocate_object(avl, (void **)&obj, sizeof(item_t));
+            obj->key = i;
+            avl_tree_insert(avl, obj, NULL);
+        }
+
+        tsl  = bench_run(sl, NULL, n);
+        tavl = bench_run(NULL, avl, n);
+        printf("%d threads: skiplist %5.2f Mops/s, avl+mutex %5.2f Mops/s\n", n,
+               n * BENCH_OPS / 1000.0 / (tsl ? tsl : 1),
+               n * BENCH_OPS / 1000.0 / (tavl ? tavl : 1));
+
+        skiplist_destroy(sl);
+        avl_tree_shutdown(&avl, AVL_FREE_OBJECTS);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    skiplist_basic_test();
+    skiplist_stress_test(1);
+    skiplist_stress_test(4);
+    skiplist_stress_test(8);
+    skiplist_bench();
+    return 0;
+}
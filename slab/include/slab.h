@@ -0,0 +1,99 @@
+/*
+ * slab.h - size-class allocator
+ *
+ * Date   : 2021/04/22
+ */
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Sizes up to SLAB_MAX_SIZE are rounded up to a class, multiples of 16 up
+ * to 64, then two classes per power of two: 16, 32, 48, 64, 96, 128, ...
+ * 3072, 4096. Every class carves SLAB_ARENA_SIZE aligned arenas into
+ * members, a new arena is added whenever the free members run out. A
+ * member carries no header: slab_free() masks its address to find the
+ * arena and the class. Larger sizes go to posix_memalign() with an
+ * arena head of their own.
+ *
+ * Every thread caches free members of each class, linked through their
+ * first word: slab_alloc()/slab_free() of a cached member is a pop/push
+ * on a thread local list, the shared free list of the class is only
+ * locked to move SLAB_CACHE_BATCH members (fewer for big classes,
+ * SLAB_CACHE_BYTES at most) at a time. A cache holds at most two batches
+ * per class and is given back when its thread exits. Double frees aren't
+ * caught.
+ */
+#define SLAB_MIN_SIZE 16
+#define SLAB_MAX_SIZE 4096
+#define SLAB_CLASS_NUM 16
+
+// a power of two, at least 4 * SLAB_MAX_SIZE
+#ifndef SLAB_ARENA_SIZE
+#define SLAB_ARENA_SIZE (64 * 1024)
+#endif
+#ifndef SLAB_CACHE_BATCH
+#define SLAB_CACHE_BATCH 32
+#endif
+#ifndef SLAB_CACHE_BYTES
+#define SLAB_CACHE_BYTES (32 * 1024)
+#endif
+
+typedef struct {
+    size_t size;       // member size of the class
+    uint64_t arenas;   // arenas allocated
+    uint64_t capacity; // members in all arenas
+    uint64_t in_use;   // members handed out by slab_alloc()
+    uint64_t avail;    // free members in the shared free list
+    uint64_t cached;   // free members parked in per-thread caches
+    // members moved from/to the shared free list
+    int64_t alloc;
+    int64_t free;
+    int64_t fail; // slab_alloc() out of memory
+} slab_stat_t;
+
+/*
+ * Allocate size bytes aligned to 16, like malloc(). The signatures match
+ * the malloc hooks of other modules, e.g.
+ * avl_tree_init_v2(cmp, slab_alloc, slab_free, ...).
+ * Return NULL if out of memory.
+ */
+void *slab_alloc(size_t size);
+
+/*
+ * Allocate size bytes set to zero.
+ */
+void *slab_zalloc(size_t size);
+
+/*
+ * Free memory from slab_alloc()/slab_zalloc(), NULL is ignored.
+ */
+void slab_free(void *ptr);
+
+/*
+ * The class serving size, -1 if it is beyond SLAB_MAX_SIZE. O(1).
+ */
+int slab_class(size_t size);
+
+/*
+ * The member size of class cls, 0 if cls is out of range.
+ */
+size_t slab_class_size(int cls);
+
+/*
+ * Statistics of class cls, cls == SLAB_CLASS_NUM reports the large
+ * allocations, alloc/free count the calls there.
+ * Return 0 on success, -1 if cls is out of range.
+ */
+int slab_stat(int cls, slab_stat_t *stat);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
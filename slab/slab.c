@@ -0,0 +1,440 @@
+/*
+ * slab.c - size-class allocator
+ *
+ * Date   : 2021/04/22
+ */
+
+#include "slab.h"
+#include "atomic.h"
+#include "macro.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if (SLAB_ARENA_SIZE & (SLAB_ARENA_SIZE - 1)) || SLAB_ARENA_SIZE < 4 * SLAB_MAX_SIZE
+#error "SLAB_ARENA_SIZE must be a power of two, at least 4 * SLAB_MAX_SIZE"
+#endif
+
+/*
+ * The head of an arena, at its SLAB_ARENA_SIZE aligned start: a member
+ * finds it by masking its address. A large allocation has one too.
+ */
+typedef struct {
+    int cls; // SLAB_CLASS_NUM for a large allocation
+} slab_arena_t;
+
+#define SLAB_ARENA_HEAD ALIGN(sizeof(slab_arena_t), 16)
+#define SLAB_LARGE SLAB_CLASS_NUM
+
+static inline __attribute__((always_inline)) slab_arena_t *
+slab_arena_of(void *ptr)
+{
+    return (slab_arena_t *)((uintptr_t)ptr & ~((uintptr_t)SLAB_ARENA_SIZE - 1));
+}
+
+/*
+ * Free members of a class shared by all threads, linked through their
+ * first word.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    void *top;
+    uint64_t nfree;
+    uint64_t arenas;
+    int64_t alloc; // members handed to the thread caches
+    int64_t free;  // members given back
+    int64_t fail;
+} slab_class_t;
+
+/*
+ * Free members of a class in a thread cache, linked through their
+ * first word.
+ */
+typedef struct {
+    void *top;
+    uint32_t count;
+    uint32_t batch; // members moved from/to the class at a time
+} slab_bin_t;
+
+#define SLAB_CACHE_NONE 0
+#define SLAB_CACHE_LIVE 1 // registered for the flush at thread exit
+#define SLAB_CACHE_DEAD 2 // flushed, the thread is exiting
+
+typedef struct slab_cache {
+    int state;
+    slab_bin_t bins[SLAB_CLASS_NUM];
+    struct slab_cache *prev; // in slab_caches, for slab_stat()
+    struct slab_cache *next;
+} slab_cache_t;
+
+static const size_t slab_sizes[SLAB_CLASS_NUM] = {
+    16,  32,  48,  64,   96,   128,  192,  256,
+    384, 512, 768, 1024, 1536, 2048, 3072, 4096,
+};
+
+static slab_class_t slab_classes[SLAB_CLASS_NUM] = {
+    [0 ... SLAB_CLASS_NUM - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER},
+};
+static pthread_mutex_t slab_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_once_t slab_once = PTHREAD_ONCE_INIT;
+static pthread_key_t slab_key;
+// initial-exec: no __tls_get_addr() call on the fast path of the .so
+static __thread slab_cache_t slab_cache
+    __attribute__((tls_model("initial-exec")));
+static slab_cache_t *slab_caches; // protected by slab_lock
+
+// allocations beyond SLAB_MAX_SIZE
+static volatile int64_t slab_large_alloc;
+static volatile int64_t slab_large_free;
+static volatile int64_t slab_large_fail;
+
+// slab_class(), inlined in the alloc/free fast paths
+static inline __attribute__((always_inline)) int
+slab_class_of(size_t size)
+{
+    unsigned b;
+
+    if (size <= 64) {
+        return size <= 16 ? 0 : (int)((size - 1) >> 4);
+    }
+    if (size > SLAB_MAX_SIZE) {
+        return -1;
+    }
+
+    // size - 1 in [2^b, 2^(b+1)), the class is 1.5 * 2^b or 2^(b+1)
+    b = 63 - __builtin_clzll((unsigned long long)(size - 1));
+    return 4 + (b - 6) * 2 + (((size - 1) >> (b - 1)) & 1);
+}
+
+int
+slab_class(size_t size)
+{
+    return slab_class_of(size);
+}
+
+size_t
+slab_class_size(int cls)
+{
+    if (cls < 0 || cls >= SLAB_CLASS_NUM) {
+        return 0;
+    }
+    return slab_sizes[cls];
+}
+
+static inline uint32_t
+slab_arena_items(int cls)
+{
+    return (uint32_t)((SLAB_ARENA_SIZE - SLAB_ARENA_HEAD) / slab_sizes[cls]);
+}
+
+/*
+ * Add an arena to class c, under c->lock.
+ * Return 0 on success, -1 if out of memory.
+ */
+static int
+slab_grow(slab_class_t *c, int cls)
+{
+    slab_arena_t *arena;
+    uint8_t *p;
+    uint32_t i, n = slab_arena_items(cls);
+
+    arena = (slab_arena_t *)aligned_alloc(SLAB_ARENA_SIZE, SLAB_ARENA_SIZE);
+    if (!arena) {
+        return -1;
+    }
+    arena->cls = cls;
+
+    // linked in address order, the first member on top
+    p = (uint8_t *)arena + SLAB_ARENA_HEAD;
+    for (i = 0; i + 1 < n; i++) {
+        *(void **)(p + i * slab_sizes[cls]) = p + (i + 1) * slab_sizes[cls];
+    }
+    *(void **)(p + i * slab_sizes[cls]) = c->top;
+    c->top = p;
+    c->nfree += n;
+    c->arenas++;
+    return 0;
+}
+
+static void *
+slab_large(size_t size)
+{
+    slab_arena_t *arena;
+
+    // aligned like an arena, slab_free() finds the head the same way
+    if (size > SIZE_MAX - SLAB_ARENA_HEAD
+        || posix_memalign((void **)&arena, SLAB_ARENA_SIZE,
+                          SLAB_ARENA_HEAD + size) != 0) {
+        atomic_increment64(&slab_large_fail);
+        return NULL;
+    }
+
+    arena->cls = SLAB_LARGE;
+    atomic_increment64(&slab_large_alloc);
+    return (uint8_t *)arena + SLAB_ARENA_HEAD;
+}
+
+/*
+ * Take up to n members of class cls, adding an arena if there are none.
+ * Return the first of *got members linked through their first word,
+ * NULL if out of memory.
+ */
+static void *
+slab_get(int cls, uint32_t n, uint32_t *got)
+{
+    slab_class_t *c = &slab_classes[cls];
+    void *first, *last;
+    uint32_t i;
+
+    pthread_mutex_lock(&c->lock);
+    if (c->nfree == 0 && slab_grow(c, cls) != 0) {
+        c->fail++;
+        pthread_mutex_unlock(&c->lock);
+        *got = 0;
+        return NULL;
+    }
+
+    first = last = c->top;
+    for (i = 1; i < n && i < c->nfree; i++) {
+        last = *(void **)last;
+    }
+    c->top = *(void **)last;
+    c->nfree -= i;
+    c->alloc += i;
+    pthread_mutex_unlock(&c->lock);
+
+    *got = i;
+    return first;
+}
+
+/*
+ * Give n members linked from first to last back to class cls.
+ */
+static void
+slab_put(int cls, void *first, void *last, uint32_t n)
+{
+    slab_class_t *c = &slab_classes[cls];
+
+    pthread_mutex_lock(&c->lock);
+    *(void **)last = c->top;
+    c->top = first;
+    c->nfree += n;
+    c->free += n;
+    pthread_mutex_unlock(&c->lock);
+}
+
+/*
+ * Give n members of a bin back to their class.
+ */
+static void
+slab_flush(slab_bin_t *bin, int cls, uint32_t n)
+{
+    void *first, *last;
+    uint32_t i;
+
+    if (n == 0 || bin->count == 0) {
+        return;
+    }
+
+    first = last = bin->top;
+    for (i = 1; i < n && i < bin->count; i++) {
+        last = *(void **)last;
+    }
+    bin->top = *(void **)last;
+    bin->count -= i;
+    slab_put(cls, first, last, i);
+}
+
+/*
+ * Thread exit, give the cached members back.
+ */
+static void
+slab_cache_destroy(void *arg)
+{
+    slab_cache_t *cache = (slab_cache_t *)arg;
+    int cls;
+
+    pthread_mutex_lock(&slab_lock);
+    if (cache->prev) {
+        cache->prev->next = cache->next;
+    } else {
+        slab_caches = cache->next;
+    }
+    if (cache->next) {
+        cache->next->prev = cache->prev;
+    }
+    pthread_mutex_unlock(&slab_lock);
+
+    for (cls = 0; cls < SLAB_CLASS_NUM; cls++) {
+        slab_flush(&cache->bins[cls], cls, cache->bins[cls].count);
+    }
+    // later slab calls of this thread, from other destructors, bypass it
+    cache->state = SLAB_CACHE_DEAD;
+}
+
+static void
+slab_cache_key(void)
+{
+    pthread_key_create(&slab_key, slab_cache_destroy);
+}
+
+/*
+ * The cache of this thread, NULL if it can't be used.
+ */
+static slab_cache_t *
+slab_cache_init(void)
+{
+    slab_cache_t *cache = &slab_cache;
+    uint32_t batch;
+    int cls;
+
+    if (cache->state == SLAB_CACHE_DEAD) {
+        return NULL;
+    }
+
+    // nothing cached yet, without the key it would leak at thread exit
+    pthread_once(&slab_once, slab_cache_key);
+    if (pthread_setspecific(slab_key, cache) != 0) {
+        return NULL;
+    }
+
+    for (cls = 0; cls < SLAB_CLASS_NUM; cls++) {
+        batch = SLAB_CACHE_BYTES / slab_sizes[cls];
+        batch = batch > SLAB_CACHE_BATCH ? SLAB_CACHE_BATCH : batch;
+        cache->bins[cls].batch = batch ? batch : 1;
+    }
+
+    pthread_mutex_lock(&slab_lock);
+    cache->next = slab_caches;
+    if (slab_caches) {
+        slab_caches->prev = cache;
+    }
+    slab_caches  = cache;
+    cache->state = SLAB_CACHE_LIVE;
+    pthread_mutex_unlock(&slab_lock);
+    return cache;
+}
+
+void *
+slab_alloc(size_t size)
+{
+    slab_cache_t *cache = &slab_cache;
+    slab_bin_t *bin;
+    uint32_t n;
+    void *p;
+    int cls;
+
+    cls = slab_class_of(size);
+    if (cls < 0) {
+        return slab_large(size);
+    }
+
+    bin = &cache->bins[cls];
+    if (bin->count) {
+        p        = bin->top;
+        bin->top = *(void **)p;
+        bin->count--;
+        return p;
+    }
+
+    if (cache->state != SLAB_CACHE_LIVE && !slab_cache_init()) {
+        return slab_get(cls, 1, &n);
+    }
+
+    // refill, keep the first one
+    p = slab_get(cls, bin->batch, &n);
+    if (n > 1) {
+        bin->top   = *(void **)p;
+        bin->count = n - 1;
+    }
+    return p;
+}
+
+void *
+slab_zalloc(size_t size)
+{
+    void *p = slab_alloc(size);
+    if (p) {
+        memset(p, 0, size);
+    }
+    return p;
+}
+
+void
+slab_free(void *ptr)
+{
+    slab_cache_t *cache = &slab_cache;
+    slab_arena_t *arena;
+    slab_bin_t *bin;
+    int cls;
+
+    if (!ptr) {
+        return;
+    }
+
+    arena = slab_arena_of(ptr);
+    cls   = arena->cls;
+    if (cls == SLAB_LARGE) {
+        atomic_increment64(&slab_large_free);
+        free(arena);
+        return;
+    }
+
+    if (cache->state != SLAB_CACHE_LIVE && !slab_cache_init()) {
+        slab_put(cls, ptr, ptr, 1);
+        return;
+    }
+
+    bin = &cache->bins[cls];
+    *(void **)ptr = bin->top;
+    bin->top      = ptr;
+    if (++bin->count >= 2 * bin->batch) {
+        slab_flush(bin, cls, bin->batch);
+    }
+}
+
+int
+slab_stat(int cls, slab_stat_t *stat)
+{
+    slab_cache_t *cache;
+    slab_class_t *c;
+
+    if (!stat || cls < 0 || cls > SLAB_CLASS_NUM) {
+        return -1;
+    }
+
+    memset(stat, 0, sizeof(*stat));
+    if (cls == SLAB_CLASS_NUM) {
+        stat->alloc  = atomic_load64(&slab_large_alloc);
+        stat->free   = atomic_load64(&slab_large_free);
+        stat->fail   = atomic_load64(&slab_large_fail);
+        stat->in_use = (uint64_t)(stat->alloc - stat->free);
+        return 0;
+    }
+
+    c          = &slab_classes[cls];
+    stat->size = slab_sizes[cls];
+    pthread_mutex_lock(&c->lock);
+    stat->arenas   = c->arenas;
+    stat->capacity = c->arenas * slab_arena_items(cls);
+    stat->avail    = c->nfree;
+    stat->alloc    = c->alloc;
+    stat->free     = c->free;
+    stat->fail     = c->fail;
+    pthread_mutex_unlock(&c->lock);
+
+    // the caches of other threads are read on the fly
+    pthread_mutex_lock(&slab_lock);
+    for (cache = slab_caches; cache; cache = cache->next) {
+        stat->cached += cache->bins[cls].count;
+    }
+    pthread_mutex_unlock(&slab_lock);
+
+    // the caches are read unlocked, don't go below zero
+    stat->in_use = stat->capacity > stat->avail + stat->cached ?
+                       stat->capacity - stat->avail - stat->cached :
+                       0;
+    return 0;
+}
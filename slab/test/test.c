@@ -0,0 +1,228 @@
+/*
+ * test.c - test
+ *
+ * Date   : 2021/04/22
+ */
+
+#include "avl.h"
+#include "macro.h"
+#include "slab.h"
+#include "system.h"
+#include "thread.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <assert.h>
+
+typedef struct {
+    int key;
+    char name[20];
+} my_object_t;
+
+static avl_tree_compare_code_td
+my_compare_fn(void *obj1, void *obj2)
+{
+    int a = ((my_object_t *)obj1)->key;
+    int b = ((my_object_t *)obj2)->key;
+
+    if (a > b) {
+        return AVL_TREE_GT;
+    } else if (a < b) {
+        return AVL_TREE_LT;
+    }
+    return AVL_TREE_EQ;
+}
+
+int
+slab_class_test(void)
+{
+    size_t size;
+    int cls;
+
+    for (size = 0; size <= SLAB_MAX_SIZE; size++) {
+        cls = slab_class(size);
+        assert(cls >= 0 && cls < SLAB_CLASS_NUM);
+        assert(slab_class_size(cls) >= size);
+        assert(cls == 0 || slab_class_size(cls - 1) < size);
+    }
+    assert(slab_class(SLAB_MAX_SIZE + 1) == -1);
+
+    for (cls = 0; cls < SLAB_CLASS_NUM; cls++) {
+        printf("%zu ", slab_class_size(cls));
+    }
+    printf("\n");
+    return 0;
+}
+
+int
+slab_alloc_test(void)
+{
+    void *p[4096];
+    slab_stat_t stat;
+    int i, cls;
+
+    for (i = 0; i < (int)ARRAY_SIZE(p); i++) {
+        size_t size = (i * 7) % (SLAB_MAX_SIZE + 512) + 1;
+        p[i] = slab_zalloc(size);
+        assert(p[i] && ((uintptr_t)p[i] & 15) == 0);
+        memset(p[i], i & 0xff, size);
+    }
+    for (i = 0; i < (int)ARRAY_SIZE(p); i++) {
+        slab_free(p[i]);
+    }
+    slab_free(NULL);
+
+    for (cls = 0; cls <= SLAB_CLASS_NUM; cls++) {
+        slab_stat(cls, &stat);
+        if (stat.arenas || stat.alloc) {
+            printf("class: %2d size: %4zu arenas: %lu capacity: %5lu "
+                   "in_use: %lu avail: %lu cached: %lu alloc: %ld free: %ld "
+                   "fail: %ld\n",
+                   cls, stat.size, (unsigned long)stat.arenas,
+                   (unsigned long)stat.capacity, (unsigned long)stat.in_use,
+                   (unsigned long)stat.avail, (unsigned long)stat.cached,
+                   (long)stat.alloc, (long)stat.free, (long)stat.fail);
+        }
+        // freed members are cached or back in the free list
+        assert(stat.in_use == 0);
+    }
+    slab_stat(SLAB_CLASS_NUM, &stat);
+    assert(stat.alloc > 0 && stat.alloc == stat.free);
+    return 0;
+}
+
+// a class grows as long as there is memory
+int
+slab_grow_test(void)
+{
+    const int n = 300000;
+    void **p = (void **)malloc(n * sizeof(void *));
+    slab_stat_t stat;
+    int i;
+
+    assert(p);
+    for (i = 0; i < n; i++) {
+        p[i] = slab_alloc(24);
+        assert(p[i]);
+        *(int *)p[i] = i;
+    }
+    slab_stat(slab_class(24), &stat);
+    printf("grow: arenas: %lu capacity: %lu in_use: %lu\n",
+           (unsigned long)stat.arenas, (unsigned long)stat.capacity,
+           (unsigned long)stat.in_use);
+    assert(stat.in_use >= (uint64_t)n);
+    for (i = 0; i < n; i++) {
+        assert(*(int *)p[i] == i);
+        slab_free(p[i]);
+    }
+    free(p);
+    return 0;
+}
+
+int
+slab_avl_test(void)
+{
+    avl_tree_h_td tree = NULL;
+    my_object_t *obj, *key, *found;
+    avl_tree_search_options_td result;
+    int i, rc;
+
+    rc = avl_tree_init_v2(my_compare_fn, slab_alloc, slab_free,
+                          AVL_TREE_OPTION_DEFAULT, &tree);
+    assert(rc == 0);
+
+    for (i = 0; i < 10000; i++) {
+        rc = avl_tree_allocate_object(tree, (void **)&obj, sizeof(*obj));
+        assert(rc == 0);
+        obj->key = i;
+        snprintf(obj->name, sizeof(obj->name), "obj%d", i);
+        rc = avl_tree_insert(tree, obj, NULL);
+        assert(rc == 0);
+    }
+
+    // avl only compares objects with its own header
+    rc = avl_tree_allocate_object(tree, (void **)&key, sizeof(*key));
+    assert(rc == 0);
+    key->key = 4321;
+    rc = avl_tree_search(tree, AVL_TREE_OPTION_EQ, key, (void **)&found,
+                         &result);
+    assert(rc == 0 && found && strcmp(found->name, "obj4321") == 0);
+    avl_tree_free_object(tree, key);
+    printf("avl with slab hooks: %u objects\n", avl_tree_count(tree));
+
+    avl_tree_shutdown(&tree, AVL_FREE_OBJECTS);
+    return 0;
+}
+
+// slab.c is built like the rest of the tree, unoptimized by default, while
+// malloc is libc's optimized code: compare with CMAKE_BUILD_TYPE=Release.
+#define BENCH_BURST 64
+#define BENCH_LOOPS 5000
+
+typedef void *(*alloc_fn)(size_t);
+typedef void (*free_fn)(void *);
+
+static alloc_fn bench_alloc;
+static free_fn bench_free;
+
+int
+bench_run(void *arg)
+{
+    void *p[BENCH_BURST];
+    int i, j;
+
+    (void)arg;
+    for (i = 0; i < BENCH_LOOPS; i++) {
+        for (j = 0; j < BENCH_BURST; j++) {
+            p[j] = bench_alloc(16 + (j * 40) % 1000);
+            *(int *)p[j] = j;
+        }
+        for (j = 0; j < BENCH_BURST; j++) {
+            bench_free(p[j]);
+        }
+    }
+    return 0;
+}
+
+int
+slab_benchmark(void)
+{
+    static const char *names[] = {"malloc", "slab"};
+    pthread_t t[16];
+    uint64_t start, cost;
+    int i, n, k;
+
+    for (k = 0; k < 2; k++) {
+        bench_alloc = k ? slab_alloc : malloc;
+        bench_free  = k ? slab_free : free;
+        for (n = 1; n <= (int)ARRAY_SIZE(t); n *= 4) {
+            start = system_clock();
+            for (i = 0; i < n; i++) {
+                thread_create(&t[i], bench_run, NULL);
+            }
+            for (i = 0; i < n; i++) {
+                thread_destroy(t[i]);
+            }
+            cost = system_clock() - start;
+            printf("%-6s threads: %2d alloc/free: %8d cost: %5lums\n", names[k],
+                   n, n * BENCH_LOOPS * BENCH_BURST, (unsigned long)cost);
+        }
+    }
+    return 0;
+}
+
+int
+main(void)
+{
+    slab_class_test();
+    slab_alloc_test();
+    slab_grow_test();
+    slab_avl_test();
+    slab_benchmark();
+    return 0;
+}
@@ -20,23 +20,87 @@ typedef struct twtimer {
 
     void (*ontimeout)(void *param);
     void *param;
+    // 0-one-shot, else re-armed at expire + period before the callback,
+    // on the grid of the first expire, missed periods are skipped
+    uint64_t period;
+
+    // sharded service only, see twtimer_shard_start()
+    struct twtimer_shard *shard; // owner, set by the first start
+    struct twtimer *cmd_next;    // link in the command queue of the owner
+    uint64_t cmd_expire;
+    volatile int32_t cmd;
 } twtimer_t;
 
+#define TIME_WHEEL_MAX_LEVELS 9
+
 typedef struct time_wheel time_wheel_t;
+/// 1ms tick, 5 levels (~49day)
 time_wheel_t *time_wheel_create(uint64_t clock);
+/// @param resolution a tick is 2^resolution ms, 0..16
+/// @param levels 2..TIME_WHEEL_MAX_LEVELS, 256 ticks * 64^(levels-1) ahead
+time_wheel_t *time_wheel_create2(uint64_t clock, int resolution, int levels);
 int time_wheel_destroy(time_wheel_t *tm);
 void time_wheel_dump(time_wheel_t *tm);
 
-/// @return sleep time(ms)
+/// @return start clock of the tick of the next expiry, for a timer in an
+/// upper level the start of its bucket (where it cascades), UINT64_MAX if
+/// empty. O(levels)
+uint64_t time_wheel_next(time_wheel_t *tm);
+
+/// expire timers up to clock, empty buckets are skipped
+/// @return sleep time(ms) until the next expiry (or cascade), INT_MAX if
+/// empty, a timer started meanwhile from another thread needs a wakeup
 int twtimer_process(time_wheel_t *tm, uint64_t clock);
 
-/// one-shoot timeout timer
+/// expire timers up to clock into expired (at most max) with the lock
+/// taken once, the caller runs expired[i]->ontimeout(expired[i]->param)
+/// without it, periodic timers are re-armed already.
+/// Call it again while it returns max.
+/// @param sleep optional, as the return of twtimer_process()
+/// @return number of timers in expired, -EINVAL if max <= 0
+int twtimer_process_batch(time_wheel_t *tm, uint64_t clock,
+                          twtimer_t **expired, int max, int *sleep);
+
+/// one-shoot(or periodic, see period) timeout timer
 /// @return 0-ok, other-error
 int twtimer_start(time_wheel_t *tm, twtimer_t *timer);
 /// @return  0-ok, other-timer can't be stop(timer have triggered or will be
 /// triggered)
 int twtimer_stop(time_wheel_t *tm, twtimer_t *timer);
 
+/*
+ * Sharded timer service: one wheel per worker thread (shard), each only
+ * touched by its owner, the thread calling twtimer_shard_process() on it.
+ * Start/stop from the owner (including from a callback) go directly to
+ * the wheel, from other threads they are posted lock-free to the command
+ * queue of the shard and take effect at its next process, so a remote
+ * stop can't tell if the timer fired already, and the memory of a timer
+ * may be reused only after the owner has seen its last request.
+ * A timer belongs to the shard of its first start, zero it to move it.
+ */
+typedef struct twtimer_service twtimer_service_t;
+typedef struct twtimer_shard twtimer_shard_t;
+
+twtimer_service_t *twtimer_service_create(int nshards, uint64_t clock);
+int twtimer_service_destroy(twtimer_service_t *svc);
+/// @return shard i, NULL if out of range
+twtimer_shard_t *twtimer_service_shard(twtimer_service_t *svc, int i);
+
+int twtimer_shard_id(twtimer_shard_t *shard);
+/// @return timers in the wheel of shard, owner only
+uint64_t twtimer_shard_count(twtimer_shard_t *shard);
+
+/// apply posted requests and run the wheel, the caller becomes the owner
+/// @return sleep time(ms), see twtimer_process()
+int twtimer_shard_process(twtimer_shard_t *shard, uint64_t clock);
+
+/// (re)arm timer to fire at expire, timer->expire is owned by the shard
+/// @return 0-ok(or posted), -EBUSY-timer belongs to another shard
+int twtimer_shard_start(twtimer_shard_t *shard, twtimer_t *timer,
+                        uint64_t expire);
+/// @return 0-ok(or posted), other-timer isn't armed(owner only)/never started
+int twtimer_shard_stop(twtimer_t *timer);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
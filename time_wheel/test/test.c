@@ -8,12 +8,18 @@
 #include "atomic.h"
 #include "thread.h"
 #include "system.h"
+#include "macro.h"
 #include <time.h>
 #include <stdio.h>
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <errno.h>
+#include <limits.h>
 
 #define TIMER 0x3FFFFF
 #define TIMER_RESOLUTION 3
@@ -278,6 +284,303 @@ static void timer_simple_test()
 
 }
 
+static uint64_t s_clock;
+
+static void ontimer4(void* param)
+{
+    twtimer_t *timer = (twtimer_t *)param;
+    // within a tick (8ms) of the expiry
+    assert(s_clock > timer->expire && s_clock - timer->expire <= 16);
+    timer->param = NULL;
+}
+
+static void timer_check_sparse()
+{
+    int i, n, wakeups, sleep;
+    uint64_t now;
+    time_wheel_t *wheel;
+    twtimer_t timers[6];
+    static const uint64_t after[] = {
+        0, 5, 300, 70000, 3600 * 1000, 3 * 24 * 3600 * 1000ULL,
+    };
+
+    now = system_clock();
+    assert(NULL == time_wheel_create2(now, 3, 1));
+    assert(NULL == time_wheel_create2(now, 3, TIME_WHEEL_MAX_LEVELS + 1));
+    // 8ms tick, 256 * 64^3 ticks (~6day)
+    wheel = time_wheel_create2(now, 3, 4);
+    assert(wheel);
+    assert(INT_MAX == twtimer_process(wheel, now));
+    assert(UINT64_MAX == time_wheel_next(wheel));
+
+    memset(timers, 0, sizeof(timers));
+    for (i = 0; i < 6; i++) {
+        timers[i].ontimeout = ontimer4;
+        timers[i].param = &timers[i];
+        timers[i].expire = now + after[5 - i];
+        assert(0 == twtimer_start(wheel, &timers[i]));
+    }
+    assert(time_wheel_next(wheel) <= now);
+
+    // sleep as told, only wake for expiries and cascades
+    s_clock = now;
+    for (wakeups = 0; ; wakeups++) {
+        sleep = twtimer_process(wheel, s_clock);
+        if (INT_MAX == sleep)
+            break;
+        s_clock += sleep ? sleep : 1;
+    }
+
+    for (n = i = 0; i < 6; i++)
+        n += (NULL == timers[i].param);
+    printf("sparse: %d timers over %"PRIu64"ms, wakeups: %d\n", n,
+           s_clock - now, wakeups);
+    assert(6 == n && wakeups < 30);
+    time_wheel_destroy(wheel);
+}
+
+struct periodic_test_t {
+    twtimer_t timer;
+    uint64_t first;
+    int counter;
+};
+
+static void ontimer5(void* param)
+{
+    struct periodic_test_t *t = (struct periodic_test_t *)param;
+    t->counter++;
+    // re-armed already, still on the grid of the first expire
+    assert(0 == (t->timer.expire - t->first) % t->timer.period);
+    assert(t->timer.expire >= s_clock);
+}
+
+static void timer_check_periodic()
+{
+    int i, n, m, step, sleep;
+    uint64_t now, start, cost[2];
+    time_wheel_t *wheel;
+    struct periodic_test_t t;
+    twtimer_t *expired[64];
+    twtimer_t *timers;
+
+    for (step = 1; step <= 25; step += 6) {
+        now = system_clock();
+        wheel = time_wheel_create(now);
+        memset(&t, 0, sizeof(t));
+        t.timer.ontimeout = ontimer5;
+        t.timer.param = &t;
+        t.timer.period = 10;
+        t.timer.expire = t.first = now + 10;
+        twtimer_start(wheel, &t.timer);
+
+        // a late process runs the callback once, missed periods are skipped
+        for (m = 0; m * step < 1000; m++) {
+            s_clock = now + m * step;
+            twtimer_process(wheel, s_clock);
+        }
+        m--;
+        printf("periodic: step: %2d callbacks: %d\n", step, t.counter);
+        assert(t.counter == (step < 10 ? (m * step - 1) / 10 : m));
+
+        assert(0 == twtimer_stop(wheel, &t.timer));
+        time_wheel_destroy(wheel);
+    }
+
+    // batch, the lock is taken once per call
+    timers = (twtimer_t *)calloc(TIMER, sizeof(twtimer_t));
+    for (m = 0; m < 2; m++) {
+        now = system_clock();
+        wheel = time_wheel_create(now);
+        for (i = 0; i < TIMER; i++) {
+            timers[i].ontimeout = ontimer1;
+            timers[i].param = &n;
+            timers[i].expire = now + i % 1000;
+            twtimer_start(wheel, &timers[i]);
+        }
+
+        n = 0;
+        start = system_clock();
+        if (m) {
+            do {
+                i = twtimer_process_batch(wheel, now + 1000, expired,
+                                          ARRAY_SIZE(expired), &sleep);
+                assert(i >= 0 && i <= (int)ARRAY_SIZE(expired));
+                while (i-- > 0) {
+                    assert(NULL == expired[i]->pprev);
+                    expired[i]->ontimeout(expired[i]->param);
+                }
+            } while (n < TIMER);
+            assert(INT_MAX == sleep);
+        } else {
+            twtimer_process(wheel, now + 1000);
+        }
+        cost[m] = system_clock() - start;
+        assert(TIMER == n);
+        time_wheel_destroy(wheel);
+    }
+    printf("expire %d timers: callback: %"PRIu64"ms batch: %"PRIu64"ms\n",
+           TIMER, cost[0], cost[1]);
+    free(timers);
+}
+
+static void timer_check_shard()
+{
+    int counter = 0;
+    uint64_t now;
+    twtimer_service_t *svc;
+    twtimer_shard_t *s0, *s1;
+    twtimer_t timers[3];
+
+    now = system_clock();
+    svc = twtimer_service_create(2, now);
+    assert(svc);
+    s0 = twtimer_service_shard(svc, 0);
+    s1 = twtimer_service_shard(svc, 1);
+    assert(NULL == twtimer_service_shard(svc, 2));
+
+    memset(timers, 0, sizeof(timers));
+    timers[0].ontimeout = timers[1].ontimeout = timers[2].ontimeout = ontimer1;
+    timers[0].param = timers[1].param = timers[2].param = &counter;
+
+    // the owner of s0 goes straight to its wheel
+    twtimer_shard_process(s0, now);
+    assert(0 == twtimer_shard_start(s0, &timers[0], now + 10));
+    assert(1 == twtimer_shard_count(s0));
+
+    // s1 is remote, posted until it's processed, the last request wins
+    assert(0 == twtimer_shard_start(s1, &timers[1], now + 100));
+    assert(0 == twtimer_shard_stop(&timers[1]));
+    assert(0 == twtimer_shard_start(s1, &timers[1], now + 10));
+    assert(-EBUSY == twtimer_shard_start(s0, &timers[1], now));
+    assert(0 == twtimer_shard_start(s1, &timers[2], now + 10));
+    assert(0 == twtimer_shard_stop(&timers[2]));
+    assert(0 == twtimer_shard_count(s1));
+
+    twtimer_shard_process(s1, now);
+    assert(1 == twtimer_shard_count(s1));
+    twtimer_shard_process(s1, now + 20);
+    assert(1 == counter);
+    twtimer_shard_process(s0, now + 20);
+    assert(2 == counter);
+
+    assert(0 == twtimer_shard_count(s0) && 0 == twtimer_shard_count(s1));
+    twtimer_service_destroy(svc);
+
+    // a new shard, maybe at the address of s0, has no owner until processed
+    svc = twtimer_service_create(2, now);
+    assert(svc);
+    s0 = twtimer_service_shard(svc, 0);
+    memset(timers, 0, sizeof(timers));
+    timers[0].ontimeout = ontimer1;
+    timers[0].param     = &counter;
+    assert(0 == twtimer_shard_start(s0, &timers[0], now + 10));
+    assert(0 == twtimer_shard_count(s0));
+    twtimer_shard_process(s0, now + 20);
+    assert(3 == counter);
+    twtimer_service_destroy(svc);
+}
+
+#define SHARD_TIMERS (1024 * 1024)
+#define SHARD_THREADS 16
+
+struct shard_bench_t {
+    twtimer_service_t *svc;
+    time_wheel_t *wheel;
+    twtimer_t *timers;
+    uint64_t now;
+    volatile int32_t done;
+};
+
+static struct shard_bench_t s_bench;
+
+static int STDCALL shard_bench_worker(void *param)
+{
+    int i, id = (int)(intptr_t)param;
+    int n = SHARD_TIMERS / SHARD_THREADS;
+    twtimer_t *timers = s_bench.timers + id * n;
+    twtimer_shard_t *own = twtimer_service_shard(s_bench.svc, id);
+    twtimer_shard_t *peer;
+
+    // every other timer lives on the next shard, a cross-thread request
+    peer = twtimer_service_shard(s_bench.svc, (id + 1) % SHARD_THREADS);
+    twtimer_shard_process(own, s_bench.now);
+    for (i = 0; i < n; i++) {
+        twtimer_shard_start((i & 1) ? peer : own, &timers[i],
+                            s_bench.now + 60000 + i);
+        if ((i & 1023) == 0)
+            twtimer_shard_process(own, s_bench.now);
+    }
+    for (i = 0; i < n; i++) {
+        twtimer_shard_stop(&timers[i]);
+        if ((i & 1023) == 0)
+            twtimer_shard_process(own, s_bench.now);
+    }
+
+    atomic_increment32(&s_bench.done);
+    while (atomic_load32(&s_bench.done) < SHARD_THREADS)
+        twtimer_shard_process(own, s_bench.now);
+    twtimer_shard_process(own, s_bench.now);
+    return 0;
+}
+
+static int STDCALL shared_bench_worker(void *param)
+{
+    int i, id = (int)(intptr_t)param;
+    int n = SHARD_TIMERS / SHARD_THREADS;
+    twtimer_t *timers = s_bench.timers + id * n;
+
+    for (i = 0; i < n; i++) {
+        timers[i].expire = s_bench.now + 60000 + i;
+        twtimer_start(s_bench.wheel, &timers[i]);
+    }
+    for (i = 0; i < n; i++)
+        twtimer_stop(s_bench.wheel, &timers[i]);
+    return 0;
+}
+
+static void timer_shard_benchmark()
+{
+    int i, k;
+    uint64_t start, cost;
+    pthread_t worker[SHARD_THREADS];
+    static const char *names[] = {"shared", "sharded"};
+
+    for (k = 0; k < 2; k++) {
+        s_bench.now    = system_clock();
+        s_bench.done   = 0;
+        s_bench.timers = (twtimer_t *)calloc(SHARD_TIMERS, sizeof(twtimer_t));
+        assert(s_bench.timers);
+        for (i = 0; i < SHARD_TIMERS; i++)
+            s_bench.timers[i].ontimeout = ontimer3;
+
+        if (k)
+            s_bench.svc = twtimer_service_create(SHARD_THREADS, s_bench.now);
+        else
+            s_bench.wheel = time_wheel_create(s_bench.now);
+
+        start = system_clock();
+        for (i = 0; i < SHARD_THREADS; i++)
+            thread_create(&worker[i], k ? shard_bench_worker : shared_bench_worker,
+                          (void *)(intptr_t)i);
+        for (i = 0; i < SHARD_THREADS; i++)
+            thread_destroy(worker[i]);
+        cost = system_clock() - start;
+
+        printf("%-7s threads: %d timers: %d start+stop cost: %"PRIu64"ms\n",
+               names[k], SHARD_THREADS, SHARD_TIMERS, cost);
+
+        if (k) {
+            for (i = 0; i < SHARD_THREADS; i++)
+                assert(0 == twtimer_shard_count(
+                                twtimer_service_shard(s_bench.svc, i)));
+            twtimer_service_destroy(s_bench.svc);
+        } else {
+            time_wheel_destroy(s_bench.wheel);
+        }
+        free(s_bench.timers);
+    }
+}
+
 void timer_test(void)
 {
     srand((unsigned int)system_clock());
@@ -288,6 +591,10 @@ void timer_test(void)
 	timer_check_cascade2();
     timer_check3();
 	timer_check_remove();
+    timer_check_sparse();
+    timer_check_periodic();
+    timer_check_shard();
+    timer_shard_benchmark();
 
     printf("timer test ok.\n");
 }
@@ -5,34 +5,40 @@
  */
 
 // Timing Wheel Timer(timeout)
-// 64ms per bucket
 // http://www.cs.columbia.edu/~nahum/w6998/papers/sosp87-timing-wheels.pdf
 #include "twtimer.h"
+#include "atomic.h"
 #include "spinlock.h"
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
 
-/* #define TIME_RESOLUTION 3  // (0xFFFFFFFF << 3)/(24 * 3600 * 1000) ~= 397day (8ms)*/
-#define TIME_RESOLUTION 0    // (0xFFFFFFFF) / (24 * 3600 * 1000) ~= 49day (1ms)
-#define TIME(clock) ((clock) >> TIME_RESOLUTION)
-
-
-/*  6bit |  6bit |   6bit |  6bit |   8bit |*/
-/* 111111  111111  111111  111111  11111111*/
+/*
+ * A tick is 2^resolution ms, the default is 1ms.
+ * Level 0 has 256 buckets of one tick, each upper level 64 buckets of a
+ * whole lower level, the default 5 levels cover 2^32 ticks (~49day at 1ms,
+ * ~397day at 8ms).
+ *
+ *  ... |  6bit |  6bit |  6bit |  6bit |   8bit |
+ *      111111  111111  111111  111111  11111111
+ */
 #define TVR_BITS 8
 #define TVN_BITS 6
 #define TVR_SIZE (1 << TVR_BITS)
 #define TVN_SIZE (1 << TVN_BITS)
-#define TVR_MASK (TVR_SIZE - 1)
-#define TVN_MASK (TVN_SIZE - 1)
 
-#define TVR_INDEX(clock) ((int)((clock >> TIME_RESOLUTION) & TVR_MASK))
-#define TVN_INDEX(clock, n)                                                    \
-    ((int)((clock >> (TIME_RESOLUTION + TVR_BITS + (n * TVN_BITS))) & TVN_MASK))
+#define TV_SHIFT(l) ((l) ? TVR_BITS + ((l) - 1) * TVN_BITS : 0)
+#define TV_SIZE(l) ((l) ? TVN_SIZE : TVR_SIZE)
+#define TV_INDEX(tick, l) ((int)(((tick) >> TV_SHIFT(l)) & (TV_SIZE(l) - 1)))
+#define TV_WORDS (TVR_SIZE / 64)
+
+#define TIME(tm, clock) ((clock) >> (tm)->resolution)
 
 struct time_bucket {
     struct twtimer *first;
@@ -43,26 +49,54 @@ struct time_wheel {
 
     uint64_t count;
     uint64_t clock;
+    int resolution;
+    int levels;
 
-    struct time_bucket tv1[TVR_SIZE];  // 8(256)
-    struct time_bucket tv2[TVN_SIZE];  // 6(64)
-    struct time_bucket tv3[TVN_SIZE];  // 6(64)
-    struct time_bucket tv4[TVN_SIZE];  // 6(64)
-    struct time_bucket tv5[TVN_SIZE];  // 6(64)
+    struct time_bucket *tv[TIME_WHEEL_MAX_LEVELS];
+    // a bit per non-empty bucket, upper levels use the first word
+    uint64_t bitmap[TIME_WHEEL_MAX_LEVELS][TV_WORDS];
+    struct time_bucket buckets[];
 };
 
 static int twtimer_add(struct time_wheel *tm, struct twtimer *timer);
-static int twtimer_cascade(struct time_wheel *tm, struct time_bucket *tv,
-                           int index);
+static int twtimer_del(struct time_wheel *tm, struct twtimer *timer);
+static int time_wheel_advance(struct time_wheel *tm, uint64_t clock,
+                              spinlock_t *locker, struct twtimer **expired,
+                              int max);
+static int time_wheel_sleep(struct time_wheel *tm, uint64_t clock);
+static int twtimer_cascade(struct time_wheel *tm, int level, int index);
 
 struct time_wheel *
 time_wheel_create(uint64_t clock)
+{
+    return time_wheel_create2(clock, 0, 5);
+}
+
+struct time_wheel *
+time_wheel_create2(uint64_t clock, int resolution, int levels)
 {
     struct time_wheel *tm;
-    tm = (struct time_wheel *)calloc(1, sizeof(*tm));
+    size_t n;
+    int l;
+
+    if (resolution < 0 || resolution > 16 || levels < 2
+        || levels > TIME_WHEEL_MAX_LEVELS) {
+        return NULL;
+    }
+
+    n  = TVR_SIZE + (size_t)(levels - 1) * TVN_SIZE;
+    tm = (struct time_wheel *)calloc(1, sizeof(*tm)
+                                            + n * sizeof(struct time_bucket));
     if (tm) {
-        tm->count = 0;
-        tm->clock = clock;
+        tm->count      = 0;
+        tm->clock      = clock;
+        tm->resolution = resolution;
+        tm->levels     = levels;
+
+        tm->tv[0] = tm->buckets;
+        for (l = 1; l < levels; l++) {
+            tm->tv[l] = tm->tv[l - 1] + TV_SIZE(l - 1);
+        }
 
         spinlock_create(&tm->locker);
     }
@@ -73,9 +107,12 @@ time_wheel_create(uint64_t clock)
 int
 time_wheel_destroy(struct time_wheel *tm)
 {
+    int r;
+
     assert(0 == tm->count);
-    return spinlock_destroy(&tm->locker);
-    // TODO:
+    r = spinlock_destroy(&tm->locker);
+    free(tm);
+    return r;
 }
 
 static void
@@ -101,11 +138,70 @@ bucket_dump(struct time_bucket *tv, size_t size, const char *prefix)
 void
 time_wheel_dump(struct time_wheel *tm)
 {
-    bucket_dump(tm->tv1, TVR_SIZE, "tv1");
-    bucket_dump(tm->tv2, TVN_SIZE, "tv2");
-    bucket_dump(tm->tv3, TVN_SIZE, "tv3");
-    bucket_dump(tm->tv4, TVN_SIZE, "tv4");
-    bucket_dump(tm->tv5, TVN_SIZE, "tv5");
+    char prefix[8];
+    int l;
+
+    for (l = 0; l < tm->levels; l++) {
+        snprintf(prefix, sizeof(prefix), "tv%d", l + 1);
+        bucket_dump(tm->tv[l], TV_SIZE(l), prefix);
+    }
+}
+
+/*
+ * The first set bit at or after start, circularly.
+ * Return the distance from start, -1 if none.
+ */
+static int
+tw_bitmap_next(const uint64_t *bm, int size, int start)
+{
+    int i, w, n = size / 64;
+    uint64_t x;
+
+    w = start / 64;
+    x = bm[w] & (~0ULL << (start % 64));
+    for (i = 0; i <= n; i++) {
+        if (x) {
+            return (w * 64 + __builtin_ctzll(x) - start) & (size - 1);
+        }
+        w = (w + 1) % n;
+        x = bm[w]; // the last round rechecks the low bits of the first word
+    }
+    return -1;
+}
+
+uint64_t
+time_wheel_next(struct time_wheel *tm)
+{
+    uint64_t tick, next = UINT64_MAX, t;
+    int l, d, ahead;
+
+    if (0 == tm->count) {
+        return UINT64_MAX;
+    }
+
+    // level 0 is exact, including the next round
+    tick = TIME(tm, tm->clock);
+    d    = tw_bitmap_next(tm->bitmap[0], TVR_SIZE, TV_INDEX(tick, 0));
+    if (d >= 0) {
+        next = tick + d;
+    }
+
+    // a timer of an upper level is 1..64 buckets ahead, the start of its
+    // bucket is a lower bound, where it cascades. At a bucket boundary the
+    // current bucket hasn't cascaded yet, it's due now.
+    for (l = 1; l < tm->levels; l++) {
+        ahead = 0 == (tick & ((1ULL << TV_SHIFT(l)) - 1)) ? 0 : 1;
+        d = tw_bitmap_next(tm->bitmap[l], TVN_SIZE,
+                           (TV_INDEX(tick, l) + ahead) & (TVN_SIZE - 1));
+        if (d >= 0) {
+            t = ((tick >> TV_SHIFT(l)) + d + ahead) << TV_SHIFT(l);
+            if (t < next) {
+                next = t;
+            }
+        }
+    }
+
+    return next == UINT64_MAX ? next : next << tm->resolution;
 }
 
 int
@@ -124,48 +220,145 @@ twtimer_start(struct time_wheel *tm, struct twtimer *timer)
 int
 twtimer_stop(struct time_wheel *tm, struct twtimer *timer)
 {
-    struct twtimer **pprev;
+    int r;
 
     spinlock_lock(&tm->locker);
-    pprev = timer->pprev;
-    if (timer->pprev) {
-        --tm->count;  // timer validation ??
-        *timer->pprev = timer->next;
-    }
-
-    if (timer->next)
-        timer->next->pprev = timer->pprev;
-
-    timer->pprev = NULL;
-    timer->next  = NULL;
+    r = twtimer_del(tm, timer);
     spinlock_unlock(&tm->locker);
 
-    return pprev ? 0 : -1;
+    return r;
 }
 
 int
 twtimer_process(struct time_wheel *tm, uint64_t clock)
 {
-    int index;
+    int r;
+
+    spinlock_lock(&tm->locker);
+    time_wheel_advance(tm, clock, &tm->locker, NULL, 0);
+    r = time_wheel_sleep(tm, clock);
+    spinlock_unlock(&tm->locker);
+    return r;
+}
+
+int
+twtimer_process_batch(struct time_wheel *tm, uint64_t clock,
+                      struct twtimer **expired, int max, int *sleep)
+{
+    int n;
+
+    if (max <= 0) {
+        return -EINVAL;
+    }
+
+    spinlock_lock(&tm->locker);
+    n = time_wheel_advance(tm, clock, NULL, expired, max);
+    if (sleep)
+        *sleep = n < max ? time_wheel_sleep(tm, clock) : 0;
+    spinlock_unlock(&tm->locker);
+    return n;
+}
+
+/*
+ * Put a periodic timer back at its next period, on the grid of its first
+ * expire, periods already missed by clock are skipped.
+ */
+static void
+twtimer_rearm(struct time_wheel *tm, struct twtimer *timer, uint64_t clock)
+{
+    uint64_t target;
+
+    if (0 == timer->period)
+        return;
+
+    timer->expire += timer->period;
+    target = TIME(tm, clock) << tm->resolution;
+    if (timer->expire < target) {
+        timer->expire += (target - timer->expire + timer->period - 1)
+                         / timer->period * timer->period;
+    }
+    twtimer_add(tm, timer);
+}
+
+/*
+ * Time from clock to the end of the tick of the next expiry (or cascade),
+ * when a process will trigger it, INT_MAX if none.
+ */
+static int
+time_wheel_sleep(struct time_wheel *tm, uint64_t clock)
+{
+    uint64_t next = time_wheel_next(tm);
+
+    if (next == UINT64_MAX) {
+        return INT_MAX;
+    }
+    next += 1ULL << tm->resolution;
+    if (next <= clock) {
+        return 0;
+    }
+    return next - clock > INT_MAX ? INT_MAX : (int)(next - clock);
+}
+
+/*
+ * Run the wheel up to clock, only the ticks up to the next non-empty
+ * bucket are visited.
+ * With expired, the expired timers are moved there (at most max) and
+ * their number is returned, the clock stops at a tick not drained yet.
+ * Otherwise their callbacks run, locker (if any) is held by the caller
+ * and released around them.
+ */
+static int
+time_wheel_advance(struct time_wheel *tm, uint64_t clock, spinlock_t *locker,
+                   struct twtimer **expired, int max)
+{
+    int index, l, n = 0;
+    uint64_t tick, next;
     struct twtimer *timer;
     struct time_bucket bucket;
 
-    spinlock_lock(&tm->locker);
-    while (TIME(tm->clock) < TIME(clock)) {
-        index = TVR_INDEX(tm->clock);
-
-        if (0 == index
-            && 0 == twtimer_cascade(tm, tm->tv2, TVN_INDEX(tm->clock, 0))
-            && 0 == twtimer_cascade(tm, tm->tv3, TVN_INDEX(tm->clock, 1))
-            && 0 == twtimer_cascade(tm, tm->tv4, TVN_INDEX(tm->clock, 2))) {
-            twtimer_cascade(tm, tm->tv5, TVN_INDEX(tm->clock, 3));
+    while (TIME(tm, tm->clock) < TIME(tm, clock)) {
+        // jump over the empty buckets, next is a tick boundary
+        next = time_wheel_next(tm);
+        if (next > tm->clock) {
+            tm->clock = next < clock ? next : clock;
+            if (TIME(tm, tm->clock) >= TIME(tm, clock)) {
+                break;
+            }
+        }
+
+        tick  = TIME(tm, tm->clock);
+        index = TV_INDEX(tick, 0);
+
+        // each bucket cascades in a single pass over its list
+        if (0 == index) {
+            for (l = 1; l < tm->levels; l++) {
+                if (0 != twtimer_cascade(tm, l, TV_INDEX(tick, l)))
+                    break;
+            }
+        }
+
+        if (expired) {
+            while (tm->tv[0][index].first && n < max) {
+                timer = tm->tv[0][index].first;
+                twtimer_del(tm, timer);
+                expired[n++] = timer;
+                twtimer_rearm(tm, timer, clock);
+            }
+            if (tm->tv[0][index].first)
+                break; // full, the rest of this tick next time
+
+            tm->clock = (tick + 1) << tm->resolution;
+            continue;
         }
 
 
         // move bucket
-        bucket.first         = tm->tv1[index].first;
-        tm->tv1[index].first = NULL;  // clear
-        tm->clock += (1 << TIME_RESOLUTION);
+        bucket.first         = tm->tv[0][index].first;
+        tm->tv[0][index].first = NULL;  // clear
+        tm->bitmap[0][index / 64] &= ~(1ULL << (index % 64));
+        if (bucket.first)
+            bucket.first->pprev = &bucket.first;
+        tm->clock = (tick + 1) << tm->resolution;
 
 
         // trigger timer
@@ -178,25 +371,28 @@ twtimer_process(struct time_wheel *tm, uint64_t clock)
             timer->next  = NULL;
             timer->pprev = NULL;
             --tm->count;
+            twtimer_rearm(tm, timer, clock);
             if (timer->ontimeout) {
-                spinlock_unlock(&tm->locker);
+                if (locker)
+                    spinlock_unlock(locker);
                 timer->ontimeout(timer->param);
-                spinlock_lock(&tm->locker);
+                if (locker)
+                    spinlock_lock(locker);
             }
         }
     }
 
-    spinlock_unlock(&tm->locker);
-    return (int)(tm->clock - clock);
+    return n;
 }
 
 static int
-twtimer_cascade(struct time_wheel *tm, struct time_bucket *tv, int index)
+twtimer_cascade(struct time_wheel *tm, int level, int index)
 {
     struct twtimer *timer;
     struct twtimer *next;
-    next            = tv[index].first;
-    tv[index].first = NULL;  // clear
+    next            = tm->tv[level][index].first;
+    tm->tv[level][index].first = NULL;  // clear
+    tm->bitmap[level][0] &= ~(1ULL << index);
 
     for (timer = next; timer; timer = next) {
         --tm->count;  // start will add count
@@ -212,8 +408,8 @@ twtimer_cascade(struct time_wheel *tm, struct time_bucket *tv, int index)
 static int
 twtimer_add(struct time_wheel *tm, struct twtimer *timer)
 {
-    uint64_t diff;
-    struct time_bucket *tv;
+    uint64_t diff, tick, now;
+    int l, index;
 
     assert(timer->ontimeout);
     if (timer->pprev) {
@@ -221,33 +417,280 @@ twtimer_add(struct time_wheel *tm, struct twtimer *timer)
         return -EEXIST;
     }
 
-    diff = TIME(timer->expire - tm->clock);  // per 64ms
-
+    now  = TIME(tm, tm->clock);
+    tick = TIME(tm, timer->expire);
     if (timer->expire < tm->clock) {
-        tv = tm->tv1 + TVR_INDEX(tm->clock);
-    } else if (diff < (1 << TVR_BITS)) {
-        tv = tm->tv1 + TVR_INDEX(timer->expire);
-    } else if (diff < (1 << (TVR_BITS + TVN_BITS))) {
-        tv = tm->tv2 + TVN_INDEX(timer->expire, 0);
-    } else if (diff < (1 << (TVR_BITS + 2 * TVN_BITS))) {
-        tv = tm->tv3 + TVN_INDEX(timer->expire, 1);
-    } else if (diff < (1 << (TVR_BITS + 3 * TVN_BITS))) {
-        tv = tm->tv4 + TVN_INDEX(timer->expire, 2);
-    } else if (diff < (1ULL << (TVR_BITS + 4 * TVN_BITS))) {
-        tv = tm->tv5 + TVN_INDEX(timer->expire, 3);
+        l    = 0;
+        tick = now;
     } else {
-        spinlock_unlock(&tm->locker);
-        assert(0);  // exceed max timeout value
-        return -1;
+        diff = tick - now;
+        for (l = 0; l < tm->levels; l++) {
+            if (diff < (1ULL << (TV_SHIFT(l) + (l ? TVN_BITS : TVR_BITS))))
+                break;
+        }
+        if (l == tm->levels) {
+            assert(0);  // exceed max timeout value
+            return -1;
+        }
     }
+    index = TV_INDEX(tick, l);
 
     // list insert
-    timer->pprev = &tv->first;
-    timer->next  = tv->first;
+    timer->pprev = &tm->tv[l][index].first;
+    timer->next  = tm->tv[l][index].first;
     if (timer->next)
         timer->next->pprev = &timer->next;
 
-    tv->first = timer;
+    tm->tv[l][index].first = timer;
+    tm->bitmap[l][index / 64] |= 1ULL << (index % 64);
     ++tm->count;
     return 0;
 }
+
+static int
+twtimer_del(struct time_wheel *tm, struct twtimer *timer)
+{
+    struct twtimer **pprev;
+    struct time_bucket *tv;
+    size_t n;
+    int l, index;
+
+    pprev = timer->pprev;
+    if (timer->pprev) {
+        --tm->count;  // timer validation ??
+        *timer->pprev = timer->next;
+    }
+
+    if (timer->next)
+        timer->next->pprev = timer->pprev;
+
+    // the last of a bucket in the wheel (not one being triggered)
+    tv = (struct time_bucket *)pprev;
+    n  = TVR_SIZE + (size_t)(tm->levels - 1) * TVN_SIZE;
+    if (pprev && !timer->next && tv >= tm->buckets && tv < tm->buckets + n
+        && NULL == tv->first) {
+        index = (int)(tv - tm->buckets);
+        for (l = 0; index >= TV_SIZE(l); l++)
+            index -= TV_SIZE(l);
+        tm->bitmap[l][index / 64] &= ~(1ULL << (index % 64));
+    }
+
+    timer->pprev = NULL;
+    timer->next  = NULL;
+    return pprev ? 0 : -1;
+}
+
+/*
+ * Sharded service, one wheel per owner thread.
+ * Other threads never touch a wheel, they post the timer to the MPSC
+ * command queue of its shard: a lock-free stack (push by cas, the owner
+ * takes it all by exchange), a timer is linked at most once, the op in
+ * timer->cmd is the latest request and earlier ones are dropped.
+ */
+#define TW_CMD_QUEUED 0x01
+#define TW_CMD_START 0x02
+#define TW_CMD_STOP 0x04
+
+#define TW_CACHELINE 64
+
+struct twtimer_shard {
+    struct time_wheel *tm;
+    struct twtimer_service *svc;
+    int id;
+    int64_t remote; // commands applied from the queue
+    // pthread_self() of the thread in twtimer_shard_process(), 0 before
+    // the first one; per shard, so a shard reusing the memory of a
+    // destroyed one starts without an owner
+    volatile uintptr_t owner;
+
+    struct twtimer *volatile cmds __attribute__((aligned(TW_CACHELINE)));
+} __attribute__((aligned(TW_CACHELINE)));
+
+struct twtimer_service {
+    int nshards;
+    struct twtimer_shard *shards;
+};
+
+twtimer_service_t *
+twtimer_service_create(int nshards, uint64_t clock)
+{
+    struct twtimer_service *svc;
+    int i;
+
+    if (nshards <= 0) {
+        return NULL;
+    }
+
+    svc = (struct twtimer_service *)calloc(1, sizeof(*svc));
+    if (!svc) {
+        return NULL;
+    }
+
+    svc->shards = (struct twtimer_shard *)aligned_alloc(
+        TW_CACHELINE, sizeof(struct twtimer_shard) * nshards);
+    if (!svc->shards) {
+        free(svc);
+        return NULL;
+    }
+    memset(svc->shards, 0, sizeof(struct twtimer_shard) * nshards);
+
+    for (i = 0; i < nshards; i++) {
+        svc->shards[i].svc = svc;
+        svc->shards[i].id  = i;
+        svc->shards[i].tm  = time_wheel_create(clock);
+        if (!svc->shards[i].tm) {
+            svc->nshards = i;
+            twtimer_service_destroy(svc);
+            return NULL;
+        }
+    }
+    svc->nshards = nshards;
+
+    return svc;
+}
+
+int
+twtimer_service_destroy(twtimer_service_t *svc)
+{
+    int i;
+
+    for (i = 0; i < svc->nshards; i++) {
+        assert(NULL == svc->shards[i].cmds);
+        time_wheel_destroy(svc->shards[i].tm);
+    }
+    free(svc->shards);
+    free(svc);
+    return 0;
+}
+
+twtimer_shard_t *
+twtimer_service_shard(twtimer_service_t *svc, int i)
+{
+    if (i < 0 || i >= svc->nshards) {
+        return NULL;
+    }
+    return &svc->shards[i];
+}
+
+int
+twtimer_shard_id(twtimer_shard_t *shard)
+{
+    return shard->id;
+}
+
+uint64_t
+twtimer_shard_count(twtimer_shard_t *shard)
+{
+    return shard->tm->count;
+}
+
+static void
+twtimer_shard_apply(struct twtimer_shard *shard, struct twtimer *timer,
+                    int32_t op)
+{
+    if (op & TW_CMD_START) {
+        twtimer_del(shard->tm, timer); // re-arm
+        timer->expire = timer->cmd_expire;
+        twtimer_add(shard->tm, timer);
+    } else if (op & TW_CMD_STOP) {
+        twtimer_del(shard->tm, timer);
+    }
+}
+
+static int
+twtimer_shard_post(struct twtimer_shard *shard, struct twtimer *timer,
+                   int32_t op)
+{
+    struct twtimer *head;
+    int32_t cmd;
+
+    if (__atomic_load_n(&shard->owner, __ATOMIC_RELAXED)
+        == (uintptr_t)pthread_self()) {
+        // the owner, drop a pending remote request and go straight
+        do {
+            cmd = timer->cmd;
+        } while (!atomic_cas32(&timer->cmd, cmd, cmd & TW_CMD_QUEUED));
+
+        if (op & TW_CMD_START) {
+            twtimer_del(shard->tm, timer);
+            timer->expire = timer->cmd_expire;
+            return twtimer_add(shard->tm, timer);
+        }
+        return twtimer_del(shard->tm, timer);
+    }
+
+    do {
+        cmd = timer->cmd;
+    } while (!atomic_cas32(&timer->cmd, cmd, op | TW_CMD_QUEUED));
+
+    if (cmd & TW_CMD_QUEUED) {
+        return 0; // still in the queue, the owner will see the new op
+    }
+
+    do {
+        head            = shard->cmds;
+        timer->cmd_next = head;
+    } while (!atomic_cas_ptr((void *volatile *)&shard->cmds, head, timer));
+    return 0;
+}
+
+int
+twtimer_shard_start(twtimer_shard_t *shard, twtimer_t *timer, uint64_t expire)
+{
+    assert(timer->ontimeout);
+    if (!timer->shard) {
+        timer->shard = shard;
+    } else if (timer->shard != shard) {
+        return -EBUSY;
+    }
+
+    timer->cmd_expire = expire;
+    return twtimer_shard_post(shard, timer, TW_CMD_START);
+}
+
+int
+twtimer_shard_stop(twtimer_t *timer)
+{
+    if (!timer->shard) {
+        return -1;
+    }
+    return twtimer_shard_post(timer->shard, timer, TW_CMD_STOP);
+}
+
+int
+twtimer_shard_process(twtimer_shard_t *shard, uint64_t clock)
+{
+    struct twtimer *list, *prev, *timer, *next;
+    uintptr_t self = (uintptr_t)pthread_self();
+    int32_t cmd;
+
+    if (__atomic_load_n(&shard->owner, __ATOMIC_RELAXED) != self) {
+        __atomic_store_n(&shard->owner, self, __ATOMIC_RELAXED);
+    }
+
+    list = (struct twtimer *)__atomic_exchange_n(&shard->cmds, NULL,
+                                                 __ATOMIC_ACQUIRE);
+
+    // reverse the stack, apply in posting order
+    for (prev = NULL; list; list = next) {
+        next           = list->cmd_next;
+        list->cmd_next = prev;
+        prev           = list;
+    }
+
+    for (timer = prev; timer; timer = next) {
+        next            = timer->cmd_next;
+        timer->cmd_next = NULL;
+
+        // unlink before reading the op, a new request queues it again
+        do {
+            cmd = timer->cmd;
+        } while (!atomic_cas32(&timer->cmd, cmd, 0));
+
+        twtimer_shard_apply(shard, timer, cmd);
+        shard->remote++;
+    }
+
+    time_wheel_advance(shard->tm, clock, NULL, NULL, 0);
+    return time_wheel_sleep(shard->tm, clock);
+}